@@ -37,6 +37,14 @@
 
 
 
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../cpu.h"
+#include "../kernels.h"                                    // matMul32(), the SIMD versions of matMul()
+
+
+
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -59,8 +67,9 @@ typedef            int  I32;           // signed integer, must be at least 32 bi
 #define    NULL                 0
 #endif
 
-#define    MAX_YSZ              8192                               // max image height
-#define    MAX_XSZ              8192                               // max image width
+#define    MAX_YSZ              16384                              // max image height, the caller must not pass a larger image (checkHEVCSize() in imageio_hevc.c rejects it)
+#define    MAX_XSZ              16384                              // max image width , the caller must not pass a larger image (the context line-buffers on the stack are proportional to it)
+#define    MAX_LUMA_PS          35651584                           // max pixels of a picture of level 6 ~ 6.2 (see getLevelIdc()), a larger picture goes beyond every level, and is signalled as level 6.2
 
 #define    CTU_SZ               32                                 // CTU        : 32x32
 #define    MIN_CU_SZ            8                                  // minimal CU : 8x8
@@ -478,6 +487,8 @@ void matMul (
 ) {
     const I32 dst_add = 1 << dst_sft >> 1;
     I32 i, j, k, s;
+    if (!matMul32(sz, (const int32_t*)src1[0], src1_transpose, (const int32_t*)src2[0], src2_transpose, (int32_t*)dst[0], dst_sft, dst_clip))   // the SIMD version, if the CPU has one. CTU_SZ is the MAT_STRIDE of kernels.h
+        return;
     for (i=0; i<sz; i++) {
         for (j=0; j<sz; j++) {
             s = dst_add;
@@ -661,6 +672,17 @@ void putBytesToBuffer (UI8 **ppbuf, const UI8 *bytes, I32 len) {
 }
 
 
+I32 getLevelIdc (const I32 ysz, const I32 xsz) {                                   // return general_level_idc (30 times the level) of the lowest level which allows a picture of ysz x xsz, by its MaxLumaPs and max width and height (sqrt(8*MaxLumaPs))
+    static const I32 LEVEL_MAX_LUMA_PS [] = {36864, 122880, 245760, 552960, 983040, 2228224, 8912896, MAX_LUMA_PS};
+    static const I32 LEVEL_IDC         [] = {   30,     60,     63,     90,     93,     120,     150,         180,  186};   // level 1, 2, 2.1, 3, 3.1, 4, 5, 6, and 6.2 for a picture beyond every level
+    I32 i;
+    for (i=0; i<8; i++)
+        if ( ysz*xsz <= LEVEL_MAX_LUMA_PS[i] && ysz*ysz <= 8*LEVEL_MAX_LUMA_PS[i] && xsz*xsz <= 8*LEVEL_MAX_LUMA_PS[i] )
+            break;
+    return LEVEL_IDC[i];
+}
+
+
 void putHeaderToBuffer (UI8 **ppbuf, const I32 qpd6, const I32 ysz, const I32 xsz) {
     static const UI8 VPS [] = {0x00, 0x00, 0x01, 0x40, 0x01, 0x0C, 0x01, 0xFF, 0xFF, 0x03, 0x10, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xB4, 0xF0, 0x24};
     static const UI8 SPS [] = {0x00, 0x00, 0x01, 0x42, 0x01, 0x01, 0x03, 0x10, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0xB4};
@@ -674,10 +696,15 @@ void putHeaderToBuffer (UI8 **ppbuf, const I32 qpd6, const I32 ysz, const I32 xs
         {0x00, 0x00, 0x01, 0x26, 0x01, 0xAC, 0x97, 0x80}         // qpd6=4
     };
     
+    const UI8 level_idc = (UI8)getLevelIdc(ysz, xsz);
+    
     I32 bitpos = 7;
     
-    putBytesToBuffer(ppbuf, VPS, sizeof(VPS));
-    putBytesToBuffer(ppbuf, SPS, sizeof(SPS));
+    putBytesToBuffer(ppbuf, VPS, 24);
+    putBytesToBuffer(ppbuf, &level_idc, 1);                                          // replace the general_level_idc of VPS (0xB4 : level 6)
+    putBytesToBuffer(ppbuf, VPS+25, sizeof(VPS)-25);
+    putBytesToBuffer(ppbuf, SPS, sizeof(SPS)-1);
+    putBytesToBuffer(ppbuf, &level_idc, 1);                                          // replace the general_level_idc of SPS (0xB4 : level 6)
     putBitsToBuffer (ppbuf, &bitpos, 0x0A, 4);
     putUVLCtoBuffer (ppbuf, &bitpos, xsz);
     putUVLCtoBuffer (ppbuf, &bitpos, ysz);
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "platform.h"
+#include "memstat.h"
+#include "arena.h"
+
+
+void arenaInit (Arena_t *p_arena) {
+    int i;
+    for (i=0; i<ARENA_N_BLOCK; i++)
+        p_arena->p_blocks[i] = NULL;
+}
+
+
+void arenaDestroy (Arena_t *p_arena) {
+    int i;
+    for (i=0; i<ARENA_N_BLOCK; i++) {
+        free(p_arena->p_blocks[i]);     // the kept blocks are already uncounted by memStatRelease()
+        p_arena->p_blocks[i] = NULL;
+    }
+}
+
+
+void* arenaAlloc (Arena_t *p_arena, size_t size) {
+    int i, i_best=-1;
+    void *p;
+    
+    if (p_arena == NULL || size < ARENA_MIN_SIZE)
+        return memMalloc(size);
+    
+    for (i=0; i<ARENA_N_BLOCK; i++)   // find the smallest kept block which is large enough
+        if (p_arena->p_blocks[i] && getAllocSize(p_arena->p_blocks[i]) >= size)
+            if (i_best < 0 || getAllocSize(p_arena->p_blocks[i]) < getAllocSize(p_arena->p_blocks[i_best]))
+                i_best = i;
+    
+    if (i_best < 0)
+        return memMalloc(size);
+    
+    p = p_arena->p_blocks[i_best];
+    p_arena->p_blocks[i_best] = NULL;
+    memStatAcquire(p);
+    return p;
+}
+
+
+void arenaFree (Arena_t *p_arena, void *p) {
+    int i, i_min=-1;
+    
+    if (p_arena == NULL || p == NULL || getAllocSize(p) < ARENA_MIN_SIZE) {
+        memFree(p);
+        return;
+    }
+    
+    for (i=0; i<ARENA_N_BLOCK; i++) {  // find an empty entry, or else the smallest kept block
+        if (p_arena->p_blocks[i] == NULL) {
+            i_min = i;
+            break;
+        }
+        if (i_min < 0 || getAllocSize(p_arena->p_blocks[i]) < getAllocSize(p_arena->p_blocks[i_min]))
+            i_min = i;
+    }
+    
+    if (p_arena->p_blocks[i_min] && getAllocSize(p_arena->p_blocks[i_min]) >= getAllocSize(p)) {   // the arena is full of larger blocks, do not keep this one
+        memFree(p);
+        return;
+    }
+    
+    free(p_arena->p_blocks[i_min]);   // evict the smallest block (it is already uncounted)
+    p_arena->p_blocks[i_min] = p;
+    memStatRelease(p);
+}
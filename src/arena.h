@@ -0,0 +1,31 @@
+#ifndef   __ARENA_H__
+#define   __ARENA_H__
+
+
+// a small pool of large buffers that are kept between the files of a batch, so that converting same-sized images does not malloc() and free() the image buffers again and again
+// each worker thread owns its own arena, and passes it explicitly to the decoders and encoders, so there is no locking
+// all functions accept p_arena=NULL, which means plain memMalloc() and memFree() without reuse
+
+
+#define  ARENA_N_BLOCK     4            // max number of free blocks kept in an arena
+#define  ARENA_MIN_SIZE    65536        // smaller blocks are not kept, since malloc() handles them well
+
+
+typedef struct {
+    void *p_blocks [ARENA_N_BLOCK];   // free blocks kept for reuse, NULL if the entry is empty
+} Arena_t;
+
+
+void  arenaInit    (Arena_t *p_arena);
+
+// free all the blocks kept in the arena
+void  arenaDestroy (Arena_t *p_arena);
+
+// return: a block of at least size bytes, which is a kept block if there is one large enough, or allocated by memMalloc(). NULL if failed
+void* arenaAlloc   (Arena_t *p_arena, size_t size);
+
+// give a block allocated by arenaAlloc() (or memMalloc()) back to the arena. If the arena is full, the smallest block is freed
+void  arenaFree    (Arena_t *p_arena, void *p);
+
+
+#endif // __ARENA_H__
@@ -0,0 +1,352 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "batchio.h"
+
+
+#if defined(__linux__) && defined(__has_include)
+  #if __has_include(<linux/io_uring.h>)
+    #define  BATCH_IO_URING
+  #endif
+#endif
+
+
+#ifdef BATCH_IO_URING
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/stat.h>
+#include <linux/io_uring.h>
+
+
+#define  MAX_FILE_SIZE  (64*1024*1024)      // larger files are better to be mapped (for read), or written as usual
+
+
+struct BatchIO_s {
+    int       fd;                     // of the io_uring
+    unsigned  sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void     *p_sq_ring;
+    void     *p_cq_ring;
+    size_t    sq_ring_size;
+    size_t    cq_ring_size;
+    int       max_files;
+    int      *fds;                    // per file of a batch, then the results of the second entries of the files (as the user_data of them)
+    int      *results;
+    struct statx *stats;
+};
+
+
+BatchIO_t* batchIOOpen (int max_files) {
+    struct io_uring_params params;
+    BatchIO_t *p_bio;
+    
+    if (max_files < 1)
+        return NULL;
+    
+    if ((p_bio = (BatchIO_t*)calloc(1, sizeof(BatchIO_t))) == NULL)
+        return NULL;
+    
+    p_bio->max_files = max_files;
+    p_bio->fds       = (int*)malloc(sizeof(int) * 2 * max_files);
+    p_bio->results   = (int*)malloc(sizeof(int) * 2 * max_files);
+    p_bio->stats     = (struct statx*)malloc(sizeof(struct statx) * max_files);
+    
+    memset(&params, 0, sizeof(params));
+    
+    p_bio->fd = (int)syscall(__NR_io_uring_setup, 2*max_files, &params);   // each file needs 2 entries (read/write + close)
+    
+    if (p_bio->fd < 0 || p_bio->fds == NULL || p_bio->results == NULL || p_bio->stats == NULL) {
+        if (p_bio->fd >= 0)
+            close(p_bio->fd);
+        free(p_bio->fds);
+        free(p_bio->results);
+        free(p_bio->stats);
+        free(p_bio);
+        return NULL;
+    }
+    
+    p_bio->sq_entries   = params.sq_entries;
+    p_bio->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    p_bio->cq_ring_size = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    
+    p_bio->p_sq_ring = mmap(NULL, p_bio->sq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, p_bio->fd, IORING_OFF_SQ_RING);
+    p_bio->p_cq_ring = mmap(NULL, p_bio->cq_ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, p_bio->fd, IORING_OFF_CQ_RING);
+    p_bio->sqes      = (struct io_uring_sqe*)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, p_bio->fd, IORING_OFF_SQES);
+    
+    if (p_bio->p_sq_ring == MAP_FAILED || p_bio->p_cq_ring == MAP_FAILED || p_bio->sqes == MAP_FAILED) {
+        if (p_bio->p_sq_ring != MAP_FAILED) munmap(p_bio->p_sq_ring, p_bio->sq_ring_size);
+        if (p_bio->p_cq_ring != MAP_FAILED) munmap(p_bio->p_cq_ring, p_bio->cq_ring_size);
+        if (p_bio->sqes      != MAP_FAILED) munmap(p_bio->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        close(p_bio->fd);
+        free(p_bio->fds);
+        free(p_bio->results);
+        free(p_bio->stats);
+        free(p_bio);
+        return NULL;
+    }
+    
+    p_bio->sq_head  = (unsigned*)((uint8_t*)p_bio->p_sq_ring + params.sq_off.head);
+    p_bio->sq_tail  = (unsigned*)((uint8_t*)p_bio->p_sq_ring + params.sq_off.tail);
+    p_bio->sq_mask  = (unsigned*)((uint8_t*)p_bio->p_sq_ring + params.sq_off.ring_mask);
+    p_bio->sq_array = (unsigned*)((uint8_t*)p_bio->p_sq_ring + params.sq_off.array);
+    p_bio->cq_head  = (unsigned*)((uint8_t*)p_bio->p_cq_ring + params.cq_off.head);
+    p_bio->cq_tail  = (unsigned*)((uint8_t*)p_bio->p_cq_ring + params.cq_off.tail);
+    p_bio->cq_mask  = (unsigned*)((uint8_t*)p_bio->p_cq_ring + params.cq_off.ring_mask);
+    p_bio->cqes     = (struct io_uring_cqe*)((uint8_t*)p_bio->p_cq_ring + params.cq_off.cqes);
+    
+    return p_bio;
+}
+
+
+void batchIOClose (BatchIO_t *p_bio) {
+    if (p_bio == NULL)
+        return;
+    munmap(p_bio->sqes, p_bio->sq_entries * sizeof(struct io_uring_sqe));
+    munmap(p_bio->p_sq_ring, p_bio->sq_ring_size);
+    munmap(p_bio->p_cq_ring, p_bio->cq_ring_size);
+    close(p_bio->fd);
+    free(p_bio->fds);
+    free(p_bio->results);
+    free(p_bio->stats);
+    free(p_bio);
+}
+
+
+// return: a cleared submission entry, the caller must fill it before the next call
+static struct io_uring_sqe* getSQE (BatchIO_t *p_bio) {
+    unsigned tail = *p_bio->sq_tail;
+    unsigned idx  = tail & (*p_bio->sq_mask);
+    struct io_uring_sqe *p_sqe = &p_bio->sqes[idx];
+    memset(p_sqe, 0, sizeof(struct io_uring_sqe));
+    p_bio->sq_array[idx] = idx;
+    __atomic_store_n(p_bio->sq_tail, tail+1, __ATOMIC_RELEASE);
+    return p_sqe;
+}
+
+
+// submit n_sqe entries and wait for all of them, the result of each entry is stored to results[user_data] (user_data < 2*max_files)
+// the kernel may take fewer entries than asked, the rest are submitted again. If it fails to take them, they are dropped, and only the submitted ones are waited for
+// return:   0 : success    1 : failed, some entries are not run, their results are not stored
+static int submitAndWait (BatchIO_t *p_bio, int n_sqe, int *results) {
+    int n_submitted = 0, n_done = 0, failed = 0;
+    
+    while (n_done < n_sqe) {
+        unsigned head, tail;
+        int ret;
+        
+        if (n_submitted < n_sqe)
+            ret = (int)syscall(__NR_io_uring_enter, p_bio->fd, n_sqe-n_submitted, 0, 0, NULL, 0);
+        else
+            ret = (int)syscall(__NR_io_uring_enter, p_bio->fd, 0, n_sqe-n_done, IORING_ENTER_GETEVENTS, NULL, 0);
+        
+        if (ret < 0 && errno == EINTR)
+            continue;
+        
+        if (n_submitted < n_sqe) {
+            if (ret > 0) {
+                n_submitted += ret;
+            } else {                  // the kernel takes no entries, drop them from the ring, so that they are not submitted with the next batch
+                __atomic_store_n(p_bio->sq_tail, __atomic_load_n(p_bio->sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+                n_sqe  = n_submitted;
+                failed = 1;
+            }
+        } else if (ret < 0) {         // can not wait for the submitted entries
+            return 1;
+        }
+        
+        head = *p_bio->cq_head;
+        tail = __atomic_load_n(p_bio->cq_tail, __ATOMIC_ACQUIRE);
+        
+        for (; head != tail; head++) {
+            struct io_uring_cqe *p_cqe = &p_bio->cqes[head & (*p_bio->cq_mask)];
+            if (p_cqe->user_data < 2 * (uint64_t)p_bio->max_files)
+                results[p_cqe->user_data] = p_cqe->res;
+            n_done ++;
+        }
+        
+        __atomic_store_n(p_bio->cq_head, head, __ATOMIC_RELEASE);
+    }
+    
+    return failed;
+}
+
+
+// open n files in one submission, the fds are stored to p_bio->fds (negative if failed)
+// if p_stats is not NULL, also get the size of each file
+static void openFiles (BatchIO_t *p_bio, const char **fnames, int n, int flags, struct statx *p_stats) {
+    int i, n_sqe = 0;
+    
+    for (i=0; i<n; i++) {
+        struct io_uring_sqe *p_sqe = getSQE(p_bio);
+        p_sqe->opcode     = IORING_OP_OPENAT;
+        p_sqe->fd         = AT_FDCWD;
+        p_sqe->addr       = (uint64_t)(uintptr_t)fnames[i];
+        p_sqe->len        = 0666;               // mode, which is masked by umask
+        p_sqe->open_flags = flags;
+        p_sqe->user_data  = i;
+        n_sqe ++;
+        
+        if (p_stats) {
+            p_sqe = getSQE(p_bio);
+            p_sqe->opcode      = IORING_OP_STATX;
+            p_sqe->fd          = AT_FDCWD;
+            p_sqe->addr        = (uint64_t)(uintptr_t)fnames[i];
+            p_sqe->len         = STATX_SIZE | STATX_TYPE;
+            p_sqe->off         = (uint64_t)(uintptr_t)&p_stats[i];
+            p_sqe->statx_flags = 0;
+            p_sqe->user_data   = p_bio->max_files + i;   // the result is not used, it is checked by stx_mask
+            n_sqe ++;
+            p_stats[i].stx_mask = 0;
+        }
+    }
+    
+    for (i=0; i<n; i++)
+        p_bio->fds[i] = -1;
+    
+    if (submitAndWait(p_bio, n_sqe, p_bio->fds)) {
+        for (i=0; i<n; i++) {       // fail all of them, the ones which are opened are closed
+            if (p_bio->fds[i] >= 0)
+                close(p_bio->fds[i]);
+            p_bio->fds[i] = -1;
+        }
+    }
+}
+
+
+// submit a read or write of each opened file, hard-linked with a close, so the file is closed even if the transfer fails
+// return: in p_bio->results, the number of bytes transferred, or negative if failed
+static void transferFiles (BatchIO_t *p_bio, int opcode, uint8_t **bufs, const size_t *lens, int n) {
+    int i, n_sqe = 0;
+    
+    for (i=0; i<n; i++) {
+        struct io_uring_sqe *p_sqe;
+        
+        p_bio->results[i] = -1;
+        p_bio->results[p_bio->max_files+i] = 1;     // not closed yet, a close returns 0 or negative
+        
+        if (p_bio->fds[i] < 0)
+            continue;
+        
+        p_sqe = getSQE(p_bio);
+        p_sqe->opcode    = opcode;
+        p_sqe->fd        = p_bio->fds[i];
+        p_sqe->addr      = (uint64_t)(uintptr_t)bufs[i];
+        p_sqe->len       = (uint32_t)lens[i];
+        p_sqe->off       = 0;
+        p_sqe->flags     = IOSQE_IO_HARDLINK;
+        p_sqe->user_data = i;
+        
+        p_sqe = getSQE(p_bio);
+        p_sqe->opcode    = IORING_OP_CLOSE;
+        p_sqe->fd        = p_bio->fds[i];
+        p_sqe->user_data = p_bio->max_files + i;
+        
+        n_sqe += 2;
+    }
+    
+    if (n_sqe > 0 && submitAndWait(p_bio, n_sqe, p_bio->results)) {
+        for (i=0; i<n; i++) {
+            if (p_bio->fds[i] >= 0 && p_bio->results[p_bio->max_files+i] == 1)   // its close is not run
+                close(p_bio->fds[i]);
+            p_bio->results[i] = -1;
+        }
+    }
+}
+
+
+void batchReadFiles (BatchIO_t *p_bio, const char **fnames, int n, MappedFile_t *p_files) {
+    uint8_t *bufs [1024];
+    size_t   lens [1024];
+    int i, i_base, n_batch;
+    
+    for (i=0; i<n; i++) {
+        p_files[i].p_data    = NULL;
+        p_files[i].len       = 0;
+        p_files[i].is_mapped = 0;
+    }
+    
+    for (i_base=0; i_base<n; i_base+=n_batch) {
+        n_batch = n - i_base;
+        if (n_batch > p_bio->max_files) n_batch = p_bio->max_files;
+        if (n_batch > 1024)             n_batch = 1024;
+        
+        openFiles(p_bio, fnames+i_base, n_batch, O_RDONLY, p_bio->stats);
+        
+        for (i=0; i<n_batch; i++) {
+            const struct statx *p_st = &p_bio->stats[i];
+            bufs[i] = NULL;
+            lens[i] = 0;
+            if (p_bio->fds[i] >= 0) {
+                if ((p_st->stx_mask & STATX_SIZE) && (p_st->stx_mask & STATX_TYPE) && S_ISREG(p_st->stx_mode) && p_st->stx_size > 0 && p_st->stx_size <= MAX_FILE_SIZE) {
+                    lens[i] = (size_t)p_st->stx_size;
+                    bufs[i] = (uint8_t*)malloc(lens[i]);
+                }
+                if (bufs[i] == NULL) {  // not read in the batch
+                    close(p_bio->fds[i]);
+                    p_bio->fds[i] = -1;
+                }
+            }
+        }
+        
+        transferFiles(p_bio, IORING_OP_READ, bufs, lens, n_batch);
+        
+        for (i=0; i<n_batch; i++) {
+            if (bufs[i] && p_bio->results[i] == (int)lens[i]) {
+                p_files[i_base+i].p_data = bufs[i];
+                p_files[i_base+i].len    = lens[i];
+            } else {
+                free(bufs[i]);
+            }
+        }
+    }
+}
+
+
+void batchWriteFiles (BatchIO_t *p_bio, const char **fnames, const uint8_t **bufs, const size_t *lens, int n, int *failed) {
+    int i, i_base, n_batch;
+    
+    for (i_base=0; i_base<n; i_base+=n_batch) {
+        n_batch = n - i_base;
+        if (n_batch > p_bio->max_files) n_batch = p_bio->max_files;
+        
+        openFiles(p_bio, fnames+i_base, n_batch, O_WRONLY|O_CREAT|O_TRUNC, NULL);
+        
+        for (i=0; i<n_batch; i++) {
+            if (p_bio->fds[i] >= 0 && (lens[i_base+i] == 0 || lens[i_base+i] > MAX_FILE_SIZE)) {   // not written in the batch
+                close(p_bio->fds[i]);
+                p_bio->fds[i] = -1;
+            }
+        }
+        
+        transferFiles(p_bio, IORING_OP_WRITE, (uint8_t**)(bufs+i_base), lens+i_base, n_batch);
+        
+        for (i=0; i<n_batch; i++)
+            failed[i_base+i] = (p_bio->results[i] != (int)lens[i_base+i]);
+    }
+}
+
+
+#else
+
+BatchIO_t* batchIOOpen  (int max_files) { (void)max_files; return NULL; }
+void batchIOClose       (BatchIO_t *p_bio) { (void)p_bio; }
+void batchReadFiles     (BatchIO_t *p_bio, const char **fnames, int n, MappedFile_t *p_files) { (void)p_bio; (void)fnames; (void)n; (void)p_files; }
+void batchWriteFiles    (BatchIO_t *p_bio, const char **fnames, const uint8_t **bufs, const size_t *lens, int n, int *failed) { (void)p_bio; (void)fnames; (void)bufs; (void)lens; (void)n; (void)failed; }
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef   __BATCH_IO_H__
+#define   __BATCH_IO_H__
+
+
+// batched whole-file I/O, for converting a lot of small files (see convertFilesPipelined() in main.c)
+// on Linux, the files of a batch are opened, read or written, and closed by io_uring, so that a batch costs a few system calls instead of several per file
+// on other systems, or when io_uring is not available (an old kernel, or forbidden by seccomp), batchIOOpen() returns NULL and the files should be read/written one by one as usual
+// a BatchIO_t must be used by only one thread
+
+
+typedef struct BatchIO_s BatchIO_t;
+
+
+// max_files : max number of files in a batch
+// return:  NULL     : batched I/O is not available
+//          non-NULL : success
+BatchIO_t* batchIOOpen  (int max_files);
+
+void batchIOClose       (BatchIO_t *p_bio);
+
+// read whole files, p_files[i] is filled as if mapFile() (see platform.h) fallbacks to read. It can be released by unmapFile()
+// if a file can not be read in the batch (failed to open, empty, or too large), p_files[i].p_data is NULL, and the caller should read it as usual (for example, by mapFile(), which also reports the error)
+void batchReadFiles     (BatchIO_t *p_bio, const char **fnames, int n, MappedFile_t *p_files);
+
+// write whole files, failed[i] = 1 if the file can not be written in the batch, and the caller should write it as usual
+void batchWriteFiles    (BatchIO_t *p_bio, const char **fnames, const uint8_t **bufs, const size_t *lens, int n, int *failed);
+
+
+#endif // __BATCH_IO_H__
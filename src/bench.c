@@ -0,0 +1,248 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "imageio.h"
+#include "console.h"
+#include "platform.h"
+#include "bench.h"
+#include "cpu.h"
+#include "kernels.h"
+
+
+#define  SYNTH_HEIGHT  480
+#define  SYNTH_WIDTH   640
+
+
+// adapters, so that all encoders have the same signature
+static int benchEncodePNM  (const ImageDesc_t *p_img, int q, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) { (void)q; return encodePNMImage(p_img, pp_dst, p_dst_len, p_arena); }
+static int benchEncodePNG  (const ImageDesc_t *p_img, int q, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) { (void)q; return encodePNGImage(p_img, pp_dst, p_dst_len, p_arena); }
+static int benchEncodeBMP  (const ImageDesc_t *p_img, int q, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) { (void)q; return encodeBMPImage(p_img, pp_dst, p_dst_len, p_arena); }
+static int benchEncodeQOI  (const ImageDesc_t *p_img, int q, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) { (void)q; return encodeQOIImage(p_img, pp_dst, p_dst_len, p_arena); }
+
+
+typedef struct {
+    const char *name;
+    int         has_q;                // 1: the encoder has a quality parameter (-0 ~ -4)
+    int      (*p_encode) (const ImageDesc_t *p_img, int q, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);
+    uint8_t* (*p_decode) (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena);   // NULL if there is no decoder
+} BenchCodec_t;
+
+
+static const BenchCodec_t CODECS [] = {
+    { "pnm" , 0, benchEncodePNM , decodePNMImage },
+    { "png" , 0, benchEncodePNG , decodePNGImage },
+    { "bmp" , 0, benchEncodeBMP , decodeBMPImage },
+    { "qoi" , 0, benchEncodeQOI , decodeQOIImage },
+    { "jls" , 1, encodeJLSImage , NULL           },
+    { "h265", 1, encodeHEVCImage, NULL           }
+};
+
+
+static const char *SAMPLE_FNAMES [] = { "image/1.png", "image/2.png", "image/3.png" };
+
+
+
+// a simple LCG, so that the synthetic images are the same on every platform
+static uint32_t nextRandom (uint32_t *p_seed) {
+    *p_seed = (*p_seed) * 1103515245U + 12345U;
+    return (*p_seed) >> 8;
+}
+
+
+// type 0 : RGB gradient    type 1 : RGB noise    type 2 : gray text-like (black glyphs on white)
+static uint8_t* makeSyntheticImage (int type, int *p_is_rgb, uint32_t height, uint32_t width) {
+    uint32_t seed = 1 + type, i, j;
+    uint8_t *p_buf;
+    
+    *p_is_rgb = (type != 2);
+    
+    if ((p_buf = (uint8_t*)malloc((size_t)(*p_is_rgb?3:1) * height * width)) == NULL)
+        return NULL;
+    
+    if (type == 0) {
+        uint8_t *p = p_buf;
+        for (i=0; i<height; i++) {
+            for (j=0; j<width; j++) {
+                *(p++) = (uint8_t)(255 * j / width);
+                *(p++) = (uint8_t)(255 * i / height);
+                *(p++) = (uint8_t)(255 * (i+j) / (height+width));
+            }
+        }
+    } else if (type == 1) {
+        for (i=0; i<3*height*width; i++)
+            p_buf[i] = (uint8_t)nextRandom(&seed);
+    } else {
+        memset(p_buf, 255, (size_t)height * width);
+        for (i=0; i+16<=height; i+=16) {                // text lines of 16 pixels, glyph cells of 8x16 pixels, glyphs are random 5x6 dot patterns scaled by 1x2
+            for (j=0; j+8<=width; j+=8) {
+                uint32_t bits = nextRandom(&seed), y, x;
+                if ((bits & 7) == 0)                    // space between words
+                    continue;
+                bits ^= nextRandom(&seed) << 11;
+                for (y=0; y<12; y++)
+                    for (x=0; x<5; x++)
+                        if ((bits >> ((y/2)*5+x)) & 1)
+                            p_buf[(size_t)(i+1+y)*width + j+1+x] = 0;
+            }
+        }
+    }
+    
+    return p_buf;
+}
+
+
+
+static int compareTime (const void *p_a, const void *p_b) {
+    uint64_t a = *(const uint64_t*)p_a;
+    uint64_t b = *(const uint64_t*)p_b;
+    return (a > b) - (a < b);
+}
+
+
+// return: megapixels per second of the median time
+static double medianMPps (uint64_t *p_times, int n, uint32_t height, uint32_t width) {
+    uint64_t t;
+    qsort(p_times, n, sizeof(uint64_t), compareTime);
+    t = p_times[n/2];
+    if (t == 0) t = 1;
+    return (double)height * width * 1000.0 / (double)t;
+}
+
+
+// the buffers of the codecs are taken from p_arena, so that the iterations measure the steady state of a batch, without the page faults of new buffers
+static void benchImage (const char *p_name, const ImageDesc_t *p_img, int n_iter, int near_mask, uint64_t *p_times, Arena_t *p_arena) {
+    const uint32_t height = p_img->height;
+    const uint32_t width  = p_img->width;
+    int i_codec, q, iter;
+    
+    printf("%s  (%ux%u %s)\n", p_name, width, height, (p_img->channels!=1?"RGB":"gray"));
+    
+    for (i_codec=0; i_codec<(int)(sizeof(CODECS)/sizeof(CODECS[0])); i_codec++) {
+        const BenchCodec_t *p_codec = &CODECS[i_codec];
+        
+        for (q=0; q<=4; q++) {
+            uint8_t *p_dst = NULL;
+            size_t   dst_len = 0;
+            double   enc_mpps, dec_mpps = 0;
+            int      failed = 0;
+            
+            if (p_codec->has_q ? !((near_mask>>q)&1) : (q>0))
+                continue;
+            
+            for (iter=0; !failed && iter<n_iter; iter++) {
+                ConsoleBuffer_t discard = {NULL, 0, 0};
+                uint64_t t;
+                
+                arenaFree(p_arena, p_dst);
+                p_dst = NULL;
+                
+                consoleCaptureBegin(&discard);      // mute the warnings of encoders
+                t = getTimeNs();
+                failed = p_codec->p_encode(p_img, q, &p_dst, &dst_len, p_arena);
+                p_times[iter] = getTimeNs() - t;
+                consoleCaptureEnd();
+                free(discard.p_buf);
+            }
+            
+            if (failed) {
+                printf("  %-5s %c   encode failed\n", p_codec->name, (p_codec->has_q?'0'+q:'-'));
+                continue;
+            }
+            
+            enc_mpps = medianMPps(p_times, n_iter, height, width);
+            
+            if (p_codec->p_decode) {
+                for (iter=0; !failed && iter<n_iter; iter++) {
+                    ImageDesc_t dec;
+                    uint8_t *p_dec;
+                    uint64_t t = getTimeNs();
+                    p_dec = p_codec->p_decode(p_dst, dst_len, &dec, p_arena);
+                    p_times[iter] = getTimeNs() - t;
+                    failed = (p_dec == NULL);
+                    arenaFree(p_arena, p_dec);
+                }
+                dec_mpps = failed ? 0 : medianMPps(p_times, n_iter, height, width);
+            }
+            
+            printf("  %-5s %c  %10.2f  ", p_codec->name, (p_codec->has_q?'0'+q:'-'), enc_mpps);
+            if (p_codec->p_decode && !failed)
+                printf("%10.2f  ", dec_mpps);
+            else
+                printf("%10s  ", "-");
+            printf("%12lu  %7.3f\n", (unsigned long)dst_len, 8.0 * dst_len / ((double)height * width));
+            
+            arenaFree(p_arena, p_dst);
+        }
+    }
+    
+    printf("\n");
+    fflush(stdout);
+}
+
+
+// return:   0 : success    1 : failed
+int runBenchmark (int n_iter, char **src_fnames, int n_file, int near_mask) {
+    static const char *synth_names [] = { "synthetic-gradient", "synthetic-noise", "synthetic-text" };
+    uint64_t *p_times;
+    Arena_t   arena;
+    int i, failed = 0;
+    
+    if (n_iter < 1)
+        n_iter = 1;
+    
+    if (near_mask == 0)
+        near_mask = 0x1F;
+    
+    if ((p_times = (uint64_t*)malloc(sizeof(uint64_t) * n_iter)) == NULL)
+        return 1;
+    
+    arenaInit(&arena);
+    
+    if (n_file <= 0) {                  // use the sample images, but only those which exist (they are only found when running from the repository root)
+        src_fnames = (char**)SAMPLE_FNAMES;
+        n_file     = sizeof(SAMPLE_FNAMES) / sizeof(SAMPLE_FNAMES[0]);
+    }
+    
+    printf("benchmark: median of %d iterations, speed in megapixels/s, %s kernels\n\n", n_iter, getCpuLevelName(getKernelLevel()));
+    printf("  codec q  encode MP/s  decode MP/s         bytes      bpp\n\n");
+    
+    for (i=0; i<n_file; i++) {
+        ConsoleBuffer_t discard = {NULL, 0, 0};
+        ImageFormat_t format;
+        ImageDesc_t img;
+        uint8_t *p_buf;
+        consoleCaptureBegin(&discard);
+        p_buf = loadImageFile(src_fnames[i], &format, &img);
+        consoleCaptureEnd();
+        free(discard.p_buf);
+        if (p_buf == NULL) {
+            if (src_fnames != (char**)SAMPLE_FNAMES) {
+                printf("   ***ERROR: open %s failed\n\n", src_fnames[i]);
+                failed = 1;
+            }
+            continue;
+        }
+        benchImage(src_fnames[i], &img, n_iter, near_mask, p_times, &arena);
+        free(p_buf);
+    }
+    
+    for (i=0; i<3; i++) {
+        ImageDesc_t img;
+        int      is_rgb;
+        uint8_t *p_buf = makeSyntheticImage(i, &is_rgb, SYNTH_HEIGHT, SYNTH_WIDTH);
+        if (p_buf == NULL) {
+            failed = 1;
+            continue;
+        }
+        describeImage(&img, p_buf, is_rgb, SYNTH_HEIGHT, SYNTH_WIDTH);
+        benchImage(synth_names[i], &img, n_iter, near_mask, p_times, &arena);
+        free(p_buf);
+    }
+    
+    arenaDestroy(&arena);
+    free(p_times);
+    return failed;
+}
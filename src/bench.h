@@ -0,0 +1,16 @@
+#ifndef   __BENCH_H__
+#define   __BENCH_H__
+
+
+// in-memory benchmark of all codecs, so that the measured speed does not include file I/O
+
+
+// run every encoder (and its decoder, if there is one) n_iter times on each image, and print the median speed, output size and bits-per-pixel
+// src_fnames : images to be benchmarked, if n_file=0, the sample images in image/ (when exist) are used
+//              synthetic images (gradient, noise and text) are always benchmarked
+// near_mask  : bit k is set if JPEG-LS near value / H.265 (qp-4)/6 value k (0~4) is benchmarked
+// return:   0 : success    1 : failed
+int runBenchmark (int n_iter, char **src_fnames, int n_file, int near_mask);
+
+
+#endif // __BENCH_H__
@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "platform.h"
+#include "console.h"
+
+
+static THREAD_LOCAL ConsoleBuffer_t *p_capture = NULL;
+
+static FILE *fp_console = NULL;       // NULL for stdout
+
+
+// make room for len more chars (and a '\0') in p_cbuf
+// return:   0 : success    1 : failed
+static int reserveBuffer (ConsoleBuffer_t *p_cbuf, int len) {
+    if (p_cbuf->len + len + 1 > p_cbuf->cap) {
+        size_t cap = 2 * (p_cbuf->len + len + 1) + 256;
+        char  *p   = (char*)realloc(p_cbuf->p_buf, cap);
+        if (p == NULL)
+            return 1;
+        p_cbuf->p_buf = p;
+        p_cbuf->cap   = cap;
+    }
+    return 0;
+}
+
+
+void consolePrintf (const char *p_format, ...) {
+    va_list args;
+    
+    if (p_capture == NULL) {
+        va_start(args, p_format);
+        vfprintf(fp_console ? fp_console : stdout, p_format, args);
+        va_end(args);
+        
+    } else {
+        int len;
+        
+        va_start(args, p_format);
+        len = vsnprintf(NULL, 0, p_format, args);
+        va_end(args);
+        
+        if (len <= 0 || reserveBuffer(p_capture, len))
+            return;
+        
+        va_start(args, p_format);
+        vsnprintf(p_capture->p_buf + p_capture->len, p_capture->cap - p_capture->len, p_format, args);
+        va_end(args);
+        
+        p_capture->len += len;
+    }
+}
+
+
+void bufferPrintf (ConsoleBuffer_t *p_cbuf, const char *p_format, ...) {
+    va_list args;
+    int len;
+    
+    va_start(args, p_format);
+    len = vsnprintf(NULL, 0, p_format, args);
+    va_end(args);
+    
+    if (len <= 0 || reserveBuffer(p_cbuf, len))
+        return;
+    
+    va_start(args, p_format);
+    vsnprintf(p_cbuf->p_buf + p_cbuf->len, p_cbuf->cap - p_cbuf->len, p_format, args);
+    va_end(args);
+    
+    p_cbuf->len += len;
+}
+
+
+void consoleCaptureBegin (ConsoleBuffer_t *p_cbuf) {
+    p_capture = p_cbuf;
+}
+
+
+void consoleCaptureEnd () {
+    p_capture = NULL;
+}
+
+
+void consoleSetStream (FILE *fp) {
+    fp_console = fp;
+}
+
+
+void consoleFlushBuffer (ConsoleBuffer_t *p_cbuf) {
+    if (p_cbuf->len > 0)
+        fwrite(p_cbuf->p_buf, sizeof(char), p_cbuf->len, fp_console ? fp_console : stdout);
+    free(p_cbuf->p_buf);
+    p_cbuf->p_buf = NULL;
+    p_cbuf->len = p_cbuf->cap = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef   __CONSOLE_H__
+#define   __CONSOLE_H__
+
+
+// console output that can be captured per-thread, so that the messages of files converted in parallel can be printed in order
+
+
+typedef struct {
+    char  *p_buf;         // captured text, allocated by malloc(), need to be free() later
+    size_t len;
+    size_t cap;
+} ConsoleBuffer_t;
+
+
+// print to stdout (or the stream set by consoleSetStream()), or append to the capture buffer of the calling thread if there is one
+void consolePrintf       (const char *p_format, ...);
+
+// start/stop capturing the console output of the calling thread into p_cbuf
+void consoleCaptureBegin (ConsoleBuffer_t *p_cbuf);
+void consoleCaptureEnd   ();
+
+// print the captured text to stdout (or the stream set by consoleSetStream()), and free it
+void consoleFlushBuffer  (ConsoleBuffer_t *p_cbuf);
+
+// print to fp instead of stdout (for example, stderr when stdout carries an output image), call before any thread prints
+void consoleSetStream    (FILE *fp);
+
+// append to p_cbuf as printf(), regardless of capturing
+void bufferPrintf        (ConsoleBuffer_t *p_cbuf, const char *p_format, ...);
+
+
+#endif // __CONSOLE_H__
@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "convcache.h"
+
+
+typedef struct {
+    char       *p_src_fname;
+    char       *p_dst_fname;          // the key of the record
+    int         setting;
+    FileState_t src;
+    FileState_t dst;
+} CacheRecord_t;
+
+
+struct ConvertCache_s {
+    char          *p_fname;
+    CacheRecord_t *records;           // open addressing hash table by the output name, an empty slot has p_dst_fname=NULL
+    size_t         cap;               // number of slots, power of 2
+    size_t         n_record;
+    int            changed;
+    Mutex_t        mutex;
+};
+
+
+static char* copyString (const char *p_str) {
+    size_t len = strlen(p_str) + 1;
+    char  *p   = (char*)malloc(len);
+    if (p)
+        memcpy(p, p_str, len);
+    return p;
+}
+
+
+static size_t hashString (const char *p_str) {
+    uint64_t h = 0xcbf29ce484222325ULL;          // FNV-1a
+    for (; *p_str; p_str++)
+        h = (h ^ (uint8_t)*p_str) * 0x100000001b3ULL;
+    return (size_t)h;
+}
+
+
+static uint64_t load64 (const uint8_t *p) {     // little endian, so that the hash does not depend on the machine
+    return  (uint64_t)p[0]        | ((uint64_t)p[1] << 8)  | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+
+#define  ROTL64(x,r)   (((x) << (r)) | ((x) >> (64-(r))))
+#define  HASH_PRIME1   0x9E3779B185EBCA87ULL
+#define  HASH_PRIME2   0xC2B2AE3D27D4EB4FULL
+
+
+uint64_t hashFileContent (const uint8_t *p_data, size_t len) {
+    uint64_t v0 = HASH_PRIME1, v1 = HASH_PRIME2, v2 = 0, v3 = (uint64_t)len;   // 4 independent lanes, so the multiplications overlap
+    uint64_t h;
+    size_t   i;
+    
+    for (i=0; i+32<=len; i+=32) {
+        v0 = ROTL64(v0 + load64(p_data+i   ) * HASH_PRIME2, 31) * HASH_PRIME1;
+        v1 = ROTL64(v1 + load64(p_data+i+8 ) * HASH_PRIME2, 31) * HASH_PRIME1;
+        v2 = ROTL64(v2 + load64(p_data+i+16) * HASH_PRIME2, 31) * HASH_PRIME1;
+        v3 = ROTL64(v3 + load64(p_data+i+24) * HASH_PRIME2, 31) * HASH_PRIME1;
+    }
+    
+    h = ROTL64(v0, 1) + ROTL64(v1, 7) + ROTL64(v2, 12) + ROTL64(v3, 18);
+    
+    for (; i<len; i++)
+        h = ROTL64(h ^ (p_data[i] * HASH_PRIME1), 11) * HASH_PRIME2;
+    
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    return h;
+}
+
+
+// return: the slot of the output name, which is empty if there is no record of it
+static CacheRecord_t* findRecord (const ConvertCache_t *p_cache, const char *p_dst_fname) {
+    size_t i = hashString(p_dst_fname) & (p_cache->cap - 1);
+    while (p_cache->records[i].p_dst_fname && strcmp(p_cache->records[i].p_dst_fname, p_dst_fname) != 0)
+        i = (i + 1) & (p_cache->cap - 1);
+    return &p_cache->records[i];
+}
+
+
+// return:   0 : success    1 : failed
+static int growCache (ConvertCache_t *p_cache) {
+    CacheRecord_t *old_records = p_cache->records;
+    size_t         old_cap     = p_cache->cap, i;
+    
+    p_cache->cap     = old_cap ? 2*old_cap : 256;
+    p_cache->records = (CacheRecord_t*)calloc(p_cache->cap, sizeof(CacheRecord_t));
+    
+    if (p_cache->records == NULL) {
+        p_cache->records = old_records;
+        p_cache->cap     = old_cap;
+        return 1;
+    }
+    
+    for (i=0; i<old_cap; i++)
+        if (old_records[i].p_dst_fname)
+            *findRecord(p_cache, old_records[i].p_dst_fname) = old_records[i];
+    
+    free(old_records);
+    return 0;
+}
+
+
+// the record takes p_src_fname and p_dst_fname, which must be allocated by malloc()
+static void putRecord (ConvertCache_t *p_cache, char *p_src_fname, char *p_dst_fname, int setting, const FileState_t *p_src, const FileState_t *p_dst) {
+    CacheRecord_t *p_rec;
+    
+    if (p_src_fname == NULL || p_dst_fname == NULL || (2*(p_cache->n_record+1) > p_cache->cap && growCache(p_cache))) {   // keep the table at most half full
+        free(p_src_fname);
+        free(p_dst_fname);
+        return;
+    }
+    
+    p_rec = findRecord(p_cache, p_dst_fname);
+    
+    if (p_rec->p_dst_fname) {
+        free(p_rec->p_src_fname);
+        free(p_rec->p_dst_fname);
+    } else {
+        p_cache->n_record ++;
+    }
+    
+    p_rec->p_src_fname = p_src_fname;
+    p_rec->p_dst_fname = p_dst_fname;
+    p_rec->setting     = setting;
+    p_rec->src         = *p_src;
+    p_rec->dst         = *p_dst;
+}
+
+
+// a line is "<src size> <src mtime> <src hash> <setting> <dst size> <dst mtime>\t<src name>\t<dst name>"
+static void parseLine (ConvertCache_t *p_cache, char *line) {
+    unsigned long long src_size, src_hash, dst_size;
+    long long src_mtime, dst_mtime;
+    FileState_t src, dst;
+    int   setting;
+    char *p_src_fname, *p_dst_fname, *p;
+    
+    if (line[0] == '#')
+        return;
+    
+    if ((p_src_fname = strchr(line, '\t')) == NULL)
+        return;
+    *(p_src_fname++) = '\0';
+    
+    if ((p_dst_fname = strchr(p_src_fname, '\t')) == NULL)
+        return;
+    *(p_dst_fname++) = '\0';
+    
+    for (p=p_dst_fname; *p && *p!='\r' && *p!='\n'; p++);
+    *p = '\0';
+    
+    if (sscanf(line, "%llu %lld %llx %d %llu %lld", &src_size, &src_mtime, &src_hash, &setting, &dst_size, &dst_mtime) != 6 || !p_src_fname[0] || !p_dst_fname[0])
+        return;
+    
+    src.size = src_size;
+    src.mtime = src_mtime;
+    src.hash = src_hash;
+    src.has_hash = 1;
+    dst.size = dst_size;
+    dst.mtime = dst_mtime;
+    dst.hash = 0;
+    dst.has_hash = 0;
+    
+    putRecord(p_cache, copyString(p_src_fname), copyString(p_dst_fname), setting, &src, &dst);
+}
+
+
+ConvertCache_t* openConvertCache (const char *p_fname) {
+    ConvertCache_t *p_cache;
+    char  line [8192];
+    FILE *fp;
+    
+    if ((p_cache = (ConvertCache_t*)calloc(1, sizeof(ConvertCache_t))) == NULL)
+        return NULL;
+    
+    if ((p_cache->p_fname = copyString(p_fname)) == NULL || growCache(p_cache)) {
+        free(p_cache->p_fname);
+        free(p_cache);
+        return NULL;
+    }
+    
+    if ((fp = fopen(p_fname, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp))   // a broken line (for example, too long) is ignored, so its output is converted again
+            parseLine(p_cache, line);
+        fclose(fp);
+    }
+    
+    mutexInit(&p_cache->mutex);
+    return p_cache;
+}
+
+
+int closeConvertCache (ConvertCache_t *p_cache) {
+    char  tmp_fname [8192];
+    FILE *fp;
+    size_t i;
+    int failed = 0;
+    
+    if (p_cache->changed) {           // write to a temporary file and then replace, so that an interrupted save does not lose the cache
+        snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", p_cache->p_fname);
+        
+        if ((fp = fopen(tmp_fname, "w")) == NULL) {
+            failed = 1;
+        } else {
+            fprintf(fp, "# ImCvt --incremental cache: <src size> <src mtime> <src hash> <setting> <dst size> <dst mtime> <src> <dst>\n");
+            for (i=0; i<p_cache->cap; i++) {
+                const CacheRecord_t *p_rec = &p_cache->records[i];
+                if (p_rec->p_dst_fname)
+                    fprintf(fp, "%llu %lld %016llx %d %llu %lld\t%s\t%s\n",
+                        (unsigned long long)p_rec->src.size, (long long)p_rec->src.mtime, (unsigned long long)p_rec->src.hash, p_rec->setting,
+                        (unsigned long long)p_rec->dst.size, (long long)p_rec->dst.mtime, p_rec->p_src_fname, p_rec->p_dst_fname);
+            }
+            failed = ferror(fp);
+            failed |= (fclose(fp) != 0);
+#ifdef _WIN32
+            if (!failed)
+                remove(p_cache->p_fname);   // rename() can not replace a file on Windows
+#endif
+            if (failed || rename(tmp_fname, p_cache->p_fname)) {
+                remove(tmp_fname);
+                failed = 1;
+            }
+        }
+    }
+    
+    for (i=0; i<p_cache->cap; i++) {
+        free(p_cache->records[i].p_src_fname);
+        free(p_cache->records[i].p_dst_fname);
+    }
+    
+    mutexDestroy(&p_cache->mutex);
+    free(p_cache->records);
+    free(p_cache->p_fname);
+    free(p_cache);
+    return failed;
+}
+
+
+int checkConvertCache (ConvertCache_t *p_cache, const char *p_src_fname, const char *p_dst_fname, int setting, const FileState_t *p_src, const FileState_t *p_dst) {
+    const CacheRecord_t *p_rec;
+    int result;
+    
+    mutexLock(&p_cache->mutex);
+    
+    p_rec = findRecord(p_cache, p_dst_fname);
+    
+    if (p_rec->p_dst_fname == NULL)
+        result = CACHE_NO_RECORD;
+    else if (p_dst == NULL || p_dst->size != p_rec->dst.size || p_dst->mtime != p_rec->dst.mtime)   // the output is deleted or changed by someone else
+        result = CACHE_STALE;
+    else if (strcmp(p_src_fname, p_rec->p_src_fname) != 0 || setting != p_rec->setting || p_src->size != p_rec->src.size)
+        result = CACHE_STALE;
+    else if (p_src->mtime == p_rec->src.mtime)
+        result = CACHE_CURRENT;
+    else if (!p_src->has_hash)
+        result = CACHE_NEED_HASH;
+    else
+        result = (p_src->hash == p_rec->src.hash) ? CACHE_CURRENT : CACHE_STALE;
+    
+    mutexUnlock(&p_cache->mutex);
+    
+    return result;
+}
+
+
+void recordConvertCache (ConvertCache_t *p_cache, const char *p_src_fname, const char *p_dst_fname, int setting, const FileState_t *p_src, const FileState_t *p_dst) {
+    if (strchr(p_src_fname, '\t') || strchr(p_src_fname, '\n') || strchr(p_dst_fname, '\t') || strchr(p_dst_fname, '\n'))
+        return;                       // can not be saved in a line, so the output is always converted
+    
+    mutexLock(&p_cache->mutex);
+    putRecord(p_cache, copyString(p_src_fname), copyString(p_dst_fname), setting, p_src, p_dst);
+    p_cache->changed = 1;
+    mutexUnlock(&p_cache->mutex);
+}
@@ -0,0 +1,50 @@
+#ifndef   __CONV_CACHE_H__
+#define   __CONV_CACHE_H__
+
+
+// the cache of --incremental mode, which records how each output file was made: from which source (its size, modification time and content hash), with which settings, and what the output was (its size and modification time)
+// an output is up to date if its record matches the current source and settings, and the output is not changed since it was made, so it does not need to be converted again
+// the cache is kept in memory while converting, and saved to a text file (one output per line) when closed. Its functions are thread-safe
+
+
+typedef struct ConvertCache_s ConvertCache_t;
+
+
+// the state of a file, see getFileInfo() in platform.h
+typedef struct {
+    uint64_t size;
+    int64_t  mtime;
+    uint64_t hash;                    // see hashFileContent(), valid only if has_hash=1
+    int      has_hash;
+} FileState_t;
+
+
+// load the cache from a file, which need not exist (then the cache is empty)
+// return:  NULL     : failed
+//          non-NULL : success
+ConvertCache_t* openConvertCache (const char *p_fname);
+
+// save the cache to the file it was loaded from (if it is changed), and free it
+// return:   0 : success    1 : failed to save
+int  closeConvertCache  (ConvertCache_t *p_cache);
+
+
+#define  CACHE_NO_RECORD  0           // the output has no record, so it was not made by --incremental
+#define  CACHE_STALE      1           // the output was made from another source or with other settings, or it is changed since
+#define  CACHE_NEED_HASH  2           // only the modification time of the source is changed, compare the content hash to decide
+#define  CACHE_CURRENT    3           // the output is up to date
+
+// setting : the encoder setting which affects the output (for example, the JPEG-LS near value), -1 if none
+// p_src   : the current state of the source file, its hash is compared only if has_hash=1
+// p_dst   : the current state of the output file, NULL if it does not exist
+// return: one of CACHE_xxx
+int  checkConvertCache  (ConvertCache_t *p_cache, const char *p_src_fname, const char *p_dst_fname, int setting, const FileState_t *p_src, const FileState_t *p_dst);
+
+// record that the output is made from the source, p_src must have the hash
+void recordConvertCache (ConvertCache_t *p_cache, const char *p_src_fname, const char *p_dst_fname, int setting, const FileState_t *p_src, const FileState_t *p_dst);
+
+// return: a fast 64-bit hash of the file content, which is not cryptographic, but enough to tell a changed file from a touched one
+uint64_t hashFileContent (const uint8_t *p_data, size_t len);
+
+
+#endif // __CONV_CACHE_H__
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+
+#ifdef CPU_X86
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#endif
+
+
+static const char *CPU_LEVEL_NAMES [] = {"scalar", "sse4.1", "avx2"};
+
+
+#ifdef CPU_X86
+
+// regs : EAX, EBX, ECX, EDX of the cpuid leaf
+static void getCpuid (uint32_t leaf, uint32_t regs[4]) {
+#ifdef _MSC_VER
+    int r [4];
+    __cpuidex(r, (int)leaf, 0);
+    regs[0] = r[0];  regs[1] = r[1];  regs[2] = r[2];  regs[3] = r[3];
+#else
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+
+// return: the low 32 bits of XCR0, which tells the register states saved by the OS
+static uint32_t getXcr0 () {
+#ifdef _MSC_VER
+    return (uint32_t)_xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+#endif
+}
+
+#endif
+
+
+CpuLevel_t detectCpuLevel () {
+#ifdef CPU_X86
+    uint32_t regs [4], max_leaf;
+    
+    getCpuid(0, regs);
+    max_leaf = regs[0];
+    
+    if (max_leaf < 1)
+        return CPU_SCALAR;
+        
+    getCpuid(1, regs);
+    
+    if (!(regs[2] & (1<<9)) || !(regs[2] & (1<<19)))                             // SSSE3, SSE4.1
+        return CPU_SCALAR;
+        
+    if (!(regs[2] & (1<<27)) || !(regs[2] & (1<<28)) || max_leaf < 7)             // OSXSAVE, AVX
+        return CPU_SSE41;
+        
+    if ((getXcr0() & 6) != 6)                                                    // the OS saves the XMM and YMM registers
+        return CPU_SSE41;
+        
+    getCpuid(7, regs);
+    
+    if (!(regs[1] & (1<<5)))                                                     // AVX2
+        return CPU_SSE41;
+        
+    return CPU_AVX2;
+#else
+    return CPU_SCALAR;
+#endif
+}
+
+
+int detectPclmul () {
+#ifdef CPU_X86
+    uint32_t regs [4];
+    
+    getCpuid(0, regs);
+    
+    if (regs[0] < 1)
+        return 0;
+        
+    getCpuid(1, regs);
+    
+    return (regs[2] & (1<<1)) ? 1 : 0;                                           // PCLMULQDQ
+#else
+    return 0;
+#endif
+}
+
+
+const char* getCpuLevelName (CpuLevel_t level) {
+    return CPU_LEVEL_NAMES[level];
+}
+
+
+int parseCpuLevel (const char *p_name, CpuLevel_t *p_level) {
+    int i;
+    for (i=0; i<(int)(sizeof(CPU_LEVEL_NAMES)/sizeof(CPU_LEVEL_NAMES[0])); i++) {
+        if (strcmp(p_name, CPU_LEVEL_NAMES[i]) == 0) {
+            *p_level = (CpuLevel_t)i;
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,35 @@
+#ifndef   __CPU_H__
+#define   __CPU_H__
+
+
+// detection of the SIMD instruction sets, which picks the versions of the kernels (see kernels.h) at startup
+
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  #define  CPU_X86                    // the SSE4.1 and AVX2 kernels are only built for x86
+#endif
+
+
+typedef enum {
+    CPU_SCALAR = 0,                   // plain C, for any CPU
+    CPU_SSE41,                        // SSE4.1 (with SSSE3)
+    CPU_AVX2                          // AVX2, enabled by the OS
+} CpuLevel_t;
+
+
+// return: the highest level supported by this CPU and OS
+CpuLevel_t  detectCpuLevel ();
+
+// PCLMULQDQ (carry-less multiply), which only the CRC-32 kernel uses, and which the SSE4.1 CPUs before 2010 (Penryn, Nehalem) do not have
+// return:   1 : supported    0 : not supported
+int         detectPclmul ();
+
+// return: name of the level, as "scalar", "sse4.1" or "avx2"
+const char* getCpuLevelName (CpuLevel_t level);
+
+// parse a level name of getCpuLevelName()
+// return:   0 : success    1 : unknown name
+int         parseCpuLevel (const char *p_name, CpuLevel_t *p_level);
+
+
+#endif // __CPU_H__
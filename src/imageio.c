@@ -0,0 +1,299 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
+#include "platform.h"
+#include "cpu.h"
+#include "kernels.h"
+
+
+// return:  IMAGE_FORMAT_xxx : the format recognized by the magic bytes at the start of the file
+//          IMAGE_FORMAT_UNKNOWN : not recognized
+ImageFormat_t probeImageFormat (const uint8_t *p_head, size_t len) {
+    if (len >= 2 && p_head[0] == 'P' && p_head[1] >= '1' && p_head[1] <= '6')
+        return IMAGE_FORMAT_PNM;
+    
+    if (len >= 8 && p_head[0] == 0x89 && p_head[1] == 'P' && p_head[2] == 'N' && p_head[3] == 'G' && p_head[4] == '\r' && p_head[5] == '\n' && p_head[6] == 0x1A && p_head[7] == '\n')
+        return IMAGE_FORMAT_PNG;
+    
+    if (len >= 2 && p_head[0] == 'B' && p_head[1] == 'M')
+        return IMAGE_FORMAT_BMP;
+    
+    if (len >= 4 && p_head[0] == 'q' && p_head[1] == 'o' && p_head[2] == 'i' && p_head[3] == 'f')
+        return IMAGE_FORMAT_QOI;
+    
+    return IMAGE_FORMAT_UNKNOWN;
+}
+
+
+// return:   0 : success    1 : failed
+int probeImageHeader (const uint8_t *p_head, size_t len, ImageFormat_t *p_format, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+    *p_format = probeImageFormat(p_head, len);
+    
+    switch (*p_format) {
+        case IMAGE_FORMAT_PNM : return probePNMHeader(p_head, len, p_is_rgb, p_height, p_width);
+        case IMAGE_FORMAT_PNG : return probePNGHeader(p_head, len, p_is_rgb, p_height, p_width);
+        case IMAGE_FORMAT_BMP : return probeBMPHeader(p_head, len, p_is_rgb, p_height, p_width);
+        case IMAGE_FORMAT_QOI : return probeQOIHeader(p_head, len, p_is_rgb, p_height, p_width);
+        default               : return 1;
+    }
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL)
+uint8_t* decodeImage (const uint8_t *p_src, size_t src_len, ImageFormat_t *p_format, ImageDesc_t *p_desc, Arena_t *p_arena) {
+    *p_format = probeImageFormat(p_src, src_len);
+    
+    switch (*p_format) {
+        case IMAGE_FORMAT_PNM : return decodePNMImage(p_src, src_len, p_desc, p_arena);
+        case IMAGE_FORMAT_PNG : return decodePNGImage(p_src, src_len, p_desc, p_arena);
+        case IMAGE_FORMAT_BMP : return decodeBMPImage(p_src, src_len, p_desc, p_arena);
+        case IMAGE_FORMAT_QOI : return decodeQOIImage(p_src, src_len, p_desc, p_arena);
+        default               : return NULL;
+    }
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by memMalloc(), need to be memFree() later
+uint8_t* loadImageFile (const char *p_filename, ImageFormat_t *p_format, ImageDesc_t *p_desc) {
+    MappedFile_t mf;
+    uint8_t *p_buf;
+    
+    *p_format = IMAGE_FORMAT_UNKNOWN;
+    
+    if (mapFile(p_filename, &mf))
+        return NULL;
+    
+    p_buf = decodeImage(mf.p_data, mf.len, p_format, p_desc, NULL);
+    
+    unmapFile(&mf);
+    return p_buf;
+}
+
+
+void describeImage (ImageDesc_t *p_desc, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width) {
+    p_desc->p_data       = p_buf;
+    p_desc->height       = height;
+    p_desc->width        = width;
+    p_desc->channels     = is_rgb ? 3 : 1;
+    p_desc->depth        = 8;
+    p_desc->layout       = IMAGE_INTERLEAVED;
+    p_desc->stride       = (size_t)p_desc->channels * width;
+    p_desc->plane_stride = 0;
+}
+
+
+// return:   0 : valid    1 : invalid
+int checkImageDesc (const ImageDesc_t *p_desc) {
+    const size_t sample_size = (size_t)p_desc->depth / 8;
+    size_t row_size;
+    
+    if (p_desc->p_data == NULL)
+        return 1;
+    
+    if (p_desc->channels != 1 && p_desc->channels != 3 && p_desc->channels != 4)
+        return 1;
+    
+    if (p_desc->depth != 8 && p_desc->depth != 16)
+        return 1;
+    
+    if (p_desc->layout == IMAGE_INTERLEAVED) {
+        row_size = sample_size * p_desc->channels * p_desc->width;
+    } else if (p_desc->layout == IMAGE_PLANAR) {
+        row_size = sample_size * p_desc->width;
+        if (p_desc->channels > 1 && p_desc->height > 0 && p_desc->plane_stride < p_desc->stride * (p_desc->height-1) + row_size)
+            return 1;
+    } else {
+        return 1;
+    }
+    
+    return (p_desc->height > 1 && p_desc->stride < row_size);
+}
+
+
+// return:   0 : success    1 : failed
+int cropImageDesc (ImageDesc_t *p_dst, const ImageDesc_t *p_src, uint32_t y, uint32_t x, uint32_t height, uint32_t width) {
+    const size_t pixel_size = (size_t)(p_src->layout == IMAGE_PLANAR ? 1 : p_src->channels) * (p_src->depth / 8);
+    
+    if (y > p_src->height || height > p_src->height - y || x > p_src->width || width > p_src->width - x)
+        return 1;
+    
+    *p_dst = *p_src;
+    p_dst->p_data += p_src->stride * y + pixel_size * x;
+    p_dst->height  = height;
+    p_dst->width   = width;
+    return 0;
+}
+
+
+// return:   0 : success    1 : failed
+int planeImageDesc (ImageDesc_t *p_dst, const ImageDesc_t *p_src, int channel) {
+    if (p_src->layout != IMAGE_PLANAR || channel < 0 || channel >= p_src->channels)
+        return 1;
+    
+    *p_dst = *p_src;
+    p_dst->p_data      += p_src->plane_stride * channel;
+    p_dst->channels     = 1;
+    p_dst->plane_stride = 0;
+    return 0;
+}
+
+
+// 16-bit samples are reduced to their high 8 bits a sample at a time, since no format read by this program has them
+static void readImageDescRow16 (const ImageDesc_t *p_desc, const uint8_t *p, int channel, uint8_t *p_row) {
+    const size_t pixel_step   = (p_desc->layout == IMAGE_PLANAR) ? 2 : 2 * (size_t)p_desc->channels;
+    const size_t channel_step = (p_desc->layout == IMAGE_PLANAR) ? p_desc->plane_stride : 2;
+    const int    n_out        = (channel >= 0 || p_desc->channels == 1) ? 1 : 3;
+    uint32_t x;
+    uint16_t v;
+    int c;
+    
+    if (channel < 0)
+        channel = 0;
+    
+    for (x=0; x<p_desc->width; x++) {
+        for (c=channel; c<channel+n_out; c++) {
+            memcpy(&v, p + pixel_step*x + channel_step*c, sizeof(v));
+            *(p_row++) = (uint8_t)(v >> 8);
+        }
+    }
+}
+
+
+void readImageDescRow (const ImageDesc_t *p_desc, uint32_t y, int channel, uint8_t *p_row) {
+    const size_t   width = p_desc->width;
+    const size_t   plane = p_desc->plane_stride;
+    const uint8_t *p     = p_desc->p_data + p_desc->stride * y;
+    
+    if (p_desc->channels == 1 && channel > 0)
+        channel = 0;
+    
+    if (p_desc->depth != 8) {
+        readImageDescRow16(p_desc, p, channel, p_row);
+    } else if (p_desc->layout == IMAGE_PLANAR) {
+        if (channel >= 0)
+            memcpy(p_row, p + plane*channel, width);
+        else if (p_desc->channels == 1)
+            memcpy(p_row, p, width);
+        else
+            planesToRGB(p_row, p, p+plane, p+2*plane, width);
+    } else {
+        if (channel >= 0)
+            extractChannel(p_row, p, width, p_desc->channels, channel);
+        else if (p_desc->channels == 4)
+            rgbxToRGB(p_row, p, width);
+        else
+            memcpy(p_row, p, width*p_desc->channels);
+    }
+}
+
+
+// return:  pointer to row y as packed 8-bit gray or RGB pixels
+const uint8_t* getImageDescRow (const ImageDesc_t *p_desc, uint32_t y, uint8_t *p_row) {
+    if (p_desc->depth == 8 && p_desc->layout == IMAGE_INTERLEAVED && p_desc->channels != 4)
+        return p_desc->p_data + p_desc->stride * y;
+    readImageDescRow(p_desc, y, -1, p_row);
+    return p_row;
+}
+
+
+typedef struct {
+    ImageDesc_t    desc;
+    uint32_t       i_row;
+    int            is_owner;
+} DescRowSource_t;
+
+
+static int descReadRow (ImageRowSource_t *p_rs, uint8_t *p_row) {
+    DescRowSource_t *p_ctx = (DescRowSource_t*)p_rs->p_ctx;
+    if (p_ctx->i_row >= p_rs->height)
+        return 1;
+    readImageDescRow(&p_ctx->desc, p_ctx->i_row, -1, p_row);
+    p_ctx->i_row ++;
+    return 0;
+}
+
+
+static int descRewind (ImageRowSource_t *p_rs) {
+    ((DescRowSource_t*)p_rs->p_ctx)->i_row = 0;
+    return 0;
+}
+
+
+static void descClose (ImageRowSource_t *p_rs) {
+    DescRowSource_t *p_ctx = (DescRowSource_t*)p_rs->p_ctx;
+    if (p_ctx->is_owner)
+        memFree((void*)p_ctx->desc.p_data);
+    memFree(p_ctx);
+    p_rs->p_ctx = NULL;
+}
+
+
+// return:   0 : success    1 : failed
+int openImageDescRowSource (const ImageDesc_t *p_desc, int is_owner, ImageRowSource_t *p_rs) {
+    DescRowSource_t *p_ctx;
+    
+    if (checkImageDesc(p_desc))
+        return 1;
+    
+    if ((p_ctx = (DescRowSource_t*)memMalloc(sizeof(DescRowSource_t))) == NULL)
+        return 1;
+    
+    p_ctx->desc     = *p_desc;
+    p_ctx->i_row    = 0;
+    p_ctx->is_owner = is_owner;
+    
+    p_rs->is_rgb     = (p_desc->channels != 1);
+    p_rs->height     = p_desc->height;
+    p_rs->width      = p_desc->width;
+    p_rs->p_read_row = descReadRow;
+    p_rs->p_rewind   = descRewind;
+    p_rs->p_close    = descClose;
+    p_rs->p_ctx      = p_ctx;
+    return 0;
+}
+
+
+// return:   0 : success    1 : failed
+int openImageRowSource (const uint8_t *p_src, size_t src_len, ImageFormat_t *p_format, ImageRowSource_t *p_rs) {
+    *p_format = probeImageFormat(p_src, src_len);
+    
+    switch (*p_format) {
+        case IMAGE_FORMAT_PNM : return openPNMRowSource(p_src, src_len, p_rs);
+        case IMAGE_FORMAT_BMP : return openBMPRowSource(p_src, src_len, p_rs);
+        case IMAGE_FORMAT_QOI : return openQOIRowSource(p_src, src_len, p_rs);
+        case IMAGE_FORMAT_PNG : {
+            ImageDesc_t desc;
+            uint8_t *p_buf = decodePNGImage(p_src, src_len, &desc, NULL);
+            if (p_buf == NULL)
+                return 1;
+            if (openImageDescRowSource(&desc, 1, p_rs)) {
+                memFree(p_buf);
+                return 1;
+            }
+            return 0;
+        }
+        default               : return 1;
+    }
+}
+
+
+// return:   0 : success    1 : failed
+int writeBufferToFile (const char *p_filename, const uint8_t *p_buf, size_t len) {
+    int failed;
+    FILE *fp;
+    
+    if ((fp = openOutputStream(p_filename)) == NULL)
+        return 1;
+    
+    failed  = (len != fwrite(p_buf, sizeof(uint8_t), len, fp));
+    failed |= closeOutputStream(fp);
+    
+    return failed;
+}
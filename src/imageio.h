@@ -2,23 +2,174 @@
 #define   __IMAGE_IO_H__
 
 
+typedef enum {
+    IMAGE_FORMAT_UNKNOWN = 0,
+    IMAGE_FORMAT_PNM,
+    IMAGE_FORMAT_PNG,
+    IMAGE_FORMAT_BMP,
+    IMAGE_FORMAT_QOI
+} ImageFormat_t;
+
+
+// image descriptor ------------------------------
+// describes pixels in memory which are not necessarily packed, so that a crop, a plane, or an image with padded rows can be encoded without a copy
+// the decoders below return a descriptor of their packed 8-bit pixels (see describeImage()), the encoders and writers accept any valid descriptor
+typedef enum {
+    IMAGE_INTERLEAVED = 0,            // the channels of a pixel are adjacent (RGBRGB...)
+    IMAGE_PLANAR                      // each channel is a separate plane (RRR... GGG... BBB...)
+} ImageLayout_t;
+
+typedef struct {
+    const uint8_t *p_data;            // the first sample of the top-left pixel (of the first plane if planar)
+    uint32_t       height;
+    uint32_t       width;
+    int            channels;          // 1 (gray), 3 (RGB) or 4 (RGBA, the alpha is discarded by the encoders)
+    int            depth;             // bits per sample : 8, or 16 (uint16_t in the native byte order, the encoders keep the high 8 bits)
+    ImageLayout_t  layout;
+    size_t         stride;            // bytes from a row to the next (in the same plane)
+    size_t         plane_stride;      // bytes from a plane to the next, only for IMAGE_PLANAR
+} ImageDesc_t;
+
+// describe a packed 8-bit gray (is_rgb=0) or RGB (is_rgb=1) image
+void describeImage    (ImageDesc_t *p_desc, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width);        // from imageio.c
+
+// return:   0 : the descriptor is valid    1 : invalid (bad channels, depth or layout, or the rows or planes overlap)
+int checkImageDesc    (const ImageDesc_t *p_desc);                                                                     // from imageio.c
+
+// *p_dst is the height x width window at row y and column x of *p_src, sharing its pixels
+// return:   0 : success    1 : the window is out of the image
+int cropImageDesc     (ImageDesc_t *p_dst, const ImageDesc_t *p_src, uint32_t y, uint32_t x, uint32_t height, uint32_t width);   // from imageio.c
+
+// *p_dst is the gray image of one channel of a planar *p_src, sharing its pixels
+// return:   0 : success    1 : *p_src is not planar or has no such channel
+int planeImageDesc    (ImageDesc_t *p_dst, const ImageDesc_t *p_src, int channel);                                     // from imageio.c
+
+// convert row y to packed 8-bit samples
+// channel=-1 : the pixels, as gray (channels=1) or RGB, (channels==1?1:3)*width bytes
+// channel>=0 : only that channel (0:R 1:G 2:B, any channel of a gray image is the gray), width bytes
+void readImageDescRow (const ImageDesc_t *p_desc, uint32_t y, int channel, uint8_t *p_row);                            // from imageio.c
+
+// get row y as packed 8-bit gray or RGB pixels, as readImageDescRow(p_desc, y, -1, p_row), but an 8-bit interleaved gray or RGB row is read in place instead of copied
+// return:  pointer to the row, either inside p_desc->p_data or p_row (which should have (channels==1?1:3)*width bytes)
+const uint8_t* getImageDescRow (const ImageDesc_t *p_desc, uint32_t y, uint8_t *p_row);                                // from imageio.c
+
+
+// functions for image format probe ---------------
+ImageFormat_t probeImageFormat (const uint8_t *p_head, size_t len);                                         // from imageio.c
+
+// get the size of an image from its header without decoding it, so p_head can be only the first few KB of the file
+// *p_is_rgb is whether the decoder outputs RGB pixels (see decodeXXXImage() below)
+// return:   0 : success    1 : failed
+int probePNMHeader   (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_pnm.c
+int probePNGHeader   (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_png.c
+int probeBMPHeader   (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_bmp.c
+int probeQOIHeader   (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_qoi.c
+
+// probe the format by magic bytes and call the corresponding header probe
+int probeImageHeader (const uint8_t *p_head, size_t len, ImageFormat_t *p_format, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio.c
+
+
+// functions for image decode from memory ---------
+// p_arena : the arena (see arena.h) which the pixel buffer is taken from, can be NULL
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL)
+//                     *p_desc describes them, as packed 8-bit gray or RGB pixels (see describeImage())
+uint8_t* decodePNMImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena);   // from imageio_pnm.c
+uint8_t* decodePNGImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena);   // from imageio_png.c
+uint8_t* decodeBMPImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena);   // from imageio_bmp.c
+uint8_t* decodeQOIImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena);   // from imageio_qoi.c
+
+// probe the format by magic bytes and call the corresponding decoder
+uint8_t* decodeImage    (const uint8_t *p_src, size_t src_len, ImageFormat_t *p_format, ImageDesc_t *p_desc, Arena_t *p_arena);   // from imageio.c
+
+
+// functions for image encode to memory -----------
+// p_desc  : the image, any valid descriptor (see checkImageDesc()), its 8-bit interleaved gray or RGB rows are read in place, the others are converted row by row (see readImageDescRow())
+// p_arena : the arena (see arena.h) which the output and scratch buffers are taken from, can be NULL
+// return:   0 : success    1 : failed
+//           when success, *pp_dst is the encoded stream, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL). *p_dst_len is its length
+int encodePNMImage  (const ImageDesc_t *p_desc,           uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);   // from imageio_pnm.c
+int encodePNGImage  (const ImageDesc_t *p_desc,           uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);   // from imageio_png.c
+int encodeBMPImage  (const ImageDesc_t *p_desc,           uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);   // from imageio_bmp.c
+int encodeQOIImage  (const ImageDesc_t *p_desc,           uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);   // from imageio_qoi.c
+int encodeJLSImage  (const ImageDesc_t *p_desc, int near, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);   // from imageio_jls.c, the samples of any layout and depth are read in place
+int encodeHEVCImage (const ImageDesc_t *p_desc, int qpd6, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena);   // from imageio_hevc.c, the green channel is copied to the padded frame of the encoder
+
+
 // functions for image file read ------------------
+// the file is memory-mapped (see mapFile() in platform.h) and decoded from the mapped pages without an intermediate copy
 // return:  NULL     : failed
-//          non-NULL : pointer to image pixels, allocated by malloc(), need to be free() later
-uint8_t* loadPNMImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_pnm.c
-uint8_t* loadPNGImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_png.c
-uint8_t* loadBMPImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_bmp.c
-uint8_t* loadQOIImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width);   // from imageio_qoi.c
+//          non-NULL : pointer to image pixels, allocated by memMalloc(), need to be memFree() later, *p_desc describes them (see decodeXXXImage() above)
+uint8_t* loadPNMImageFile (const char *p_filename, ImageDesc_t *p_desc);   // from imageio_pnm.c
+uint8_t* loadPNGImageFile (const char *p_filename, ImageDesc_t *p_desc);   // from imageio_png.c
+uint8_t* loadBMPImageFile (const char *p_filename, ImageDesc_t *p_desc);   // from imageio_bmp.c
+uint8_t* loadQOIImageFile (const char *p_filename, ImageDesc_t *p_desc);   // from imageio_qoi.c
+
+// probe the format by magic bytes and call the corresponding decoder
+uint8_t* loadImageFile    (const char *p_filename, ImageFormat_t *p_format, ImageDesc_t *p_desc);   // from imageio.c
+
+
+// functions for zero-copy image read --------------
+// return:  NULL     : not a raw PGM/PPM
+//          non-NULL : pointer to image pixels inside p_src, valid as long as p_src is valid, *p_desc describes them
+const uint8_t* viewPNMImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc);   // from imageio_pnm.c
+
 
 
 // functions for image file write -----------------
+// p_desc : the image, as encodeXXXImage() above
+// writePNMImageFile() also accepts p_filename="-" for the standard output, the others need a file (since they map it, see createOutputFile() in platform.h)
+// return:   0 : success    1 : failed
+int writePNMImageFile (const char *p_filename, const ImageDesc_t *p_desc);           // from imageio_pnm.c
+int writePNGImageFile (const char *p_filename, const ImageDesc_t *p_desc);           // from imageio_png.c
+int writeBMPImageFile (const char *p_filename, const ImageDesc_t *p_desc);           // from imageio_bmp.c
+int writeQOIImageFile (const char *p_filename, const ImageDesc_t *p_desc);           // from imageio_qoi.c
+int writeJLSImageFile (const char *p_filename, const ImageDesc_t *p_desc, int near); // from imageio_jls.c
+int writeHEVCImageFile(const char *p_filename, const ImageDesc_t *p_desc, int qpd6); // from imageio_hevc.c
+
+
+// functions for row streaming -------------------
+// a source produces the image row by row (from top to bottom), so that an image can be converted with memory proportional to its width instead of its size
+typedef struct ImageRowSource_s {
+    int      is_rgb;
+    uint32_t height;
+    uint32_t width;
+    int    (*p_read_row) (struct ImageRowSource_s *p_rs, uint8_t *p_row);   // read the next row ((is_rgb?3:1)*width bytes) to p_row, return:  0 : success    1 : failed
+    int    (*p_rewind)   (struct ImageRowSource_s *p_rs);                   // restart from the first row, return:  0 : success    1 : failed
+    void   (*p_close)    (struct ImageRowSource_s *p_rs);                   // release the resources of the source (but not the source data)
+    void    *p_ctx;
+} ImageRowSource_t;
+
+// open a row source on an encoded image in memory, p_src must be valid until the source is closed
+// return:   0 : success    1 : failed
+int openPNMRowSource    (const uint8_t *p_src, size_t src_len, ImageRowSource_t *p_rs);                    // from imageio_pnm.c
+int openBMPRowSource    (const uint8_t *p_src, size_t src_len, ImageRowSource_t *p_rs);                    // from imageio_bmp.c
+int openQOIRowSource    (const uint8_t *p_src, size_t src_len, ImageRowSource_t *p_rs);                    // from imageio_qoi.c
+
+// open a row source which reads a raw PBM, PGM or PPM from fp by rows (so the image is never in memory as a whole), p_head of head_len bytes is the start of the file already read from fp (see readStdinHead() in platform.h), which must have the whole header
+// the source can not be rewound, so it suits one pass of the rows (one output, which is not a RGB JPEG-LS), *p_file_len is the length of the file by its header
+int openPNMFileRowSource (FILE *fp, const uint8_t *p_head, size_t head_len, ImageRowSource_t *p_rs, uint64_t *p_file_len);   // from imageio_pnm.c
+
+// open a row source on a described image (the rows are converted by readImageDescRow()), so that every streamXXXImage() below can encode it, *p_desc is copied
+// if is_owner=1, p_desc->p_data is released by memFree() when the source is closed, so it must be allocated by memMalloc() (or arenaAlloc(NULL))
+int openImageDescRowSource (const ImageDesc_t *p_desc, int is_owner, ImageRowSource_t *p_rs);   // from imageio.c
+
+// probe the format by magic bytes and open the corresponding row source (PNG is decoded as a whole, since its rows are not stored independently)
+int openImageRowSource  (const uint8_t *p_src, size_t src_len, ImageFormat_t *p_format, ImageRowSource_t *p_rs);   // from imageio.c
+
+// encode the rows of a source to fp, the output is the same as encodeXXXImage()
+// return:   0 : success    1 : failed
+int streamPNMImage (ImageRowSource_t *p_rs, FILE *fp);              // from imageio_pnm.c
+int streamPNGImage (ImageRowSource_t *p_rs, FILE *fp);              // from imageio_png.c
+int streamBMPImage (ImageRowSource_t *p_rs, FILE *fp);              // from imageio_bmp.c, fp must be seekable since BMP rows are stored from bottom to top
+int streamQOIImage (ImageRowSource_t *p_rs, FILE *fp);              // from imageio_qoi.c
+int streamJLSImage (ImageRowSource_t *p_rs, FILE *fp, int near);    // from imageio_jls.c, for RGB image, the source is read 3 times (one scan per component)
+
+
+// functions for whole file write -----------------
+// p_filename="-" is the standard output
 // return:   0 : success    1 : failed
-int writePNMImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width);           // from imageio_pnm.c
-int writePNGImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width);           // from imageio_png.c
-int writeBMPImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width);           // from imageio_bmp.c
-int writeQOIImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width);           // from imageio_qoi.c
-int writeJLSImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width, int near); // from imageio_jls.c
-int writeHEVCImageFile(const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width, int qpd6); // from imageio_hevc.c
+int writeBufferToFile (const char *p_filename, const uint8_t *p_buf, size_t len);                             // from imageio.c
 
 
 #endif // __IMAGE_IO_H__
@@ -1,177 +1,513 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
+#include "console.h"
+#include "platform.h"
+#include "cpu.h"
+#include "kernels.h"
 
-static void writeLittleEndian (uint32_t value, uint32_t len, FILE *fp) {
+
+static void putLittleEndian (uint32_t value, uint32_t len, uint8_t **pp) {
     for (; len>0; len--) {
-        fputc((value&0xFF), fp);
+        *((*pp)++) = (value&0xFF);
         value >>= 8;
     }
 }
 
 
-static uint32_t loadLittleEndian (uint32_t len, FILE *fp) {
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *p_end;
+} ByteReader_t;
+
+
+// return: next byte, or EOF if reach the end
+static int getByte (ByteReader_t *p_rd) {
+    return (p_rd->p < p_rd->p_end) ? *(p_rd->p++) : EOF;
+}
+
+
+static uint32_t loadLittleEndian (uint32_t len, ByteReader_t *p_rd) {
     uint32_t i, value=0;
     for (i=0; i<len; i++)
-        value |= (fgetc(fp) << (8*i));
+        value |= (getByte(p_rd) << (8*i));
     return value;
 }
 
 
-// return:   0 : success    1 : failed
-int writeBMPImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width) {
+// write BMP header (and palette for gray image) to p
+// return: header size
+static size_t put_bmp_header (uint8_t *p, int is_rgb, uint32_t height, uint32_t width) {
     const size_t row_size    = (size_t)(is_rgb?3:1) * width;
     const size_t row_size_a  = ((row_size+3)/4)*4;
     const size_t n_palette   = is_rgb ? 0 : 256;
     const size_t header_size = 14 + 40 + 4*n_palette;              // 14B BMP file header + 40B DIB header + palette + pixels
-    const size_t file_size   = header_size + height * row_size_a;  // whole file size
-    uint32_t i, j;
-    int failed;
-    FILE *fp;
-    
-    if (width < 1 || height < 1)
-        return 1;
-    
-    if ((fp = fopen(p_filename, "wb")) == NULL)
-        return 1;
+    const size_t file_size   = header_size + (size_t)height * row_size_a;  // whole file size, at most BMP_MAX_FILE_SIZE
+    uint32_t i;
     
     // write 14B BMP file header -----------------------------------------------------------------------
-    writeLittleEndian(    0x4D42, 2, fp);   // 'BM'
-    writeLittleEndian( file_size, 4, fp);   // whole file size
-    writeLittleEndian(0x00000000, 4, fp);   // reserved
-    writeLittleEndian(header_size,4, fp);   // start position of pixel data
+    putLittleEndian(    0x4D42, 2, &p);     // 'BM'
+    putLittleEndian( file_size, 4, &p);     // whole file size
+    putLittleEndian(0x00000000, 4, &p);     // reserved
+    putLittleEndian(header_size,4, &p);     // start position of pixel data
     
     // write 40B DIB header ----------------------------------------------------------------------------
-    writeLittleEndian(        40, 4, fp);   // DIB header size
-    writeLittleEndian(     width, 4, fp);   // width
-    writeLittleEndian(    height, 4, fp);   // height
-    writeLittleEndian(    0x0001, 2, fp);   // one color plane
-    writeLittleEndian(is_rgb?24:8,2, fp);   // bits per pixel
-    writeLittleEndian(0x00000000, 4, fp);   // BI_RGB
-    writeLittleEndian(0x00000000, 4, fp);   // pixel data size (height * width), a dummy 0 can be given for BI_RGB bitmaps
-    writeLittleEndian(0x00000EC4, 4, fp);   // horizontal resolution of the image. (pixel per metre, signed integer)
-    writeLittleEndian(0x00000EC4, 4, fp);   // vertical resolution of the image. (pixel per metre, signed integer)
-    writeLittleEndian( n_palette, 4, fp);   // number of colors in the color palette, or 0 to default to 2^n
-    writeLittleEndian(0x00000000, 4, fp);   // number of important colors used, or 0 when every color is important; generally ignored
+    putLittleEndian(        40, 4, &p);     // DIB header size
+    putLittleEndian(     width, 4, &p);     // width
+    putLittleEndian(    height, 4, &p);     // height
+    putLittleEndian(    0x0001, 2, &p);     // one color plane
+    putLittleEndian(is_rgb?24:8,2, &p);     // bits per pixel
+    putLittleEndian(0x00000000, 4, &p);     // BI_RGB
+    putLittleEndian(0x00000000, 4, &p);     // pixel data size (height * width), a dummy 0 can be given for BI_RGB bitmaps
+    putLittleEndian(0x00000EC4, 4, &p);     // horizontal resolution of the image. (pixel per metre, signed integer)
+    putLittleEndian(0x00000EC4, 4, &p);     // vertical resolution of the image. (pixel per metre, signed integer)
+    putLittleEndian( n_palette, 4, &p);     // number of colors in the color palette, or 0 to default to 2^n
+    putLittleEndian(0x00000000, 4, &p);     // number of important colors used, or 0 when every color is important; generally ignored
     
     // write palette -----------------------------------------------------------------------------------
     for (i=0; i<n_palette; i++) {
-        fputc(i, fp);
-        fputc(i, fp);
-        fputc(i, fp);
-        fputc(0xFF, fp);
+        *(p++) = i;
+        *(p++) = i;
+        *(p++) = i;
+        *(p++) = 0xFF;
     }
     
+    return header_size;
+}
+
+
+// return: length of the BMP file, which is exact since BMP is not compressed
+static uint64_t getBMPFileSize (int is_rgb, uint32_t height, uint32_t width) {
+    const uint64_t row_size_a  = (((uint64_t)(is_rgb?3:1) * width + 3) / 4) * 4;
+    const uint64_t header_size = 14 + 40 + (is_rgb ? 0 : 4*256);
+    return header_size + height * row_size_a;
+}
+
+
+#define  BMP_MAX_FILE_SIZE  0xFFFFFFFF      // the file size in the header is 32-bit
+#define  BMP_MAX_SIZE       0x7FFFFFFF      // the width and height in the header are signed 32-bit
+
+
+// return:   0 : the image can be a BMP file    1 : too large, the error is printed
+static int checkBMPSize (int is_rgb, uint32_t height, uint32_t width) {
+    if (width > BMP_MAX_SIZE || height > BMP_MAX_SIZE || getBMPFileSize(is_rgb, height, width) > BMP_MAX_FILE_SIZE) {
+        consolePrintf("   ***ERROR: a BMP file is at most %u bytes (its size in the header is 32-bit), which the %ux%u image goes beyond\n", BMP_MAX_FILE_SIZE, width, height);
+        return 1;
+    }
+    return 0;
+}
+
+
+// encode the whole image to p, which should have getBMPFileSize() bytes, p_row_buf is a row for the rows which are converted (see getImageDescRow())
+static void putBMPImage (const ImageDesc_t *p_desc, uint8_t *p_row_buf, uint8_t *p) {
+    const int      is_rgb      = (p_desc->channels != 1);
+    const uint32_t height      = p_desc->height;
+    const uint32_t width       = p_desc->width;
+    const size_t   row_size    = (size_t)(is_rgb?3:1) * width;
+    const size_t   row_size_a  = ((row_size+3)/4)*4;
+    uint32_t i;
+    
+    p += put_bmp_header(p, is_rgb, height, width);
+    
     // write pixel data, note that the scan order of BMP is from down to up, from left to right --------
     for (i=0; i<height; i++) {
-        const uint8_t *p_row = p_buf + (size_t)(height-1-i) * row_size;
-        if (is_rgb) {
-            for (j=0; j<width; j++) {
-                fputc(p_row[2], fp);
-                fputc(p_row[1], fp);
-                fputc(p_row[0], fp);
-                p_row += 3;
-            }
-        } else {
-            fwrite(p_row, sizeof(uint8_t), row_size, fp);
-        }
-        writeLittleEndian(0, (row_size_a-row_size), fp);
+        const uint8_t *p_row = getImageDescRow(p_desc, height-1-i, p_row_buf);
+        if (is_rgb)
+            swapRB24(p, p_row, width);      // RGB -> BGR
+        else
+            memcpy(p, p_row, row_size);
+        p += row_size;
+        putLittleEndian(0, (row_size_a-row_size), &p);
     }
+}
+
+
+// return:   0 : success    1 : failed
+int encodeBMPImage (const ImageDesc_t *p_desc, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    const int    is_rgb    = (p_desc->channels != 1);
+    const size_t file_size = (size_t)getBMPFileSize(is_rgb, p_desc->height, p_desc->width);
+    uint8_t *p_row, *p_dst;
     
-    failed = ((size_t)ftell(fp) != file_size);
-    fclose(fp);
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc) || checkBMPSize(is_rgb, p_desc->height, p_desc->width))
+        return 1;
+    
+    p_row = (uint8_t*)memMalloc((size_t)(is_rgb?3:1) * p_desc->width);
+    p_dst = (uint8_t*)arenaAlloc(p_arena, file_size);
+    
+    if (p_row == NULL || p_dst == NULL) {
+        memFree(p_row);
+        arenaFree(p_arena, p_dst);
+        return 1;
+    }
+    
+    putBMPImage(p_desc, p_row, p_dst);
+    
+    *pp_dst    = p_dst;
+    *p_dst_len = file_size;
+    
+    memFree(p_row);
+    return 0;
+}
+
+
+// write the whole image to fp row by row in the order of the file (from down to up), so unlike streamBMPImage(), fp needs no seeking, p_row_buf is as putBMPImage()
+// return:   0 : success    1 : failed
+static int putBMPImageStream (const ImageDesc_t *p_desc, uint8_t *p_row_buf, FILE *fp) {
+    const int      is_rgb      = (p_desc->channels != 1);
+    const uint32_t height      = p_desc->height;
+    const uint32_t width       = p_desc->width;
+    const size_t   row_size    = (size_t)(is_rgb?3:1) * width;
+    const size_t   row_size_a  = ((row_size+3)/4)*4;
+    uint8_t  header [14+40+4*256];
+    uint8_t *p_dst_row, *p;
+    size_t   header_size;
+    uint32_t i;
+    int failed;
+    
+    if ((p_dst_row = (uint8_t*)memMalloc(row_size_a)) == NULL)
+        return 1;
+    
+    header_size = put_bmp_header(header, is_rgb, height, width);
+    
+    failed = (header_size != fwrite(header, sizeof(uint8_t), header_size, fp));
+    
+    for (i=0; !failed && i<height; i++) {
+        const uint8_t *p_row = getImageDescRow(p_desc, height-1-i, p_row_buf);
+        if (is_rgb)
+            swapRB24(p_dst_row, p_row, width);
+        else
+            memcpy(p_dst_row, p_row, row_size);
+        p = p_dst_row + row_size;
+        putLittleEndian(0, (row_size_a-row_size), &p);
+        failed = (row_size_a != fwrite(p_dst_row, sizeof(uint8_t), row_size_a, fp));
+    }
+    
+    memFree(p_dst_row);
     return failed;
 }
 
 
-// return:  NULL     : failed
-//          non-NULL : pointer to image pixels, allocated by malloc(), need to be free() later
-uint8_t* loadBMPImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
-    uint8_t palette_R [256] = {0};
-    uint8_t palette_G [256] = {0};
-    uint8_t palette_B [256] = {0};
-    uint8_t *p_buf;
-    uint32_t bm, offset, dib_size, bpp, cmprs_method, n_palette, bytepp, row_skip, i, j;
-    FILE *fp;
+// return:   0 : success    1 : failed
+// the stream is encoded straight into the output file (see createOutputFile() in platform.h), instead of a heap buffer which is then copied to the file
+int writeBMPImageFile (const char *p_filename, const ImageDesc_t *p_desc) {
+    const int    is_rgb    = (p_desc->channels != 1);
+    const size_t file_size = (size_t)getBMPFileSize(is_rgb, p_desc->height, p_desc->width);
+    OutputFile_t of;
+    uint8_t *p_row;
+    int failed;
     
-    if ((fp = fopen(p_filename, "rb")) == NULL)
-        return NULL;
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc) || checkBMPSize(is_rgb, p_desc->height, p_desc->width))
+        return 1;
+    
+    if ((p_row = (uint8_t*)memMalloc((size_t)(is_rgb?3:1) * p_desc->width)) == NULL)
+        return 1;
+    
+    if (createOutputFile(p_filename, file_size, &of)) {
+        memFree(p_row);
+        return 1;
+    }
+    
+    if (!of.is_mapped) {              // the file can not be mapped, so the rows are written to it, with memory proportional to the width
+        failed = putBMPImageStream(p_desc, p_row, of.fp);
+        failed = closeOutputFile(&of, 0) | failed;
+    } else {
+        putBMPImage(p_desc, p_row, of.p_data);
+        failed = closeOutputFile(&of, file_size);
+    }
+    
+    memFree(p_row);
+    return failed;
+}
+
+
+// return:   0 : success    1 : failed
+int streamBMPImage (ImageRowSource_t *p_rs, FILE *fp) {
+    const int      is_rgb     = p_rs->is_rgb;
+    const uint32_t height     = p_rs->height;
+    const uint32_t width      = p_rs->width;
+    const size_t   row_size   = (size_t)(is_rgb?3:1) * width;
+    const size_t   row_size_a = ((row_size+3)/4)*4;
+    uint8_t  header [14+40+4*256];
+    uint8_t *p_row, *p_dst_row, *p;
+    size_t   header_size;
+    uint32_t i;
+    int failed;
+    
+    if (width < 1 || height < 1 || checkBMPSize(is_rgb, height, width))
+        return 1;
+    
+    p_row     = (uint8_t*)memMalloc(row_size);
+    p_dst_row = (uint8_t*)memMalloc(row_size_a);
+    
+    if (p_row == NULL || p_dst_row == NULL) {
+        memFree(p_row);
+        memFree(p_dst_row);
+        return 1;
+    }
+    
+    header_size = put_bmp_header(header, is_rgb, height, width);
+    
+    failed = (header_size != fwrite(header, sizeof(uint8_t), header_size, fp));
+    
+    // the scan order of BMP is from down to up, so each row is written to its position in the file --------
+    for (i=0; !failed && i<height; i++) {
+        failed = p_rs->p_read_row(p_rs, p_row);
+        if (is_rgb)
+            swapRB24(p_dst_row, p_row, width);
+        else
+            memcpy(p_dst_row, p_row, row_size);
+        p = p_dst_row + row_size;
+        putLittleEndian(0, (row_size_a-row_size), &p);
+        failed |= seekOutputStream(fp, header_size + (uint64_t)(height-1-i) * row_size_a);
+        failed |= (row_size_a != fwrite(p_dst_row, sizeof(uint8_t), row_size_a, fp));
+    }
+    
+    memFree(p_row);
+    memFree(p_dst_row);
+    return failed;
+}
+
+
+typedef struct {
+    const uint8_t *p_src;
+    size_t   src_len;
+    size_t   offset;                    // offset of pixel data
+    uint32_t bytepp;
+    uint32_t i_row;
+    uint8_t  palette_R [256];
+    uint8_t  palette_G [256];
+    uint8_t  palette_B [256];
+} BMPHeader_t;
+
+
+// parse BMP header, and fill p_rs->is_rgb, p_rs->height and p_rs->width
+// return:   0 : success    1 : failed
+static int parse_bmp_header (const uint8_t *p_src, size_t src_len, BMPHeader_t *p_hdr, ImageRowSource_t *p_rs) {
+    uint32_t bm, dib_size, bpp, cmprs_method, n_palette, i;
+    ByteReader_t rd;
+    
+    rd.p     = p_src;
+    rd.p_end = p_src + src_len;
+    
+    for (i=0; i<256; i++)
+        p_hdr->palette_R[i] = p_hdr->palette_G[i] = p_hdr->palette_B[i] = 0;
     
     // BMP file header (14B) ----------------------
-    bm          = loadLittleEndian(2, fp);  // 'BM'
-                  loadLittleEndian(8, fp);  // whole file size + reserved
-    offset      = loadLittleEndian(4, fp);  // offset of pixel data
+    bm          = loadLittleEndian(2, &rd);  // 'BM'
+                  loadLittleEndian(8, &rd);  // whole file size + reserved
+    p_hdr->offset=loadLittleEndian(4, &rd);  // offset of pixel data
     // DIB header ---------------------------------
-    dib_size    = loadLittleEndian(4, fp);  // DIB header size
-    *p_width    = loadLittleEndian(4, fp);  // width
-    *p_height   = loadLittleEndian(4, fp);  // height
-                  loadLittleEndian(2, fp);  // color plane
-    bpp         = loadLittleEndian(2, fp);  // bits per pixel
-    cmprs_method= loadLittleEndian(4, fp);  // compress method
-                  loadLittleEndian(12,fp);  // skip: pixel data size + horizontal resolution + vertical resolution
-    n_palette   = loadLittleEndian(4, fp);  // number of colors in the color palette, or 0 to default to 2^n
-                  loadLittleEndian(4, fp);  // number of important colors used, or 0 when every color is important; generally ignored
-    
-    if (bm!=0x4D42 || offset<54 || dib_size<40 || (*p_width)<1 || (*p_height)<1 || (bpp!=8&&bpp!=24&&bpp!=32) || cmprs_method!=0 || n_palette>256) {
-        fclose(fp);
-        return NULL;
-    }
+    dib_size    = loadLittleEndian(4, &rd);  // DIB header size
+    p_rs->width = loadLittleEndian(4, &rd);  // width
+    p_rs->height= loadLittleEndian(4, &rd);  // height
+                  loadLittleEndian(2, &rd);  // color plane
+    bpp         = loadLittleEndian(2, &rd);  // bits per pixel
+    cmprs_method= loadLittleEndian(4, &rd);  // compress method
+                  loadLittleEndian(12,&rd);  // skip: pixel data size + horizontal resolution + vertical resolution
+    n_palette   = loadLittleEndian(4, &rd);  // number of colors in the color palette, or 0 to default to 2^n
+                  loadLittleEndian(4, &rd);  // number of important colors used, or 0 when every color is important; generally ignored
     
-    bytepp = bpp / 8;
+    if (bm!=0x4D42 || p_hdr->offset<54 || dib_size<40 || p_rs->width<1 || p_rs->height<1 || (bpp!=8&&bpp!=24&&bpp!=32) || cmprs_method!=0 || n_palette>256)
+        return 1;
+    
+    if (p_rs->width > BMP_MAX_SIZE || p_rs->height > BMP_MAX_SIZE)   // the fields are signed, a negative height is a top-down BMP, which is not supported
+        return 1;
     
-    if (bytepp > 1) {
-        *p_is_rgb = 1;
+    p_hdr->bytepp = bpp / 8;
+    
+    if (p_hdr->bytepp > 1) {
+        p_rs->is_rgb = 1;
     } else {
-        *p_is_rgb = 0;
-        loadLittleEndian(dib_size-40, fp); // seek to the start of palette
+        p_rs->is_rgb = 0;
+        loadLittleEndian(dib_size-40, &rd); // seek to the start of palette
         for (i=0; i<n_palette; i++) {      // load palette
-            palette_B[i] = (uint8_t)fgetc(fp);
-            palette_G[i] = (uint8_t)fgetc(fp);
-            palette_R[i] = (uint8_t)fgetc(fp);
-            fgetc(fp);
-            if ( palette_B[i] != palette_G[i] || palette_G[i] != palette_R[i] ) *p_is_rgb = 1;
+            p_hdr->palette_B[i] = (uint8_t)getByte(&rd);
+            p_hdr->palette_G[i] = (uint8_t)getByte(&rd);
+            p_hdr->palette_R[i] = (uint8_t)getByte(&rd);
+            getByte(&rd);
+            if ( p_hdr->palette_B[i] != p_hdr->palette_G[i] || p_hdr->palette_G[i] != p_hdr->palette_R[i] ) p_rs->is_rgb = 1;
         }
     }
     
-    if (fseek(fp, offset, SEEK_SET)) {     // seek to the start of pixel data
-        fclose(fp);
-        return NULL;
+    if (p_hdr->offset > src_len)
+        return 1;
+    
+    p_hdr->p_src   = p_src;
+    p_hdr->src_len = src_len;
+    p_hdr->i_row   = 0;
+    return 0;
+}
+
+
+// load the pixels of a BMP row from *p_rd to p_row
+static void load_bmp_row (const BMPHeader_t *p_hdr, int is_rgb, uint32_t width, ByteReader_t *p_rd, uint8_t *p_row) {
+    uint32_t j;
+    if        (p_hdr->bytepp > 1 && (size_t)(p_rd->p_end - p_rd->p) >= (size_t)p_hdr->bytepp * width) {   // the whole row is in the file
+        if (p_hdr->bytepp == 4)
+            bgrxToRGB(p_row, p_rd->p, width);
+        else
+            swapRB24(p_row, p_rd->p, width);
+        p_rd->p += (size_t)p_hdr->bytepp * width;
+    } else if (p_hdr->bytepp > 1) {             // a truncated row, the missing bytes are read as 0xFF
+        for (j=0; j<width; j++) {
+            p_row[2] = (uint8_t)getByte(p_rd);
+            p_row[1] = (uint8_t)getByte(p_rd);
+            p_row[0] = (uint8_t)getByte(p_rd);
+            p_row += 3;
+            if (p_hdr->bytepp == 4) getByte(p_rd);
+        }
+    } else {
+        for (j=0; j<width; j++) {
+            uint8_t value = (uint8_t)getByte(p_rd);
+            *(p_row++) = p_hdr->palette_R[value];
+            if (is_rgb) {
+                *(p_row++) = p_hdr->palette_G[value];
+                *(p_row++) = p_hdr->palette_B[value];
+            }
+        }
     }
+}
+
+
+// unlike parse_bmp_header(), the pixel data and the end of the palette need not be in p_head
+// return:   0 : success    1 : failed
+int probeBMPHeader (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+    uint32_t bm, dib_size, bpp, n_palette, i;
+    ByteReader_t rd;
     
-    p_buf = (uint8_t*)malloc((size_t)((*p_is_rgb)?3:1) * (*p_width) * (*p_height));  // alloc pixel buffer
+    rd.p     = p_head;
+    rd.p_end = p_head + len;
     
-    if (p_buf == NULL) {
-        fclose(fp);
-        return NULL;
+    bm          = loadLittleEndian(2, &rd);  // 'BM'
+                  loadLittleEndian(12,&rd);  // skip: whole file size + reserved + offset of pixel data
+    dib_size    = loadLittleEndian(4, &rd);  // DIB header size
+    *p_width    = loadLittleEndian(4, &rd);  // width
+    *p_height   = loadLittleEndian(4, &rd);  // height
+                  loadLittleEndian(2, &rd);  // color plane
+    bpp         = loadLittleEndian(2, &rd);  // bits per pixel
+                  loadLittleEndian(16,&rd);  // skip: compress method + pixel data size + horizontal resolution + vertical resolution
+    n_palette   = loadLittleEndian(4, &rd);  // number of colors in the color palette
+                  loadLittleEndian(4, &rd);  // number of important colors used
+    
+    if (len < 54 || bm!=0x4D42 || dib_size<40 || *p_width<1 || *p_height<1 || *p_width>BMP_MAX_SIZE || *p_height>BMP_MAX_SIZE || (bpp!=8&&bpp!=24&&bpp!=32) || n_palette>256)
+        return 1;
+    
+    *p_is_rgb = (bpp > 8);
+    
+    loadLittleEndian(dib_size-40, &rd);     // seek to the start of palette
+    for (i=0; i<n_palette && !(*p_is_rgb); i++) {   // as parse_bmp_header(), a palette which is not gray makes an RGB image, and the palette beyond p_head is assumed not gray
+        int B = getByte(&rd), G = getByte(&rd), R = getByte(&rd);
+        getByte(&rd);
+        *p_is_rgb = (R == EOF || B != G || G != R);
     }
     
-    row_skip = ((bytepp*(*p_width)+3)/4)*4 - bytepp*(*p_width);
+    return 0;
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL)
+uint8_t* decodeBMPImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena) {
+    BMPHeader_t      hdr;
+    ImageRowSource_t info;
+    ByteReader_t     rd;
+    uint8_t *p_buf;
+    size_t   row_skip;
+    uint32_t i;
+    
+    if (parse_bmp_header(p_src, src_len, &hdr, &info))
+        return NULL;
+    
+    rd.p     = p_src + hdr.offset;         // seek to the start of pixel data
+    rd.p_end = p_src + src_len;
+    
+    p_buf = (uint8_t*)arenaAlloc(p_arena, (size_t)(info.is_rgb?3:1) * info.width * info.height);  // alloc pixel buffer
+    
+    if (p_buf == NULL)
+        return NULL;
+    
+    row_skip = (((size_t)hdr.bytepp*info.width+3)/4)*4 - (size_t)hdr.bytepp*info.width;
     
     // load pixel data, note that the scan order of BMP is from down to up, from left to right --------
-    for (i=0; i<(*p_height); i++) {
-        uint8_t *p_row = p_buf + (size_t)((*p_is_rgb)?3:1) * ((*p_height)-1-i) * (*p_width);
-        if        (bytepp > 1) {
-            for (j=0; j<(*p_width); j++) {
-                p_row[2] = (uint8_t)fgetc(fp);
-                p_row[1] = (uint8_t)fgetc(fp);
-                p_row[0] = (uint8_t)fgetc(fp);
-                p_row += 3;
-                if (bytepp == 4) fgetc(fp);
-            }
-        } else {
-            for (j=0; j<(*p_width); j++) {
-                uint8_t value = (uint8_t)fgetc(fp);
-                *(p_row++) = palette_R[value];
-                if (*p_is_rgb) {
-                    *(p_row++) = palette_G[value];
-                    *(p_row++) = palette_B[value];
-                }
-            }
-        }
-        loadLittleEndian(row_skip, fp);
+    for (i=0; i<info.height; i++) {
+        load_bmp_row(&hdr, info.is_rgb, info.width, &rd, p_buf + (size_t)(info.is_rgb?3:1) * (info.height-1-i) * info.width);
+        loadLittleEndian(row_skip, &rd);
+    }
+    
+    describeImage(p_desc, p_buf, info.is_rgb, info.height, info.width);
+    return p_buf;
+}
+
+
+static int bmpReadRow (ImageRowSource_t *p_rs, uint8_t *p_row) {
+    BMPHeader_t *p_hdr    = (BMPHeader_t*)p_rs->p_ctx;
+    size_t       row_size = (((size_t)p_hdr->bytepp*p_rs->width+3)/4)*4;
+    size_t       pos;
+    ByteReader_t rd;
+    
+    if (p_hdr->i_row >= p_rs->height)
+        return 1;
+    
+    pos = p_hdr->offset + row_size * (p_rs->height-1-p_hdr->i_row);     // the rows are stored from down to up, so read them in reverse order from the source
+    
+    rd.p_end = p_hdr->p_src + p_hdr->src_len;
+    rd.p     = (pos < p_hdr->src_len) ? p_hdr->p_src + pos : rd.p_end;   // as decodeBMPImage(), the bytes of a truncated file are read as 0xFF (see load_bmp_row())
+    
+    load_bmp_row(p_hdr, p_rs->is_rgb, p_rs->width, &rd, p_row);
+    
+    p_hdr->i_row ++;
+    return 0;
+}
+
+
+static int bmpRewind (ImageRowSource_t *p_rs) {
+    ((BMPHeader_t*)p_rs->p_ctx)->i_row = 0;
+    return 0;
+}
+
+
+static void bmpClose (ImageRowSource_t *p_rs) {
+    memFree(p_rs->p_ctx);
+    p_rs->p_ctx = NULL;
+}
+
+
+// return:   0 : success    1 : failed
+int openBMPRowSource (const uint8_t *p_src, size_t src_len, ImageRowSource_t *p_rs) {
+    BMPHeader_t *p_hdr = (BMPHeader_t*)memMalloc(sizeof(BMPHeader_t));
+    
+    if (p_hdr == NULL)
+        return 1;
+    
+    if (parse_bmp_header(p_src, src_len, p_hdr, p_rs)) {
+        memFree(p_hdr);
+        return 1;
     }
     
-    fclose(fp);
+    p_rs->p_read_row = bmpReadRow;
+    p_rs->p_rewind   = bmpRewind;
+    p_rs->p_close    = bmpClose;
+    p_rs->p_ctx      = p_hdr;
+    return 0;
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by memMalloc(), need to be memFree() later
+uint8_t* loadBMPImageFile (const char *p_filename, ImageDesc_t *p_desc) {
+    MappedFile_t mf;
+    uint8_t *p_buf;
+    
+    if (mapFile(p_filename, &mf))
+        return NULL;
+    
+    p_buf = decodeBMPImage(mf.p_data, mf.len, p_desc, NULL);
+    
+    unmapFile(&mf);
     return p_buf;
 }
@@ -2,52 +2,117 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
 #include "HEVCe/HEVCe.h"
+#include "console.h"
+#include "platform.h"
 
 
-// return:   0 : success    1 : failed
-int writeHEVCImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width, int qpd6) {
-    FILE *fp;
-    size_t i;
-    int failed = 1;
+#define  HEVC_MAX_SIZE                  16384                                             // max width and height, as MAX_XSZ and MAX_YSZ in HEVCe/HEVCe.c
+#define  HEVC_MAX_PIXELS                35651584                                          // max pixels of the coded (padded to 32x32 CTUs) picture of the highest level 6.2, as MAX_LUMA_PS in HEVCe/HEVCe.c
+#define  HEVC_PAD_SIZE(size)            (((uint64_t)(size)+31)/32*32)
+#define  HEVC_MAX_LENGTH(height,width)  (2*((size_t)(width)+32)*((size_t)(height)+32)+65536)   // max length of the encoded stream
+
+
+// the stream signals the lowest level which allows the picture (see getLevelIdc() in HEVCe/HEVCe.c), a picture beyond every level is still encoded, signalled as level 6.2, with a warning
+// return:   0 : the image can be encoded    1 : too large for the encoder, the error is printed
+static int checkHEVCSize (uint32_t height, uint32_t width) {
+    if (height > HEVC_MAX_SIZE || width > HEVC_MAX_SIZE) {
+        consolePrintf("   ***ERROR: the H.265 encoder supports images up to %dx%d, which %ux%u goes beyond\n", HEVC_MAX_SIZE, HEVC_MAX_SIZE, width, height);
+        return 1;
+    }
+    if (HEVC_PAD_SIZE(height) * HEVC_PAD_SIZE(width) > HEVC_MAX_PIXELS)
+        consolePrintf("   warning: %ux%u goes beyond the %d pixels of the highest H.265 level 6.2, which the stream signals, so a decoder which enforces the level limits may refuse it\n", width, height, HEVC_MAX_PIXELS);
+    return 0;
+}
+
+
+// encode the image to p_hevc, which should have HEVC_MAX_LENGTH() bytes, the size should be checked by checkHEVCSize()
+// return:  length of the encoded stream, 0 if failed
+static size_t putHEVCImage (const ImageDesc_t *p_desc, int qpd6, unsigned char *p_hevc, Arena_t *p_arena) {
+    const uint32_t height   = p_desc->height;
+    const uint32_t width    = p_desc->width;
+    const size_t   img_size = ((size_t)width+32)*((size_t)height+32)+1048576;
+    uint32_t i;
     int h, w, hevc_size;
-    unsigned char *p_hevc = (unsigned char*)malloc(2*(width+32)*(height+32)+65536 + ((width+32)*(height+32)+1048576)*2);
-    unsigned char *p_img_orig = p_hevc           + 2*(width+32)*(height+32)+65536;
-    unsigned char *p_img_rcon = p_img_orig                                        + ((width+32)*(height+32)+1048576);
+    unsigned char *p_img_orig = (unsigned char*)arenaAlloc(p_arena, img_size*2);
+    unsigned char *p_img_rcon = p_img_orig + img_size;
     
-    if (p_hevc == NULL)
-        return 1;
+    if (p_img_orig == NULL)
+        return 0;
     
-    if (is_rgb) {
-        printf("   warning: this HEVCencoder currently only support gray 8-bit image instead of RGB image. Only compress the green channel of this image.\n");
-        
-        for (i=0; i<(size_t)height*width; i++) {
-            p_img_orig[i] = p_buf[i*3+1];
-        }
-        
-    } else {
-        for (i=0; i<(size_t)height*width; i++) {
-            p_img_orig[i] = p_buf[i];
-        }
-    }
+    if (p_desc->channels > 1)
+        consolePrintf("   warning: this HEVCencoder currently only support gray 8-bit image instead of RGB image. Only compress the green channel of this image.\n");
+    
+    for (i=0; i<height; i++)
+        readImageDescRow(p_desc, i, 1, p_img_orig + (size_t)width*i);
     
     h = (int)height;
     w = (int)width;
     hevc_size = HEVCImageEncoder(p_hevc, p_img_orig, p_img_rcon, &h, &w, qpd6);
     
-    if (hevc_size<=0 || h<=0 || w<=0) {
-        free(p_hevc);
+    arenaFree(p_arena, p_img_orig);
+    
+    if (hevc_size<=0 || h<=0 || w<=0)
+        return 0;
+    
+    return (size_t)hevc_size;
+}
+
+
+// return:   0 : success    1 : failed
+int encodeHEVCImage (const ImageDesc_t *p_desc, int qpd6, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    unsigned char *p_hevc;
+    
+    if (checkImageDesc(p_desc) || checkHEVCSize(p_desc->height, p_desc->width))
+        return 1;
+    
+    if ((p_hevc = (unsigned char*)arenaAlloc(p_arena, HEVC_MAX_LENGTH(p_desc->height, p_desc->width))) == NULL)
+        return 1;
+    
+    if ((*p_dst_len = putHEVCImage(p_desc, qpd6, p_hevc, p_arena)) == 0) {
+        arenaFree(p_arena, p_hevc);
         return 1;
     }
     
-    fp = fopen(p_filename, "wb");
+    *pp_dst = p_hevc;
+    return 0;
+}
+
+
+// return:   0 : success    1 : failed
+// the stream is encoded straight into the output file (see createOutputFile() in platform.h), instead of a heap buffer which is then copied to the file
+// H.265 can not be streamed row by row (the encoder takes the whole frame), so if the file can not be mapped, the stream is encoded to a heap buffer of HEVC_MAX_LENGTH() bytes and written then
+int writeHEVCImageFile (const char *p_filename, const ImageDesc_t *p_desc, int qpd6) {
+    const uint32_t height = p_desc->height;
+    const uint32_t width  = p_desc->width;
+    OutputFile_t of;
+    unsigned char *p_hevc;
+    size_t len;
+    
+    if (checkImageDesc(p_desc) || checkHEVCSize(height, width))
+        return 1;
+    
+    if (createOutputFile(p_filename, HEVC_MAX_LENGTH(height, width), &of))
+        return 1;
     
-    if (fp) {
-        failed = ((size_t)hevc_size != fwrite(p_hevc, sizeof(uint8_t), (size_t)hevc_size, fp));
-        fclose(fp);
+    if (of.is_mapped) {
+        len = putHEVCImage(p_desc, qpd6, of.p_data, NULL);
+    } else if ((p_hevc = (unsigned char*)memMalloc(HEVC_MAX_LENGTH(height, width))) != NULL) {
+        len = putHEVCImage(p_desc, qpd6, p_hevc, NULL);
+        if (len != fwrite(p_hevc, sizeof(unsigned char), len, of.fp))
+            len = 0;
+        memFree(p_hevc);
+    } else {
+        len = 0;
     }
     
-    free(p_hevc);
+    if (closeOutputFile(&of, len) || len == 0) {
+        remove(p_filename);           // do not leave an empty file
+        return 1;
+    }
     
-    return failed;
+    return 0;
 }
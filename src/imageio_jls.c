@@ -2,14 +2,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
+#include "console.h"
+#include "platform.h"
+
 
 #define    ABS(x)               ( ((x) < 0) ? (-(x)) : (x) )                         // get absolute value
 #define    MAX(x, y)            ( ((x)<(y)) ? (y) : (x) )                            // get the minimum value of x, y
 #define    MIN(x, y)            ( ((x)<(y)) ? (x) : (y) )                            // get the maximum value of x, y
 #define    CLIP(x, min, max)    ( MIN(MAX((x), (min)), (max)) )                      // clip x between min~max
 
-#define    G2D(ptr,xsz,y,x)     (*( (ptr) + (xsz)*(y) + (x) ))
-
 #define    RESET_VAL            64
 
 static const int J [] = {0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,5,5,6,6,7,7,8,9,10,11,12,13,14,15};
@@ -43,24 +47,25 @@ static int isNear (int near, int v1, int v2) {
 }
 
 
-static void samplePixels (int *img, int xsz, int i, int j, int *a, int *b, int *c, int *d) {
+// row0 : current row , row1 : the row above , row2 : the row above row1
+static void samplePixels (const int *row0, const int *row1, const int *row2, int xsz, int i, int j, int *a, int *b, int *c, int *d) {
     *a = *b = *c = *d = 0;
     
     if (i > 0) {
-        *b = G2D(img, xsz, i-1, j);
+        *b = row1[j];
         *d = *b;
         if (j+1 < xsz)
-            *d = G2D(img, xsz, i-1, j+1);
+            *d = row1[j+1];
     }
     
     if (j <= 0) {
         *a = *b;
         if (i > 1)
-            *c = G2D(img, xsz, i-2, j);
+            *c = row2[j];
     } else {
-        *a = G2D(img, xsz, i, j-1);
+        *a = row0[j-1];
         if (i > 0)
-            *c = G2D(img, xsz, i-1, j-1);
+            *c = row1[j-1];
     }
 }
 
@@ -139,11 +144,20 @@ static BitWriter_t initBitWriter (uint8_t *pbuf) {
 }
 
 
-static int getBitWriterLength (BitWriter_t *pbw) {
+static size_t getBitWriterLength (BitWriter_t *pbw) {
     return pbw->pbuf - pbw->pbuf_base;
 }
 
 
+// write the completed bytes to fp, and restart the buffer
+// return:   0 : success    1 : failed
+static int drainBitWriter (BitWriter_t *pbw, FILE *fp) {
+    size_t len = getBitWriterLength(pbw);
+    pbw->pbuf = pbw->pbuf_base;
+    return (len != fwrite(pbw->pbuf_base, sizeof(uint8_t), len, fp));
+}
+
+
 static void writeValue (BitWriter_t *pbw, int value, int byte_cnt) {
     int i = byte_cnt * 8;
     for (i-=8; i>=0; i-=8) {
@@ -208,14 +222,37 @@ static void writeScanHeader (BitWriter_t *pbw, int compID, int near) {
 }
 
 
+#define  JLS_MAX_SOF_SIZE   65535          // max width and height in the SOF, whose sizes are 16-bit
+#define  JLS_MAX_SIZE       2147483647     // max width and height of the encoder, whose sizes are int
+
+
+static int isOversize (int ysz, int xsz) {
+    return ysz > JLS_MAX_SOF_SIZE || xsz > JLS_MAX_SOF_SIZE;
+}
+
+
+// if the width or height is beyond JLS_MAX_SOF_SIZE, the sizes in the SOF are 0, and the LSE oversize image dimension marker (ID=4, see T.87 C.2.4.1.4) which follows the SOF has them as 32-bit
+static void writeOversizeMarker (BitWriter_t *pbw, int ysz, int xsz) {
+    if (isOversize(ysz, xsz)) {
+        writeValue(pbw, 0xFFF8     , 2);
+        writeValue(pbw, 0x000C     , 2);
+        writeValue(pbw, 0x04       , 1);
+        writeValue(pbw, 0x04       , 1);
+        writeValue(pbw, ysz        , 4);
+        writeValue(pbw, xsz        , 4);
+    }
+}
+
+
 static void writeJLShearderGray (BitWriter_t *pbw, int bpp, int ysz, int xsz) {
     writeValue(pbw, 0xFFD8     , 2);
     writeValue(pbw, 0xFFF7000B , 4);
     writeValue(pbw, bpp        , 1);
-    writeValue(pbw, ysz        , 2);
-    writeValue(pbw, xsz        , 2);
+    writeValue(pbw, isOversize(ysz, xsz) ? 0 : ysz, 2);
+    writeValue(pbw, isOversize(ysz, xsz) ? 0 : xsz, 2);
     writeValue(pbw, 0x01       , 1);
     writeValue(pbw, 0x011100   , 3);
+    writeOversizeMarker(pbw, ysz, xsz);
 }
 
 
@@ -223,12 +260,13 @@ static void writeJLShearderRGB  (BitWriter_t *pbw, int bpp, int ysz, int xsz) {
     writeValue(pbw, 0xFFD8     , 2);
     writeValue(pbw, 0xFFF70011 , 4);
     writeValue(pbw, bpp        , 1);
-    writeValue(pbw, ysz        , 2);
-    writeValue(pbw, xsz        , 2);
+    writeValue(pbw, isOversize(ysz, xsz) ? 0 : ysz, 2);
+    writeValue(pbw, isOversize(ysz, xsz) ? 0 : xsz, 2);
     writeValue(pbw, 0x03       , 1);
     writeValue(pbw, 0x011100   , 3);
     writeValue(pbw, 0x021100   , 3);
     writeValue(pbw, 0x031100   , 3);
+    writeOversizeMarker(pbw, ysz, xsz);
 }
 
 
@@ -237,7 +275,7 @@ static void writeJLSfooter (BitWriter_t *pbw) {
 }
 
 
-static void JLSencodeScan (BitWriter_t *p_bw, int bpp, int near, int ysz, int xsz, int *img, int *imgrcon) {
+typedef struct {
     int A  [364];
     int B  [364];
     int C  [364];
@@ -245,233 +283,367 @@ static void JLSencodeScan (BitWriter_t *p_bw, int bpp, int near, int ysz, int xs
     int Ar [2];
     int Br [2];
     int Nr [2];
-    
     int alpha, t1, t2, t3, quant, qbeta, qbpp, limit, a_init;
-    int run_idx = 0;
-    int i, j;
+    int bpp, near, xsz;
+    int run_idx;
+    int i;                    // index of the next row
+    int *rcon;                // reconstructed pixels of the latest 3 rows (ring buffer), only they are needed for context modeling
+} JLSscan_t;
+
+
+static void JLSinitScan (JLSscan_t *p_scan, int bpp, int near, int xsz, int *rcon) {
+    int i;
+    
+    p_scan->bpp  = bpp = CLIP(bpp, 8, 16);
+    p_scan->near = near;
+    p_scan->xsz  = xsz;
+    p_scan->rcon = rcon;
+    p_scan->run_idx = 0;
+    p_scan->i    = 0;
     
-    bpp = CLIP(bpp, 8, 16);
-    setParameters(bpp, near, &alpha, &t1, &t2, &t3, &quant, &qbeta, &qbpp, &limit, &a_init);
+    setParameters(bpp, near, &p_scan->alpha, &p_scan->t1, &p_scan->t2, &p_scan->t3, &p_scan->quant, &p_scan->qbeta, &p_scan->qbpp, &p_scan->limit, &p_scan->a_init);
     
     for (i=0; i<364; i++) {
-        A[i] = a_init;
-        B[i] = 0;
-        C[i] = 0;
-        N[i] = 1;
+        p_scan->A[i] = p_scan->a_init;
+        p_scan->B[i] = 0;
+        p_scan->C[i] = 0;
+        p_scan->N[i] = 1;
     }
     
     for (i=0; i<2; i++) {
-        Ar[i] = a_init;
-        Br[i] = 0;
-        Nr[i] = 1;
+        p_scan->Ar[i] = p_scan->a_init;
+        p_scan->Br[i] = 0;
+        p_scan->Nr[i] = 1;
     }
+}
+
+
+// encode the next row of a scan
+// p_row : the pixels of this row, where the j-th pixel is p_row[j*step]
+static void JLSencodeRow (JLSscan_t *p_scan, BitWriter_t *p_bw, const uint8_t *p_row, int step) {
+    int *A  = p_scan->A;
+    int *B  = p_scan->B;
+    int *C  = p_scan->C;
+    int *N  = p_scan->N;
+    int *Ar = p_scan->Ar;
+    int *Br = p_scan->Br;
+    int *Nr = p_scan->Nr;
+    
+    const int alpha = p_scan->alpha, t1 = p_scan->t1, t2 = p_scan->t2, t3 = p_scan->t3, quant = p_scan->quant, qbeta = p_scan->qbeta, qbpp = p_scan->qbpp, limit = p_scan->limit;
+    const int near  = p_scan->near;
+    const int xsz   = p_scan->xsz;
+    const int i     = p_scan->i;
+    
+    int *row0 = p_scan->rcon + (size_t)xsz * ( i    % 3);
+    int *row1 = p_scan->rcon + (size_t)xsz * ((i+2) % 3);
+    int *row2 = p_scan->rcon + (size_t)xsz * ((i+1) % 3);
+    
+    int run_idx = p_scan->run_idx;
+    int j;
     
-    for (i=0; i<ysz; i++) {
-        int running=0 , run_cnt=0;
+    int running=0 , run_cnt=0;
+    
+    for (j=0; j<xsz; j++) {
+        int runend = 0;
+        int x, px, rx, a, b, c, d, q, sign, errval, k, map, merrval;
+        
+        x = p_row[(size_t)j*step];
+        samplePixels(row0, row1, row2, xsz, i, j, &a, &b, &c, &d);
+        
+        q = getQ(near, t1, t2, t3, a, b, c, d);
+        
+        sign = (q<0) ? -1 : +1;
+        q = ABS(q);
+        
+        running |= (q == 0);
+        
+        if (running) {
+            running = isNear(near, x, a);
+            runend  = !running;
+        }
         
-        for (j=0; j<xsz; j++) {
-            int runend = 0;
-            int x, px, rx, a, b, c, d, q, sign, errval, k, map, merrval;
+        if (running) {
+            row0[j] = a;
             
-            x = G2D(img, xsz, i, j);
-            samplePixels(imgrcon, xsz, i, j, &a, &b, &c, &d);
+            run_cnt ++;
+            if (run_cnt >= (1<<J[run_idx])) {
+                writeBit(p_bw, 1);
+                run_cnt -= (1<<J[run_idx]);
+                if (run_idx < 31)
+                    run_idx ++;
+            }
+            
+            if (j == xsz-1 && run_cnt > 0)
+                writeBit(p_bw, 1);
+            
+        } else if (runend) {
+            int glimit = limit - 1 - J[run_idx];
             
-            q = getQ(near, t1, t2, t3, a, b, c, d);
+            writeBits(p_bw, run_cnt, J[run_idx]+1);
+            run_cnt = 0;
+            if (run_idx > 0)
+                run_idx --;
             
-            sign = (q<0) ? -1 : +1;
-            q = ABS(q);
+            q = isNear(near, a, b);
+            sign = (a > (b + near)) ? -1 : +1;
             
-            running |= (q == 0);
+            px = q ? a : b;
+            errval = sign * (x - px);
+            errval = quantize(near, quant, errval);
             
-            if (running) {
-                running = isNear(near, x, a);
-                runend  = !running;
+            if (near) {
+                rx = px + sign * quant * errval;
+                rx = CLIP(rx, 0, alpha-1);
+                row0[j] = rx;
+            } else {
+                row0[j] = x;
             }
             
-            if (running) {
-                G2D(imgrcon, xsz, i, j) = a;
-                
-                run_cnt ++;
-                if (run_cnt >= (1<<J[run_idx])) {
-                    writeBit(p_bw, 1);
-                    run_cnt -= (1<<J[run_idx]);
-                    if (run_idx < 31)
-                        run_idx ++;
-                }
-                
-                if (j == xsz-1 && run_cnt > 0)
-                    writeBit(p_bw, 1);
-                
-            } else if (runend) {
-                int glimit = limit - 1 - J[run_idx];
-                
-                writeBits(p_bw, run_cnt, J[run_idx]+1);
-                run_cnt = 0;
-                if (run_idx > 0)
-                    run_idx --;
-                
-                q = isNear(near, a, b);
-                sign = (a > (b + near)) ? -1 : +1;
-                
-                px = q ? a : b;
-                errval = sign * (x - px);
-                errval = quantize(near, quant, errval);
-                
-                if (near) {
-                    rx = px + sign * quant * errval;
-                    rx = CLIP(rx, 0, alpha-1);
-                    G2D(imgrcon, xsz, i, j) = rx;
-                } else {
-                    G2D(imgrcon, xsz, i, j) = x;
-                }
-                
-                errval = modRange(qbeta, errval);
-                k = getK(Ar[q], Nr[q], q);
-                
-                map = (errval!=0) && ( (errval>0) == (k==0 && 2*Br[q]<Nr[q]) );
-                merrval = 2 * ABS(errval) - q - map;
-                
-                GolombCoding(p_bw, qbpp, glimit, merrval, k);
-                
-                if (errval < 0)
-                    Br[q] ++;
-                Ar[q] += ((merrval+1-q) >> 1);
-                if (Nr[q] >= RESET_VAL) {
-                    Ar[q] >>= 1;
-                    Br[q] >>= 1;
-                    Nr[q] >>= 1;
-                }
-                Nr[q] ++;
-                
+            errval = modRange(qbeta, errval);
+            k = getK(Ar[q], Nr[q], q);
+            
+            map = (errval!=0) && ( (errval>0) == (k==0 && 2*Br[q]<Nr[q]) );
+            merrval = 2 * ABS(errval) - q - map;
+            
+            GolombCoding(p_bw, qbpp, glimit, merrval, k);
+            
+            if (errval < 0)
+                Br[q] ++;
+            Ar[q] += ((merrval+1-q) >> 1);
+            if (Nr[q] >= RESET_VAL) {
+                Ar[q] >>= 1;
+                Br[q] >>= 1;
+                Nr[q] >>= 1;
+            }
+            Nr[q] ++;
+            
+        } else {
+            run_cnt = 0;
+            q --;
+            
+            px = predict(a,b,c) + sign * C[q];
+            px = CLIP(px, 0, alpha-1);
+            
+            errval = sign * (x - px);
+            errval = quantize(near, quant, errval);
+            
+            if (near) {
+                rx = px + sign * quant * errval;
+                rx = CLIP(rx, 0, alpha-1);
+                row0[j] = rx;
             } else {
-                run_cnt = 0;
-                q --;
-                
-                px = predict(a,b,c) + sign * C[q];
-                px = CLIP(px, 0, alpha-1);
-                
-                errval = sign * (x - px);
-                errval = quantize(near, quant, errval);
-                
-                if (near) {
-                    rx = px + sign * quant * errval;
-                    rx = CLIP(rx, 0, alpha-1);
-                    G2D(imgrcon, xsz, i, j) = rx;
-                } else {
-                    G2D(imgrcon, xsz, i, j) = x;
-                }
-                
-                errval = modRange(qbeta, errval);
-                k = getK(A[q], N[q], 0);
-                
-                map = (k==0) && (2*B[q]<=-N[q]) && (near==0);
-                merrval = 2 * ABS(errval);
-                if (errval < 0)
-                    merrval -= map + 1;
-                else
-                    merrval += map;
-                
-                GolombCoding(p_bw, qbpp, limit, merrval, k);
-                
-                B[q] += errval * quant;
-                A[q] += ABS(errval);
-                if (N[q] >= RESET_VAL) {
-                    A[q] >>= 1;
-                    B[q] >>= 1;
-                    N[q] >>= 1;
-                }
-                N[q] ++;
-                if (B[q] <= -N[q]) {
-                    B[q] += N[q];
-                    B[q] = MAX(B[q], -N[q]+1);
-                    C[q] --;
-                } else if (B[q] > 0) {
-                    B[q] -= N[q];
-                    B[q] = MIN(B[q], 0);
-                    C[q] ++;
-                }
-                C[q] = CLIP(C[q], -128, 127);
+                row0[j] = x;
+            }
+            
+            errval = modRange(qbeta, errval);
+            k = getK(A[q], N[q], 0);
+            
+            map = (k==0) && (2*B[q]<=-N[q]) && (near==0);
+            merrval = 2 * ABS(errval);
+            if (errval < 0)
+                merrval -= map + 1;
+            else
+                merrval += map;
+            
+            GolombCoding(p_bw, qbpp, limit, merrval, k);
+            
+            B[q] += errval * quant;
+            A[q] += ABS(errval);
+            if (N[q] >= RESET_VAL) {
+                A[q] >>= 1;
+                B[q] >>= 1;
+                N[q] >>= 1;
+            }
+            N[q] ++;
+            if (B[q] <= -N[q]) {
+                B[q] += N[q];
+                B[q] = MAX(B[q], -N[q]+1);
+                C[q] --;
+            } else if (B[q] > 0) {
+                B[q] -= N[q];
+                B[q] = MIN(B[q], 0);
+                C[q] ++;
             }
+            C[q] = CLIP(C[q], -128, 127);
         }
     }
     
-    flushBits(p_bw);
+    p_scan->run_idx = run_idx;
+    p_scan->i ++;
 }
 
 
-static int JLSencodeImageGray (int bpp, int near, int ysz, int xsz, int *img                         , uint8_t *pbuf) {
-    BitWriter_t bw = initBitWriter(pbuf);
-    writeJLShearderGray(&bw, bpp, ysz, xsz);
-    writeScanHeader(&bw, 1, near);
-    JLSencodeScan(&bw, bpp, near, ysz, xsz, img, img);
-    writeJLSfooter(&bw);
-    return getBitWriterLength(&bw);
+// encode a whole scan of one component from an image in memory, where the component of pixel (i,j) is p_buf[i*stride+j*step]
+static void JLSencodeScan (BitWriter_t *p_bw, int bpp, int near, int ysz, int xsz, const uint8_t *p_buf, size_t stride, int step, int *rcon) {
+    JLSscan_t scan;
+    int i;
+    JLSinitScan(&scan, bpp, near, xsz, rcon);
+    for (i=0; i<ysz; i++)
+        JLSencodeRow(&scan, p_bw, p_buf + (size_t)i*stride, step);
+    flushBits(p_bw);
 }
 
 
-static int JLSencodeImageRGB (int bpp, int near, int ysz, int xsz, int *img_r, int *img_g, int *img_b, uint8_t *pbuf) {
+// the components are read in place from the samples of *p_desc, in either layout, the 8-bit sample of a 16-bit one is its high byte, which is read at its address in the native byte order
+static size_t JLSencodeImage (int bpp, int near, const ImageDesc_t *p_desc, int *rcon, uint8_t *pbuf) {
+    static const uint16_t one = 1;
+    const int      ysz    = (int)p_desc->height;
+    const int      xsz    = (int)p_desc->width;
+    const int      sample = p_desc->depth / 8;
+    const int      step   = (p_desc->layout == IMAGE_PLANAR) ? sample : sample * p_desc->channels;
+    const size_t   plane  = (p_desc->layout == IMAGE_PLANAR) ? p_desc->plane_stride : (size_t)sample;
+    const uint8_t *p_data = p_desc->p_data + ((sample == 2 && *(const uint8_t*)&one == 1) ? 1 : 0);   // the high byte is the second one in little-endian
     BitWriter_t bw = initBitWriter(pbuf);
-    writeJLShearderRGB(&bw, bpp, ysz, xsz);
-    writeScanHeader(&bw, 1, near);
-    JLSencodeScan(&bw, bpp, near, ysz, xsz, img_r, img_r);
-    writeScanHeader(&bw, 2, near);
-    JLSencodeScan(&bw, bpp, near, ysz, xsz, img_g, img_g);
-    writeScanHeader(&bw, 3, near);
-    JLSencodeScan(&bw, bpp, near, ysz, xsz, img_b, img_b);
+    if (p_desc->channels > 1) {
+        writeJLShearderRGB(&bw, bpp, ysz, xsz);
+        writeScanHeader(&bw, 1, near);
+        JLSencodeScan(&bw, bpp, near, ysz, xsz, p_data        , p_desc->stride, step, rcon);
+        writeScanHeader(&bw, 2, near);
+        JLSencodeScan(&bw, bpp, near, ysz, xsz, p_data+plane  , p_desc->stride, step, rcon);
+        writeScanHeader(&bw, 3, near);
+        JLSencodeScan(&bw, bpp, near, ysz, xsz, p_data+2*plane, p_desc->stride, step, rcon);
+    } else {
+        writeJLShearderGray(&bw, bpp, ysz, xsz);
+        writeScanHeader(&bw, 1, near);
+        JLSencodeScan(&bw, bpp, near, ysz, xsz, p_data        , p_desc->stride, step, rcon);
+    }
     writeJLSfooter(&bw);
     return getBitWriterLength(&bw);
 }
 
 
 
+#define  JLS_MAX_LENGTH(height,width)  ((size_t)8*(width)*(height)+65536)   // max length of the encoded stream
+
+
+// return:   0 : the image can be encoded    1 : empty or too large, the error is printed
+static int checkJLSSize (uint32_t height, uint32_t width) {
+    if (height < 1 || width < 1 || height > JLS_MAX_SIZE || width > JLS_MAX_SIZE) {
+        consolePrintf("   ***ERROR: the JPEG-LS encoder supports widths and heights of 1 to %d, which %ux%u goes beyond\n", JLS_MAX_SIZE, width, height);
+        return 1;
+    }
+    return 0;
+}
+
+
 // return:   0 : success    1 : failed
-int writeJLSImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width, int near) {
-    int *p_r, *p_g, *p_b;
+int encodeJLSImage (const ImageDesc_t *p_desc, int near, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    const uint32_t height = p_desc->height;
+    const uint32_t width  = p_desc->width;
     uint8_t *p_jls;
-    size_t jls_len;
-    int failed = 1;
-    uint32_t i;
-    FILE *fp;
+    int     *p_rcon;
     
-    if (width<1 || width>32767 || height<1 || height>32767)
+    if (checkJLSSize(height, width) || checkImageDesc(p_desc))
         return 1;
     
-    p_jls = (uint8_t*)malloc( (size_t)8*width*height+65536 + (size_t)(is_rgb?3:1)*height*width*sizeof(int) );
-    p_r   = (int*)(p_jls + (size_t)8*width*height+65536);
-    p_g   = p_r + ((size_t)height * width);
-    p_b   = p_g + ((size_t)height * width);
+    p_jls  = (uint8_t*)arenaAlloc(p_arena, JLS_MAX_LENGTH(height, width) );
+    p_rcon = (int*)arenaAlloc(p_arena, (size_t)3*width*sizeof(int) );
     
-    if (p_jls == NULL)
+    if (p_jls == NULL || p_rcon == NULL) {
+        arenaFree(p_arena, p_jls);
+        arenaFree(p_arena, p_rcon);
         return 1;
+    }
     
-    if (is_rgb) {
-        int *pr = p_r, *pg = p_g, *pb = p_b;
-        for (i=(height*width); i>0; i--) {
-            *(pr++) = *(p_buf++);
-            *(pg++) = *(p_buf++);
-            *(pb++) = *(p_buf++);
-        }
-    } else {
-        int *pr = p_r;
-        for (i=(height*width); i>0; i--) {
-            *(pr++) = *(p_buf++);
+    *p_dst_len = JLSencodeImage(8, near, p_desc, p_rcon, p_jls);
+    *pp_dst    = p_jls;
+    
+    arenaFree(p_arena, p_rcon);
+    return 0;
+}
+
+
+// return:   0 : success    1 : failed
+// the stream is encoded straight into the output file (see createOutputFile() in platform.h), instead of a heap buffer which is then copied to the file
+int writeJLSImageFile (const char *p_filename, const ImageDesc_t *p_desc, int near) {
+    const uint32_t height = p_desc->height;
+    const uint32_t width  = p_desc->width;
+    OutputFile_t of;
+    ImageRowSource_t rs;
+    int *p_rcon;
+    int failed;
+    
+    if (checkJLSSize(height, width) || checkImageDesc(p_desc))
+        return 1;
+    
+    if (createOutputFile(p_filename, JLS_MAX_LENGTH(height, width), &of))
+        return 1;
+    
+    if (!of.is_mapped) {
+        failed = openImageDescRowSource(p_desc, 0, &rs);   // the file can not be mapped, so the rows are streamed to it, with memory proportional to the width
+        if (!failed) {
+            failed = streamJLSImage(&rs, of.fp, near);
+            rs.p_close(&rs);
         }
+        return closeOutputFile(&of, 0) | failed;
     }
     
-    if (is_rgb) {
-        jls_len = JLSencodeImageRGB (8, near, height, width, p_r, p_g, p_b, p_jls);
-    } else {
-        jls_len = JLSencodeImageGray(8, near, height, width, p_r,           p_jls);
+    if ((p_rcon = (int*)memMalloc( (size_t)3*width*sizeof(int) )) == NULL) {
+        closeOutputFile(&of, 0);
+        return 1;
     }
     
-    fp = fopen(p_filename, "wb");
+    failed = closeOutputFile(&of, JLSencodeImage(8, near, p_desc, p_rcon, of.p_data));
+    
+    memFree(p_rcon);
+    return failed;
+}
+
+
+// return:   0 : success    1 : failed
+// for RGB image, the components are encoded as 3 scans (not interleaved), so the source is rewound and read 3 times
+int streamJLSImage (ImageRowSource_t *p_rs, FILE *fp, int near) {
+    const int    xsz    = (int)p_rs->width;
+    const int    ysz    = (int)p_rs->height;
+    const int    n_comp = p_rs->is_rgb ? 3 : 1;
+    uint8_t     *p_row, *p_out;
+    int         *p_rcon;
+    BitWriter_t  bw;
+    JLSscan_t    scan;
+    int i, comp, failed = 0;
+    
+    if (checkJLSSize(p_rs->height, p_rs->width))
+        return 1;
     
-    if (fp) {
-        failed = (jls_len != fwrite(p_jls, sizeof(uint8_t), jls_len, fp));
-        fclose(fp);
+    p_row  = (uint8_t*)memMalloc( (size_t)n_comp*xsz );
+    p_out  = (uint8_t*)memMalloc( (size_t)8*xsz+1024 );            // enough for the bits of a row
+    p_rcon = (int*)memMalloc( (size_t)3*xsz*sizeof(int) );
+    
+    if (p_row == NULL || p_out == NULL || p_rcon == NULL) {
+        memFree(p_row);
+        memFree(p_out);
+        memFree(p_rcon);
+        return 1;
+    }
+    
+    bw = initBitWriter(p_out);
+    
+    if (p_rs->is_rgb)
+        writeJLShearderRGB (&bw, 8, ysz, xsz);
+    else
+        writeJLShearderGray(&bw, 8, ysz, xsz);
+    
+    for (comp=0; !failed && comp<n_comp; comp++) {
+        if (comp > 0)
+            failed |= p_rs->p_rewind(p_rs);
+        
+        writeScanHeader(&bw, comp+1, near);
+        JLSinitScan(&scan, 8, near, xsz, p_rcon);
+        
+        for (i=0; !failed && i<ysz; i++) {
+            failed |= p_rs->p_read_row(p_rs, p_row);
+            JLSencodeRow(&scan, &bw, p_row+comp, n_comp);
+            failed |= drainBitWriter(&bw, fp);
+        }
+        
+        flushBits(&bw);
     }
     
-    free(p_jls);
+    writeJLSfooter(&bw);
+    failed |= drainBitWriter(&bw, fp);
     
+    memFree(p_row);
+    memFree(p_out);
+    memFree(p_rcon);
     return failed;
 }
@@ -1,116 +1,323 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
+#include "platform.h"
+#include "console.h"
+#include "cpu.h"
+#include "kernels.h"
 
 
-static void write_png_chunk (char *p_name, uint8_t *p_data, uint32_t len, FILE *fp) {
-    const static uint32_t crc_table[] = {0, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c };
-    uint32_t i, crc=0xFFFFFFFF;
-    fputc(((len>>24) & 0xFF), fp);
-    fputc(((len>>16) & 0xFF), fp);
-    fputc(((len>> 8) & 0xFF), fp);
-    fputc(((len    ) & 0xFF), fp);
-    fwrite(p_name, sizeof(uint8_t),   4, fp);
-    if (len > 0)
-        fwrite(p_data, sizeof(uint8_t), len, fp);
-    for (i=0; i<4; i++) {
-        crc ^= p_name[i];
-        crc = (crc >> 4) ^ crc_table[crc & 15];
-        crc = (crc >> 4) ^ crc_table[crc & 15];
+
+static uint8_t* put_big_endian32 (uint8_t *p, uint32_t value) {
+    *p++ = ((value>>24) & 0xFF);
+    *p++ = ((value>>16) & 0xFF);
+    *p++ = ((value>> 8) & 0xFF);
+    *p++ = ((value    ) & 0xFF);
+    return p;
+}
+
+
+// put a PNG chunk to p, the chunk data (len bytes) should already be at p+8
+// return: pointer to the end of the chunk
+static uint8_t* put_png_chunk (uint8_t *p, const char *p_name, uint32_t len) {
+    uint32_t i;
+    p = put_big_endian32(p, len);
+    for (i=0; i<4; i++)
+        p[i] = p_name[i];
+    p = put_big_endian32(p+4+len, ~crc32Update(0xFFFFFFFF, p, 4+len));
+    return p;
+}
+
+
+// put 8-bit PNG magic and IHDR chunk to p_dst (33 bytes)
+// return: pointer to the end of IHDR chunk
+static uint8_t* put_png_header (uint8_t *p_dst, int is_rgb, uint32_t height, uint32_t width) {
+    uint8_t *p;
+    
+    memcpy(p_dst, "\x89PNG\r\n\32\n", 8);               // 8-bit PNG magic
+    
+    p = p_dst + 8 + 8;                                  // IHDR data
+    p = put_big_endian32(p, width);
+    p = put_big_endian32(p, height);
+    *p++ = 8;                                           // bit depth
+    *p++ = (is_rgb ? 2 : 0);                            // color type
+    *p++ = 0;                                           // compression method
+    *p++ = 0;                                           // filter method
+    *p++ = 0;                                           // interlace method
+    return put_png_chunk(p_dst + 8, "IHDR", 13);
+}
+
+
+
+#define  PNG_MAX_CHUNK  0x7FFFFFFF                 // max length of a chunk, so the zlib stream of a large image is split to several IDAT chunks
+
+
+// the zlib stream of stored deflate blocks, which is put to the IDAT chunks row by row
+typedef struct {
+    uint64_t raw_len;                                   // length of the raw (filtered) data
+    uint64_t n_blk;                                     // number of deflate blocks
+    uint64_t i;                                         // position in the raw data
+    uint64_t left;                                      // bytes of the zlib stream not put yet
+    uint32_t chunk_left;                                // bytes of the current IDAT chunk not put yet
+    uint32_t crc;                                       // CRC of the current IDAT chunk
+    uint32_t adler;
+} PNGStream_t;
+
+
+static void initPNGStream (PNGStream_t *p_ps, int is_rgb, uint32_t height, uint32_t width) {
+    p_ps->raw_len    = ((uint64_t)(is_rgb?3:1) * width + 1) * height;
+    p_ps->n_blk      = (p_ps->raw_len + 0xFFFE) / 0xFFFF;
+    p_ps->i          = 0;
+    p_ps->left       = 2 + 5*p_ps->n_blk + p_ps->raw_len + 4;
+    p_ps->chunk_left = 0;
+    p_ps->crc        = 0;
+    p_ps->adler      = 1;
+}
+
+
+// return: max length of the bytes put by putPNGStream() for n bytes of the zlib stream, including the chunk headers and CRCs
+static size_t getPNGStreamMaxLength (uint64_t n) {
+    return (size_t)(n + 12 * (n / PNG_MAX_CHUNK + 2));
+}
+
+
+// put n bytes of the zlib stream to p, the IDAT chunks are closed (CRC) and opened (length and name) on the way
+// return: pointer to the end of the put bytes
+static uint8_t* putPNGStream (PNGStream_t *p_ps, uint8_t *p, const uint8_t *p_src, size_t n) {
+    while (n > 0) {
+        size_t m;
+        if (p_ps->chunk_left == 0) {
+            p_ps->chunk_left = (p_ps->left < PNG_MAX_CHUNK) ? (uint32_t)p_ps->left : PNG_MAX_CHUNK;
+            p = put_big_endian32(p, p_ps->chunk_left);
+            memcpy(p, "IDAT", 4);
+            p_ps->crc = crc32Update(0xFFFFFFFF, p, 4);
+            p += 4;
+        }
+        m = (n < p_ps->chunk_left) ? n : p_ps->chunk_left;
+        memcpy(p, p_src, m);
+        p_ps->crc = crc32Update(p_ps->crc, p, m);
+        p_ps->chunk_left -= (uint32_t)m;
+        p_ps->left       -= m;
+        p     += m;
+        p_src += m;
+        n     -= m;
+        if (p_ps->chunk_left == 0)
+            p = put_big_endian32(p, ~p_ps->crc);
     }
-    for (i=0; i<len; i++) {
-        crc ^= p_data[i];
-        crc = (crc >> 4) ^ crc_table[crc & 15];
-        crc = (crc >> 4) ^ crc_table[crc & 15];
+    return p;
+}
+
+
+// put a row of pixels (row_size bytes) with its filter byte to the zlib stream, which is copied in runs split at the deflate block starts
+// return: pointer to the end of the put bytes
+static uint8_t* putPNGRow (PNGStream_t *p_ps, uint8_t *p, const uint8_t *p_pix, size_t row_size) {
+    static const uint8_t filter = 0;                    // filter at each start of line
+    const size_t w = row_size + 1;
+    size_t j, n;
+    
+    for (j=0; j<w; j+=n, p_ps->i+=n) {
+        if (p_ps->i%0xFFFF == 0) {                      // deflate block start (5bytes)
+            const int      is_last = (p_ps->i/0xFFFF+1 >= p_ps->n_blk);
+            const uint32_t blk_len = is_last ? (uint32_t)(p_ps->raw_len - p_ps->i) : 0xFFFF;
+            uint8_t blk [5];
+            blk[0] = is_last ? 1 : 0;
+            blk[1] = (  blk_len    ) & 0xFF;
+            blk[2] = (  blk_len >>8) & 0xFF;
+            blk[3] = ((~blk_len)   ) & 0xFF;
+            blk[4] = ((~blk_len)>>8) & 0xFF;
+            p = putPNGStream(p_ps, p, blk, 5);
+        }
+        n = 0xFFFF - (size_t)(p_ps->i%0xFFFF);
+        if (n > w-j)
+            n = w-j;
+        if (j == 0) {
+            p = putPNGStream(p_ps, p, &filter, 1);
+            p = putPNGStream(p_ps, p, p_pix, n-1);
+            p_ps->adler = adler32Update(p_ps->adler, &filter, 1);
+            p_ps->adler = adler32Update(p_ps->adler, p_pix, n-1);
+            p_pix += n-1;
+        } else {
+            p = putPNGStream(p_ps, p, p_pix, n);
+            p_ps->adler = adler32Update(p_ps->adler, p_pix, n);
+            p_pix += n;
+        }
     }
-    crc = ~crc;
-    fputc(((crc>>24) & 0xFF), fp);
-    fputc(((crc>>16) & 0xFF), fp);
-    fputc(((crc>> 8) & 0xFF), fp);
-    fputc(((crc    ) & 0xFF), fp);
+    return p;
 }
 
 
+// return: max length of the encoded stream
+static size_t getPNGMaxLength (int is_rgb, uint32_t height, uint32_t width) {
+    PNGStream_t ps;
+    initPNGStream(&ps, is_rgb, height, width);
+    return 8 + 25 + getPNGStreamMaxLength(ps.left) + 12;
+}
+
+
+// encode the whole image to p_dst, which should have getPNGMaxLength() bytes, p_row is a row for the rows which are converted (see getImageDescRow())
+// return: length of the encoded stream
+static size_t putPNGImage (const ImageDesc_t *p_desc, uint8_t *p_row, uint8_t *p_dst) {
+    static const uint8_t zlib_header [] = {0x78, 0x01};
+    const int    is_rgb   = (p_desc->channels != 1);
+    const size_t row_size = (size_t)(is_rgb?3:1) * p_desc->width;
+    PNGStream_t ps;
+    uint8_t adler [4];
+    uint32_t y;
+    uint8_t *p;
+    
+    initPNGStream(&ps, is_rgb, p_desc->height, p_desc->width);
+    
+    p = put_png_header(p_dst, is_rgb, p_desc->height, p_desc->width);
+    p = putPNGStream(&ps, p, zlib_header, 2);
+    
+    for (y=0; y<p_desc->height; y++)
+        p = putPNGRow(&ps, p, getImageDescRow(p_desc, y, p_row), row_size);
+    
+    put_big_endian32(adler, ps.adler);
+    p = putPNGStream(&ps, p, adler, 4);
+    
+    p = put_png_chunk(p, "IEND", 0);
+    
+    return (size_t)(p - p_dst);
+}
+
 
 // return:   0 : success    1 : failed
-int writePNGImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width) {
-    size_t   w = (is_rgb?3:1)*width + 1;
-    uint32_t adler_a=1, adler_b=0;
-    size_t   i;
-    uint8_t *p_dst, *p, *p_last_blk;
-    FILE    *fp;
-    
-    if (width < 1 || height < 1)
-        return 1;
+int encodePNGImage (const ImageDesc_t *p_desc, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    const int is_rgb = (p_desc->channels != 1);
+    uint8_t *p_row, *p_dst;
     
-    p_dst = p = p_last_blk = (uint8_t*)malloc((w+6)*height + 65536);
-    if (p_dst == NULL)
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc))
         return 1;
     
-    if ((fp = fopen(p_filename, "wb")) == NULL) {
-        free(p_dst);
+    p_row = (uint8_t*)memMalloc((size_t)(is_rgb?3:1) * p_desc->width);
+    p_dst = (uint8_t*)arenaAlloc(p_arena, getPNGMaxLength(is_rgb, p_desc->height, p_desc->width));
+    
+    if (p_row == NULL || p_dst == NULL) {
+        memFree(p_row);
+        arenaFree(p_arena, p_dst);
         return 1;
     }
     
-    fwrite("\x89PNG\r\n\32\n", sizeof(char), 8, fp);    // 8-bit PNG magic
-    
-    sprintf((char*)p_dst, "%c%c%c%c%c%c%c%c\x08%c%c%c%c", 
-        (uint8_t)( width>>24), (uint8_t)( width>>16), (uint8_t)( width>>8), (uint8_t)( width),
-        (uint8_t)(height>>24), (uint8_t)(height>>16), (uint8_t)(height>>8), (uint8_t)(height),
-        (is_rgb ? 2 : 0),
-        0, 0, 0
-    );
-    write_png_chunk("IHDR", p_dst, 13, fp);
-    
-    *p++ = 0x78;
-    *p++ = 0x01;
-    for (i=0; i<(w*height); i++) {
-        if (i%0xFFFF == 0) {
-            *p++ = 0;         // deflate block start (5bytes)
-            *p++ = 0xFF;
-            *p++ = 0xFF;
-            *p++ = 0x00;
-            *p++ = 0x00;
-            p_last_blk = p;
-        }
-        if (i%w == 0) {
-            *p = 0;           // filter at each start of line
-        } else {
-            *p = *(p_buf++);  // pixel byte
+    *pp_dst    = p_dst;
+    *p_dst_len = putPNGImage(p_desc, p_row, p_dst);
+    
+    memFree(p_row);
+    return 0;
+}
+
+
+// return:   0 : success    1 : failed
+// the stream is encoded straight into the output file (see createOutputFile() in platform.h), instead of a heap buffer which is then copied to the file
+int writePNGImageFile (const char *p_filename, const ImageDesc_t *p_desc) {
+    const int is_rgb = (p_desc->channels != 1);
+    OutputFile_t of;
+    ImageRowSource_t rs;
+    uint8_t *p_row;
+    int failed;
+    
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc))
+        return 1;
+    
+    if (createOutputFile(p_filename, getPNGMaxLength(is_rgb, p_desc->height, p_desc->width), &of))
+        return 1;
+    
+    if (of.is_mapped) {
+        if ((p_row = (uint8_t*)memMalloc((size_t)(is_rgb?3:1) * p_desc->width)) == NULL) {
+            closeOutputFile(&of, 0);
+            return 1;
         }
-        adler_a = (adler_a + *p)      % 65521;
-        adler_b = (adler_b + adler_a) % 65521;
-        p ++;
+        failed = closeOutputFile(&of, putPNGImage(p_desc, p_row, of.p_data));
+        memFree(p_row);
+        return failed;
     }
-    adler_a |= (adler_b << 16);
-    adler_b  = (p - p_last_blk);        // length of the last deflate block
-    p_last_blk[-5] = 1;
-    p_last_blk[-4] = (  adler_b    ) & 0xFF;
-    p_last_blk[-3] = (  adler_b >>8) & 0xFF;
-    p_last_blk[-2] = ((~adler_b)   ) & 0xFF;
-    p_last_blk[-1] = ((~adler_b)>>8) & 0xFF;
-    *p++ = (adler_a>>24) & 0xFF;
-    *p++ = (adler_a>>16) & 0xFF;
-    *p++ = (adler_a>> 8) & 0xFF;
-    *p++ = (adler_a    ) & 0xFF;
-    write_png_chunk("IDAT", p_dst, (size_t)(p-p_dst), fp);
-    
-    write_png_chunk("IEND", p_dst, 0, fp);
-    
-    free(p_dst);
-    fclose(fp);
-    return 0;
+    
+    failed = openImageDescRowSource(p_desc, 0, &rs);   // the file can not be mapped, so the rows are streamed to it, with memory proportional to the width
+    if (!failed) {
+        failed = streamPNGImage(&rs, of.fp);
+        rs.p_close(&rs);
+    }
+    
+    return closeOutputFile(&of, 0) | failed;
+}
+
+
+
+// the output is the same as encodePNGImage(), the IDAT lengths are known in advance, so the zlib stream (stored deflate blocks) is written row by row while the CRC and Adler-32 are accumulated
+// return:   0 : success    1 : failed
+int streamPNGImage (ImageRowSource_t *p_rs, FILE *fp) {
+    static const uint8_t zlib_header [] = {0x78, 0x01};
+    const size_t row_size = (size_t)(p_rs->is_rgb?3:1) * p_rs->width;
+    const size_t out_size = getPNGStreamMaxLength(row_size + 1 + 5*((row_size+1)/0xFFFF+2)) + 64;   // a row with its deflate block starts, or the header or the end
+    PNGStream_t ps;
+    uint8_t  adler [4];
+    uint32_t y;
+    size_t   len;
+    uint8_t *p_row, *p_out, *p;
+    int failed;
+    
+    if (p_rs->width < 1 || p_rs->height < 1)
+        return 1;
+    
+    p_row = (uint8_t*)memMalloc(row_size);
+    p_out = (uint8_t*)memMalloc(out_size);
+    
+    if (p_row == NULL || p_out == NULL) {
+        memFree(p_row);
+        memFree(p_out);
+        return 1;
+    }
+    
+    initPNGStream(&ps, p_rs->is_rgb, p_rs->height, p_rs->width);
+    
+    p = put_png_header(p_out, p_rs->is_rgb, p_rs->height, p_rs->width);
+    p = putPNGStream(&ps, p, zlib_header, 2);
+    len = p - p_out;
+    
+    failed = (len != fwrite(p_out, sizeof(uint8_t), len, fp));
+    
+    for (y=0; !failed && y<p_rs->height; y++) {
+        failed = p_rs->p_read_row(p_rs, p_row);
+        p = putPNGRow(&ps, p_out, p_row, row_size);
+        len = p - p_out;
+        failed |= (len != fwrite(p_out, sizeof(uint8_t), len, fp));
+    }
+    
+    put_big_endian32(adler, ps.adler);
+    p = putPNGStream(&ps, p_out, adler, 4);
+    p = put_png_chunk(p, "IEND", 0);
+    len = p - p_out;
+    
+    failed |= (len != fwrite(p_out, sizeof(uint8_t), len, fp));
+    
+    memFree(p_row);
+    memFree(p_out);
+    return failed;
 }
 
 
+// return:   0 : success    1 : failed
+int probePNGHeader (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+    if (len < 26 || memcmp(p_head+12, "IHDR", 4) != 0)
+        return 1;
+    *p_width  = ((uint32_t)p_head[16]<<24) | ((uint32_t)p_head[17]<<16) | ((uint32_t)p_head[18]<<8) | p_head[19];
+    *p_height = ((uint32_t)p_head[20]<<24) | ((uint32_t)p_head[21]<<16) | ((uint32_t)p_head[22]<<8) | p_head[23];
+    *p_is_rgb = (p_head[25] != 0 && p_head[25] != 4);   // color type 0 and 4 are gray (with alpha), the others are RGB (with alpha, or a palette)
+    return (*p_width < 1 || *p_height < 1);
+}
+
 
 #include "uPNG/uPNG.h"
 
 
 // return:  NULL     : failed
-//          non-NULL : pointer to image pixels, allocated by malloc(), need to be free() later
-uint8_t* loadPNGImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+//          non-NULL : pointer to image pixels, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL)
+uint8_t* decodePNGImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena) {
     upng_t     *p_upng;
     upng_error  err;
     upng_format png_format;
@@ -130,10 +337,12 @@ uint8_t* loadPNGImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_he
         (const char*)"LUMA_ALPHA8"
     };
     size_t img_size;
+    uint32_t height, width;
+    int is_rgb;
     uint8_t *p_dst_base, *p_dst;
-    const uint8_t *p_src;
+    const uint8_t *p_pix;
     
-    p_upng = upng_new_from_file(p_filename);
+    p_upng = upng_new_from_bytes(p_src, src_len);
     
     if (p_upng == NULL)
         return NULL;
@@ -142,7 +351,7 @@ uint8_t* loadPNGImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_he
     
     if (err != UPNG_EOK) {
         if (err==UPNG_EUNSUPPORTED || err==UPNG_EUNINTERLACED || err==UPNG_EUNFORMAT)
-            printf("   ***ERROR: this PNG format is not-yet supported, error code = %d\n", err);
+            consolePrintf("   ***ERROR: this PNG format is not-yet supported, error code = %d\n", err);
         upng_free(p_upng);
         return NULL;
     }
@@ -150,39 +359,47 @@ uint8_t* loadPNGImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_he
     png_format = upng_get_format(p_upng);
     
     if (png_format != UPNG_RGBA8 && png_format != UPNG_RGB8 && png_format != UPNG_LUMINANCE8) {
-        printf("   ***ERROR: only support LUMA8, RGB8, and RGBA8. But this PNG is %s\n", upng_format_names[png_format]);
+        consolePrintf("   ***ERROR: only support LUMA8, RGB8, and RGBA8. But this PNG is %s\n", upng_format_names[png_format]);
         upng_free(p_upng);
         return NULL;
     }
     
-    *p_is_rgb = (png_format != UPNG_LUMINANCE8);
-    *p_height = upng_get_height(p_upng);
-    *p_width  = upng_get_width(p_upng);
+    is_rgb = (png_format != UPNG_LUMINANCE8);
+    height = upng_get_height(p_upng);
+    width  = upng_get_width(p_upng);
     
-    img_size = (size_t)((*p_is_rgb)?3:1) * (*p_height) * (*p_width);
+    img_size = (size_t)(is_rgb?3:1) * height * width;
     
-    p_dst_base = p_dst = (uint8_t*)malloc(img_size);
+    p_dst_base = p_dst = (uint8_t*)arenaAlloc(p_arena, img_size);
     
     if (p_dst_base) {
-        size_t i;
-        p_src = upng_get_buffer(p_upng);
+        p_pix = upng_get_buffer(p_upng);
         if (png_format == UPNG_RGBA8) {
-            printf("   *warning: disard alpha channel of this PNG\n");
-            for (i=(size_t)(*p_height)*(*p_width); i>0; i--) {
-                p_dst[0] = p_src[0];
-                p_dst[1] = p_src[1];
-                p_dst[2] = p_src[2];
-                p_dst += 3;
-                p_src += 4;
-            }
+            consolePrintf("   *warning: disard alpha channel of this PNG\n");
+            rgbxToRGB(p_dst, p_pix, (size_t)height*width);
         } else {
-            for (i=img_size; i>0; i--) {
-                *(p_dst++) = *(p_src++);
-            }
+            memcpy(p_dst, p_pix, img_size);
         }
     }
     
     upng_free(p_upng);
     
+    describeImage(p_desc, p_dst_base, is_rgb, height, width);
     return p_dst_base;
 }
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by memMalloc(), need to be memFree() later
+uint8_t* loadPNGImageFile (const char *p_filename, ImageDesc_t *p_desc) {
+    MappedFile_t mf;
+    uint8_t *p_buf;
+    
+    if (mapFile(p_filename, &mf))
+        return NULL;
+    
+    p_buf = decodePNGImage(mf.p_data, mf.len, p_desc, NULL);
+    
+    unmapFile(&mf);
+    return p_buf;
+}
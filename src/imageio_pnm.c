@@ -1,45 +1,139 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
+#include "platform.h"
+#include "cpu.h"
+#include "kernels.h"
+
+
+// write PNM header to p_dst (which should have at least 32 bytes)
+// return: header length
+static size_t put_pnm_header (char *p_dst, int is_rgb, uint32_t height, uint32_t width) {
+    return (size_t)sprintf(p_dst, "P%c\n%u %u\n255\n", (is_rgb?'6':'5'), width, height);
+}
 
 
 // return:   0 : success    1 : failed
 // support:
 //    - raw PGM (start with 'P5')
 //    - raw PPM (start with 'P6')
-int writePNMImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width) {
-    size_t len;
+int encodePNMImage (const ImageDesc_t *p_desc, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    const int    is_rgb   = (p_desc->channels != 1);
+    const size_t row_size = (size_t)(is_rgb?3:1) * p_desc->width;
+    char   header [64];
+    size_t header_len, len, i;
+    uint32_t y;
+    uint8_t *p_dst;
+    
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc))
+        return 1;
+    
+    header_len = put_pnm_header(header, is_rgb, p_desc->height, p_desc->width);
+    
+    len = row_size * p_desc->height;
+    
+    if ((p_dst = (uint8_t*)arenaAlloc(p_arena, header_len + len)) == NULL)
+        return 1;
+    
+    for (i=0; i<header_len; i++)
+        p_dst[i] = (uint8_t)header[i];
+    
+    for (y=0; y<p_desc->height; y++)   // the rows are converted straight to their place in the output
+        readImageDescRow(p_desc, y, -1, p_dst + header_len + row_size*y);
+    
+    *pp_dst    = p_dst;
+    *p_dst_len = header_len + len;
+    return 0;
+}
+
+
+// return:   0 : success    1 : failed
+// support:
+//    - raw PGM (start with 'P5')
+//    - raw PPM (start with 'P6')
+int writePNMImageFile (const char *p_filename, const ImageDesc_t *p_desc) {
+    const int    is_rgb   = (p_desc->channels != 1);
+    const size_t row_size = (size_t)(is_rgb?3:1) * p_desc->width;
+    char   header [64];
+    size_t header_len;
+    uint8_t *p_row;
+    uint32_t y;
     int failed;
     FILE *fp;
     
-    if (width < 1 || height < 1)
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc))
+        return 1;
+    
+    if ((p_row = (uint8_t*)memMalloc(row_size)) == NULL)
         return 1;
     
-    if ((fp = fopen(p_filename, "wb")) == NULL)
+    if ((fp = openOutputStream(p_filename)) == NULL) {
+        memFree(p_row);
         return 1;
+    }
+    
+    header_len = put_pnm_header(header, is_rgb, p_desc->height, p_desc->width);   // 8-bit gray or RGB rows are already in PNM raw layout, so write them directly instead of encoding to a copy
     
-    fprintf(fp, "P%c\n%d %d\n255\n", (is_rgb?'6':'5'), width, height);
+    failed = (header_len != fwrite(header, sizeof(char), header_len, fp));
     
-    len = (size_t)(is_rgb?3:1) * width * height;
+    for (y=0; !failed && y<p_desc->height; y++)
+        failed = (row_size != fwrite(getImageDescRow(p_desc, y, p_row), sizeof(uint8_t), row_size, fp));
     
-    failed = (len != fwrite(p_buf, sizeof(uint8_t), len, fp));
+    failed |= closeOutputStream(fp);
     
-    fclose(fp);
+    memFree(p_row);
     return failed;
 }
 
 
 
+// return:   0 : success    1 : failed
+int streamPNMImage (ImageRowSource_t *p_rs, FILE *fp) {
+    const size_t row_size = (size_t)(p_rs->is_rgb?3:1) * p_rs->width;
+    char     header [64];
+    size_t   header_len;
+    uint8_t *p_row;
+    uint32_t i;
+    int failed;
+    
+    if (p_rs->width < 1 || p_rs->height < 1)
+        return 1;
+    
+    if ((p_row = (uint8_t*)memMalloc(row_size)) == NULL)
+        return 1;
+    
+    header_len = put_pnm_header(header, p_rs->is_rgb, p_rs->height, p_rs->width);
+    
+    failed = (header_len != fwrite(header, sizeof(char), header_len, fp));
+    
+    for (i=0; !failed && i<p_rs->height; i++) {
+        failed  = p_rs->p_read_row(p_rs, p_row);
+        failed |= (row_size != fwrite(p_row, sizeof(uint8_t), row_size, fp));
+    }
+    
+    memFree(p_row);
+    return failed;
+}
+
+
 // get next number (regard # as comment)
-static int fget_next_number (FILE *fp, int *p_num) {
+// return: the character after the number (which is also consumed), or EOF
+static int get_next_number (const uint8_t **pp, const uint8_t *p_end, int *p_num) {
+    #define  NEXT_CHAR  ((*pp < p_end) ? (int)*((*pp)++) : EOF)
     *p_num = -1;
     for (;;) {
-        int ch = fgetc(fp);
+        int ch = NEXT_CHAR;
         if (ch == EOF) {
             return ch;
         } else if (ch == '#') {
             for (;;) {
-                ch = fgetc(fp);
+                ch = NEXT_CHAR;
                 if (ch == EOF) {
                     return ch;
                 }
@@ -50,9 +144,13 @@ static int fget_next_number (FILE *fp, int *p_num) {
         } else if (ch >= '0' && ch <= '9') {
             *p_num = 0;
             while (ch >= '0' && ch <= '9') {
-                (*p_num) *= 10;
-                (*p_num) += (ch - '0');
-                ch = fgetc(fp);
+                if (*p_num < (INT_MAX - 9) / 10) {     // a number too large for int saturates instead of wrapping around to a small or negative one
+                    (*p_num) *= 10;
+                    (*p_num) += (ch - '0');
+                } else {
+                    *p_num = INT_MAX;
+                }
+                ch = NEXT_CHAR;
             }
             return ch;
         }
@@ -61,88 +159,331 @@ static int fget_next_number (FILE *fp, int *p_num) {
 
 
 
-// return:  NULL     : failed
-//          non-NULL : pointer to image pixels, allocated by malloc(), need to be free() later
-// support:
-//    - plain PBM (start with 'P1')
-//    - plain PGM (start with 'P2')
-//    - plain PPM (start with 'P3')
-//    - raw   PBM (start with 'P4')
-//    - raw   PGM (start with 'P5')
-//    - raw   PPM (start with 'P6')
-uint8_t* loadPNMImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+// parse n values of plain PBM, PGM or PPM to p_dst, the short numbers are parsed by parsePlainNumbers() (see kernels.h) and
+// get_next_number() takes the rest (comments, long numbers and the end of the file)
+// return:   0 : success    1 : failed
+static int get_plain_values (const uint8_t **pp, const uint8_t *p_end, uint8_t *p_dst, size_t n, int T) {
+    size_t i = 0, used;
+    int    num;
+    while (i < n) {
+        i  += parsePlainNumbers(p_dst+i, n-i, *pp, (size_t)(p_end - *pp), (T==1), &used);
+        *pp += used;
+        if (i < n) {
+            get_next_number(pp, p_end, &num);
+            if (num < 0)
+                return 1;
+            p_dst[i++] = (T!=1) ? num : (num ? 0 : 255);
+        }
+    }
+    return 0;
+}
+
+
+
+// parse PNM header
+// return:   0 : success    1 : failed
+//           when success, *p_T is the type number (1~6), and *pp is the start of pixel data
+static int parse_pnm_header (const uint8_t *p_src, size_t src_len, const uint8_t **pp, int *p_T, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+    const uint8_t *p     = p_src + 2;
+    const uint8_t *p_end = p_src + src_len;
     int      ch, P, T, W, H, maxval=1;
-    size_t   i, j, len;
-    uint8_t *p_buf;
-    FILE *fp;
     
-    if ((fp = fopen(p_filename, "rb")) == NULL)
-        return NULL;
+    if (src_len < 2)
+        return 1;
     
-    P  = fgetc(fp);
-    T  = fgetc(fp) - (int)'0';
-    ch = fget_next_number(fp, &W);
-    ch = fget_next_number(fp, &H);
+    P  = p_src[0];
+    T  = p_src[1] - (int)'0';
+    ch = get_next_number(&p, p_end, &W);
+    ch = get_next_number(&p, p_end, &H);
     
     if (T==2 || T==3 || T==5 || T==6) { // PGM or PPM
-        ch = fget_next_number(fp, &maxval);
+        ch = get_next_number(&p, p_end, &maxval);
     }
     
-    if (P!='P' || T<1 || T>6 || W<1 || H<1 || maxval<1 || maxval>255) {
-        fclose(fp);
-        return NULL;
-    }
+    if (P!='P' || T<1 || T>6 || W<1 || H<1 || maxval<1 || maxval>255)
+        return 1;
     
     while (ch!='\n' && ch!=EOF) {
-        ch = fgetc(fp);
+        ch = (p < p_end) ? *(p++) : EOF;
     }
     
+    *pp       = p;
+    *p_T      = T;
     *p_width  = W;
     *p_height = H;
     *p_is_rgb = (T==3 || T==6);         // PPM
+    return 0;
+}
+
+
+
+// return:   0 : success    1 : failed
+int probePNMHeader (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+    const uint8_t *p;
+    int T;
+    return parse_pnm_header(p_head, len, &p, &T, p_is_rgb, p_height, p_width);
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL)
+// support:
+//    - plain PBM (start with 'P1')
+//    - plain PGM (start with 'P2')
+//    - plain PPM (start with 'P3')
+//    - raw   PBM (start with 'P4')
+//    - raw   PGM (start with 'P5')
+//    - raw   PPM (start with 'P6')
+uint8_t* decodePNMImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena) {
+    const uint8_t *p;
+    const uint8_t *p_end = p_src + src_len;
+    int      ch, T, W, H, is_rgb;
+    uint32_t height, width;
+    size_t   i, j, len;
+    uint8_t *p_buf;
+    
+    if (parse_pnm_header(p_src, src_len, &p, &T, &is_rgb, &height, &width))
+        return NULL;
     
-    len = (size_t)((*p_is_rgb) ? 3 : 1) * W * H;
+    W = (int)width;
+    H = (int)height;
     
-    p_buf = (uint8_t*)malloc(len + 8);
+    len = (size_t)(is_rgb ? 3 : 1) * W * H;
+    
+    p_buf = (uint8_t*)arenaAlloc(p_arena, len + 8);
     
     if (p_buf) {
         int failed = 0;
         
         if (T==5 || T==6) {             // raw PGM or PPM
-            failed = (len != fread(p_buf, sizeof(uint8_t), len, fp));
+            failed = ((size_t)(p_end - p) < len);
+            for (i=0; !failed && i<len; i++)
+                p_buf[i] = p[i];
             
         } else if (T == 4) {            // raw PBM
-            uint8_t *p = p_buf;
+            uint8_t *p_row = p_buf;
             for     (i=0; i<(size_t)H; i++) {
                 for (j=0; j<(size_t)W; j+=8) {
-                    ch = fgetc(fp);
+                    ch = (p < p_end) ? *(p++) : EOF;
                     failed = failed || (ch == EOF);
-                    p[j  ] = ((ch>>7) & 1) ? 0 : 255;
-                    p[j+1] = ((ch>>6) & 1) ? 0 : 255;
-                    p[j+2] = ((ch>>5) & 1) ? 0 : 255;
-                    p[j+3] = ((ch>>4) & 1) ? 0 : 255;
-                    p[j+4] = ((ch>>3) & 1) ? 0 : 255;
-                    p[j+5] = ((ch>>2) & 1) ? 0 : 255;
-                    p[j+6] = ((ch>>1) & 1) ? 0 : 255;
-                    p[j+7] = ( ch     & 1) ? 0 : 255;
+                    p_row[j  ] = ((ch>>7) & 1) ? 0 : 255;
+                    p_row[j+1] = ((ch>>6) & 1) ? 0 : 255;
+                    p_row[j+2] = ((ch>>5) & 1) ? 0 : 255;
+                    p_row[j+3] = ((ch>>4) & 1) ? 0 : 255;
+                    p_row[j+4] = ((ch>>3) & 1) ? 0 : 255;
+                    p_row[j+5] = ((ch>>2) & 1) ? 0 : 255;
+                    p_row[j+6] = ((ch>>1) & 1) ? 0 : 255;
+                    p_row[j+7] = ( ch     & 1) ? 0 : 255;
                 }
-                p += W;
+                p_row += W;
             }
             
         } else {                        // plain PBM, PGM or PPM
-            for (i=0; i<len; i++) {
-                fget_next_number(fp, &ch);
-                failed = failed || (ch < 0);
-                p_buf[i] = (T!=1) ? ch : (ch ? 0 : 255);
-            }
+            failed = get_plain_values(&p, p_end, p_buf, len, T);
         }
         
         if (failed) {
-            free(p_buf);
+            arenaFree(p_arena, p_buf);
             p_buf = NULL;
         }
     }
     
-    fclose(fp);
+    describeImage(p_desc, p_buf, is_rgb, height, width);
     return p_buf;
 }
+
+
+typedef struct {
+    const uint8_t *p_pix;               // start of pixel data
+    const uint8_t *p;                   // current read position
+    const uint8_t *p_end;
+    int            T;
+} PNMRowSource_t;
+
+
+static int pnmReadRow (ImageRowSource_t *p_rs, uint8_t *p_row) {
+    PNMRowSource_t *p_ctx = (PNMRowSource_t*)p_rs->p_ctx;
+    const size_t    len   = (size_t)(p_rs->is_rgb?3:1) * p_rs->width;
+    size_t i;
+    
+    if (p_ctx->T==5 || p_ctx->T==6) {   // raw PGM or PPM
+        if ((size_t)(p_ctx->p_end - p_ctx->p) < len)
+            return 1;
+        memcpy(p_row, p_ctx->p, len);
+        p_ctx->p += len;
+        
+    } else if (p_ctx->T == 4) {         // raw PBM, each row starts at a byte boundary
+        if ((size_t)(p_ctx->p_end - p_ctx->p) < (len+7)/8)
+            return 1;
+        for (i=0; i<len; i++)
+            p_row[i] = ((p_ctx->p[i/8] >> (7-i%8)) & 1) ? 0 : 255;
+        p_ctx->p += (len+7)/8;
+        
+    } else {                            // plain PBM, PGM or PPM
+        return get_plain_values(&p_ctx->p, p_ctx->p_end, p_row, len, p_ctx->T);
+    }
+    
+    return 0;
+}
+
+
+static int pnmRewind (ImageRowSource_t *p_rs) {
+    PNMRowSource_t *p_ctx = (PNMRowSource_t*)p_rs->p_ctx;
+    p_ctx->p = p_ctx->p_pix;
+    return 0;
+}
+
+
+static void pnmClose (ImageRowSource_t *p_rs) {
+    memFree(p_rs->p_ctx);
+    p_rs->p_ctx = NULL;
+}
+
+
+// return:   0 : success    1 : failed
+int openPNMRowSource (const uint8_t *p_src, size_t src_len, ImageRowSource_t *p_rs) {
+    PNMRowSource_t *p_ctx;
+    const uint8_t  *p;
+    int T;
+    
+    if (parse_pnm_header(p_src, src_len, &p, &T, &p_rs->is_rgb, &p_rs->height, &p_rs->width))
+        return 1;
+    
+    if ((p_ctx = (PNMRowSource_t*)memMalloc(sizeof(PNMRowSource_t))) == NULL)
+        return 1;
+    
+    p_ctx->p_pix = p_ctx->p = p;
+    p_ctx->p_end = p_src + src_len;
+    p_ctx->T     = T;
+    
+    p_rs->p_read_row = pnmReadRow;
+    p_rs->p_rewind   = pnmRewind;
+    p_rs->p_close    = pnmClose;
+    p_rs->p_ctx      = p_ctx;
+    return 0;
+}
+
+
+typedef struct {
+    FILE          *fp;
+    const uint8_t *p_left;              // the bytes after the header in the head, which are read before fp
+    size_t         n_left;
+    int            T;
+    uint8_t       *p_bits;              // a row of raw PBM
+} PNMFileRowSource_t;
+
+
+// read n bytes, first from the rest of the head, then from fp
+// return:   0 : success    1 : failed (the end of the file)
+static int pnmFileRead (PNMFileRowSource_t *p_ctx, uint8_t *p_dst, size_t n) {
+    size_t n_head = (n < p_ctx->n_left) ? n : p_ctx->n_left;
+    memcpy(p_dst, p_ctx->p_left, n_head);
+    p_ctx->p_left += n_head;
+    p_ctx->n_left -= n_head;
+    return (n - n_head != fread(p_dst + n_head, sizeof(uint8_t), n - n_head, p_ctx->fp));
+}
+
+
+static int pnmFileReadRow (ImageRowSource_t *p_rs, uint8_t *p_row) {
+    PNMFileRowSource_t *p_ctx = (PNMFileRowSource_t*)p_rs->p_ctx;
+    const size_t        len   = (size_t)(p_rs->is_rgb?3:1) * p_rs->width;
+    size_t i;
+    
+    if (p_ctx->T != 4)                  // raw PGM or PPM
+        return pnmFileRead(p_ctx, p_row, len);
+    
+    if (pnmFileRead(p_ctx, p_ctx->p_bits, (len+7)/8))   // raw PBM, each row starts at a byte boundary
+        return 1;
+    for (i=0; i<len; i++)
+        p_row[i] = ((p_ctx->p_bits[i/8] >> (7-i%8)) & 1) ? 0 : 255;
+    return 0;
+}
+
+
+static int pnmFileRewind (ImageRowSource_t *p_rs) {
+    (void)p_rs;
+    return 1;                           // the rows already read from fp are not kept
+}
+
+
+static void pnmFileClose (ImageRowSource_t *p_rs) {
+    memFree(p_rs->p_ctx);
+    p_rs->p_ctx = NULL;
+}
+
+
+// return:   0 : success    1 : failed
+int openPNMFileRowSource (FILE *fp, const uint8_t *p_head, size_t head_len, ImageRowSource_t *p_rs, uint64_t *p_file_len) {
+    PNMFileRowSource_t *p_ctx;
+    const uint8_t      *p;
+    size_t n_left, n_bits;
+    int T;
+    
+    if (parse_pnm_header(p_head, head_len, &p, &T, &p_rs->is_rgb, &p_rs->height, &p_rs->width))
+        return 1;
+    
+    if ((T!=4 && T!=5 && T!=6) || p >= p_head + head_len)   // not raw, or the header may go on beyond the head (a pixel byte must follow it)
+        return 1;
+    
+    n_left = (size_t)(p_head + head_len - p);
+    n_bits = (T == 4) ? ((size_t)p_rs->width+7)/8 : 0;
+    
+    *p_file_len = (uint64_t)(p - p_head) + (uint64_t)p_rs->height * ((T == 4) ? n_bits : (uint64_t)(p_rs->is_rgb?3:1) * p_rs->width);
+    
+    if ((p_ctx = (PNMFileRowSource_t*)memMalloc(sizeof(PNMFileRowSource_t) + n_left + n_bits)) == NULL)
+        return 1;
+    
+    memcpy((uint8_t*)(p_ctx+1), p, n_left);
+    p_ctx->fp     = fp;
+    p_ctx->p_left = (const uint8_t*)(p_ctx+1);
+    p_ctx->n_left = n_left;
+    p_ctx->T      = T;
+    p_ctx->p_bits = (uint8_t*)(p_ctx+1) + n_left;
+    
+    p_rs->p_read_row = pnmFileReadRow;
+    p_rs->p_rewind   = pnmFileRewind;
+    p_rs->p_close    = pnmFileClose;
+    p_rs->p_ctx      = p_ctx;
+    return 0;
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by memMalloc(), need to be memFree() later
+uint8_t* loadPNMImageFile (const char *p_filename, ImageDesc_t *p_desc) {
+    MappedFile_t mf;
+    uint8_t *p_buf;
+    
+    if (mapFile(p_filename, &mf))
+        return NULL;
+    
+    p_buf = decodePNMImage(mf.p_data, mf.len, p_desc, NULL);
+    
+    unmapFile(&mf);
+    return p_buf;
+}
+
+
+
+// return:  NULL     : not a raw PGM/PPM (or the pixel data is incomplete)
+//          non-NULL : pointer to image pixels inside p_src, which are already in the same layout as decodePNMImage() returns, so no copy is needed
+// support:
+//    - raw   PGM (start with 'P5')
+//    - raw   PPM (start with 'P6')
+const uint8_t* viewPNMImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc) {
+    const uint8_t *p;
+    uint32_t height, width;
+    int T, is_rgb;
+    
+    if (parse_pnm_header(p_src, src_len, &p, &T, &is_rgb, &height, &width))
+        return NULL;
+    
+    if (T != 5 && T != 6)
+        return NULL;
+    
+    if ((size_t)(p_src + src_len - p) < (size_t)(is_rgb ? 3 : 1) * width * height)
+        return NULL;
+    
+    describeImage(p_desc, p, is_rgb, height, width);
+    return p;
+}
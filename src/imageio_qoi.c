@@ -2,195 +2,329 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "imageio.h"
+#include "memstat.h"
+#include "platform.h"
 
-// return:   0 : success    1 : failed
-int writeQOIImageFile (const char *p_filename, const uint8_t *p_buf, int is_rgb, uint32_t height, uint32_t width) {
-    uint8_t *p_qoi_start, *p_qoi;
-    FILE *fp;
-    
-    if (width < 1 || height < 1)
-        return 1;
-    
-    p_qoi_start = p_qoi = (uint8_t*)malloc( (size_t)(5) * width * height + 65536 );
-    
-    if (p_qoi_start == NULL)
-        return 1;
-    
-    if ((fp = fopen(p_filename, "wb")) == NULL) {
-        free(p_qoi_start);
-        return 1;
-    }
+
+// state of QOI encoder, kept between rows when streaming
+typedef struct {
+    uint8_t run;
+    uint8_t pr, pg, pb, pa;
+    uint8_t ar[64], ag[64], ab[64], aa[64];
+} QOIEncoder_t;
+
+
+static void initQOIEncoder (QOIEncoder_t *p_enc) {
+    int i;
+    p_enc->run = 0;
+    p_enc->pr  = p_enc->pg = p_enc->pb = 0;
+    p_enc->pa  = 255;
+    for (i=0; i<64; i++)
+        p_enc->ar[i] = p_enc->ag[i] = p_enc->ab[i] = p_enc->aa[i] = 0;
+}
+
+
+// write qoi header (14 bytes) to p_qoi
+// return: pointer to the end of header
+static uint8_t* putQOIHeader (uint8_t *p_qoi, uint32_t height, uint32_t width) {
+    *(p_qoi++) = 'q';
+    *(p_qoi++) = 'o';
+    *(p_qoi++) = 'i';
+    *(p_qoi++) = 'f';
+    *(p_qoi++) = (width >>24)&0xff;
+    *(p_qoi++) = (width >>16)&0xff;
+    *(p_qoi++) = (width >> 8)&0xff;
+    *(p_qoi++) = (width     )&0xff;
+    *(p_qoi++) = (height>>24)&0xff;
+    *(p_qoi++) = (height>>16)&0xff;
+    *(p_qoi++) = (height>> 8)&0xff;
+    *(p_qoi++) = (height    )&0xff;
+    *(p_qoi++) = 0x03;                  // channels = RGB
+    *(p_qoi++) = 0x00;                  // colorspace
+    return p_qoi;
+}
+
+
+// encode n_pixel pixels from p_buf to p_qoi, which should have at least 5*n_pixel bytes. A pending run is kept in *p_enc, so call finishQOIEncoder() at the end of image
+// return: pointer to the end of encoded bytes
+static uint8_t* encodeQOIPixels (QOIEncoder_t *p_enc, const uint8_t *p_buf, int is_rgb, size_t n_pixel, uint8_t *p_qoi) {
+    uint8_t idx, run = p_enc->run;
+    uint8_t pr = p_enc->pr, pg = p_enc->pg, pb = p_enc->pb, pa = p_enc->pa;       // work on local copies, so that the compiler can keep them in registers
+    uint8_t cr  , cg  , cb  , ca;
+    uint8_t dr  , dg  , db      ;
+    uint8_t *ar = p_enc->ar, *ag = p_enc->ag, *ab = p_enc->ab, *aa = p_enc->aa;
+    size_t i;
     
-    // encode qoi ------------------
-    {   uint8_t idx, run=0;
-        uint8_t pr=0, pg=0, pb=0, pa=255;
-        uint8_t cr  , cg  , cb  , ca;
-        uint8_t dr  , dg  , db      ;
-        uint8_t ar[64]={0}, ag[64]={0}, ab[64]={0}, aa[64]={0};
-        size_t i;
+    for (i=n_pixel; i>0; i--) {
+        cr = cg = cb = *(p_buf++);
+        if (is_rgb) {
+            cg = *(p_buf++);
+            cb = *(p_buf++);
+        }
+        ca = 255;
+        
+        idx = (3*cr + 5*cg + 7*cb + 11*ca) & 0x3f;
         
-        for (i=(size_t)width*height; i>0; i--) {
-            cr = cg = cb = *(p_buf++);
-            if (is_rgb) {
-                cg = *(p_buf++);
-                cb = *(p_buf++);
+        if (cr==pr && cg==pg && cb==pb && ca==pa) {
+            run ++;
+            if (run >= 62) {
+                *(p_qoi++) = (0xc0 | (run-1));                    // QOI_OP_RUN
+                run = 0;
             }
-            ca = 255;
             
-            idx = (3*cr + 5*cg + 7*cb + 11*ca) & 0x3f;
+        } else {
+            if (run > 0) {
+                *(p_qoi++) = (0xc0 | (run-1));                    // QOI_OP_RUN
+                run = 0;
+            }
+            
+            if (cr == ar[idx] && cg == ag[idx] && cb == ab[idx] && ca == aa[idx]) {
+                *(p_qoi++) = idx;                                 // QOI_OP_INDEX
             
-            if (cr==pr && cg==pg && cb==pb && ca==pa) {
-                run ++;
-                if (run >= 62) {
-                    *(p_qoi++) = (0xc0 | (run-1));                    // QOI_OP_RUN
-                    run = 0;
-                }
-                
             } else {
-                if (run > 0) {
-                    *(p_qoi++) = (0xc0 | (run-1));                    // QOI_OP_RUN
-                    run = 0;
-                }
-                
-                if (cr == ar[idx] && cg == ag[idx] && cb == ab[idx] && ca == aa[idx]) {
-                    *(p_qoi++) = idx;                                 // QOI_OP_INDEX
+                dr = cr - pr + 2;
+                dg = cg - pg + 2;
+                db = cb - pb + 2;
                 
+                if (dr<4 && dg<4 && db<4 && ca==pa) {
+                    *(p_qoi++) = (0x40 | (dr<<4) | (dg<<2) | db); // QOI_OP_DIFF
+                    
                 } else {
-                    dr = cr - pr + 2;
-                    dg = cg - pg + 2;
-                    db = cb - pb + 2;
+                    dr = dr - dg + 8;
+                    db = db - dg + 8;
+                    dg += 30;
                     
-                    if (dr<4 && dg<4 && db<4 && ca==pa) {
-                        *(p_qoi++) = (0x40 | (dr<<4) | (dg<<2) | db); // QOI_OP_DIFF
+                    if (dr<16 && dg<64 && db<16 && ca==pa) {
+                        *(p_qoi++) = (   0x80 | dg);              // QOI_OP_LUMA
+                        *(p_qoi++) = ((dr<<4) | db);
                         
                     } else {
-                        dr = dr - dg + 8;
-                        db = db - dg + 8;
-                        dg += 30;
-                        
-                        if (dr<16 && dg<64 && db<16 && ca==pa) {
-                            *(p_qoi++) = (   0x80 | dg);              // QOI_OP_LUMA
-                            *(p_qoi++) = ((dr<<4) | db);
-                            
-                        } else {
-                            *(p_qoi++) = ((ca!=pa)?0xff:0xfe);        // QOI_OP_RGB or QOI_OP_RGBA
-                            *(p_qoi++) = cr;
-                            *(p_qoi++) = cg;
-                            *(p_qoi++) = cb;
-                            if (ca != pa)
-                                *(p_qoi++) = ca;
-                        }
+                        *(p_qoi++) = ((ca!=pa)?0xff:0xfe);        // QOI_OP_RGB or QOI_OP_RGBA
+                        *(p_qoi++) = cr;
+                        *(p_qoi++) = cg;
+                        *(p_qoi++) = cb;
+                        if (ca != pa)
+                            *(p_qoi++) = ca;
                     }
                 }
             }
-            
-            ar[idx] = pr = cr;
-            ag[idx] = pg = cg;
-            ab[idx] = pb = cb;
-            aa[idx] = pa = ca;
         }
         
-        if (run > 0) *(p_qoi++) = (0xc0 | (run-1));                   // QOI_OP_RUN
+        ar[idx] = pr = cr;
+        ag[idx] = pg = cg;
+        ab[idx] = pb = cb;
+        aa[idx] = pa = ca;
     }
     
-    fprintf(fp, "qoif%c%c%c%c%c%c%c%c\x03%c",  // write qoi header
-        (width >>24)&0xff,
-        (width >>16)&0xff,
-        (width >> 8)&0xff,
-        (width     )&0xff,
-        (height>>24)&0xff,
-        (height>>16)&0xff,
-        (height>> 8)&0xff,
-        (height    )&0xff,
-        0x00
-    );
-    
-    {
-        size_t qoi_size = p_qoi - p_qoi_start;
-        int failed = (qoi_size!= fwrite(p_qoi_start, sizeof(uint8_t), qoi_size, fp));
-        
-        free(p_qoi_start);
-        fclose(fp);
-        
-        return failed;
+    p_enc->run = run;
+    p_enc->pr  = pr;
+    p_enc->pg  = pg;
+    p_enc->pb  = pb;
+    p_enc->pa  = pa;
+    return p_qoi;
+}
+
+
+// return: pointer to the end of encoded bytes
+static uint8_t* finishQOIEncoder (QOIEncoder_t *p_enc, uint8_t *p_qoi) {
+    if (p_enc->run > 0) *(p_qoi++) = (0xc0 | (p_enc->run-1));        // QOI_OP_RUN
+    p_enc->run = 0;
+    return p_qoi;
+}
+
+
+// return: max length of the encoded stream
+static size_t getQOIMaxLength (uint32_t height, uint32_t width) {
+    return (size_t)(5) * width * height + 65536;
+}
+
+
+// encode the whole image to p_qoi_start, which should have getQOIMaxLength() bytes, p_row is a row for the rows which are converted (see getImageDescRow())
+// return: length of the encoded stream
+static size_t putQOIImage (const ImageDesc_t *p_desc, uint8_t *p_row, uint8_t *p_qoi_start) {
+    QOIEncoder_t enc;
+    uint8_t *p_qoi;
+    uint32_t y;
+    
+    p_qoi = putQOIHeader(p_qoi_start, p_desc->height, p_desc->width);
+    
+    initQOIEncoder(&enc);
+    for (y=0; y<p_desc->height; y++)   // a run goes on across the rows, since the state is kept in enc
+        p_qoi = encodeQOIPixels(&enc, getImageDescRow(p_desc, y, p_row), (p_desc->channels != 1), p_desc->width, p_qoi);
+    p_qoi = finishQOIEncoder(&enc, p_qoi);
+    
+    return p_qoi - p_qoi_start;
+}
+
+
+// return:   0 : success    1 : failed
+int encodeQOIImage (const ImageDesc_t *p_desc, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    uint8_t *p_row, *p_qoi;
+    
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc))
+        return 1;
+    
+    p_row = (uint8_t*)memMalloc((size_t)(3) * p_desc->width);
+    p_qoi = (uint8_t*)arenaAlloc(p_arena, getQOIMaxLength(p_desc->height, p_desc->width));
+    
+    if (p_row == NULL || p_qoi == NULL) {
+        memFree(p_row);
+        arenaFree(p_arena, p_qoi);
+        return 1;
     }
+    
+    *pp_dst    = p_qoi;
+    *p_dst_len = putQOIImage(p_desc, p_row, p_qoi);
+    
+    memFree(p_row);
+    return 0;
 }
 
 
-// return:  NULL     : failed
-//          non-NULL : pointer to image pixels, allocated by malloc(), need to be free() later
-uint8_t* loadQOIImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
-    uint8_t               *p_qoi, *p_qoi_end;
-    uint8_t *p_buf_start, *p_buf, *p_buf_end;
-    uint8_t ch;
-    FILE *fp;
+// return:   0 : success    1 : failed
+int streamQOIImage (ImageRowSource_t *p_rs, FILE *fp) {
+    const size_t row_size = (size_t)(p_rs->is_rgb?3:1) * p_rs->width;
+    QOIEncoder_t enc;
+    uint8_t *p_row, *p_qoi_start, *p_qoi;
+    uint32_t i;
+    int failed;
     
-    if ((fp = fopen(p_filename, "rb")) == NULL)
-        return NULL;
+    if (p_rs->width < 1 || p_rs->height < 1)
+        return 1;
     
-    // parse qoi header -----------------
-    if (fgetc(fp) != 'q') {fclose(fp); return NULL;}
-    if (fgetc(fp) != 'o') {fclose(fp); return NULL;}
-    if (fgetc(fp) != 'i') {fclose(fp); return NULL;}
-    if (fgetc(fp) != 'f') {fclose(fp); return NULL;}
-    (*p_width)  =                    fgetc(fp);
-    (*p_width)  =  ((*p_width)<<8) + fgetc(fp);
-    (*p_width)  =  ((*p_width)<<8) + fgetc(fp);
-    (*p_width)  =  ((*p_width)<<8) + fgetc(fp);
-    (*p_height) =               fgetc(fp);
-    (*p_height) = ((*p_height)<<8) + fgetc(fp);
-    (*p_height) = ((*p_height)<<8) + fgetc(fp);
-    (*p_height) = ((*p_height)<<8) + fgetc(fp);
-    ch          =           (uint8_t)fgetc(fp);
-                                     fgetc(fp);
-    
-    if ((*p_width)<1 || (*p_height)<1 || ch<3 || ch>4) {
-        fclose(fp);
-        return NULL;
+    p_row       = (uint8_t*)memMalloc(row_size);
+    p_qoi_start = (uint8_t*)memMalloc((size_t)(5) * p_rs->width + 64);
+    
+    if (p_row == NULL || p_qoi_start == NULL) {
+        memFree(p_row);
+        memFree(p_qoi_start);
+        return 1;
     }
     
-    {
-        size_t qoi_size, qoi_data_start_pos;
-        qoi_data_start_pos = ftell(fp);
-        if (fseek(fp, 0, SEEK_END)) {
-            fclose(fp);
-            return NULL;
-        }
-        qoi_size = (size_t)ftell(fp) - qoi_data_start_pos;
-        if (fseek(fp, qoi_data_start_pos, SEEK_SET)) {
-            fclose(fp);
-            return NULL;
-        }
-        if (qoi_size <= 0) {
-            fclose(fp);
-            return NULL;
-        }
-        
-        p_buf_start = p_buf = (uint8_t*)malloc((size_t)(3)*(*p_width)*(*p_height)+16 + qoi_size+16);
-        p_buf_end   = p_buf +                  (size_t)(3)*(*p_width)*(*p_height);
-        p_qoi       = p_buf_end                                       + 16;
-        p_qoi_end   = p_qoi                                                + qoi_size;
-        
-        if (p_buf_start == NULL) {
-            fclose(fp);
-            return NULL;
+    p_qoi  = putQOIHeader(p_qoi_start, p_rs->height, p_rs->width);
+    failed = ((size_t)(p_qoi-p_qoi_start) != fwrite(p_qoi_start, sizeof(uint8_t), p_qoi-p_qoi_start, fp));
+    
+    initQOIEncoder(&enc);
+    
+    for (i=0; !failed && i<p_rs->height; i++) {
+        failed = p_rs->p_read_row(p_rs, p_row);
+        p_qoi  = encodeQOIPixels(&enc, p_row, p_rs->is_rgb, p_rs->width, p_qoi_start);
+        if (i+1 == p_rs->height)
+            p_qoi = finishQOIEncoder(&enc, p_qoi);
+        failed |= ((size_t)(p_qoi-p_qoi_start) != fwrite(p_qoi_start, sizeof(uint8_t), p_qoi-p_qoi_start, fp));
+    }
+    
+    memFree(p_row);
+    memFree(p_qoi_start);
+    return failed;
+}
+
+
+// return:   0 : success    1 : failed
+// the stream is encoded straight into the output file (see createOutputFile() in platform.h), instead of a heap buffer which is then copied to the file
+int writeQOIImageFile (const char *p_filename, const ImageDesc_t *p_desc) {
+    OutputFile_t of;
+    ImageRowSource_t rs;
+    uint8_t *p_row;
+    int failed;
+    
+    if (p_desc->width < 1 || p_desc->height < 1 || checkImageDesc(p_desc))
+        return 1;
+    
+    if (createOutputFile(p_filename, getQOIMaxLength(p_desc->height, p_desc->width), &of))
+        return 1;
+    
+    if (of.is_mapped) {
+        if ((p_row = (uint8_t*)memMalloc((size_t)(3) * p_desc->width)) == NULL) {
+            closeOutputFile(&of, 0);
+            return 1;
         }
-        
-        fread(p_qoi, sizeof(uint8_t), qoi_size, fp);
-        fclose(fp);
+        failed = closeOutputFile(&of, putQOIImage(p_desc, p_row, of.p_data));
+        memFree(p_row);
+        return failed;
     }
     
-    (*p_is_rgb) = 1;
+    failed = openImageDescRowSource(p_desc, 0, &rs);   // the file can not be mapped, so the rows are streamed to it, with memory proportional to the width
+    if (!failed) {
+        failed = streamQOIImage(&rs, of.fp);
+        rs.p_close(&rs);
+    }
+    
+    return closeOutputFile(&of, 0) | failed;
+}
+
+
+// state of QOI decoder, kept between rows when streaming
+typedef struct {
+    const uint8_t *p_qoi;
+    const uint8_t *p_qoi_end;
+    uint8_t tail [16];
+    int     in_tail;
+    int     ended;                      // the source is exhausted
+    uint8_t run;                        // remaining pixels of the current op
+    uint8_t r, g, b, a;
+    uint8_t ar[64], ag[64], ab[64], aa[64];
+} QOIDecoder_t;
+
+
+// parse qoi header, and init the decoder to decode from the source directly, without copying it
+// return:   0 : success    1 : failed
+static int initQOIDecoder (QOIDecoder_t *p_dec, const uint8_t *p_src, size_t src_len, uint32_t *p_height, uint32_t *p_width) {
+    uint8_t ch;
+    int i;
+    
+    if (src_len <= 14)  return 1;
+    if (p_src[0] != 'q') return 1;
+    if (p_src[1] != 'o') return 1;
+    if (p_src[2] != 'i') return 1;
+    if (p_src[3] != 'f') return 1;
+    (*p_width)  = ((uint32_t)p_src[4] <<24) | ((uint32_t)p_src[5] <<16) | ((uint32_t)p_src[6] <<8) | p_src[7];
+    (*p_height) = ((uint32_t)p_src[8] <<24) | ((uint32_t)p_src[9] <<16) | ((uint32_t)p_src[10]<<8) | p_src[11];
+    ch          = p_src[12];
     
+    if ((*p_width)<1 || (*p_height)<1 || ch<3 || ch>4)
+        return 1;
+    
+    p_dec->p_qoi     = p_src + 14;
+    p_dec->p_qoi_end = p_src + src_len;
+    p_dec->in_tail   = 0;
+    p_dec->ended     = 0;
+    p_dec->run       = 0;
+    p_dec->r = p_dec->g = p_dec->b = 0;
+    p_dec->a = 255;
+    for (i=0; i<64; i++)
+        p_dec->ar[i] = p_dec->ag[i] = p_dec->ab[i] = p_dec->aa[i] = 0;
+    for (i=0; i<16; i++)
+        p_dec->tail[i] = 0;
+    return 0;
+}
+
+
+// decode n_pixel RGB pixels to p_buf, if the source ends early, the remaining pixels are filled with 0
+static void decodeQOIPixels (QOIDecoder_t *p_dec, uint8_t *p_buf, size_t n_pixel) {
+    const uint8_t *p_qoi     = p_dec->p_qoi;                          // work on local copies, so that the compiler can keep them in registers
+    const uint8_t *p_qoi_end = p_dec->p_qoi_end;
+    uint8_t *p_buf_end = p_buf + 3*n_pixel;
+    uint8_t tag, type, run = p_dec->run;
+    uint8_t r = p_dec->r, g = p_dec->g, b = p_dec->b, a = p_dec->a;
+    uint8_t *ar = p_dec->ar, *ag = p_dec->ag, *ab = p_dec->ab, *aa = p_dec->aa;
     
-    {   // decode qoi ------------------
-        uint8_t tag, type, run;
-        uint8_t r=0, g=0, b=0, a=255;
-        uint8_t ar [64] = {0};
-        uint8_t ag [64] = {0};
-        uint8_t ab [64] = {0};
-        uint8_t aa [64] = {0};
-        for (;;) {
+    while (p_buf < p_buf_end) {
+        if (run == 0) {
+            if (p_dec->ended)
+                break;
+            
+            if (p_qoi_end - p_qoi < 5 && !p_dec->in_tail) {   // near the end of the source, switch to a zero-padded copy of the tail, so that the longest op (5 bytes) never reads out of the source
+                size_t i, n = p_qoi_end - p_qoi;
+                for (i=0; i<n; i++)
+                    p_dec->tail[i] = p_qoi[i];
+                p_qoi     = p_dec->tail;
+                p_qoi_end = p_dec->tail + n;
+                p_dec->in_tail = 1;
+            }
+            
             tag  = *(p_qoi++);
             type = (tag >> 6);
             tag &= 0x3f;
@@ -236,20 +370,121 @@ uint8_t* loadQOIImageFile (const char *p_filename, int *p_is_rgb, uint32_t *p_he
             ab[tag] = b;
             aa[tag] = a;
             
-            for (; run>0; run--) {
-                p_buf[0] = r;
-                p_buf[1] = g;
-                p_buf[2] = b;
-                p_buf += 3;
-                
-                if (p_buf>=p_buf_end) {
-                    return p_buf_start;
-                }
-            }
-            
-            if (p_qoi>=p_qoi_end) {
-                return p_buf_start;
-            }
+            if (p_qoi >= p_qoi_end)          // the pixels of the last op are still output
+                p_dec->ended = 1;
+        }
+        
+        for (; run>0 && p_buf<p_buf_end; run--) {
+            p_buf[0] = r;
+            p_buf[1] = g;
+            p_buf[2] = b;
+            p_buf += 3;
         }
     }
+    
+    for (; p_buf<p_buf_end; p_buf++)
+        *p_buf = 0;
+    
+    p_dec->p_qoi     = p_qoi;
+    p_dec->p_qoi_end = p_qoi_end;
+    p_dec->run = run;
+    p_dec->r   = r;
+    p_dec->g   = g;
+    p_dec->b   = b;
+    p_dec->a   = a;
+}
+
+
+// return:   0 : success    1 : failed
+int probeQOIHeader (const uint8_t *p_head, size_t len, int *p_is_rgb, uint32_t *p_height, uint32_t *p_width) {
+    QOIDecoder_t dec;
+    *p_is_rgb = 1;                      // the alpha channel is discarded, so the pixels are always RGB
+    return initQOIDecoder(&dec, p_head, len, p_height, p_width);
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by arenaAlloc(p_arena), need to be arenaFree(p_arena) later (or memFree() if p_arena=NULL)
+uint8_t* decodeQOIImage (const uint8_t *p_src, size_t src_len, ImageDesc_t *p_desc, Arena_t *p_arena) {
+    QOIDecoder_t dec;
+    uint32_t height, width;
+    uint8_t *p_buf;
+    
+    if (initQOIDecoder(&dec, p_src, src_len, &height, &width))
+        return NULL;
+    
+    p_buf = (uint8_t*)arenaAlloc(p_arena, (size_t)(3)*width*height);
+    
+    if (p_buf == NULL)
+        return NULL;
+    
+    decodeQOIPixels(&dec, p_buf, (size_t)width*height);
+    
+    describeImage(p_desc, p_buf, 1, height, width);
+    return p_buf;
+}
+
+
+typedef struct {
+    QOIDecoder_t   dec;
+    const uint8_t *p_src;
+    size_t         src_len;
+} QOIRowSource_t;
+
+
+static int qoiReadRow (ImageRowSource_t *p_rs, uint8_t *p_row) {
+    decodeQOIPixels(&((QOIRowSource_t*)p_rs->p_ctx)->dec, p_row, p_rs->width);
+    return 0;
+}
+
+
+static int qoiRewind (ImageRowSource_t *p_rs) {
+    QOIRowSource_t *p_ctx = (QOIRowSource_t*)p_rs->p_ctx;
+    return initQOIDecoder(&p_ctx->dec, p_ctx->p_src, p_ctx->src_len, &p_rs->height, &p_rs->width);
+}
+
+
+static void qoiClose (ImageRowSource_t *p_rs) {
+    memFree(p_rs->p_ctx);
+    p_rs->p_ctx = NULL;
+}
+
+
+// return:   0 : success    1 : failed
+int openQOIRowSource (const uint8_t *p_src, size_t src_len, ImageRowSource_t *p_rs) {
+    QOIRowSource_t *p_ctx = (QOIRowSource_t*)memMalloc(sizeof(QOIRowSource_t));
+    
+    if (p_ctx == NULL)
+        return 1;
+    
+    if (initQOIDecoder(&p_ctx->dec, p_src, src_len, &p_rs->height, &p_rs->width)) {
+        memFree(p_ctx);
+        return 1;
+    }
+    
+    p_ctx->p_src   = p_src;
+    p_ctx->src_len = src_len;
+    
+    p_rs->is_rgb     = 1;
+    p_rs->p_read_row = qoiReadRow;
+    p_rs->p_rewind   = qoiRewind;
+    p_rs->p_close    = qoiClose;
+    p_rs->p_ctx      = p_ctx;
+    return 0;
+}
+
+
+// return:  NULL     : failed
+//          non-NULL : pointer to image pixels, allocated by memMalloc(), need to be memFree() later
+uint8_t* loadQOIImageFile (const char *p_filename, ImageDesc_t *p_desc) {
+    MappedFile_t mf;
+    uint8_t *p_buf;
+    
+    if (mapFile(p_filename, &mf))
+        return NULL;
+    
+    p_buf = decodeQOIImage(mf.p_data, mf.len, p_desc, NULL);
+    
+    unmapFile(&mf);
+    return p_buf;
 }
@@ -0,0 +1,356 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "console.h"
+#include "treewalk.h"
+#include "joblist.h"
+
+
+int matchSuffixIgnoringCase (const char *string, const char *suffix) {
+    #define  TO_LOWER(c)   ((((c) >= 'A') && ((c) <= 'Z')) ? ((c)+32) : (c))
+    const char *p1, *p2;
+    for (p1=string; *p1; p1++);
+    for (p2=suffix; *p2; p2++);
+    while (TO_LOWER(*p1) == TO_LOWER(*p2)) {
+        if (p2 <= suffix)
+            return 1;
+        if (p1 <= string)
+            return 0;
+        p1 --;
+        p2 --;
+    }
+    return 0;
+}
+
+
+void replaceFileSuffix (char *p_dst, const char *p_src, const char *p_suffix) {
+    char *p;
+    char *p_base = p_dst;
+    
+    for (; *p_src; p_src++)         // traversal p_src
+        *(p_dst++) = *p_src;        // copy p_src to p_dst
+    *p_dst = '\0';
+    
+    for (p=p_dst; ; p--) {          // reverse traversal p_dst
+        if (p < p_base || *p=='/' || *p=='\\') {
+            break;
+        }
+        if (*p == '.') {
+            p_dst = p;
+            break;
+        }
+    }
+    
+    *(p_dst++) = '.';
+    
+    for (; *p_suffix; p_suffix++) { // traversal p_suffix
+        *(p_dst++) = *p_suffix;     // copy p_suffix to p_dst
+    }
+    *p_dst = '\0';
+}
+
+
+static char* duplicateString (const char *p_str, size_t len) {
+    char *p = (char*)malloc(len + 1);
+    if (p) {
+        memcpy(p, p_str, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+
+// get the next file name from *pp, which can be quoted
+// return:   NULL     : no more file name in this line
+//           non-NULL : the file name, allocated by malloc()
+static char* nextToken (char **pp) {
+    char *p = *pp, *p_start;
+    
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        p ++;
+    
+    if (*p == '\0')
+        return NULL;
+    
+    if (*p == '"') {
+        p_start = ++p;
+        while (*p && *p != '"')
+            p ++;
+        *pp = (*p == '"') ? (p+1) : p;
+    } else {
+        p_start = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            p ++;
+        *pp = p;
+    }
+    
+    return duplicateString(p_start, p - p_start);
+}
+
+
+// add a file name to the outputs of p_job, the extra outputs beyond MAX_N_DST are dropped
+static void addOutput (Job_t *p_job, char *p_dst) {
+    if (p_job->n_dst < MAX_N_DST) {
+        p_job->dst_fnames[p_job->n_dst ++] = p_dst;
+    } else {
+        consolePrintf("   ***ERROR: too many outputs of %s, %s is ignored\n", p_job->src_fname, p_dst);
+        free(p_dst);
+    }
+}
+
+
+// return:   1 : the file name has the suffix of a format that can be an input (the file is then recognized by its content, see probeImageFormat() and decodeImage() in imageio.h)
+static int isInputFileName (const char *p_fname) {
+    return matchSuffixIgnoringCase(p_fname, ".pnm") || matchSuffixIgnoringCase(p_fname, ".pgm") || matchSuffixIgnoringCase(p_fname, ".ppm") ||
+           matchSuffixIgnoringCase(p_fname, ".png") || matchSuffixIgnoringCase(p_fname, ".bmp") || matchSuffixIgnoringCase(p_fname, ".qoi");
+}
+
+
+// return: p_dir/p_name, with the suffix replaced by p_suffix if it is not NULL, allocated by malloc()
+static char* makePath (const char *p_dir, const char *p_name, const char *p_suffix) {
+    size_t len_dir = strlen(p_dir), len_name = strlen(p_name);
+    char  *p = (char*)malloc(len_dir + len_name + (p_suffix ? strlen(p_suffix) : 0) + 3);
+    if (p == NULL)
+        return NULL;
+    memcpy(p, p_dir, len_dir);
+    if (len_dir > 0 && p_dir[len_dir-1] != '/' && p_dir[len_dir-1] != '\\')
+        p[len_dir++] = '/';
+    memcpy(p+len_dir, p_name, len_name+1);
+    if (p_suffix)
+        replaceFileSuffix(p, p, p_suffix);       // can be in place, since it copies forward
+    return p;
+}
+
+
+// give a job without an output its default output: the standard output for the standard input "-", or the input with the suffix of --to (png without --to)
+void addDefaultOutput (Job_t *p_job, const char *p_to_suffix) {
+    char *p_dst;
+    if (p_job->n_dst > 0)
+        return;
+    if (p_job->src_fname[0] == '-' && p_job->src_fname[1] == '\0')
+        p_dst = makePath("", "-", NULL);
+    else
+        p_dst = makePath("", p_job->src_fname, (p_to_suffix ? p_to_suffix : "png"));
+    if (p_dst)
+        addOutput(p_job, p_dst);
+}
+
+
+// create the directory of p_fname and its parents, which may exist
+static void makeParentDirs (JobList_t *p_jl, char *p_fname) {
+    char *p, *p_end = NULL;
+    
+    for (p=p_fname; *p; p++)
+        if (*p == '/' || *p == '\\')
+            p_end = p;
+    
+    if (p_end == NULL || p_end == p_fname || (size_t)(p_end - p_fname) >= sizeof(p_jl->made_dir))
+        return;
+    
+    if (strncmp(p_jl->made_dir, p_fname, p_end - p_fname) == 0 && p_jl->made_dir[p_end - p_fname] == '\0')
+        return;                                  // the same directory as the last file, which is the usual case
+    
+    for (p=p_fname+1; p<=p_end; p++) {
+        if (*p == '/' || *p == '\\') {
+            char ch = *p;
+            *p = '\0';
+            makeDir(p_fname);
+            *p = ch;
+        }
+    }
+    
+    memcpy(p_jl->made_dir, p_fname, p_end - p_fname);
+    p_jl->made_dir[p_end - p_fname] = '\0';
+}
+
+
+// get the next job from the tree being walked, the output of each image file is the same relative path under each output directory (or the input directory if there is none)
+// return:   1 : got a job    0 : no more file in the tree
+static int nextTreeJob (JobList_t *p_jl, Job_t *p_job) {
+    const char  *p_in_dir = p_jl->arg_fnames[p_jl->i_walk_arg];
+    const char  *p_suffix = p_jl->p_to_suffix ? p_jl->p_to_suffix : "png";
+    char        *p_rel_path, *p_dst;
+    int          i;
+    
+    while (nextTreeFile(p_jl->p_walk, &p_rel_path)) {
+        if (isInputFileName(p_rel_path) && (p_job->src_fname = makePath(p_in_dir, p_rel_path, NULL)) != NULL) {
+            for (i=0; i<p_jl->n_walk_dst || (i==0 && p_jl->n_walk_dst==0); i++) {
+                const char *p_out_dir = p_jl->n_walk_dst ? p_jl->arg_fnames[p_jl->i_walk_arg+1+i] : p_in_dir;
+                if ((p_dst = makePath(p_out_dir, p_rel_path, p_suffix)) == NULL)
+                    continue;
+                if (strcmp(p_dst, p_job->src_fname) == 0) {     // would overwrite the input
+                    free(p_dst);
+                    p_job->keeps_src = 1;
+                    continue;
+                }
+                makeParentDirs(p_jl, p_dst);
+                addOutput(p_job, p_dst);
+            }
+            if (p_job->n_dst > 0 || p_job->keeps_src) {   // a file whose only output is dropped is still a job, so that it is listed and counted
+                free(p_rel_path);
+                return 1;
+            }
+            freeJob(p_job);
+        }
+        free(p_rel_path);
+    }
+    
+    return 0;
+}
+
+
+// start walking an input directory, its outputs are created first, so that they can be excluded from the walk if they are inside the tree
+// return:   0 : success    1 : failed
+static int startTreeWalk (JobList_t *p_jl) {
+    const char **out_dirs = (const char**)(p_jl->arg_fnames + p_jl->i_walk_arg + 1);
+    char        *p_dir;
+    int          i;
+    
+    for (i=0; i<p_jl->n_walk_dst; i++) {
+        if ((p_dir = makePath(out_dirs[i], "", NULL)) != NULL) {
+            makeParentDirs(p_jl, p_dir);
+            free(p_dir);
+        }
+    }
+    
+    p_jl->p_walk = openTreeWalk(p_jl->arg_fnames[p_jl->i_walk_arg], out_dirs, p_jl->n_walk_dst);
+    
+    return (p_jl->p_walk == NULL);
+}
+
+
+int parseJobLine (char *p_line, Job_t *p_job) {
+    char *p_dst;
+    
+    p_job->src_fname = NULL;
+    p_job->n_dst = 0;
+    p_job->keeps_src = 0;
+    
+    while (*p_line == ' ' || *p_line == '\t')
+        p_line ++;
+    
+    if (*p_line == '#')
+        return 0;
+    
+    if ((p_job->src_fname = nextToken(&p_line)) == NULL)
+        return 0;
+    
+    while ((p_dst = nextToken(&p_line)) != NULL)
+        addOutput(p_job, p_dst);
+    
+    return 1;
+}
+
+
+int openJobList (JobList_t *p_jl, char **arg_fnames, int *arg_is_dst, int n_arg, const char *p_list_fname, int recursive, const char *p_to_suffix) {
+    p_jl->arg_fnames = arg_fnames;
+    p_jl->arg_is_dst = arg_is_dst;
+    p_jl->n_arg      = n_arg;
+    p_jl->i_arg      = 0;
+    p_jl->fp_list    = NULL;
+    p_jl->i_line     = 0;
+    p_jl->recursive  = recursive;
+    p_jl->p_to_suffix= p_to_suffix;
+    p_jl->p_walk     = NULL;
+    p_jl->made_dir[0]= '\0';
+    
+    if (p_list_fname) {
+        p_jl->fp_list = (strcmp(p_list_fname, "-") == 0) ? stdin : fopen(p_list_fname, "r");
+        if (p_jl->fp_list == NULL)
+            return 1;
+    }
+    
+    return 0;
+}
+
+
+void closeJobList (JobList_t *p_jl) {
+    if (p_jl->p_walk)
+        closeTreeWalk(p_jl->p_walk);
+    p_jl->p_walk = NULL;
+    if (p_jl->fp_list && p_jl->fp_list != stdin)
+        fclose(p_jl->fp_list);
+    p_jl->fp_list = NULL;
+}
+
+
+void freeJob (Job_t *p_job) {
+    int i;
+    free(p_job->src_fname);
+    for (i=0; i<p_job->n_dst; i++)
+        free(p_job->dst_fnames[i]);
+    p_job->src_fname = NULL;
+    p_job->n_dst = 0;
+    p_job->keeps_src = 0;
+}
+
+
+int nextJob (JobList_t *p_jl, Job_t *p_job) {
+    char *p_dst;
+    
+    p_job->src_fname = NULL;
+    p_job->n_dst = 0;
+    p_job->keeps_src = 0;
+    
+    for (;;) {
+        if (p_jl->p_walk) {
+            if (nextTreeJob(p_jl, p_job))
+                return 1;
+            closeTreeWalk(p_jl->p_walk);
+            p_jl->p_walk = NULL;
+        }
+        
+        while (p_jl->i_arg < p_jl->n_arg && p_jl->arg_is_dst[p_jl->i_arg])   // skip the output names which have no input before them
+            p_jl->i_arg ++;
+        
+        if (p_jl->i_arg >= p_jl->n_arg)
+            break;
+        
+        if (p_jl->recursive && isDir(p_jl->arg_fnames[p_jl->i_arg])) {
+            p_jl->i_walk_arg = p_jl->i_arg ++;
+            for (p_jl->n_walk_dst=0; p_jl->i_arg < p_jl->n_arg && p_jl->arg_is_dst[p_jl->i_arg]; p_jl->i_arg++)
+                p_jl->n_walk_dst ++;
+            if (startTreeWalk(p_jl))
+                consolePrintf("   ***ERROR: walk directory %s failed\n", p_jl->arg_fnames[p_jl->i_walk_arg]);
+            continue;
+        }
+        
+        {
+            const char *p_src = p_jl->arg_fnames[p_jl->i_arg ++];
+            if ((p_job->src_fname = duplicateString(p_src, strlen(p_src))) == NULL)
+                return 0;
+            for (; p_jl->i_arg < p_jl->n_arg && p_jl->arg_is_dst[p_jl->i_arg]; p_jl->i_arg++)
+                if ((p_dst = duplicateString(p_jl->arg_fnames[p_jl->i_arg], strlen(p_jl->arg_fnames[p_jl->i_arg]))) != NULL)
+                    addOutput(p_job, p_dst);
+            addDefaultOutput(p_job, p_jl->p_to_suffix);
+            return 1;
+        }
+    }
+    
+    while (p_jl->fp_list && fgets(p_jl->line, sizeof(p_jl->line), p_jl->fp_list)) {
+        char *p = p_jl->line;
+        
+        p_jl->i_line ++;
+        
+        if (strchr(p, '\n') == NULL && !feof(p_jl->fp_list)) {    // too long line, skip it
+            int ch;
+            do {
+                ch = fgetc(p_jl->fp_list);
+            } while (ch != '\n' && ch != EOF);
+            consolePrintf("   ***ERROR: line %d of job list is too long, skipped\n", p_jl->i_line);
+            continue;
+        }
+        
+        if (!parseJobLine(p, p_job))
+            continue;
+        
+        addDefaultOutput(p_job, p_jl->p_to_suffix);
+        
+        return 1;
+    }
+    
+    return 0;
+}
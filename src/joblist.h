@@ -0,0 +1,71 @@
+#ifndef   __JOB_LIST_H__
+#define   __JOB_LIST_H__
+
+
+// the conversion jobs (an input file name and its output file names) of a batch, which come from the command line and then from a list file
+// the list file is read lazily job by job, so the number of jobs is unbounded and the memory does not grow with it
+// an input directory on the command line (with -r) is walked in the background (see treewalk.h), and each image file in its tree becomes a job
+
+
+#define  MAX_N_DST  16                // max number of outputs of an input
+
+
+typedef struct {
+    char  *src_fname;
+    char  *dst_fnames [MAX_N_DST];
+    int    n_dst;                     // the default output is added by nextJob(), so it is 0 only if it can not be allocated, if the job is from parseJobLine(), or if keeps_src=1
+    int    keeps_src;                 // 1 : an output of a walked tree is dropped since it would overwrite the input (as "-r dir --to png" without -o), which is reported when the job is converted
+} Job_t;
+
+
+typedef struct {
+    char **arg_fnames;                // jobs from the command line, each input name is followed by its output names
+    int   *arg_is_dst;
+    int    n_arg;
+    int    i_arg;
+    FILE  *fp_list;                   // jobs from the list file, NULL if there is no list file
+    int    i_line;
+    char   line [8192];
+    int    recursive;                 // 1 : an input directory is walked, its image files are converted into the same tree under each output directory
+    const char *p_to_suffix;          // suffix of the outputs which are not named, NULL for the default (png)
+    struct TreeWalk_s *p_walk;        // the input directory being walked, NULL if none
+    int    i_walk_arg;                // index of the input directory in arg_fnames, followed by its n_walk_dst output directories
+    int    n_walk_dst;
+    char   made_dir [4096];           // the last output directory created, so that the directories of a tree are not created again for each file
+} JobList_t;
+
+
+// open a job list, p_list_fname can be NULL (no list file), or "-" for stdin
+// recursive   : 1 to walk the input directories, whose outputs (if any) are directories
+// p_to_suffix : suffix of the outputs of a walked tree and of the inputs without outputs, can be NULL
+// return:   0 : success    1 : failed to open the list file
+int  openJobList  (JobList_t *p_jl, char **arg_fnames, int *arg_is_dst, int n_arg, const char *p_list_fname, int recursive, const char *p_to_suffix);
+
+void closeJobList (JobList_t *p_jl);
+
+// get the next job, the file names in *p_job are allocated by malloc(), need to be released by freeJob() later
+// an input without outputs gets its default output (see addDefaultOutput()), so the output names are resolved once here rather than by each user of the job
+// each line of the list file is "<in> [<out1> <out2> ...]", the file names are separated by spaces or tabs, and can be quoted by "" if they contain spaces
+// empty lines and lines starting with # are ignored
+// return:   1 : got a job    0 : no more job
+int  nextJob      (JobList_t *p_jl, Job_t *p_job);
+
+void freeJob      (Job_t *p_job);
+
+// parse a line of the list file (see nextJob()) to a job, which need to be released by freeJob() later
+// return:   1 : got a job    0 : the line is empty or a comment
+int  parseJobLine (char *p_line, Job_t *p_job);
+
+// if p_job has no output, add its default output: the standard output "-" for the standard input "-", otherwise the input with its suffix replaced by p_to_suffix (png if NULL)
+void addDefaultOutput (Job_t *p_job, const char *p_to_suffix);
+
+
+// return:   1 : match    0 : mismatch
+int  matchSuffixIgnoringCase (const char *string, const char *suffix);
+
+// copy p_src to p_dst with its suffix (after the last '.' of the file name) replaced by p_suffix, or appended if there is none
+// p_dst must have space for strlen(p_src) + strlen(p_suffix) + 2 chars
+void replaceFileSuffix (char *p_dst, const char *p_src, const char *p_suffix);
+
+
+#endif // __JOB_LIST_H__
@@ -0,0 +1,288 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "kernels.h"
+
+
+#define  ADLER_BASE  65521
+#define  ADLER_NMAX  5552             // max bytes before the sums must be reduced, so that they do not overflow 32 bits (as zlib)
+
+
+
+static uint32_t adler32C (uint32_t adler, const uint8_t *p, size_t len) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (len > 0) {
+        size_t n = (len < ADLER_NMAX) ? len : ADLER_NMAX;
+        len -= n;
+        for (; n>0; n--) {
+            a += *p++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return a | (b << 16);
+}
+
+
+static uint32_t crc32C (uint32_t crc, const uint8_t *p, size_t len) {
+    static const uint32_t crc_table[] = {0, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c };
+    for (; len>0; len--) {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ crc_table[crc & 15];
+        crc = (crc >> 4) ^ crc_table[crc & 15];
+    }
+    return crc;
+}
+
+
+static void swapRB24C (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    for (; n_pixel>0; n_pixel--) {
+        uint8_t R = p_src[0];
+        p_dst[0] = p_src[2];
+        p_dst[1] = p_src[1];
+        p_dst[2] = R;
+        p_dst += 3;
+        p_src += 3;
+    }
+}
+
+
+static void bgrxToRGBC (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    for (; n_pixel>0; n_pixel--) {
+        p_dst[0] = p_src[2];
+        p_dst[1] = p_src[1];
+        p_dst[2] = p_src[0];
+        p_dst += 3;
+        p_src += 4;
+    }
+}
+
+
+static void rgbxToRGBC (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    for (; n_pixel>0; n_pixel--) {
+        p_dst[0] = p_src[0];
+        p_dst[1] = p_src[1];
+        p_dst[2] = p_src[2];
+        p_dst += 3;
+        p_src += 4;
+    }
+}
+
+
+static void extractChannelC (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel, int n_channel, int channel) {
+    for (p_src+=channel; n_pixel>0; n_pixel--) {
+        *(p_dst++) = *p_src;
+        p_src += n_channel;
+    }
+}
+
+
+static void planesToRGBC (uint8_t *p_dst, const uint8_t *p_r, const uint8_t *p_g, const uint8_t *p_b, size_t n_pixel) {
+    for (; n_pixel>0; n_pixel--) {
+        p_dst[0] = *(p_r++);
+        p_dst[1] = *(p_g++);
+        p_dst[2] = *(p_b++);
+        p_dst += 3;
+    }
+}
+
+
+static size_t parsePlainNumbersC (uint8_t *p_dst, size_t n_num, const uint8_t *p_src, size_t len, int is_bit, size_t *p_used) {
+    const uint8_t *p = p_src, *p_end = p_src + len;
+    size_t i = 0;
+    
+    while (i < n_num && p_end - p >= 4) {                      // a number of 3 digits and the byte after it, or the byte after 3 digits
+        uint32_t d0 = (uint32_t)p[0] - '0', d1, d2, v;
+        if (d0 > 9) {
+            if (p[0] == '#')
+                break;
+            p ++;
+            continue;
+        }
+        d1 = (uint32_t)p[1] - '0';
+        d2 = (uint32_t)p[2] - '0';
+        if (d1 > 9) {
+            v = d0;
+            p += 2;
+        } else if (d2 > 9) {
+            v = d0*10 + d1;
+            p += 3;
+        } else if ((uint32_t)p[3] - '0' > 9) {
+            v = d0*100 + d1*10 + d2;
+            p += 4;
+        } else {
+            break;
+        }
+        p_dst[i++] = is_bit ? (v ? 0 : 255) : (uint8_t)v;
+    }
+    
+    *p_used = p - p_src;
+    return i;
+}
+
+
+// Paeth predictor, used by PNG filter type 4
+static int paethPredictor (int a, int b, int c) {
+    int p  = a + b - c;
+    int pa = p > a ? p - a : a - p;
+    int pb = p > b ? p - b : b - p;
+    int pc = p > c ? p - c : c - p;
+    if (pa <= pb && pa <= pc)
+        return a;
+    else if (pb <= pc)
+        return b;
+    else
+        return c;
+}
+
+
+static void unfilterRowC (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len) {
+    size_t i;
+    switch (filter_type) {
+        case 1 :
+            for (i=0; i<bpp && i<len; i++)
+                p_recon[i] = p_scan[i];
+            for (; i<len; i++)
+                p_recon[i] = p_scan[i] + p_recon[i-bpp];
+            break;
+        case 2 :
+            for (i=0; i<len; i++)
+                p_recon[i] = p_scan[i] + (p_prev ? p_prev[i] : 0);
+            break;
+        case 3 :
+            for (i=0; i<bpp && i<len; i++)
+                p_recon[i] = p_scan[i] + (p_prev ? p_prev[i] / 2 : 0);
+            for (; i<len; i++)
+                p_recon[i] = p_scan[i] + ((p_recon[i-bpp] + (p_prev ? p_prev[i] : 0)) / 2);
+            break;
+        case 4 :
+            for (i=0; i<bpp && i<len; i++)
+                p_recon[i] = (uint8_t)(p_scan[i] + (p_prev ? p_prev[i] : 0));                        // the predictor is b, since a = c = 0
+            for (; i<len; i++)
+                p_recon[i] = (uint8_t)(p_scan[i] + (p_prev ? paethPredictor(p_recon[i-bpp], p_prev[i], p_prev[i-bpp]) : p_recon[i-bpp]));
+            break;
+        default :
+            if (p_recon != p_scan)
+                memcpy(p_recon, p_scan, len);
+            break;
+    }
+}
+
+
+
+static CpuLevel_t kernel_level = CPU_SCALAR;
+
+static uint32_t (*p_adler32)    (uint32_t, const uint8_t*, size_t) = adler32C;
+static uint32_t (*p_crc32)      (uint32_t, const uint8_t*, size_t) = crc32C;
+static void     (*p_swap_rb24)  (uint8_t*, const uint8_t*, size_t) = swapRB24C;
+static void     (*p_bgrx_to_rgb)(uint8_t*, const uint8_t*, size_t) = bgrxToRGBC;
+static void     (*p_rgbx_to_rgb)(uint8_t*, const uint8_t*, size_t) = rgbxToRGBC;
+static void     (*p_extract_channel)(uint8_t*, const uint8_t*, size_t, int, int) = extractChannelC;
+static void     (*p_planes_to_rgb)(uint8_t*, const uint8_t*, const uint8_t*, const uint8_t*, size_t) = planesToRGBC;
+static size_t   (*p_parse_plain)(uint8_t*, size_t, const uint8_t*, size_t, int, size_t*) = parsePlainNumbersC;
+static int      (*p_unfilter_row)(uint8_t*, const uint8_t*, const uint8_t*, size_t, int, size_t) = NULL;   // NULL : only the plain C version
+static void     (*p_mat_mul32)  (int, const int32_t*, int, const int32_t*, int, int32_t*, int, int) = NULL;            // NULL : the plain C loop of the caller
+
+
+void initKernels (CpuLevel_t level) {
+    kernel_level   = level;
+    p_adler32      = adler32C;
+    p_crc32        = crc32C;
+    p_swap_rb24    = swapRB24C;
+    p_bgrx_to_rgb  = bgrxToRGBC;
+    p_rgbx_to_rgb  = rgbxToRGBC;
+    p_extract_channel = extractChannelC;
+    p_planes_to_rgb   = planesToRGBC;
+    p_parse_plain     = parsePlainNumbersC;
+    p_unfilter_row = NULL;
+    p_mat_mul32    = NULL;
+#ifdef CPU_X86
+    if (level >= CPU_SSE41) {
+        p_adler32      = adler32SSE41;
+        if (detectPclmul())           // not a part of the SSE4.1 level, since the SSE4.1 CPUs before 2010 do not have it
+            p_crc32    = crc32PCLMUL;
+        p_swap_rb24    = swapRB24SSE41;
+        p_bgrx_to_rgb  = bgrxToRGBSSE41;
+        p_rgbx_to_rgb  = rgbxToRGBSSE41;
+        p_extract_channel = extractChannelSSE41;
+        p_planes_to_rgb   = planesToRGBSSE41;
+        p_parse_plain     = parsePlainNumbersSSE41;
+        initPlainNumbersSSE41();
+        p_unfilter_row = unfilterRowSSE41;
+        p_mat_mul32    = matMul32SSE41;
+    }
+    if (level >= CPU_AVX2) {
+        p_adler32      = adler32AVX2;
+        p_unfilter_row = unfilterRowAVX2;
+        p_mat_mul32    = matMul32AVX2;
+    }
+#else
+    kernel_level   = CPU_SCALAR;
+#endif
+}
+
+
+CpuLevel_t getKernelLevel () {
+    return kernel_level;
+}
+
+
+uint32_t adler32Update (uint32_t adler, const uint8_t *p, size_t len) {
+    return p_adler32(adler, p, len);
+}
+
+
+uint32_t crc32Update (uint32_t crc, const uint8_t *p, size_t len) {
+    return p_crc32(crc, p, len);
+}
+
+
+void swapRB24 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    p_swap_rb24(p_dst, p_src, n_pixel);
+}
+
+
+void bgrxToRGB (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    p_bgrx_to_rgb(p_dst, p_src, n_pixel);
+}
+
+
+void rgbxToRGB (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    p_rgbx_to_rgb(p_dst, p_src, n_pixel);
+}
+
+
+void extractChannel (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel, int n_channel, int channel) {
+    if (n_channel == 1)
+        memcpy(p_dst, p_src, n_pixel);
+    else
+        p_extract_channel(p_dst, p_src, n_pixel, n_channel, channel);
+}
+
+
+void planesToRGB (uint8_t *p_dst, const uint8_t *p_r, const uint8_t *p_g, const uint8_t *p_b, size_t n_pixel) {
+    p_planes_to_rgb(p_dst, p_r, p_g, p_b, n_pixel);
+}
+
+
+size_t parsePlainNumbers (uint8_t *p_dst, size_t n_num, const uint8_t *p_src, size_t len, int is_bit, size_t *p_used) {
+    return p_parse_plain(p_dst, n_num, p_src, len, is_bit, p_used);
+}
+
+
+void unfilterRow (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len) {
+    if (p_unfilter_row == NULL || p_unfilter_row(p_recon, p_scan, p_prev, bpp, filter_type, len))
+        unfilterRowC(p_recon, p_scan, p_prev, bpp, filter_type, len);
+}
+
+
+int matMul32 (int sz, const int32_t *p_a, int a_transpose, const int32_t *p_b, int b_transpose, int32_t *p_dst, int shift, int clip) {
+    if (p_mat_mul32 == NULL)
+        return 1;
+    p_mat_mul32(sz, p_a, a_transpose, p_b, b_transpose, p_dst, shift, clip);
+    return 0;
+}
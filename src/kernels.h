@@ -0,0 +1,81 @@
+#ifndef   __KERNELS_H__
+#define   __KERNELS_H__
+
+
+// the hot loops of the codecs, each has a plain C version and (on x86) SSE4.1 and AVX2 versions, which give exactly the same results
+// the versions are picked once by initKernels() at startup, before that the plain C versions are used
+
+
+// pick the versions of all kernels, call before starting any thread
+void     initKernels   (CpuLevel_t level);
+
+// return: the level picked by initKernels()
+CpuLevel_t getKernelLevel ();
+
+
+// Adler-32 of the zlib stream, adler is the value of the previous bytes (1 at the start)
+uint32_t adler32Update (uint32_t adler, const uint8_t *p, size_t len);
+
+// CRC-32 of the PNG chunks, crc is the register before the final inversion (0xFFFFFFFF at the start)
+uint32_t crc32Update   (uint32_t crc, const uint8_t *p, size_t len);
+
+// pixel format conversions, used by the loaders and writers instead of their own loops ---------------------------------------------
+
+// swap R and B of n_pixel 24-bit pixels (RGB <-> BGR), p_dst and p_src can be the same
+void     swapRB24      (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel);
+
+// convert n_pixel 32-bit BGRX pixels to 24-bit RGB, p_dst and p_src should not overlap
+void     bgrxToRGB     (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel);
+
+// drop the alpha of n_pixel 32-bit RGBA pixels to 24-bit RGB, p_dst and p_src should not overlap
+void     rgbxToRGB     (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel);
+
+// copy one channel (0 ~ n_channel-1) of n_pixel interleaved pixels of n_channel (1~4) bytes to n_pixel bytes, p_dst and p_src should not overlap
+void     extractChannel(uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel, int n_channel, int channel);
+
+// interleave n_pixel bytes of three planes to n_pixel 24-bit RGB pixels, p_dst should not overlap the planes
+void     planesToRGB   (uint8_t *p_dst, const uint8_t *p_r, const uint8_t *p_g, const uint8_t *p_b, size_t n_pixel);
+
+// PNM text -----------------------------------------------------------------------------------------------------------------------------
+
+// parse up to n_num numbers of plain (ASCII) PNM (P1, P2 or P3) to p_dst, as get_next_number() in imageio_pnm.c : the numbers are separated by
+// any non-digit bytes, and the byte after each number is also consumed. A value is stored as its low 8 bits, or as 0 (nonzero) / 255 (zero) if is_bit
+// it stops early at a '#' which starts a comment, at a number of more than 3 digits and near the end of p_src, the caller parses those by its plain loop
+// return: the number of values parsed, *p_used is set to the number of bytes consumed
+size_t   parsePlainNumbers (uint8_t *p_dst, size_t n_num, const uint8_t *p_src, size_t len, int is_bit, size_t *p_used);
+
+// PNG unfilter and HEVC transform -------------------------------------------------------------------------------------------------
+
+// undo the PNG filter of a row, as unfilter_scanline() in uPNG/uPNG.c
+// p_recon and p_scan can be the same, p_prev is the previous unfiltered row (NULL for the first row), bpp is bytes per pixel
+void     unfilterRow   (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len);
+
+#define  MAT_STRIDE  32
+
+// dst = (a * b + rounding) >> shift, clipped to -32768~32767 if clip, as matMul() in HEVCe/HEVCe.c, which is the plain C version
+// the matrices are sz x sz (sz = 4, 8, 16 or 32) with a row stride of MAT_STRIDE, a and b are transposed first if a_transpose and b_transpose
+// return:   0 : done    1 : no SIMD version is picked, the caller should run its plain C loop
+int      matMul32      (int sz, const int32_t *p_a, int a_transpose, const int32_t *p_b, int b_transpose, int32_t *p_dst, int shift, int clip);
+
+
+// the SSE4.1 (and PCLMULQDQ) and AVX2 versions, only used by initKernels() -----------------------------------------------------------
+// from kernels_x86.c, the unfilterRow versions only handle some filters and pixel sizes, they return 1 if the plain C version should be used
+// initPlainNumbersSSE41() fills the tables of parsePlainNumbersSSE41()
+
+uint32_t adler32SSE41  (uint32_t adler, const uint8_t *p, size_t len);
+uint32_t adler32AVX2   (uint32_t adler, const uint8_t *p, size_t len);
+uint32_t crc32PCLMUL   (uint32_t crc, const uint8_t *p, size_t len);
+void     swapRB24SSE41 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel);
+void     bgrxToRGBSSE41(uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel);
+void     rgbxToRGBSSE41(uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel);
+void     extractChannelSSE41 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel, int n_channel, int channel);
+void     planesToRGBSSE41 (uint8_t *p_dst, const uint8_t *p_r, const uint8_t *p_g, const uint8_t *p_b, size_t n_pixel);
+void     initPlainNumbersSSE41 ();
+size_t   parsePlainNumbersSSE41 (uint8_t *p_dst, size_t n_num, const uint8_t *p_src, size_t len, int is_bit, size_t *p_used);
+int      unfilterRowSSE41 (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len);
+int      unfilterRowAVX2  (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len);
+void     matMul32SSE41 (int sz, const int32_t *p_a, int a_transpose, const int32_t *p_b, int b_transpose, int32_t *p_dst, int shift, int clip);
+void     matMul32AVX2  (int sz, const int32_t *p_a, int a_transpose, const int32_t *p_b, int b_transpose, int32_t *p_dst, int shift, int clip);
+
+
+#endif // __KERNELS_H__
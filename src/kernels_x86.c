@@ -0,0 +1,608 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "kernels.h"
+
+#ifdef CPU_X86
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+
+// the functions are compiled for their instruction set regardless of the compiler options, and are only called when initKernels() finds the CPU supports it
+#ifdef _MSC_VER
+  #define  TARGET_SSE41
+  #define  TARGET_PCLMUL
+  #define  TARGET_AVX2
+#else
+  #define  TARGET_SSE41  __attribute__((target("ssse3,sse4.1")))
+  #define  TARGET_PCLMUL __attribute__((target("ssse3,sse4.1,pclmul")))
+  #define  TARGET_AVX2   __attribute__((target("ssse3,sse4.1,avx2")))
+#endif
+
+
+#define  ADLER_BASE  65521
+#define  ADLER_NMAX  5552             // max bytes before the sums must be reduced, so that they do not overflow 32 bits (as zlib)
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Adler-32 : for each 32-byte block, a is increased by the sum of the bytes (PSADBW), and b by the bytes weighted by 32,31,...,1 (PMADDUBSW) plus 32 times a
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TARGET_SSE41 static uint32_t sumLanes (__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1)));
+    return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+
+// the remaining bytes which do not fill a block
+static uint32_t adler32Tail (uint32_t a, uint32_t b, const uint8_t *p, size_t len) {
+    for (; len>0; len--) {
+        a += *p++;
+        b += a;
+    }
+    return (a % ADLER_BASE) | ((b % ADLER_BASE) << 16);
+}
+
+
+TARGET_SSE41 uint32_t adler32SSE41 (uint32_t adler, const uint8_t *p, size_t len) {
+    const __m128i tap1 = _mm_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17);
+    const __m128i tap2 = _mm_setr_epi8(16,15,14,13,12,11,10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    size_t   n_blk = len / 32;
+    
+    len -= n_blk * 32;
+    
+    while (n_blk > 0) {
+        size_t  n = (n_blk < ADLER_NMAX/32) ? n_blk : ADLER_NMAX/32;
+        __m128i v_ps = _mm_cvtsi32_si128((int)(a * n));          // a before each block, summed
+        __m128i v_a  = zero;
+        __m128i v_b  = _mm_cvtsi32_si128((int)b);
+        n_blk -= n;
+        for (; n>0; n--) {
+            const __m128i x1 = _mm_loadu_si128((const __m128i*)p);
+            const __m128i x2 = _mm_loadu_si128((const __m128i*)(p+16));
+            v_ps = _mm_add_epi32(v_ps, v_a);
+            v_a  = _mm_add_epi32(v_a, _mm_sad_epu8(x1, zero));
+            v_b  = _mm_add_epi32(v_b, _mm_madd_epi16(_mm_maddubs_epi16(x1, tap1), ones));
+            v_a  = _mm_add_epi32(v_a, _mm_sad_epu8(x2, zero));
+            v_b  = _mm_add_epi32(v_b, _mm_madd_epi16(_mm_maddubs_epi16(x2, tap2), ones));
+            p += 32;
+        }
+        v_b = _mm_add_epi32(v_b, _mm_slli_epi32(v_ps, 5));
+        a  += sumLanes(v_a);
+        b   = sumLanes(v_b);
+        a  %= ADLER_BASE;
+        b  %= ADLER_BASE;
+    }
+    
+    return adler32Tail(a, b, p, len);
+}
+
+
+TARGET_AVX2 uint32_t adler32AVX2 (uint32_t adler, const uint8_t *p, size_t len) {
+    const __m256i tap  = _mm256_setr_epi8(32,31,30,29,28,27,26,25,24,23,22,21,20,19,18,17,16,15,14,13,12,11,10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    size_t   n_blk = len / 32;
+    
+    len -= n_blk * 32;
+    
+    while (n_blk > 0) {
+        size_t  n = (n_blk < ADLER_NMAX/32) ? n_blk : ADLER_NMAX/32;
+        __m256i v_ps = _mm256_setr_epi32((int)(a * n), 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_a  = zero;
+        __m256i v_b  = _mm256_setr_epi32((int)b, 0, 0, 0, 0, 0, 0, 0);
+        n_blk -= n;
+        for (; n>0; n--) {
+            const __m256i x = _mm256_loadu_si256((const __m256i*)p);
+            v_ps = _mm256_add_epi32(v_ps, v_a);
+            v_a  = _mm256_add_epi32(v_a, _mm256_sad_epu8(x, zero));
+            v_b  = _mm256_add_epi32(v_b, _mm256_madd_epi16(_mm256_maddubs_epi16(x, tap), ones));
+            p += 32;
+        }
+        v_b = _mm256_add_epi32(v_b, _mm256_slli_epi32(v_ps, 5));
+        a  += sumLanes(_mm_add_epi32(_mm256_castsi256_si128(v_a), _mm256_extracti128_si256(v_a, 1)));
+        b   = sumLanes(_mm_add_epi32(_mm256_castsi256_si128(v_b), _mm256_extracti128_si256(v_b, 1)));
+        a  %= ADLER_BASE;
+        b  %= ADLER_BASE;
+    }
+    
+    return adler32Tail(a, b, p, len);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// CRC-32 : folding 64 bytes at a time by carry-less multiply (PCLMULQDQ), then Barrett reduction, see Intel's paper "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t crc32Bitwise (uint32_t crc, const uint8_t *p, size_t len) {
+    int k;
+    for (; len>0; len--) {
+        crc ^= *p++;
+        for (k=0; k<8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return crc;
+}
+
+
+TARGET_PCLMUL uint32_t crc32PCLMUL (uint32_t crc, const uint8_t *p, size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(-1, 0, -1, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+    
+    if (len < 64)
+        return crc32Bitwise(crc, p, len);
+        
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(p     )), _mm_cvtsi32_si128((int)crc));
+    x2 = _mm_loadu_si128((const __m128i*)(p+16));
+    x3 = _mm_loadu_si128((const __m128i*)(p+32));
+    x4 = _mm_loadu_si128((const __m128i*)(p+48));
+    p   += 64;
+    len -= 64;
+    
+    for (; len>=64; p+=64, len-=64) {                 // fold 4 x 128 bits
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(p     )));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(p+16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(p+32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(p+48)));
+    }
+    
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);        // fold into 128 bits
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    
+    for (; len>=16; p+=16, len-=16) {                 // fold the remaining 128-bit blocks
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)p)), x5);
+    }
+    
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);        // fold 128 bits to 64 bits
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    
+    x2 = _mm_and_si128(x1, mask);                     // Barrett reduction to 32 bits
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    
+    return crc32Bitwise((uint32_t)_mm_extract_epi32(x1, 1), p, len);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// pixel format conversions : 4 pixels in a 16-byte register are shuffled (PSHUFB), the 16-byte stores overlap, so the loop stops 2 pixels before the end
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TARGET_SSE41 void swapRB24SSE41 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    const __m128i shuf = _mm_setr_epi8(2,1,0, 5,4,3, 8,7,6, 11,10,9, 12,13,14,15);   // the last 4 bytes are kept, so it also works in place
+    size_t i;
+    
+    for (i=0; i+6<=n_pixel; i+=4)
+        _mm_storeu_si128((__m128i*)(p_dst+3*i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p_src+3*i)), shuf));
+        
+    for (; i<n_pixel; i++) {
+        uint8_t R = p_src[3*i];
+        p_dst[3*i  ] = p_src[3*i+2];
+        p_dst[3*i+1] = p_src[3*i+1];
+        p_dst[3*i+2] = R;
+    }
+}
+
+
+TARGET_SSE41 void bgrxToRGBSSE41 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    const __m128i shuf = _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1);
+    size_t i;
+    
+    for (i=0; i+6<=n_pixel; i+=4)
+        _mm_storeu_si128((__m128i*)(p_dst+3*i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p_src+4*i)), shuf));
+        
+    for (; i<n_pixel; i++) {
+        p_dst[3*i  ] = p_src[4*i+2];
+        p_dst[3*i+1] = p_src[4*i+1];
+        p_dst[3*i+2] = p_src[4*i  ];
+    }
+}
+
+
+TARGET_SSE41 void rgbxToRGBSSE41 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel) {
+    const __m128i shuf = _mm_setr_epi8(0,1,2, 4,5,6, 8,9,10, 12,13,14, -1,-1,-1,-1);
+    size_t i;
+    
+    for (i=0; i+6<=n_pixel; i+=4)
+        _mm_storeu_si128((__m128i*)(p_dst+3*i), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p_src+4*i)), shuf));
+        
+    for (; i<n_pixel; i++) {
+        p_dst[3*i  ] = p_src[4*i  ];
+        p_dst[3*i+1] = p_src[4*i+1];
+        p_dst[3*i+2] = p_src[4*i+2];
+    }
+}
+
+
+// 16 pixels (16*n_channel bytes) in n_channel registers, the bytes of the channel are gathered from each of them and merged
+TARGET_SSE41 void extractChannelSSE41 (uint8_t *p_dst, const uint8_t *p_src, size_t n_pixel, int n_channel, int channel) {
+    int8_t  idx [4][16];
+    __m128i shuf [4];
+    size_t  i;
+    int     j, k;
+    
+    for (j=0; j<n_channel; j++) {
+        for (k=0; k<16; k++) {
+            int pos = n_channel*k + channel - 16*j;              // position of the byte of pixel k in register j
+            idx[j][k] = (pos >= 0 && pos < 16) ? (int8_t)pos : -1;
+        }
+        shuf[j] = _mm_loadu_si128((const __m128i*)idx[j]);
+    }
+    
+    for (i=0; i+16<=n_pixel; i+=16) {
+        const uint8_t *p = p_src + n_channel*i;
+        __m128i x = _mm_setzero_si128();
+        for (j=0; j<n_channel; j++)
+            x = _mm_or_si128(x, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p+16*j)), shuf[j]));
+        _mm_storeu_si128((__m128i*)(p_dst+i), x);
+    }
+    
+    for (; i<n_pixel; i++)
+        p_dst[i] = p_src[n_channel*i+channel];
+}
+
+
+// the reverse of extractChannelSSE41() : 16 bytes of each plane are spread to the three 16-byte registers of 16 pixels
+TARGET_SSE41 void planesToRGBSSE41 (uint8_t *p_dst, const uint8_t *p_r, const uint8_t *p_g, const uint8_t *p_b, size_t n_pixel) {
+    int8_t  idx [3][3][16];
+    __m128i shuf [3][3];
+    size_t  i;
+    int     j, c, k;
+    
+    for (j=0; j<3; j++) {
+        for (c=0; c<3; c++) {
+            for (k=0; k<16; k++)                                 // byte k of register j is channel (16*j+k)%3 of pixel (16*j+k)/3
+                idx[j][c][k] = ((16*j+k)%3 == c) ? (int8_t)((16*j+k)/3) : -1;
+            shuf[j][c] = _mm_loadu_si128((const __m128i*)idx[j][c]);
+        }
+    }
+    
+    for (i=0; i+16<=n_pixel; i+=16) {
+        __m128i r = _mm_loadu_si128((const __m128i*)(p_r+i));
+        __m128i g = _mm_loadu_si128((const __m128i*)(p_g+i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(p_b+i));
+        for (j=0; j<3; j++) {
+            __m128i x = _mm_or_si128(_mm_shuffle_epi8(r, shuf[j][0]), _mm_shuffle_epi8(g, shuf[j][1]));
+            x = _mm_or_si128(x, _mm_shuffle_epi8(b, shuf[j][2]));
+            _mm_storeu_si128((__m128i*)(p_dst+3*i+16*j), x);
+        }
+    }
+    
+    for (; i<n_pixel; i++) {
+        p_dst[3*i  ] = p_r[i];
+        p_dst[3*i+1] = p_g[i];
+        p_dst[3*i+2] = p_b[i];
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PNM text : the digits of a 16-byte window are found by compare, the value of each number is formed at its last digit from the two digits
+// before it (by PSHUFB tables of 10x and 100x modulo 256), then the values at the last digits are packed by PSHUFB with a table of bit masks
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t pick_index [256][8];         // the positions of the set bits of each 8-bit mask, then 0x80 (which PSHUFB turns to 0)
+static uint8_t pick_count [256];            // the number of set bits of each 8-bit mask
+
+
+static int lowestBit (uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+
+static int highestBit (uint32_t x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanReverse(&i, x);
+    return (int)i;
+#else
+    return 31 - __builtin_clz(x);
+#endif
+}
+
+
+void initPlainNumbersSSE41 () {
+    int m, k, n;
+    for (m=0; m<256; m++) {
+        for (n=k=0; k<8; k++)
+            if ((m >> k) & 1)
+                pick_index[m][n++] = (uint8_t)k;
+        pick_count[m] = (uint8_t)n;
+        for (; n<8; n++)
+            pick_index[m][n] = 0x80;
+    }
+}
+
+
+TARGET_SSE41 size_t parsePlainNumbersSSE41 (uint8_t *p_dst, size_t n_num, const uint8_t *p_src, size_t len, int is_bit, size_t *p_used) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c0   = _mm_set1_epi8('0');
+    const __m128i c9   = _mm_set1_epi8(9);
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i x10  = _mm_setr_epi8(0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 0, 0, 0, 0, 0, 0);
+    const __m128i x100 = _mm_setr_epi8(0, 100, (char)200, 44, (char)144, (char)244, 88, (char)188, 32, (char)132, 0, 0, 0, 0, 0, 0);   // 100*d modulo 256
+    __m128i d_prev = zero, isd_prev = zero, x, d, isd;
+    uint8_t vals [16];
+    size_t  pos, last = 0, i = 0;
+    
+    *p_used = 0;
+    
+    if (len < 32 || n_num == 0)
+        return 0;
+    
+    x   = _mm_loadu_si128((const __m128i*)p_src);
+    d   = _mm_sub_epi8(x, c0);
+    isd = _mm_cmpeq_epi8(_mm_min_epu8(d, c9), d);
+    
+    // the window at pos is parsed when the next one is loaded, since its last number may end there, the byte before p_src is taken as a non-digit
+    for (pos=0; pos+32<=len; pos+=16) {
+        __m128i  xn    = _mm_loadu_si128((const __m128i*)(p_src+pos+16));
+        __m128i  dn    = _mm_sub_epi8(xn, c0);
+        __m128i  isdn  = _mm_cmpeq_epi8(_mm_min_epu8(dn, c9), dn);
+        __m128i  dd    = _mm_and_si128(d, isd);
+        __m128i  isd1  = _mm_alignr_epi8(isd, isd_prev, 15);
+        __m128i  d1    = _mm_alignr_epi8(dd, d_prev, 15);
+        __m128i  d2    = _mm_and_si128(_mm_alignr_epi8(dd, d_prev, 14), isd1);                  // the digit 2 bytes before, only if the digit between is in the same number
+        __m128i  isl   = _mm_and_si128(_mm_and_si128(isd, isd1), _mm_and_si128(_mm_alignr_epi8(isd, isd_prev, 14), _mm_alignr_epi8(isd, isd_prev, 13)));
+        __m128i  v;
+        uint32_t dm    = (uint32_t)_mm_movemask_epi8(isd);
+        uint32_t ends  = dm & ~((dm >> 1) | ((uint32_t)_mm_movemask_epi8(isdn) << 15)) & 0xFFFF;      // the last digits
+        uint32_t stop  = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_andnot_si128(isd1, _mm_cmpeq_epi8(x, hash)), isl));   // a '#' which is not the byte after a number, or the 4th digit of a number
+        
+        if (is_bit)
+            v = _mm_cmpeq_epi8(_mm_or_si128(_mm_or_si128(dd, d1), d2), zero);
+        else
+            v = _mm_add_epi8(_mm_add_epi8(dd, _mm_shuffle_epi8(x10, d1)), _mm_shuffle_epi8(x100, d2));
+        
+        if (stop)
+            ends &= (1U << lowestBit(stop)) - 1;
+        
+        if (ends) {
+            if (n_num - i >= 16) {                         // the two 8-byte stores fit
+                _mm_storel_epi64((__m128i*)(p_dst+i), _mm_shuffle_epi8(v, _mm_loadl_epi64((const __m128i*)pick_index[ends & 0xFF])));
+                i += pick_count[ends & 0xFF];
+                _mm_storel_epi64((__m128i*)(p_dst+i), _mm_shuffle_epi8(_mm_srli_si128(v, 8), _mm_loadl_epi64((const __m128i*)pick_index[ends >> 8])));
+                i += pick_count[ends >> 8];
+                last = pos + highestBit(ends) + 2;
+            } else {
+                _mm_storeu_si128((__m128i*)vals, v);
+                for (; ends && i<n_num; ends&=ends-1) {
+                    int e = lowestBit(ends);
+                    p_dst[i++] = vals[e];
+                    last = pos + e + 2;
+                }
+            }
+        }
+        
+        if (stop || i >= n_num)
+            break;
+        
+        d_prev   = dd;
+        isd_prev = isd;
+        x   = xn;
+        d   = dn;
+        isd = isdn;
+    }
+    
+    *p_used = last;                                        // after the byte which follows the last number, the caller parses the rest
+    return i;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PNG unfilter : the up filter runs on whole registers, the sub, average and Paeth filters depend on the pixel on the left, so they run a pixel (3 or 4 bytes) at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TARGET_SSE41 static __m128i loadPixel (const uint8_t *p, size_t bpp) {
+    uint32_t v = 0;
+    memcpy(&v, p, bpp);
+    return _mm_cvtsi32_si128((int)v);
+}
+
+
+TARGET_SSE41 static void storePixel (uint8_t *p, __m128i x, size_t bpp) {
+    uint32_t v = (uint32_t)_mm_cvtsi128_si32(x);
+    memcpy(p, &v, bpp);
+}
+
+
+// bpp = 3 or 4, p_prev is not NULL for filter 3 and 4
+TARGET_SSE41 static void unfilterPixels (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i a = zero, b, c = zero, x;                 // a : left, b : up, c : up-left, as the PNG specification
+    size_t i;
+    
+    if (filter_type == 1) {
+        for (i=0; i<len; i+=bpp) {
+            a = _mm_add_epi8(loadPixel(p_scan+i, bpp), a);
+            storePixel(p_recon+i, a, bpp);
+        }
+    } else if (filter_type == 3) {
+        for (i=0; i<len; i+=bpp) {
+            b = loadPixel(p_prev+i, bpp);
+            x = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));   // PAVGB rounds up, so subtract the lost bit to get (a+b)/2
+            a = _mm_add_epi8(loadPixel(p_scan+i, bpp), x);
+            storePixel(p_recon+i, a, bpp);
+        }
+    } else {
+        for (i=0; i<len; i+=bpp) {                    // in 16-bit lanes, p-a = b-c, p-b = a-c, p-c = (b-c)+(a-c)
+            __m128i pa, pb, pc, pmin;
+            b  = _mm_unpacklo_epi8(loadPixel(p_prev+i, bpp), zero);
+            pa = _mm_sub_epi16(b, c);
+            pb = _mm_sub_epi16(a, c);
+            pc = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+            pa = _mm_abs_epi16(pa);
+            pb = _mm_abs_epi16(pb);
+            pmin = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            x  = _mm_blendv_epi8(_mm_blendv_epi8(c, b, _mm_cmpeq_epi16(pmin, pb)), a, _mm_cmpeq_epi16(pmin, pa));   // ties prefer a, then b
+            a  = _mm_add_epi8(_mm_unpacklo_epi8(loadPixel(p_scan+i, bpp), zero), x);                               // the high bytes stay 0
+            storePixel(p_recon+i, _mm_packus_epi16(a, a), bpp);
+            c  = b;
+        }
+    }
+}
+
+
+TARGET_SSE41 int unfilterRowSSE41 (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len) {
+    size_t i;
+    
+    if (filter_type == 2 && p_prev) {
+        for (i=0; i+16<=len; i+=16)
+            _mm_storeu_si128((__m128i*)(p_recon+i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(p_scan+i)), _mm_loadu_si128((const __m128i*)(p_prev+i))));
+        for (; i<len; i++)
+            p_recon[i] = p_scan[i] + p_prev[i];
+        return 0;
+    }
+    
+    if ((filter_type == 1 || ((filter_type == 3 || filter_type == 4) && p_prev)) && len % bpp == 0) {
+        if (bpp == 3) {                               // separate calls with a constant bpp, so that the pixel loads and stores are inlined
+            unfilterPixels(p_recon, p_scan, p_prev, 3, filter_type, len);
+            return 0;
+        } else if (bpp == 4) {
+            unfilterPixels(p_recon, p_scan, p_prev, 4, filter_type, len);
+            return 0;
+        }
+    }
+    
+    return 1;
+}
+
+
+TARGET_AVX2 int unfilterRowAVX2 (uint8_t *p_recon, const uint8_t *p_scan, const uint8_t *p_prev, size_t bpp, int filter_type, size_t len) {
+    size_t i;
+    
+    if (filter_type == 2 && p_prev) {
+        for (i=0; i+32<=len; i+=32)
+            _mm256_storeu_si256((__m256i*)(p_recon+i), _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(p_scan+i)), _mm256_loadu_si256((const __m256i*)(p_prev+i))));
+        for (; i<len; i++)
+            p_recon[i] = p_scan[i] + p_prev[i];
+        return 0;
+    }
+    
+    return unfilterRowSSE41(p_recon, p_scan, p_prev, bpp, filter_type, len);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// matrix multiply : each row of dst is a sum of the rows of b, weighted by the elements of a row of a, 4 (SSE4.1) or 8 (AVX2) columns at a time
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// a transposed b is copied, so that the columns of dst are loaded from the rows of b
+TARGET_SSE41 void matMul32SSE41 (int sz, const int32_t *p_a, int a_transpose, const int32_t *p_b, int b_transpose, int32_t *p_dst, int shift, int clip) {
+    const __m128i add = _mm_set1_epi32(1 << shift >> 1);
+    const __m128i sft = _mm_cvtsi32_si128(shift);
+    const __m128i lo  = _mm_set1_epi32(-32768);
+    const __m128i hi  = _mm_set1_epi32( 32767);
+    const int     ai  = a_transpose ? 1 : MAT_STRIDE;     // step of a[i][k] along i and k
+    const int     ak  = a_transpose ? MAT_STRIDE : 1;
+    int32_t bt [MAT_STRIDE*MAT_STRIDE];
+    int i, j, k;
+    
+    if (b_transpose) {
+        for (k=0; k<sz; k++)
+            for (j=0; j<sz; j++)
+                bt[k*MAT_STRIDE+j] = p_b[j*MAT_STRIDE+k];
+        p_b = bt;
+    }
+    
+    for (i=0; i<sz; i++) {
+        for (j=0; j<sz; j+=4) {
+            __m128i s = add;
+            for (k=0; k<sz; k++)
+                s = _mm_add_epi32(s, _mm_mullo_epi32(_mm_set1_epi32(p_a[i*ai+k*ak]), _mm_loadu_si128((const __m128i*)(p_b+k*MAT_STRIDE+j))));
+            s = _mm_sra_epi32(s, sft);
+            if (clip)
+                s = _mm_min_epi32(_mm_max_epi32(s, lo), hi);
+            _mm_storeu_si128((__m128i*)(p_dst+i*MAT_STRIDE+j), s);
+        }
+    }
+}
+
+
+TARGET_AVX2 void matMul32AVX2 (int sz, const int32_t *p_a, int a_transpose, const int32_t *p_b, int b_transpose, int32_t *p_dst, int shift, int clip) {
+    const __m256i add = _mm256_set1_epi32(1 << shift >> 1);
+    const __m128i sft = _mm_cvtsi32_si128(shift);
+    const __m256i lo  = _mm256_set1_epi32(-32768);
+    const __m256i hi  = _mm256_set1_epi32( 32767);
+    const int     ai  = a_transpose ? 1 : MAT_STRIDE;
+    const int     ak  = a_transpose ? MAT_STRIDE : 1;
+    int32_t bt [MAT_STRIDE*MAT_STRIDE];
+    int i, j, k;
+    
+    if (sz < 8) {
+        matMul32SSE41(sz, p_a, a_transpose, p_b, b_transpose, p_dst, shift, clip);
+        return;
+    }
+    
+    if (b_transpose) {
+        for (k=0; k<sz; k++)
+            for (j=0; j<sz; j++)
+                bt[k*MAT_STRIDE+j] = p_b[j*MAT_STRIDE+k];
+        p_b = bt;
+    }
+    
+    for (i=0; i<sz; i++) {
+        for (j=0; j<sz; j+=8) {
+            __m256i s = add;
+            for (k=0; k<sz; k++)
+                s = _mm256_add_epi32(s, _mm256_mullo_epi32(_mm256_set1_epi32(p_a[i*ai+k*ak]), _mm256_loadu_si256((const __m256i*)(p_b+k*MAT_STRIDE+j))));
+            s = _mm256_sra_epi32(s, sft);
+            if (clip)
+                s = _mm256_min_epi32(_mm256_max_epi32(s, lo), hi);
+            _mm256_storeu_si256((__m256i*)(p_dst+i*MAT_STRIDE+j), s);
+        }
+    }
+}
+
+
+#endif // CPU_X86
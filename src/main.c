@@ -1,8 +1,20 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "arena.h"
 #include "imageio.h"
+#include "console.h"
+#include "platform.h"
+#include "memstat.h"
+#include "bench.h"
+#include "joblist.h"
+#include "batchio.h"
+#include "convcache.h"
+#include "server.h"
+#include "cpu.h"
+#include "kernels.h"
 
 
 const char *USAGE = 
@@ -11,6 +23,7 @@ const char *USAGE =
   "|------------------------------------------------------------------------------------|\n"
   "| Usage:                                                                             |\n"
   "|   ImCvt [-switches]  <in1> -o <out1>  [<in2> -o <out2]  ...                        |\n"
+  "|   an <in> can have several -o <out>, then it is decoded only once                  |\n"
   "|                                                                                    |\n"
   "| Where <in> and <out> can be:                                                       |\n"
   "|   .pnm (Portable Any Map)          : gray 8-bit or RGB 24-bit                      |\n"
@@ -21,90 +34,215 @@ const char *USAGE =
   "|   .qoi (Quite OK Image)            : RGB 24-bit                                    |\n"
   "|   .jls (JPEG-LS Image)             : gray 8-bit or RGB 24-bit, can be <out> only!  |\n"
   "|   .h265 (H.265/HEVC Image)         : gray 8-bit              , can be <out> only!  |\n"
+  "|   - (standard input/output)        : <in> of any format above (by its content), or |\n"
+  "|                                      <out> of the format of --to <SUFFIX> (png)    |\n"
   "|                                                                                    |\n"
   "| switches:    -f                    : force overwrite of output file                |\n"
   "|              -0, -1, -2, -3, -4    : JPEG-LS near value or H.265 (qp-4)/6 value    |\n"
+  "|              -j <N>                : convert N files in parallel, 0=all cores      |\n"
+  "|              --mem-limit <SIZE>    : with -j, start a file only if the estimated   |\n"
+  "|                                      peak memory of running files fits SIZE, as 4G |\n"
+  "|              -@ <FILE>             : also convert the <in> <out>... lines of FILE  |\n"
+  "|              -r                    : an <in> directory converts its image tree to  |\n"
+  "|                                      the same paths under each -o <out> directory  |\n"
+  "|              --to <SUFFIX>         : suffix of the outputs without -o (png)        |\n"
+  "|              --incremental[=FILE]  : skip inputs with up-to-date outputs, recorded |\n"
+  "|                                      in FILE (ImCvt.cache), overwrite stale ones   |\n"
+  "|              -p                    : encode the outputs of an input in parallel    |\n"
+  "|              -s                    : stream by rows, low memory (not for .h265)    |\n"
+  "|              --prefetch[=N]        : read, encode and write in 3 threads, N files  |\n"
+  "|              -v, --stats           : print time of each stage, sizes and MP/s      |\n"
+  "|              --json=<FILE>         : write stats as JSON lines, - for stdout       |\n"
+  "|              --bench[=N]           : benchmark codecs in memory, N iterations      |\n"
+  "|              --cpu=<LEVEL>         : SIMD kernels: scalar, sse4.1 or avx2 (best)   |\n"
+  "|              --serve <PATH>        : serve conversions on the socket PATH, with -j |\n"
+  "|                                      N workers (all cores), see README             |\n"
   "|------------------------------------------------------------------------------------|\n"
   "\n";
 
 
 
-// return:   1 : match    0 : mismatch
-static int matchSuffixIgnoringCase (const char *string, const char *suffix) {
-    #define  TO_LOWER(c)   ((((c) >= 'A') && ((c) <= 'Z')) ? ((c)+32) : (c))
-    const char *p1, *p2;
-    for (p1=string; *p1; p1++);
-    for (p2=suffix; *p2; p2++);
-    while (TO_LOWER(*p1) == TO_LOWER(*p2)) {
-        if (p2 <= suffix)
-            return 1;
-        if (p1 <= string)
-            return 0;
-        p1 --;
-        p2 --;
-    }
-    return 0;
+// return:   1 : the file name is "-", which is the standard input (as an input) or output (as an output)
+static int isStdStreamName (const char *p_fname) {
+    return (p_fname[0] == '-' && p_fname[1] == '\0');
+}
+
+
+static int fileExist (const char *p_filename) {
+    FILE *fp = fopen(p_filename, "rb");
+    if (fp) fclose(fp);
+    return (fp != NULL);
+}
+
+
+// return:   1 : the two paths are the same file (by its identity, so also through a link or a different spelling)    0 : different, or any of them does not exist
+static int isSameFile (const char *p_fname1, const char *p_fname2) {
+    uint64_t id1 [2], id2 [2];
+    return !getFileId(p_fname1, id1) && !getFileId(p_fname2, id2) && id1[0] == id2[0] && id1[1] == id2[1];
 }
 
 
-static void replaceFileSuffix (char *p_dst, const char *p_src, const char *p_suffix) {
-    char *p;
-    char *p_base = p_dst;
+// parse a size in bytes, which can end with K, M or G (case insensitive), as "4G" or "65536"
+// return:   0 : success    1 : not a size (no digits, an unknown suffix, or too large)
+static int parseSize (const char *p_str, uint64_t *p_size) {
+    const char *p = p_str;
+    int n_shift = 0;
     
-    for (; *p_src; p_src++)         // traversal p_src
-        *(p_dst++) = *p_src;        // copy p_src to p_dst
-    *p_dst = '\0';
+    if (*p < '0' || *p > '9')
+        return 1;
     
-    for (p=p_dst; ; p--) {          // reverse traversal p_dst
-        if (p < p_base || *p=='/' || *p=='\\') {
-            break;
-        }
-        if (*p == '.') {
-            p_dst = p;
-            break;
-        }
+    for ((*p_size)=0; *p >= '0' && *p <= '9'; p++) {
+        if ((*p_size) > (UINT64_MAX - 9) / 10)
+            return 1;
+        (*p_size) = (*p_size) * 10 + (*p - '0');
     }
     
-    *(p_dst++) = '.';
-    
-    for (; *p_suffix; p_suffix++) { // traversal p_suffix
-        *(p_dst++) = *p_suffix;     // copy p_suffix to p_dst
+    switch (*p) {
+        case 'G' : case 'g' : n_shift += 10;   // fall through
+        case 'M' : case 'm' : n_shift += 10;   // fall through
+        case 'K' : case 'k' : n_shift += 10;
+                              p ++;
+                              break;
     }
-    *p_dst = '\0';
+    
+    if (*p != '\0' || (*p_size) > (UINT64_MAX >> n_shift))
+        return 1;
+    
+    (*p_size) <<= n_shift;
+    return 0;
 }
 
 
-static int fileExist (const char *p_filename) {
-    FILE *fp = fopen(p_filename, "rb");
-    if (fp) fclose(fp);
-    return (fp != NULL);
-}
+#define  DEFAULT_BENCH_ITER  5
 
+#define  DEFAULT_PREFETCH    3        // one file in each stage of the pipeline: reading, encoding, writing
 
-#define  MAX_N_FILE  999
+#define  DEFAULT_CACHE_FNAME "ImCvt.cache"
 
 
 static void parseCommand (
     int   argc, char **argv,
     int   switches[128],
-    int  *p_n_file,
-    char *src_fnames[MAX_N_FILE],
-    char *dst_fnames[MAX_N_FILE]
+    int  *p_n_thread,
+    int  *p_bench_iter,
+    int  *p_prefetch,
+    char **p_json_fname,
+    char **p_list_fname,
+    char **p_cache_fname,
+    char **p_to_suffix,
+    char **p_serve_path,
+    char **p_mem_limit,
+    char **p_cpu_name,
+    int  *p_n_fname,
+    char *fnames[],                   // file names in order, each input name is followed by its output names. Must have space for at least argc elements
+    int   is_dst[]                    // 1 : fnames[i] is an output name (after -o)    0 : fnames[i] is an input name
 ) {
     int i, next_is_dst=0;
     
     for (i=0; i<128; i++)
         switches[i] = 0;
     
-    for (i=0; i<MAX_N_FILE; i++)
-        src_fnames[i] = dst_fnames[i] = NULL;
+    for (i=0; i<argc; i++) {
+        fnames[i] = NULL;
+        is_dst[i] = 0;
+    }
     
-    (*p_n_file) = -1;
+    (*p_n_thread) = -1;               // not specified
+    (*p_bench_iter) = 0;
+    (*p_prefetch) = 0;
+    (*p_json_fname) = NULL;
+    (*p_list_fname) = NULL;
+    (*p_cache_fname) = NULL;
+    (*p_to_suffix) = NULL;
+    (*p_serve_path) = NULL;
+    (*p_mem_limit) = NULL;
+    (*p_cpu_name) = NULL;
+    (*p_n_fname) = 0;
     
     for (i=1; i<argc; i++) {
         char *arg = argv[i];
         
-        if      (arg[0] == '-') {                   // parse switches
+        if      (strcmp(arg, "--bench") == 0) {     // parse benchmark mode, as "--bench" or "--bench=N"
+            
+            (*p_bench_iter) = DEFAULT_BENCH_ITER;
+            
+        } else if (strncmp(arg, "--json=", 7) == 0) {   // parse JSON stats output file, as "--json=FILE", or "--json=-" for stdout
+            
+            (*p_json_fname) = arg + 7;
+            
+        } else if (strcmp(arg, "--stats") == 0) {   // same as -v
+            
+            switches['v'] = 1;
+            
+        } else if (strncmp(arg, "--bench=", 8) == 0) {
+            
+            (*p_bench_iter) = atoi(arg+8);
+            if ((*p_bench_iter) < 1)
+                (*p_bench_iter) = 1;
+            
+        } else if (strcmp(arg, "--prefetch") == 0) {   // parse pipeline depth, as "--prefetch" or "--prefetch=N"
+            
+            (*p_prefetch) = DEFAULT_PREFETCH;
+            
+        } else if (strncmp(arg, "--prefetch=", 11) == 0) {
+            
+            (*p_prefetch) = atoi(arg+11);
+            if ((*p_prefetch) < 2)
+                (*p_prefetch) = 2;
+            
+        } else if (strcmp(arg, "--incremental") == 0) {   // parse incremental mode, as "--incremental" or "--incremental=FILE" (the cache file)
+            
+            (*p_cache_fname) = DEFAULT_CACHE_FNAME;
+            
+        } else if (strncmp(arg, "--incremental=", 14) == 0) {
+            
+            (*p_cache_fname) = arg + 14;
+            
+        } else if (strcmp(arg, "--serve") == 0 || strncmp(arg, "--serve=", 8) == 0) {   // parse server mode, as "--serve PATH" or "--serve=PATH" (the socket)
+            
+            if (arg[7] == '=')
+                (*p_serve_path) = arg + 8;
+            else if (i+1 < argc)
+                (*p_serve_path) = argv[++i];
+            
+        } else if (strcmp(arg, "--mem-limit") == 0 || strncmp(arg, "--mem-limit=", 12) == 0) {   // parse memory budget, as "--mem-limit SIZE" or "--mem-limit=SIZE", where SIZE is in bytes, or ends with K, M or G
+            
+            if (arg[11] == '=')
+                (*p_mem_limit) = arg + 12;
+            else
+                (*p_mem_limit) = (i+1 < argc) ? argv[++i] : "";
+            
+        } else if (strcmp(arg, "--cpu") == 0 || strncmp(arg, "--cpu=", 6) == 0) {   // parse SIMD level, as "--cpu NAME" or "--cpu=NAME" (see cpu.h)
+            
+            if (arg[5] == '=')
+                (*p_cpu_name) = arg + 6;
+            else if (i+1 < argc)
+                (*p_cpu_name) = argv[++i];
+            
+        } else if (strcmp(arg, "--to") == 0 || strncmp(arg, "--to=", 5) == 0) {   // parse output suffix, as "--to SUFFIX" or "--to=SUFFIX", where SUFFIX can have a leading '.'
+            
+            if (arg[4] == '=')
+                (*p_to_suffix) = arg + 5;
+            else if (i+1 < argc)
+                (*p_to_suffix) = argv[++i];
+            if ((*p_to_suffix) && (*p_to_suffix)[0] == '.')
+                (*p_to_suffix) ++;
+            
+        } else if (arg[0] == '-' && arg[1] == '@') {  // parse job list file, as "-@ FILE" or "-@FILE", or "-@ -" for stdin
+            
+            if (arg[2])
+                (*p_list_fname) = arg + 2;
+            else if (i+1 < argc)
+                (*p_list_fname) = argv[++i];
+            
+        } else if (arg[0] == '-' && arg[1] == 'j') {  // parse thread count, as "-j N" or "-jN"
+            
+            if (arg[2])
+                (*p_n_thread) = atoi(arg+2);
+            else if (i+1 < argc)
+                (*p_n_thread) = atoi(argv[++i]);
+            
+        } else if (arg[0] == '-' && arg[1]) {       // parse switches, a lone "-" is a file name (the standard input or output)
             
             for (arg++ ; *arg ; arg++) {
                 if (0<= (int)(*arg) && (int)(*arg) < 128)
@@ -114,111 +252,1748 @@ static void parseCommand (
                     next_is_dst = 1;
             }
             
-        } else if ((*p_n_file)+1 < MAX_N_FILE) {   // parse file names
+        } else {                                    // parse file names, an input can have several outputs, as "<in> -o <out1> -o <out2>"
             
-            if (next_is_dst) {
-                next_is_dst = 0;
-                
-                dst_fnames[(*p_n_file)] = arg;
-            } else {
-                (*p_n_file)++;
-                
-                src_fnames[(*p_n_file)] = arg;
-            }
+            fnames[(*p_n_fname)] = arg;
+            is_dst[(*p_n_fname)] = next_is_dst;
+            (*p_n_fname)++;
+            next_is_dst = 0;
         }
     }
-    
-    (*p_n_file)++;
 }
 
 
-#define  ERROR(error_message,fname) {   \
-    printf("   ***ERROR: ");            \
-    printf((error_message), (fname));   \
-    printf("\n");                       \
-    continue;                           \
+static int isPNMFileName (const char *p_fname) {
+    return matchSuffixIgnoringCase(p_fname, "pnm") || matchSuffixIgnoringCase(p_fname, "ppm") || matchSuffixIgnoringCase(p_fname, "pgm");
 }
 
 
-int main (int argc, char **argv) {
-    int  i_file, n_file, n_success=0, n_failed;
+static int isHEVCFileName (const char *p_fname) {
+    return matchSuffixIgnoringCase(p_fname, "h265") || matchSuffixIgnoringCase(p_fname, "265") || matchSuffixIgnoringCase(p_fname, "hevc");
+}
+
+
+// return:   1 : the output can be encoded from a row source (see streamImageFile()), not H.265, which needs the whole image, nor BMP to the standard output, which can not seek
+static int isStreamable (const char *p_dst_fname, const char *p_codec_fname) {
+    return !isHEVCFileName(p_codec_fname) && !(isStdStreamName(p_dst_fname) && matchSuffixIgnoringCase(p_codec_fname, "bmp"));
+}
+
+
+// return: name of the output codec, which is decided by the suffix of the output file name
+static const char* getCodecName (const char *p_dst_fname) {
+    if (isPNMFileName (p_dst_fname))                 return "pnm";
+    if (matchSuffixIgnoringCase(p_dst_fname, "png")) return "png";
+    if (matchSuffixIgnoringCase(p_dst_fname, "bmp")) return "bmp";
+    if (matchSuffixIgnoringCase(p_dst_fname, "qoi")) return "qoi";
+    if (matchSuffixIgnoringCase(p_dst_fname, "jls")) return "jls";
+    if (isHEVCFileName(p_dst_fname))                 return "h265";
+    return "unknown";
+}
+
+
+// return: the encoder setting which affects the output, which is recorded in the --incremental cache, -1 if none
+static int getCodecSetting (const char *p_dst_fname, int jls_near) {
+    const char *p_codec = getCodecName(p_dst_fname);
+    return (strcmp(p_codec, "jls") == 0 || strcmp(p_codec, "h265") == 0) ? jls_near : -1;
+}
+
+
+static const char* getFormatName (ImageFormat_t format) {
+    switch (format) {
+        case IMAGE_FORMAT_PNM : return "pnm";
+        case IMAGE_FORMAT_PNG : return "png";
+        case IMAGE_FORMAT_BMP : return "bmp";
+        case IMAGE_FORMAT_QOI : return "qoi";
+        default               : return "unknown";
+    }
+}
+
+
+static uint64_t getFileSize (const char *p_filename) {
+    uint64_t size;
+    int64_t  mtime;
+    return getFileInfo(p_filename, &size, &mtime) ? 0 : size;
+}
+
+
+typedef struct {
+    int force_write;
+    int jls_near;
+    int stream;
+    int parallel_outputs;             // encode the outputs of an input in parallel threads
+    int verbose;                      // print the stats of each file and a summary
+    FILE *fp_json;                    // write the stats of each file and a summary as JSON lines to it, NULL to disable
+    ConvertCache_t *p_cache;          // skip the files whose outputs are up to date, and record the converted outputs to it (see convcache.h), NULL to disable
+    const char *p_to_suffix;          // format of the standard output "-", NULL for the default (png)
+    uint64_t mem_limit;               // a parallel batch starts a job only while the estimated peak memory of the running jobs stays under it, 0 for no limit
+} ConvertOptions_t;
+
+
+// return: the name whose suffix selects the codec of an output, which is the output name itself, except for the standard output, whose format is given by --to
+static const char* getCodecFileName (const char *p_dst_fname, const ConvertOptions_t *p_opt) {
+    if (!isStdStreamName(p_dst_fname))
+        return p_dst_fname;
+    return p_opt->p_to_suffix ? p_opt->p_to_suffix : "png";
+}
+
+
+// for an input with several outputs, encode_ns, write_ns and dst_bytes are the sums of all outputs
+typedef struct {
+    uint64_t probe_ns;                // map the source file and probe its format
+    uint64_t decode_ns;
+    uint64_t encode_ns;               // for streaming conversion, this is decode + encode + write, since they are interleaved
+    uint64_t write_ns;                // for an output encoded straight into the mapped file, only its creation and close
+    uint64_t src_bytes;
+    uint64_t dst_bytes;
+    uint64_t n_pixel;
+    uint64_t peak_alloc;              // peak heap bytes allocated by the conversion (see memstat.h), for the batch total, it is the maximum of all files
+    uint32_t height;
+    uint32_t width;
+    int      is_rgb;
+    ImageFormat_t src_format;
+    int      n_skipped;               // 1 if nothing is converted, since the outputs are up to date (see --incremental) or the only output is the input (see -r), for the batch total, it is the number of such files
+} ConvertStats_t;
+
+
+static void printStats (const char *p_title, const ConvertStats_t *p_stats, uint64_t total_ns) {
+    consolePrintf("%sprobe %.2f ms  decode %.2f ms  encode %.2f ms  write %.2f ms  |  %llu -> %llu bytes (%.2f:1)  %.2f MP/s\n",
+        p_title,
+        p_stats->probe_ns  / 1e6,
+        p_stats->decode_ns / 1e6,
+        p_stats->encode_ns / 1e6,
+        p_stats->write_ns  / 1e6,
+        (unsigned long long)p_stats->src_bytes,
+        (unsigned long long)p_stats->dst_bytes,
+        p_stats->dst_bytes ? (double)p_stats->src_bytes / p_stats->dst_bytes : 0.0,
+        total_ns ? p_stats->n_pixel * 1e3 / total_ns : 0.0
+    );
+}
+
+
+// encode the rows of p_rs to a file (or the standard output, except BMP, which needs seeking), with memory proportional to the image width
+// p_codec_fname : see getCodecFileName()
+// return:   0 : success    1 : failed    -1 : unsupported output suffix
+static int streamImageFile (const char *p_dst_fname, const char *p_codec_fname, ImageRowSource_t *p_rs, int jls_near, uint64_t *p_dst_len) {
+    int failed;
+    FILE *fp;
     
-    int  switches[128];
-    char *src_fnames[MAX_N_FILE], *dst_fnames[MAX_N_FILE];
+    if (!isPNMFileName(p_codec_fname) && !matchSuffixIgnoringCase(p_codec_fname, "png") && !matchSuffixIgnoringCase(p_codec_fname, "bmp") && !matchSuffixIgnoringCase(p_codec_fname, "qoi") && !matchSuffixIgnoringCase(p_codec_fname, "jls"))
+        return -1;
+    
+    if ((fp = openOutputStream(p_dst_fname)) == NULL)
+        return 1;
     
-    int force_write, jls_near;
+    if (isPNMFileName(p_codec_fname)) {
+        failed = streamPNMImage(p_rs, fp);
+    } else if (matchSuffixIgnoringCase(p_codec_fname, "png")) {
+        failed = streamPNGImage(p_rs, fp);
+    } else if (matchSuffixIgnoringCase(p_codec_fname, "bmp")) {
+        failed = streamBMPImage(p_rs, fp);
+    } else if (matchSuffixIgnoringCase(p_codec_fname, "qoi")) {
+        failed = streamQOIImage(p_rs, fp);
+    } else {
+        failed = streamJLSImage(p_rs, fp, jls_near);
+    }
     
-    parseCommand(argc, argv, switches, &n_file, src_fnames, dst_fnames);
+    if (!failed)                        // BMP rows are written by seeking, so the end of file is not always the current position (the size of a pipe is unknown)
+        getOutputStreamLength(fp, p_dst_len);
     
-    force_write = switches['F'] || switches['f'];
-    jls_near    = switches['4']?4: switches['3']?3: switches['2']?2: switches['1']?1: 0;
+    failed |= closeOutputStream(fp);
     
-    if (n_file <= 0) {
-        printf(USAGE);
+    if (failed && !isStdStreamName(p_dst_fname))
+        remove(p_dst_fname);            // do not leave a truncated file
+    
+    return failed;
+}
+
+
+// return:   0 : success    1 : failed    -1 : unsupported output suffix
+static int encodeImageBySuffix (const char *p_dst_fname, const ImageDesc_t *p_img, int jls_near, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    if        (matchSuffixIgnoringCase(p_dst_fname, "png")) {
+        return encodePNGImage (p_img, pp_dst, p_dst_len, p_arena);
+    } else if (matchSuffixIgnoringCase(p_dst_fname, "bmp")) {
+        return encodeBMPImage (p_img, pp_dst, p_dst_len, p_arena);
+    } else if (matchSuffixIgnoringCase(p_dst_fname, "qoi")) {
+        return encodeQOIImage (p_img, pp_dst, p_dst_len, p_arena);
+    } else if (matchSuffixIgnoringCase(p_dst_fname, "jls")) {
+        return encodeJLSImage (p_img, jls_near, pp_dst, p_dst_len, p_arena);
+    } else if (isHEVCFileName(p_dst_fname)) {
+        return encodeHEVCImage(p_img, jls_near, pp_dst, p_dst_len, p_arena);
+    } else {
+        return -1;
+    }
+}
+
+
+// encode the image straight into the output file, see writeXXXImageFile() in imageio.h
+// return:   0 : success    1 : failed    -1 : unsupported output suffix
+static int writeImageBySuffix (const char *p_dst_fname, const ImageDesc_t *p_img, int jls_near) {
+    if        (matchSuffixIgnoringCase(p_dst_fname, "png")) {
+        return writePNGImageFile (p_dst_fname, p_img);
+    } else if (matchSuffixIgnoringCase(p_dst_fname, "bmp")) {
+        return writeBMPImageFile (p_dst_fname, p_img);
+    } else if (matchSuffixIgnoringCase(p_dst_fname, "qoi")) {
+        return writeQOIImageFile (p_dst_fname, p_img);
+    } else if (matchSuffixIgnoringCase(p_dst_fname, "jls")) {
+        return writeJLSImageFile (p_dst_fname, p_img, jls_near);
+    } else if (isHEVCFileName(p_dst_fname)) {
+        return writeHEVCImageFile(p_dst_fname, p_img, jls_near);
+    } else {
         return -1;
     }
+}
+
+
+// an output of an input, all the outputs share the decoded pixels
+typedef struct {
+    const char    *p_dst_fname;
+    const char    *p_codec_fname;     // see getCodecFileName()
+    ImageDesc_t    img;               // the pixels, shared by all outputs
+    int            jls_near;
+    Arena_t       *p_arena;
+    int            defer_write;       // 1 : keep the encoded stream in p_dst, to be written later by writeOutputFile()
+    
+    int            failed;            // 0 : success    1 : failed    -1 : unsupported output suffix
+    int            written;
+    uint8_t       *p_dst;             // encoded stream which is not written yet
+    size_t         dst_len;
+    uint64_t       encode_ns;
+    uint64_t       write_ns;
+    uint64_t       dst_bytes;
+    size_t         peak_alloc;        // only for the outputs encoded in their own threads
+    ConsoleBuffer_t log;              // only for the outputs encoded in their own threads
+} OutputTask_t;
+
+
+static void writeOutputFile (OutputTask_t *p_task) {
+    uint64_t t;
+    
+    if (p_task->failed || p_task->written)
+        return;
+    
+    t = getTimeNs();
+    
+    if (p_task->p_dst == NULL) {      // a PNM file, the pixels are already in PNM layout, so they are written directly without encoding
+        p_task->failed    = writePNMImageFile(p_task->p_dst_fname, &p_task->img);
+        p_task->dst_bytes = p_task->failed ? 0 : getFileSize(p_task->p_dst_fname);
+    } else {
+        p_task->failed    = writeBufferToFile(p_task->p_dst_fname, p_task->p_dst, p_task->dst_len);
+        p_task->dst_bytes = p_task->dst_len;
+        arenaFree(p_task->p_arena, p_task->p_dst);
+        p_task->p_dst = NULL;
+    }
+    
+    p_task->write_ns = getTimeNs() - t;
+    p_task->written  = 1;
+}
+
+
+static void writeOutput (OutputTask_t *p_task) {
+    uint64_t t;
     
+    if (p_task->written)              // already streamed by readStage()
+        return;
     
-    for (i_file=0; i_file<n_file; i_file++) {
-        char *p_src_fname = src_fnames[i_file];
-        char *p_dst_fname = dst_fnames[i_file];
+    if (isStdStreamName(p_task->p_dst_fname)) {   // the standard output can not be mapped, and its size can not be got afterwards, so the stream is encoded in memory and written then
+        t = getTimeNs();
+        if (isPNMFileName(p_task->p_codec_fname))
+            p_task->failed = encodePNMImage(&p_task->img, &p_task->p_dst, &p_task->dst_len, p_task->p_arena);
+        else
+            p_task->failed = encodeImageBySuffix(p_task->p_codec_fname, &p_task->img, p_task->jls_near, &p_task->p_dst, &p_task->dst_len, p_task->p_arena);
+        p_task->encode_ns = getTimeNs() - t;
+        if (!p_task->defer_write)
+            writeOutputFile(p_task);
+        
+    } else if (isPNMFileName(p_task->p_dst_fname)) {
+        if (!p_task->defer_write)
+            writeOutputFile(p_task);
         
-        uint8_t *img_buf=NULL;
-        uint32_t height=0, width=0;
-        int      is_rgb=0;
-        int      failed=0;
+    } else if (p_task->defer_write) {
+        t = getTimeNs();
+        p_task->failed    = encodeImageBySuffix(p_task->p_dst_fname, &p_task->img, p_task->jls_near, &p_task->p_dst, &p_task->dst_len, p_task->p_arena);
+        p_task->encode_ns = getTimeNs() - t;
+        
+    } else {                          // encode straight into the mapped output file, the write time is the creation and the close (unmap and truncate) of the file
+        uint64_t t_file = getOutputFileNs();
+        t = getTimeNs();
+        p_task->failed    = writeImageBySuffix(p_task->p_dst_fname, &p_task->img, p_task->jls_near);
+        p_task->dst_bytes = p_task->failed ? 0 : getFileSize(p_task->p_dst_fname);
+        p_task->write_ns  = getOutputFileNs() - t_file;
+        p_task->encode_ns = getTimeNs() - t - p_task->write_ns;
+        p_task->written   = 1;
+    }
+}
+
+
+static void writeOutputThread (void *p_task_void) {
+    OutputTask_t *p_task = (OutputTask_t*)p_task_void;
+    consoleCaptureBegin(&p_task->log);
+    memStatReset();
+    writeOutput(p_task);
+    p_task->peak_alloc = memStatPeak();
+    consoleCaptureEnd();
+}
+
+
+// write all outputs, in parallel threads if parallel=1 (each thread allocates by itself, since an arena can not be shared by threads)
+// return: sum of the peak heap bytes of the threads, which run at the same time
+static size_t writeOutputs (OutputTask_t *tasks, int n_dst, int parallel) {
+    Thread_t threads [MAX_N_DST];
+    int      started [MAX_N_DST];
+    size_t   peak_alloc = 0;
+    int i;
+    
+    for (i=0; i<n_dst; i++) {
+        started[i] = 0;
+        if (parallel && n_dst > 1) {
+            tasks[i].p_arena = NULL;
+            started[i] = !threadCreate(&threads[i], writeOutputThread, &tasks[i]);
+        }
+        if (!started[i])              // not parallel, or failed to create the thread
+            writeOutput(&tasks[i]);
+    }
+    
+    for (i=0; i<n_dst; i++) {
+        if (started[i]) {
+            threadJoin(threads[i]);
+            if (tasks[i].log.len > 0)  // print the messages of the thread in order (or append them to the capture of this thread)
+                consolePrintf("%.*s", (int)tasks[i].log.len, tasks[i].log.p_buf);
+            free(tasks[i].log.p_buf);
+            peak_alloc += tasks[i].peak_alloc;
+        }
+    }
+    
+    return peak_alloc;
+}
+
+
+// the state of converting a file, which goes through 3 stages:
+//   readStage()   : map the source file and decode it (or convert it completely if it is streamed)
+//   encodeStage() : encode the outputs, and write them unless defer_write=1
+//   writeStage()  : write the deferred outputs, release the pixels, and report the errors and stats
+// a file can go through the stages one after another in a thread, or in a pipeline of 3 threads (see convertFilesPipelined())
+typedef struct {
+    const Job_t   *p_job;
+    const char    *dst_fnames [MAX_N_DST];
+    int            n_dst;
+    OutputTask_t   tasks [MAX_N_DST];
+    
+    int            failed;            // 1 : reading failed, the error is already printed
+    int            done;              // 1 : the file is already converted by streaming, nothing to encode
+    MappedFile_t   src_file;          // valid if img_buf=NULL, since img is a view into it
+    uint8_t       *img_buf;
+    ImageDesc_t    img;               // pixels to be encoded, which are img_buf, or a view into the mapped source file (img.p_data=NULL if none)
+    size_t         peak_alloc;        // sum of the peak heap bytes of the stages
+    uint64_t       t_start;
+    ConvertStats_t stats;
+    
+    int            src_known;         // for --incremental, 1 : src_state is valid, so the outputs can be recorded
+    FileState_t    src_state;
+    int            dst_recorded [MAX_N_DST];   // 1 : the output was made by --incremental, so it can be overwritten
+} Conversion_t;
+
+
+#define  ERROR(error_message,fname) {   \
+    consolePrintf("   ***ERROR: ");     \
+    consolePrintf((error_message), (fname)); \
+    consolePrintf("\n");                \
+    p_cv->failed = 1;                   \
+    return;                             \
+}
+
+
+// check the outputs by the --incremental cache, the source is hashed only if its modification time is changed but its size is not
+// return: 1 if all outputs are up to date
+static int isUpToDate (Conversion_t *p_cv, const ConvertOptions_t *p_opt) {
+    const char  *p_src_fname = p_cv->p_job->src_fname;
+    FileState_t  dst;
+    MappedFile_t mf;
+    int i, has_dst, setting, result, up_to_date = 1;
+    
+    p_cv->src_known = !isStdStreamName(p_src_fname) && !getFileInfo(p_src_fname, &p_cv->src_state.size, &p_cv->src_state.mtime);
+    
+    if (!p_cv->src_known)             // the standard input, not a regular file, or not exist (which is reported when it is read)
+        return 0;
+    
+    for (i=0; i<p_cv->n_dst; i++) {
+        has_dst = !getFileInfo(p_cv->dst_fnames[i], &dst.size, &dst.mtime);
+        setting = getCodecSetting(p_cv->dst_fnames[i], p_opt->jls_near);
+        result  = checkConvertCache(p_opt->p_cache, p_src_fname, p_cv->dst_fnames[i], setting, &p_cv->src_state, (has_dst ? &dst : NULL));
         
-        if (p_dst_fname == NULL) {
-            static char dst_fname_buffer [16384];
-            p_dst_fname = dst_fname_buffer;
-            replaceFileSuffix(p_dst_fname, p_src_fname, "png");
+        if (result == CACHE_NEED_HASH && !mapFile(p_src_fname, &mf)) {
+            p_cv->src_state.hash     = hashFileContent(mf.p_data, mf.len);
+            p_cv->src_state.has_hash = 1;
+            unmapFile(&mf);
+            result = checkConvertCache(p_opt->p_cache, p_src_fname, p_cv->dst_fnames[i], setting, &p_cv->src_state, &dst);
+            if (result == CACHE_CURRENT)   // the source is only touched, so record its new time to not hash it again
+                recordConvertCache(p_opt->p_cache, p_src_fname, p_cv->dst_fnames[i], setting, &p_cv->src_state, &dst);
         }
         
-        printf("(%d/%d)  %s -> %s\n", i_file+1, n_file, p_src_fname, p_dst_fname);
+        p_cv->dst_recorded[i] = (result != CACHE_NO_RECORD);
+        up_to_date &= (result == CACHE_CURRENT);
+    }
+    
+    return up_to_date;
+}
+
+
+// record the outputs to the --incremental cache after they are written
+static void recordOutputs (Conversion_t *p_cv, const ConvertOptions_t *p_opt) {
+    FileState_t dst;
+    int i;
+    
+    if (!p_cv->src_known || !p_cv->src_state.has_hash)
+        return;
+    
+    for (i=0; i<p_cv->n_dst; i++)
+        if (!isStdStreamName(p_cv->dst_fnames[i]) && !getFileInfo(p_cv->dst_fnames[i], &dst.size, &dst.mtime))
+            recordConvertCache(p_opt->p_cache, p_cv->p_job->src_fname, p_cv->dst_fnames[i], getCodecSetting(p_cv->dst_fnames[i], p_opt->jls_near), &p_cv->src_state, &dst);
+}
+
+
+// n_file      : total number of files, or -1 if it is not known yet (when the jobs come from a list file)
+// p_arena     : the arena of the calling thread, which keeps the image buffers for the next file, must be NULL if the pixels are released by another thread
+// p_preloaded : the source file already read by batchReadFiles(), which is taken by this function. NULL (or p_data=NULL) to map the source file here
+static void readStage (Conversion_t *p_cv, const Job_t *p_job, int i_file, int n_file, const ConvertOptions_t *p_opt, Arena_t *p_arena, MappedFile_t *p_preloaded) {
+    const char *p_src_fname = p_job->src_fname;
+    ConvertStats_t *p_stats = &p_cv->stats;
+    int      dst_is_src=0, stdin_rows=0;
+    int      i;
+    uint64_t t;
+    ImageFormat_t src_format;
+    ImageRowSource_t rs;
+    uint8_t  stdin_head [4096];
+    size_t   stdin_head_len;
+    uint64_t stdin_len;
+    
+    memset(p_cv, 0, sizeof(Conversion_t));
+    memStatReset();
+    
+    p_cv->p_job = p_job;
+    
+    p_cv->n_dst = p_job->n_dst;       // the default output is already resolved by the job list (see addDefaultOutput() in joblist.h)
+    for (i=0; i<p_cv->n_dst; i++)
+        p_cv->dst_fnames[i] = p_job->dst_fnames[i];
+    
+    if (n_file >= 0)
+        consolePrintf("(%d/%d)  %s ->", i_file+1, n_file, p_src_fname);
+    else
+        consolePrintf("(%d)  %s ->", i_file+1, p_src_fname);
+    for (i=0; i<p_cv->n_dst; i++)
+        consolePrintf("%s %s", (i>0 ? "," : ""), p_cv->dst_fnames[i]);
+    consolePrintf("\n");
+    
+    if (p_job->keeps_src)             // an output of a walked tree is the input itself, so it is not written
+        consolePrintf("   skipped%s%s, output would overwrite the input\n", (p_cv->n_dst > 0 ? " " : ""), (p_cv->n_dst > 0 ? p_src_fname : ""));
+    
+    if (p_cv->n_dst <= 0 && p_job->keeps_src) {
+        p_stats->n_skipped = 1;
+        p_cv->done = 1;
+        return;
+    }
+    
+    if (p_cv->n_dst <= 0)
+        ERROR("no output of %s", p_src_fname);
+    
+    p_cv->t_start = t = getTimeNs();
+    
+    if (p_opt->p_cache && isUpToDate(p_cv, p_opt)) {
+        consolePrintf("   up to date, skipped\n");
+        p_stats->n_skipped = 1;
+        p_cv->done = 1;
+        return;
+    }
+    
+    if (p_preloaded && p_preloaded->p_data) {
+        p_cv->src_file = *p_preloaded;
+        p_preloaded->p_data = NULL;
+    } else if (p_opt->stream && isStdStreamName(p_src_fname)) {   // the standard input can not be mapped, so a raw PNM is read by rows if its only output needs one pass of them, and the other inputs are read as a whole
+        stdin_head_len = readStdinHead(stdin_head, sizeof(stdin_head));
+        if (p_cv->n_dst == 1 && isStreamable(p_cv->dst_fnames[0], getCodecFileName(p_cv->dst_fnames[0], p_opt)) && !openPNMFileRowSource(stdin, stdin_head, stdin_head_len, &rs, &stdin_len)) {
+            stdin_rows = !(rs.is_rgb && matchSuffixIgnoringCase(getCodecFileName(p_cv->dst_fnames[0], p_opt), "jls"));   // RGB JPEG-LS reads the rows 3 times
+            if (!stdin_rows)
+                rs.p_close(&rs);      // nothing is read from the standard input yet, beyond its head
+        }
+        if (!stdin_rows)
+            consolePrintf("   warning: %s is read as a whole, since only a raw PNM with one output which reads its rows once is read by rows\n", p_src_fname);
+        if (!stdin_rows && mapStdinRest(stdin_head, stdin_head_len, &p_cv->src_file))
+            ERROR("read %s failed", p_src_fname);
+    } else if (mapFile(p_src_fname, &p_cv->src_file)) {
+        ERROR("%s not exist", p_src_fname);
+    }
+    
+    if (p_opt->p_cache && !stdin_rows) {   // the size of the mapped file is recorded, since the file may be changed after it is checked
+        p_cv->src_state.size = p_cv->src_file.len;
+        if (!p_cv->src_state.has_hash) {
+            p_cv->src_state.hash     = hashFileContent(p_cv->src_file.p_data, p_cv->src_file.len);
+            p_cv->src_state.has_hash = 1;
+        }
+    }
+    
+    for (i=0; i<p_cv->n_dst; i++) {
+        if (!isStdStreamName(p_cv->dst_fnames[i]) && fileExist(p_cv->dst_fnames[i])) {
+            if (!p_opt->force_write && !p_cv->dst_recorded[i]) {   // an out-of-date output made by --incremental can be overwritten
+                unmapFile(&p_cv->src_file);
+                if (stdin_rows)
+                    rs.p_close(&rs);
+                ERROR("%s already exist", p_cv->dst_fnames[i]);
+            }
+            if (p_cv->src_file.is_mapped && isSameFile(p_cv->dst_fnames[i], p_src_fname)) {   // the mapped pages of the source would be lost when the output is truncated
+                if (p_opt->stream)
+                    consolePrintf("   warning: %s is the input, so it is decoded as a whole before it is overwritten\n", p_cv->dst_fnames[i]);
+                dst_is_src = 1;
+            }
+        }
+    }
+    
+    if (stdin_rows)
+        src_format = probeImageFormat(stdin_head, stdin_head_len);
+    else
+        src_format = probeImageFormat(p_cv->src_file.p_data, p_cv->src_file.len);
+    
+    p_stats->src_format = src_format;
+    p_stats->src_bytes  = stdin_rows ? stdin_len : p_cv->src_file.len;
+    p_stats->probe_ns  = getTimeNs() - t;
+    
+    if (p_opt->stream && !dst_is_src) {   // the rows are read from the mapped file (or the standard input) as they are encoded, so no output can overwrite the source
+        int n_streamed = 0;
         
-        if (!fileExist(p_src_fname)) ERROR("%s not exist", p_src_fname);
+        t = getTimeNs();
         
-        if (!force_write && fileExist(p_dst_fname)) ERROR("%s already exist", p_dst_fname);
+        if (!stdin_rows && openImageRowSource(p_cv->src_file.p_data, p_cv->src_file.len, &src_format, &rs)) {
+            unmapFile(&p_cv->src_file);
+            ERROR("open %s failed", p_src_fname);
+        }
         
-        if (img_buf==NULL) img_buf = loadPNMImageFile(p_src_fname, &is_rgb, &height, &width);
-        if (img_buf==NULL) img_buf = loadPNGImageFile(p_src_fname, &is_rgb, &height, &width);
-        if (img_buf==NULL) img_buf = loadBMPImageFile(p_src_fname, &is_rgb, &height, &width);
-        if (img_buf==NULL) img_buf = loadQOIImageFile(p_src_fname, &is_rgb, &height, &width);
-        if (img_buf==NULL) ERROR("open %s failed", p_src_fname);
+        p_stats->decode_ns = getTimeNs() - t;   // only a PNG source is decoded here, the others are decoded as their rows are read
+        p_stats->n_pixel = (uint64_t)rs.height * rs.width;
+        p_stats->height  = rs.height;
+        p_stats->width   = rs.width;
+        p_stats->is_rgb  = rs.is_rgb;
         
-        if (matchSuffixIgnoringCase(p_dst_fname, "pnm") || matchSuffixIgnoringCase(p_dst_fname, "ppm") || matchSuffixIgnoringCase(p_dst_fname, "pgm")) {
-            failed = writePNMImageFile(p_dst_fname, img_buf, is_rgb, height, width);
-        } else if (matchSuffixIgnoringCase(p_dst_fname, "png")) {
-            failed = writePNGImageFile(p_dst_fname, img_buf, is_rgb, height, width);
-        } else if (matchSuffixIgnoringCase(p_dst_fname, "bmp")) {
-            failed = writeBMPImageFile(p_dst_fname, img_buf, is_rgb, height, width);
-        } else if (matchSuffixIgnoringCase(p_dst_fname, "qoi")) {
-            failed = writeQOIImageFile(p_dst_fname, img_buf, is_rgb, height, width);
-        } else if (matchSuffixIgnoringCase(p_dst_fname, "jls")) {
-            failed = writeJLSImageFile(p_dst_fname, img_buf, is_rgb, height, width, jls_near);
-        } else if (matchSuffixIgnoringCase(p_dst_fname, "h265") || matchSuffixIgnoringCase(p_dst_fname, "265") || matchSuffixIgnoringCase(p_dst_fname, "hevc")) {
-            failed = writeHEVCImageFile(p_dst_fname,img_buf, is_rgb, height, width, jls_near);
-        } else {
-            free(img_buf);
-            ERROR("unsupported output suffix: %s", p_dst_fname);
+        for (i=0; i<p_cv->n_dst; i++) { // the outputs are streamed one by one, each reads the source again from the first row
+            OutputTask_t *p_task = &p_cv->tasks[i];
+            p_task->p_dst_fname   = p_cv->dst_fnames[i];
+            p_task->p_codec_fname = getCodecFileName(p_cv->dst_fnames[i], p_opt);
+            if (!isStreamable(p_task->p_dst_fname, p_task->p_codec_fname)) {
+                consolePrintf("   warning: %s can not be streamed, so the image is decoded as a whole for it\n", p_task->p_dst_fname);
+                continue;
+            }
+            t = getTimeNs();
+            p_task->failed    = (n_streamed > 0 && rs.p_rewind(&rs)) ? 1 : streamImageFile(p_task->p_dst_fname, p_task->p_codec_fname, &rs, p_opt->jls_near, &p_task->dst_bytes);
+            p_task->encode_ns = getTimeNs() - t;
+            p_task->written   = 1;        // skipped by encodeStage() and writeStage()
+            p_stats->encode_ns += p_task->encode_ns;
+            n_streamed ++;
         }
         
-        free(img_buf);
+        rs.p_close(&rs);
         
-        if (failed) ERROR("write %s failed", p_dst_fname);
+        if (n_streamed == p_cv->n_dst) {
+            unmapFile(&p_cv->src_file);
+            p_cv->done = 1;
+            p_cv->peak_alloc = memStatPeak();
+            return;
+        }
         
-        n_success ++;
+        p_stats->encode_ns = 0;           // the outputs which are not streamed are encoded by encodeStage(), then the encode time of each output is summed by writeStage()
     }
     
+    t = getTimeNs();
     
-    n_failed = n_file - n_success;
+    if (!dst_is_src && src_format == IMAGE_FORMAT_PNM) {   // raw PGM/PPM pixels can be encoded in place from the mapped file, as long as writing the output can not overwrite the source
+        viewPNMImage(p_cv->src_file.p_data, p_cv->src_file.len, &p_cv->img);
+    }
     
-    if (n_file > 1) {
-        printf("\nsummary:");
-        if (n_success) printf("  %d file converted", n_success);
-        if (n_failed)  printf("  %d failed"        , n_failed);
-        printf("\n");
+    if (p_cv->img.p_data == NULL) {
+        p_cv->img_buf = decodeImage(p_cv->src_file.p_data, p_cv->src_file.len, &src_format, &p_cv->img, p_arena);   // probe the format by magic bytes, and decode directly from the mapped file
+        unmapFile(&p_cv->src_file);
+    }
+    
+    p_stats->decode_ns += getTimeNs() - t;   // added to the time of opening the row source, if some outputs are streamed
+    
+    if (p_cv->img.p_data==NULL) ERROR("open %s failed", p_src_fname);
+    
+    p_stats->n_pixel = (uint64_t)p_cv->img.height * p_cv->img.width;
+    p_stats->height  = p_cv->img.height;
+    p_stats->width   = p_cv->img.width;
+    p_stats->is_rgb  = (p_cv->img.channels != 1);
+    
+    p_cv->peak_alloc = memStatPeak();
+}
+
+
+// defer_write=1 : keep the encoded streams, to be written by writeStage() in another thread
+static void encodeStage (Conversion_t *p_cv, const ConvertOptions_t *p_opt, Arena_t *p_arena, int defer_write) {
+    int i;
+    
+    if (p_cv->failed || p_cv->done)
+        return;
+    
+    memStatReset();
+    
+    for (i=0; i<p_cv->n_dst; i++) {   // all outputs share the decoded pixels, which are read-only
+        OutputTask_t *p_task = &p_cv->tasks[i];
+        p_task->p_dst_fname = p_cv->dst_fnames[i];
+        p_task->p_codec_fname = getCodecFileName(p_cv->dst_fnames[i], p_opt);
+        p_task->img         = p_cv->img;
+        p_task->jls_near    = p_opt->jls_near;
+        p_task->p_arena     = p_arena;
+        p_task->defer_write = defer_write;
+    }
+    
+    p_cv->peak_alloc += writeOutputs(p_cv->tasks, p_cv->n_dst, p_opt->parallel_outputs);
+    p_cv->peak_alloc += memStatPeak();
+}
+
+
+// p_arena : the arena which the pixels are released to, NULL if they are allocated by another thread
+// return:   0 : success    1 : failed
+static int writeStage (Conversion_t *p_cv, const ConvertOptions_t *p_opt, Arena_t *p_arena, ConvertStats_t *p_stats) {
+    int i, failed = p_cv->failed;
+    
+    if (!p_cv->failed && !p_cv->done) {
+        for (i=0; i<p_cv->n_dst; i++) {
+            writeOutputFile(&p_cv->tasks[i]);   // do nothing if the output is already written or failed
+            p_cv->stats.encode_ns += p_cv->tasks[i].encode_ns;
+            p_cv->stats.write_ns  += p_cv->tasks[i].write_ns;
+        }
+        
+        if (p_cv->img_buf)
+            arenaFree(p_arena, p_cv->img_buf);
+        else
+            unmapFile(&p_cv->src_file);
+    }
+    
+    p_cv->stats.peak_alloc = p_cv->peak_alloc;
+    
+    if (!p_cv->failed) {
+        for (i=0; i<p_cv->n_dst; i++) {
+            p_cv->stats.dst_bytes += p_cv->tasks[i].failed ? 0 : p_cv->tasks[i].dst_bytes;
+            
+            if (p_cv->tasks[i].failed < 0)
+                consolePrintf("   ***ERROR: unsupported output suffix: %s\n", p_cv->dst_fnames[i]);
+            else if (p_cv->tasks[i].failed)
+                consolePrintf("   ***ERROR: write %s failed\n", p_cv->dst_fnames[i]);
+            
+            failed |= (p_cv->tasks[i].failed != 0);
+        }
+    }
+    
+    if (!failed && p_opt->p_cache && !p_cv->stats.n_skipped)
+        recordOutputs(p_cv, p_opt);
+    
+    if (!failed && p_opt->verbose && !p_cv->stats.n_skipped)
+        printStats("   ", &p_cv->stats, getTimeNs() - p_cv->t_start);
+    
+    *p_stats = p_cv->stats;
+    return failed;
+}
+
+
+// convert a file by the 3 stages in the calling thread
+// return:   0 : success    1 : failed
+static int convertFile (const Job_t *p_job, int i_file, int n_file, const ConvertOptions_t *p_opt, ConvertStats_t *p_stats, Arena_t *p_arena) {
+    Conversion_t cv;
+    readStage(&cv, p_job, i_file, n_file, p_opt, p_arena, NULL);
+    encodeStage(&cv, p_opt, p_arena, 0);
+    return writeStage(&cv, p_opt, p_arena, p_stats);
+}
+
+
+
+// the JSON text is built in a buffer (see bufferPrintf() in console.h), so that it can be written to the --json file or sent as a response of --serve
+static void writeJSONString (ConsoleBuffer_t *p_json, const char *p_str) {
+    bufferPrintf(p_json, "\"");
+    for (; *p_str; p_str++) {
+        if (*p_str == '"' || *p_str == '\\')
+            bufferPrintf(p_json, "\\%c", *p_str);
+        else if ((unsigned char)*p_str < 0x20)
+            bufferPrintf(p_json, "\\u%04x", (unsigned char)*p_str);
+        else
+            bufferPrintf(p_json, "%c", *p_str);
+    }
+    bufferPrintf(p_json, "\"");
+}
+
+
+static void writeJSONStages (ConsoleBuffer_t *p_json, const ConvertStats_t *p_stats) {
+    bufferPrintf(p_json, "\"probe_ns\":%llu,\"decode_ns\":%llu,\"encode_ns\":%llu,\"write_ns\":%llu,\"src_bytes\":%llu,\"dst_bytes\":%llu,\"pixels\":%llu,\"peak_alloc_bytes\":%llu",
+        (unsigned long long)p_stats->probe_ns,
+        (unsigned long long)p_stats->decode_ns,
+        (unsigned long long)p_stats->encode_ns,
+        (unsigned long long)p_stats->write_ns,
+        (unsigned long long)p_stats->src_bytes,
+        (unsigned long long)p_stats->dst_bytes,
+        (unsigned long long)p_stats->n_pixel,
+        (unsigned long long)p_stats->peak_alloc
+    );
+}
+
+
+// write the JSON stats of a file, without the closing brace, so that more fields can be appended
+static void writeJSONFile (ConsoleBuffer_t *p_json, const ConvertOptions_t *p_opt, const Job_t *p_job, int failed, const ConvertStats_t *p_stats) {
+    int  i, has_quality=0, n_dst = p_job->n_dst;   // unless an input has a single output, "dst" and "codec" are arrays
+    
+    bufferPrintf(p_json, "{\"type\":\"file\",\"src\":");
+    writeJSONString(p_json, p_job->src_fname);
+    bufferPrintf(p_json, ",\"dst\":%s", (n_dst!=1 ? "[" : ""));
+    for (i=0; i<n_dst; i++) {
+        bufferPrintf(p_json, (i>0 ? "," : ""));
+        writeJSONString(p_json, p_job->dst_fnames[i]);
+    }
+    bufferPrintf(p_json, "%s,\"ok\":%s,\"skipped\":%s,\"src_format\":\"%s\",\"codec\":%s", (n_dst!=1 ? "]" : ""), (failed?"false":"true"), (p_stats->n_skipped?"true":"false"), getFormatName(p_stats->src_format), (n_dst!=1 ? "[" : ""));
+    for (i=0; i<n_dst; i++) {
+        const char *p_codec = getCodecName(getCodecFileName(p_job->dst_fnames[i], p_opt));
+        bufferPrintf(p_json, "%s\"%s\"", (i>0 ? "," : ""), p_codec);
+        has_quality |= (strcmp(p_codec, "jls") == 0 || strcmp(p_codec, "h265") == 0);
+    }
+    bufferPrintf(p_json, "%s,", (n_dst!=1 ? "]" : ""));
+    if (has_quality)
+        bufferPrintf(p_json, "\"quality\":%d,", p_opt->jls_near);
+    else
+        bufferPrintf(p_json, "\"quality\":null,");
+    bufferPrintf(p_json, "\"width\":%u,\"height\":%u,\"is_rgb\":%d,", p_stats->width, p_stats->height, p_stats->is_rgb);
+    writeJSONStages(p_json, p_stats);
+}
+
+
+// called in order for each file after it is converted, to write its JSON stats and add it to the batch total
+static void reportFile (const ConvertOptions_t *p_opt, const Job_t *p_job, int failed, const ConvertStats_t *p_stats, ConvertStats_t *p_total) {
+    if (!failed) {
+        p_total->probe_ns  += p_stats->probe_ns;
+        p_total->decode_ns += p_stats->decode_ns;
+        p_total->encode_ns += p_stats->encode_ns;
+        p_total->write_ns  += p_stats->write_ns;
+        p_total->src_bytes += p_stats->src_bytes;
+        p_total->dst_bytes += p_stats->dst_bytes;
+        p_total->n_pixel   += p_stats->n_pixel;
+        p_total->n_skipped += p_stats->n_skipped;
+        if (p_total->peak_alloc < p_stats->peak_alloc)
+            p_total->peak_alloc = p_stats->peak_alloc;
+    }
+    
+    if (p_opt->fp_json) {
+        ConsoleBuffer_t json = {NULL, 0, 0};
+        writeJSONFile(&json, p_opt, p_job, failed, p_stats);
+        bufferPrintf(&json, "}\n");
+        fwrite(json.p_buf, sizeof(char), json.len, p_opt->fp_json);
+        fflush(p_opt->fp_json);
+        free(json.p_buf);
+    }
+}
+
+
+
+#define  JOBS_PER_THREAD  4           // number of jobs that can be in flight (taken but not yet reported) per worker thread
+
+#define  PROBE_HEAD_LEN   4096        // bytes read from the start of a source file to get the image size from its header
+
+
+// estimate the peak memory of converting a job from the header of its source and the codecs of its outputs (for --mem-limit)
+// it is the sum of the buffers which are alive at the same time (see the decoders and encoders in imageio_*.c), including the mapped source and output files, whose pages are also resident
+// it is an upper bound rather than exact, for example, a raw PGM/PPM is not copied but its pixels are counted
+// return: estimated bytes, which is only the source file size if its header can not be parsed (then it fails right after it is read)
+static uint64_t estimateJobMemory (const Job_t *p_job, const ConvertOptions_t *p_opt) {
+    uint8_t  head [PROBE_HEAD_LEN];
+    uint64_t src_len = 0, n_pixel, n_ch, decode, encode, sum_encode = 0, max_encode = 0;
+    int64_t  mtime;
+    uint32_t height, width;
+    size_t   len = 0;
+    int      i, is_rgb, stream = p_opt->stream, decode_whole = !p_opt->stream;
+    ImageFormat_t format;
+    FILE    *fp;
+    
+    if (getFileInfo(p_job->src_fname, &src_len, &mtime))
+        return 0;                     // not exist, which fails at once
+    
+    if ((fp = fopen(p_job->src_fname, "rb")) != NULL) {
+        len = fread(head, sizeof(uint8_t), sizeof(head), fp);
+        fclose(fp);
+    }
+    
+    if (probeImageHeader(head, len, &format, &is_rgb, &height, &width))
+        return src_len;
+    
+    n_pixel = (uint64_t)height * width;
+    n_ch    = is_rgb ? 3 : 1;
+    
+    if (format == IMAGE_FORMAT_PNG)   // uPNG holds the IDAT data, the inflated rows and the unfiltered pixels (which can be RGBA) at the same time, which is more than the decoded pixels
+        decode = src_len + 2 * (n_pixel * (is_rgb ? 4 : 1) + height);
+    else
+        decode = n_pixel * n_ch;
+    
+    for (i=0; i<p_job->n_dst; i++)    // an output which is the source is not streamed, nor is any other output, as readStage()
+        if (!isStdStreamName(p_job->dst_fnames[i]) && isSameFile(p_job->dst_fnames[i], p_job->src_fname))
+            stream = 0, decode_whole = 1;
+    
+    for (i=0; i<p_job->n_dst; i++) {
+        const char *p_dst_fname = p_job->dst_fnames[i];
+        const char *p_codec     = getCodecName(getCodecFileName(p_dst_fname, p_opt));
+        
+        if (stream && isStreamable(p_dst_fname, getCodecFileName(p_dst_fname, p_opt)))
+            continue;                 // encoded row by row, see the return below
+        
+        decode_whole = 1;
+        
+        if      (strcmp(p_codec, "png") == 0) encode = (n_ch * width + 7) * height + 65536;               // getPNGMaxLength()
+        else if (strcmp(p_codec, "bmp") == 0) encode = (n_ch * width + 3) / 4 * 4 * height + 1078;       // getBMPFileSize()
+        else if (strcmp(p_codec, "qoi") == 0) encode = 5 * n_pixel + 65536;                               // getQOIMaxLength()
+        else if (strcmp(p_codec, "jls") == 0) encode = 8 * n_pixel + 65536 + 12 * (uint64_t)width;       // JLS_MAX_LENGTH(), and the context rows
+        else if (strcmp(p_codec, "h265")== 0) encode = 4 * (uint64_t)(width+32) * (height+32) + 3*1048576; // HEVC_MAX_LENGTH(), and the original and reconstructed planes
+        else                                  encode = 0;                                                 // PNM is written from the decoded pixels
+        
+        sum_encode += encode;
+        if (max_encode < encode)
+            max_encode = encode;
+    }
+    
+    if (!decode_whole)                // only a PNG source is decoded as a whole, the others are converted row by row
+        return src_len + (format == IMAGE_FORMAT_PNG ? decode : 0) + 16 * n_ch * width;
+    
+    return src_len + decode + (stream ? 16 * n_ch * width : 0) + (p_opt->parallel_outputs ? sum_encode : max_encode);
+}
+
+
+// the identity of a path of a job, so that "./a.png", "a.png" and a link to it are found to be the same file
+// an output may not exist yet, and may be created while it is compared, so a path is known by its parent directory and its name, and also by the file itself if it exists
+typedef struct {
+    const char *p_path;
+    const char *p_name;               // the name in the parent directory, a part of p_path
+    uint64_t dir_id  [2];             // see getFileId() in platform.h
+    uint64_t file_id [2];
+    int      has_dir;                 // 0 : the parent directory does not exist, or p_path is a standard stream, so only p_path is compared
+    int      has_file;                // 0 : the file does not exist
+} PathId_t;
+
+
+typedef struct {
+    PathId_t src;
+    PathId_t dst [MAX_N_DST];
+    int      n_dst;
+} JobIds_t;
+
+
+static void getPathId (const char *p_path, PathId_t *p_id) {
+    const char *p;
+    char *p_dir;
+    
+    memset(p_id, 0, sizeof(PathId_t));
+    p_id->p_path = p_id->p_name = p_path;
+    
+    if (isStdStreamName(p_path))
+        return;
+    
+    for (p=p_path; *p; p++)
+        if (*p == '/' || *p == '\\')
+            p_id->p_name = p + 1;
+    
+    if (p_id->p_name == p_path) {     // in the current directory
+        p_id->has_dir = !getFileId(".", p_id->dir_id);
+    } else if ((p_dir = (char*)malloc(p_id->p_name - p_path + 1)) != NULL) {
+        memcpy(p_dir, p_path, p_id->p_name - p_path);
+        p_dir[p_id->p_name - p_path] = '\0';   // the separator is kept, so that the root "/" is not empty
+        p_id->has_dir = !getFileId(p_dir, p_id->dir_id);
+        free(p_dir);
+    }
+    
+    p_id->has_file = !getFileId(p_path, p_id->file_id);
+}
+
+
+// get the identities of the paths of a job once, when it is taken, so that the conflicts with the jobs in flight are checked without touching the file system
+static void getJobIds (const Job_t *p_job, JobIds_t *p_ids) {
+    int i;
+    getPathId(p_job->src_fname, &p_ids->src);
+    for (i=0; i<p_job->n_dst; i++)
+        getPathId(p_job->dst_fnames[i], &p_ids->dst[i]);
+    p_ids->n_dst = p_job->n_dst;
+}
+
+
+// return:   1 : the two paths may be the same file    0 : different
+static int isSamePath (const PathId_t *p_id1, const PathId_t *p_id2) {
+    if (p_id1->has_file && p_id2->has_file && p_id1->file_id[0] == p_id2->file_id[0] && p_id1->file_id[1] == p_id2->file_id[1])
+        return 1;
+    if (p_id1->has_dir && p_id2->has_dir)
+        return p_id1->dir_id[0] == p_id2->dir_id[0] && p_id1->dir_id[1] == p_id2->dir_id[1] && strcmp(p_id1->p_name, p_id2->p_name) == 0;
+    return strcmp(p_id1->p_path, p_id2->p_path) == 0;
+}
+
+
+// return: 1 if p_job reads a file which is written by p_prev, or writes a file which is read or written by p_prev
+static int jobConflicts (const JobIds_t *p_job, const JobIds_t *p_prev) {
+    int i, j;
+    
+    for (j=0; j<p_prev->n_dst; j++)
+        if (isSamePath(&p_job->src, &p_prev->dst[j]))
+            return 1;
+    
+    for (i=0; i<p_job->n_dst; i++) {
+        if (isSamePath(&p_job->dst[i], &p_prev->src))
+            return 1;
+        for (j=0; j<p_prev->n_dst; j++)
+            if (isSamePath(&p_job->dst[i], &p_prev->dst[j]))
+                return 1;
+    }
+    
+    return 0;
+}
+
+
+typedef struct {
+    Job_t   job;
+    JobIds_t ids;                     // the identities of the paths of job, to find the conflicts with the jobs in flight
+    int     failed;
+    int     done;
+    ConsoleBuffer_t log;              // console output of this job, printed in order by the main thread
+    ConvertStats_t  stats;
+} JobSlot_t;
+
+
+typedef struct {
+    JobList_t *p_jl;
+    int     n_file;                   // total number of files, or -1 if it is not known
+    const ConvertOptions_t *p_opt;
+    
+    JobSlot_t *slots;                 // ring of in-flight jobs, job i is in slots[i%n_slot]
+    int     n_slot;
+    int     n_taken;                  // number of jobs taken by the workers
+    int     n_reported;               // number of jobs reported by the main thread, whose slots can be reused
+    int     end;                      // 1 : the job list is exhausted
+    uint64_t mem_used;                // sum of the estimated peak memory of the running jobs (see --mem-limit)
+    
+    Mutex_t mutex;
+    Cond_t  cond;
+} WorkerPool_t;
+
+
+static void workerThread (void *p_pool_void) {
+    WorkerPool_t *p_pool = (WorkerPool_t*)p_pool_void;
+    JobSlot_t *p_slot;
+    Job_t  job;
+    int    i_file, j, failed;
+    uint64_t mem;
+    Arena_t arena;
+    
+    arenaInit(&arena);
+    
+    mutexLock(&p_pool->mutex);
+    
+    for (;;) {
+        while (!p_pool->end && p_pool->n_taken - p_pool->n_reported >= p_pool->n_slot)   // wait until there is a free slot in the ring
+            condWait(&p_pool->cond, &p_pool->mutex);
+        
+        if (p_pool->end)
+            break;
+        
+        if (!nextJob(p_pool->p_jl, &job)) {
+            p_pool->end = 1;
+            condBroadcast(&p_pool->cond);
+            break;
+        }
+        
+        i_file = p_pool->n_taken ++;
+        p_slot = &p_pool->slots[i_file % p_pool->n_slot];
+        memset(p_slot, 0, sizeof(JobSlot_t));
+        p_slot->job = job;
+        getJobIds(&p_slot->job, &p_slot->ids);
+        
+        for (j=p_pool->n_reported; j<i_file; j++) {   // wait until the running jobs which write its source, or read or write its outputs, are done, as if they are converted sequentially
+            const JobSlot_t *p_prev = &p_pool->slots[j % p_pool->n_slot];
+            while (j >= p_pool->n_reported && !p_prev->done && jobConflicts(&p_slot->ids, &p_prev->ids))
+                condWait(&p_pool->cond, &p_pool->mutex);
+        }
+        
+        mutexUnlock(&p_pool->mutex);
+        
+        if (p_pool->p_opt->mem_limit) {
+            mem = estimateJobMemory(&p_slot->job, p_pool->p_opt);
+            
+            mutexLock(&p_pool->mutex);
+            while (p_pool->mem_used > 0 && p_pool->mem_used + mem > p_pool->p_opt->mem_limit)   // wait until the job fits, a job larger than the limit runs alone
+                condWait(&p_pool->cond, &p_pool->mutex);
+            p_pool->mem_used += mem;
+            mutexUnlock(&p_pool->mutex);
+        } else {
+            mem = 0;
+        }
+        
+        consoleCaptureBegin(&p_slot->log);
+        failed = convertFile(&p_slot->job, i_file, p_pool->n_file, p_pool->p_opt, &p_slot->stats, &arena);
+        consoleCaptureEnd();
+        
+        if (p_pool->p_opt->mem_limit) {   // the blocks kept between jobs are not in the budget, so they are freed
+            arenaDestroy(&arena);
+            arenaInit(&arena);
+        }
+        
+        mutexLock(&p_pool->mutex);
+        p_pool->mem_used -= mem;
+        p_slot->failed = failed;
+        p_slot->done   = 1;
+        condBroadcast(&p_pool->cond);
+    }
+    
+    mutexUnlock(&p_pool->mutex);
+    
+    arenaDestroy(&arena);
+}
+
+
+// convert the jobs one by one in the calling thread
+// return: number of successfully converted files, *p_n_done is set to the number of all processed files
+static int convertFilesSequential (JobList_t *p_jl, int n_file, const ConvertOptions_t *p_opt, ConvertStats_t *p_total, int *p_n_done) {
+    ConvertStats_t stats;
+    Arena_t arena;
+    Job_t job;
+    int   i_file, n_success=0;
+    
+    arenaInit(&arena);
+    
+    for (i_file=0; nextJob(p_jl, &job); i_file++) {
+        int failed = convertFile(&job, i_file, n_file, p_opt, &stats, &arena);
+        reportFile(p_opt, &job, failed, &stats, p_total);
+        if (!failed)
+            n_success ++;
+        freeJob(&job);
+    }
+    
+    arenaDestroy(&arena);
+    
+    *p_n_done = i_file;
+    return n_success;
+}
+
+
+// convert the jobs by n_thread workers, the jobs are taken from the job list as the workers need them, so that only a few jobs are held in memory at a time
+// return: number of successfully converted files, *p_n_done is set to the number of all processed files
+static int convertFilesParallel (int n_thread, JobList_t *p_jl, int n_file, const ConvertOptions_t *p_opt, ConvertStats_t *p_total, int *p_n_done) {
+    WorkerPool_t pool;
+    Thread_t threads [256];
+    JobSlot_t *p_slot;
+    int i, i_file, n_success=0;
+    
+    if (n_file >= 0 && n_thread > n_file) n_thread = n_file;
+    if (n_thread > 256) n_thread = 256;
+    
+    pool.p_jl        = p_jl;
+    pool.n_file      = n_file;
+    pool.p_opt       = p_opt;
+    pool.n_slot      = JOBS_PER_THREAD * n_thread;
+    pool.n_taken     = 0;
+    pool.n_reported  = 0;
+    pool.end         = 0;
+    pool.mem_used    = 0;
+    
+    if ((pool.slots = (JobSlot_t*)malloc(sizeof(JobSlot_t) * pool.n_slot)) == NULL)
+        return convertFilesSequential(p_jl, n_file, p_opt, p_total, p_n_done);
+    
+    mutexInit(&pool.mutex);
+    condInit(&pool.cond);
+    
+    for (i=0; i<n_thread; i++)
+        if (threadCreate(&threads[i], workerThread, &pool))
+            break;
+    
+    n_thread = i;
+    
+    if (n_thread == 0) {              // failed to create any thread, convert in the main thread instead
+        n_success = convertFilesSequential(p_jl, n_file, p_opt, p_total, p_n_done);
+    } else {
+        for (i_file=0; ; i_file++) {  // print the output of each file in order, as soon as it is done
+            mutexLock(&pool.mutex);
+            while (!(i_file < pool.n_taken && pool.slots[i_file % pool.n_slot].done) && !(pool.end && i_file >= pool.n_taken))
+                condWait(&pool.cond, &pool.mutex);
+            mutexUnlock(&pool.mutex);
+            
+            if (i_file >= pool.n_taken)   // all jobs are reported
+                break;
+            
+            p_slot = &pool.slots[i_file % pool.n_slot];
+            
+            consoleFlushBuffer(&p_slot->log);
+            fflush(stdout);
+            
+            reportFile(p_opt, &p_slot->job, p_slot->failed, &p_slot->stats, p_total);
+            
+            if (!p_slot->failed)
+                n_success ++;
+            
+            freeJob(&p_slot->job);
+            
+            mutexLock(&pool.mutex);
+            pool.n_reported ++;           // the slot can be reused now
+            condBroadcast(&pool.cond);
+            mutexUnlock(&pool.mutex);
+        }
+        
+        *p_n_done = i_file;
+    }
+    
+    for (i=0; i<n_thread; i++)
+        threadJoin(threads[i]);
+    
+    condDestroy(&pool.cond);
+    mutexDestroy(&pool.mutex);
+    
+    free(pool.slots);
+    
+    return n_success;
+}
+
+
+typedef struct {
+    Job_t   job;
+    JobIds_t ids;                     // the identities of the paths of job, to find the conflicts with the files in flight
+    Conversion_t cv;
+    ConsoleBuffer_t log;              // console output of all stages of this file, printed in order by the writer
+} PipelineItem_t;
+
+
+typedef struct {
+    JobList_t *p_jl;
+    int     n_file;                   // total number of files, or -1 if it is not known
+    const ConvertOptions_t *p_opt;
+    ConvertStats_t *p_total;
+    
+    PipelineItem_t *items;            // ring of in-flight files, file i is in items[i%depth]
+    int     depth;
+    int     n_read;                   // number of files which passed each stage
+    int     n_encoded;
+    int     n_written;
+    int     read_end;                 // 1 : all files are read
+    int     encode_end;               // 1 : all files are encoded
+    int     n_success;
+    
+    Mutex_t mutex;
+    Cond_t  cond;
+} Pipeline_t;
+
+
+// the reader takes the jobs in batches, as many as the free slots, and reads their source files together by batchReadFiles()
+static void pipelineReadThread (void *p_pl_void) {
+    Pipeline_t *p_pl = (Pipeline_t*)p_pl_void;
+    PipelineItem_t *p_item;
+    BatchIO_t    *p_bio     = batchIOOpen(p_pl->depth);
+    MappedFile_t *src_files = (MappedFile_t*)calloc(p_pl->depth, sizeof(MappedFile_t));
+    const char  **src_fnames = (const char**)calloc(p_pl->depth, sizeof(const char*));
+    Job_t    job;
+    JobIds_t ids;
+    int      has_job=0, end=0, conflict;
+    int      i_file=0, n_free, n_batch, i, k;
+    uint64_t read_ns = 0;
+    
+    if (src_files == NULL || src_fnames == NULL) {
+        batchIOClose(p_bio);
+        p_bio = NULL;
+    }
+    
+    while (!end) {
+        mutexLock(&p_pl->mutex);
+        while (i_file - p_pl->n_written >= p_pl->depth)   // wait until the writer releases a slot, so that at most depth files are in memory
+            condWait(&p_pl->cond, &p_pl->mutex);
+        n_free = p_pl->depth - (i_file - p_pl->n_written);
+        mutexUnlock(&p_pl->mutex);
+        
+        if (p_bio == NULL)            // without batched I/O, the files are read one by one as soon as a slot is free
+            n_free = 1;
+        
+        for (n_batch=0; n_batch<n_free; n_batch++) {
+            if (!has_job) {
+                if (!nextJob(p_pl->p_jl, &job)) {
+                    end = 1;
+                    break;
+                }
+                getJobIds(&job, &ids);
+            }
+            has_job = 1;
+            
+            conflict = 0;
+            for (k=0; k<n_batch && !conflict; k++)
+                conflict = jobConflicts(&ids, &p_pl->items[(i_file+k) % p_pl->depth].ids);
+            
+            if (conflict)             // the job depends on a job in this batch, so it is kept for the next batch
+                break;
+            
+            mutexLock(&p_pl->mutex);  // the writer releases the jobs in flight under the lock
+            for (i=i_file-1; i>=p_pl->n_written && !conflict; i--)
+                conflict = jobConflicts(&ids, &p_pl->items[i % p_pl->depth].ids);
+            if (conflict && n_batch == 0) {   // the job depends on a file in flight, so wait until all of them are written, as if they are converted sequentially
+                while (p_pl->n_written < i_file)
+                    condWait(&p_pl->cond, &p_pl->mutex);
+                conflict = 0;
+            }
+            mutexUnlock(&p_pl->mutex);
+            
+            if (conflict)
+                break;
+            
+            p_pl->items[(i_file+n_batch) % p_pl->depth].job = job;
+            p_pl->items[(i_file+n_batch) % p_pl->depth].ids = ids;   // its names still point to the strings of job
+            has_job = 0;
+        }
+        
+        if (p_bio && n_batch > 0) {
+            uint64_t t = getTimeNs();
+            int      use_stdin = 0;
+            for (k=0; k<n_batch; k++) {
+                src_fnames[k] = p_pl->items[(i_file+k) % p_pl->depth].job.src_fname;
+                use_stdin |= isStdStreamName(src_fnames[k]);
+            }
+            if (use_stdin)            // the standard input is read by readStage(), so the files of this batch are read one by one there
+                memset(src_files, 0, sizeof(MappedFile_t) * n_batch);
+            else
+                batchReadFiles(p_bio, src_fnames, n_batch, src_files);
+            read_ns = (getTimeNs() - t) / n_batch;
+        }
+        
+        for (k=0; k<n_batch; k++, i_file++) {
+            p_item = &p_pl->items[i_file % p_pl->depth];
+            
+            consoleCaptureBegin(&p_item->log);
+            readStage(&p_item->cv, &p_item->job, i_file, p_pl->n_file, p_pl->p_opt, NULL, (p_bio ? &src_files[k] : NULL));   // the pixels are released by the writer, so they can not be taken from an arena
+            consoleCaptureEnd();
+            
+            if (p_bio && src_files[k].p_data)   // not taken because of an error
+                unmapFile(&src_files[k]);
+            
+            p_item->cv.stats.probe_ns += read_ns;
+            
+            mutexLock(&p_pl->mutex);
+            p_pl->n_read ++;
+            condBroadcast(&p_pl->cond);
+            mutexUnlock(&p_pl->mutex);
+        }
+    }
+    
+    mutexLock(&p_pl->mutex);
+    p_pl->read_end = 1;
+    condBroadcast(&p_pl->cond);
+    mutexUnlock(&p_pl->mutex);
+    
+    batchIOClose(p_bio);
+    free(src_files);
+    free(src_fnames);
+}
+
+
+// the arrays of a batch of outputs for batchWriteFiles(), allocated once by the writer thread for depth*MAX_N_DST outputs, which is the most that the files in flight can have
+typedef struct {
+    const char    **fnames;
+    const uint8_t **bufs;
+    size_t         *lens;
+    int            *failed;
+    OutputTask_t  **p_tasks;
+} BatchWrite_t;
+
+
+// return:   0 : success    1 : failed
+static int allocBatchWrite (BatchWrite_t *p_bw, int max_n) {
+    p_bw->fnames  = (const char**)   calloc(max_n, sizeof(const char*));
+    p_bw->bufs    = (const uint8_t**)calloc(max_n, sizeof(const uint8_t*));
+    p_bw->lens    = (size_t*)        calloc(max_n, sizeof(size_t));
+    p_bw->failed  = (int*)           calloc(max_n, sizeof(int));
+    p_bw->p_tasks = (OutputTask_t**) calloc(max_n, sizeof(OutputTask_t*));
+    return p_bw->fnames == NULL || p_bw->bufs == NULL || p_bw->lens == NULL || p_bw->failed == NULL || p_bw->p_tasks == NULL;
+}
+
+
+static void freeBatchWrite (BatchWrite_t *p_bw) {
+    free(p_bw->fnames);
+    free(p_bw->bufs);
+    free(p_bw->lens);
+    free(p_bw->failed);
+    free(p_bw->p_tasks);
+}
+
+
+// write the deferred outputs of the encoded files [i_file, n_encoded) together by batchWriteFiles(), the outputs which fail are written again by writeStage()
+// since at most depth files are in flight, the outputs always fit in p_bw
+static void batchWriteOutputs (Pipeline_t *p_pl, BatchIO_t *p_bio, BatchWrite_t *p_bw, int i_file, int n_encoded) {
+    int n=0, i, j;
+    uint64_t t;
+    
+    for (; i_file<n_encoded; i_file++) {
+        Conversion_t *p_cv = &p_pl->items[i_file % p_pl->depth].cv;
+        if (p_cv->failed || p_cv->done)
+            continue;
+        for (j=0; j<p_cv->n_dst; j++) {
+            OutputTask_t *p_task = &p_cv->tasks[j];
+            if (p_task->failed || p_task->written || p_task->p_dst == NULL || isStdStreamName(p_task->p_dst_fname))   // the standard output is written by writeOutputFile()
+                continue;
+            p_bw->p_tasks[n] = p_task;
+            p_bw->fnames [n] = p_task->p_dst_fname;
+            p_bw->bufs   [n] = p_task->p_dst;
+            p_bw->lens   [n] = p_task->dst_len;
+            n ++;
+        }
+    }
+    
+    if (n == 0)
+        return;
+    
+    t = getTimeNs();
+    batchWriteFiles(p_bio, p_bw->fnames, p_bw->bufs, p_bw->lens, n, p_bw->failed);
+    t = (getTimeNs() - t) / n;
+    
+    for (i=0; i<n; i++) {
+        OutputTask_t *p_task = p_bw->p_tasks[i];
+        if (!p_bw->failed[i]) {
+            p_task->dst_bytes = p_task->dst_len;
+            p_task->write_ns  = t;
+            p_task->written   = 1;
+            arenaFree(p_task->p_arena, p_task->p_dst);
+            p_task->p_dst = NULL;
+        }
+    }
+}
+
+
+static void pipelineWriteThread (void *p_pl_void) {
+    Pipeline_t *p_pl = (Pipeline_t*)p_pl_void;
+    PipelineItem_t *p_item;
+    ConvertStats_t stats;
+    BatchIO_t *p_bio = batchIOOpen(p_pl->depth * MAX_N_DST);
+    BatchWrite_t bw;
+    int i_file, n_encoded, failed;
+    
+    if (allocBatchWrite(&bw, p_pl->depth * MAX_N_DST)) {
+        batchIOClose(p_bio);
+        p_bio = NULL;
+    }
+    
+    for (i_file=0; ; ) {
+        mutexLock(&p_pl->mutex);
+        while (i_file >= p_pl->n_encoded && !p_pl->encode_end)
+            condWait(&p_pl->cond, &p_pl->mutex);
+        n_encoded = p_pl->n_encoded;
+        mutexUnlock(&p_pl->mutex);
+        
+        if (i_file >= n_encoded)
+            break;
+        
+        if (p_bio)                    // write the outputs of all files which are encoded so far together
+            batchWriteOutputs(p_pl, p_bio, &bw, i_file, n_encoded);
+        
+        for (; i_file<n_encoded; i_file++) {
+            p_item = &p_pl->items[i_file % p_pl->depth];
+            
+            consoleCaptureBegin(&p_item->log);
+            failed = writeStage(&p_item->cv, p_pl->p_opt, NULL, &stats);
+            consoleCaptureEnd();
+            
+            consoleFlushBuffer(&p_item->log);
+            fflush(stdout);
+            
+            reportFile(p_pl->p_opt, &p_item->job, failed, &stats, p_pl->p_total);
+            
+            if (!failed)
+                p_pl->n_success ++;
+            
+            mutexLock(&p_pl->mutex);
+            freeJob(&p_item->job);    // under the lock, since the reader checks the jobs in flight for conflicts
+            p_pl->n_written ++;       // the slot can be reused now
+            condBroadcast(&p_pl->cond);
+            mutexUnlock(&p_pl->mutex);
+        }
+    }
+    
+    batchIOClose(p_bio);
+    freeBatchWrite(&bw);
+}
+
+
+// convert the files in a pipeline of 3 threads: a reader thread maps and decodes file i+1 while file i is encoded in the calling thread, and a writer thread writes file i-1
+// at most depth files are in flight, which bounds the memory
+// return: number of successfully converted files, *p_n_done is set to the number of all processed files
+static int convertFilesPipelined (int depth, JobList_t *p_jl, int n_file, const ConvertOptions_t *p_opt, ConvertStats_t *p_total, int *p_n_done) {
+    Pipeline_t pl;
+    Thread_t   reader, writer;
+    int i_file, n_success, reader_started, end;
+    
+    memset(&pl, 0, sizeof(pl));
+    pl.p_jl    = p_jl;
+    pl.n_file  = n_file;
+    pl.p_opt   = p_opt;
+    pl.p_total = p_total;
+    pl.depth   = depth;
+    
+    if ((pl.items = (PipelineItem_t*)calloc(depth, sizeof(PipelineItem_t))) == NULL)
+        return convertFilesSequential(p_jl, n_file, p_opt, p_total, p_n_done);
+    
+    mutexInit(&pl.mutex);
+    condInit(&pl.cond);
+    
+    if (threadCreate(&writer, pipelineWriteThread, &pl)) {
+        n_success = convertFilesSequential(p_jl, n_file, p_opt, p_total, p_n_done);
+        
+    } else {
+        reader_started = !threadCreate(&reader, pipelineReadThread, &pl);
+        
+        if (!reader_started)          // no file will be read, so the loop below and the writer end at once
+            pl.read_end = 1;
+        
+        for (i_file=0; ; i_file++) {  // encode in this thread
+            PipelineItem_t *p_item;
+            
+            mutexLock(&pl.mutex);
+            while (i_file >= pl.n_read && !pl.read_end)
+                condWait(&pl.cond, &pl.mutex);
+            end = (i_file >= pl.n_read);
+            mutexUnlock(&pl.mutex);
+            
+            if (end)
+                break;
+            
+            p_item = &pl.items[i_file % depth];
+            
+            consoleCaptureBegin(&p_item->log);
+            encodeStage(&p_item->cv, p_opt, NULL, 1);   // the encoded streams are written and released by the writer
+            consoleCaptureEnd();
+            
+            mutexLock(&pl.mutex);
+            pl.n_encoded ++;
+            condBroadcast(&pl.cond);
+            mutexUnlock(&pl.mutex);
+        }
+        
+        mutexLock(&pl.mutex);
+        pl.encode_end = 1;
+        condBroadcast(&pl.cond);
+        mutexUnlock(&pl.mutex);
+        
+        if (reader_started)
+            threadJoin(reader);
+        threadJoin(writer);
+        
+        if (reader_started) {
+            n_success = pl.n_success;
+            *p_n_done = pl.n_written;
+        } else {
+            n_success = convertFilesSequential(p_jl, n_file, p_opt, p_total, p_n_done);
+        }
+    }
+    
+    condDestroy(&pl.cond);
+    mutexDestroy(&pl.mutex);
+    free(pl.items);
+    
+    return n_success;
+}
+
+
+#define  SERVE_MAX_DATA  0x40000000    // max bytes of an image sent to the server inline
+
+
+// decode an image sent to the server inline, and encode it to the format of p_suffix in memory
+// return:   0 : success, *pp_dst is allocated by arenaAlloc(p_arena)    1 : failed, the error is printed
+static int convertData (const uint8_t *p_src, size_t src_len, const char *p_suffix, const ConvertOptions_t *p_opt, ConvertStats_t *p_stats, uint8_t **pp_dst, size_t *p_dst_len, Arena_t *p_arena) {
+    ImageDesc_t img;
+    uint8_t *p_pix;
+    uint64_t t;
+    int failed;
+    
+    memset(p_stats, 0, sizeof(ConvertStats_t));
+    memStatReset();
+    
+    *pp_dst = NULL;
+    
+    t = getTimeNs();
+    p_stats->src_format = probeImageFormat(p_src, src_len);
+    p_stats->src_bytes  = src_len;
+    p_stats->probe_ns   = getTimeNs() - t;
+    
+    t = getTimeNs();
+    p_pix = decodeImage(p_src, src_len, &p_stats->src_format, &img, p_arena);
+    p_stats->decode_ns = getTimeNs() - t;
+    
+    if (p_pix == NULL) {
+        consolePrintf("   ***ERROR: decode failed\n");
+        return 1;
+    }
+    
+    p_stats->n_pixel = (uint64_t)img.height * img.width;
+    p_stats->height  = img.height;
+    p_stats->width   = img.width;
+    p_stats->is_rgb  = (img.channels != 1);
+    
+    t = getTimeNs();
+    if (isPNMFileName(p_suffix))
+        failed = encodePNMImage(&img, pp_dst, p_dst_len, p_arena);
+    else
+        failed = encodeImageBySuffix(p_suffix, &img, p_opt->jls_near, pp_dst, p_dst_len, p_arena);
+    p_stats->encode_ns = getTimeNs() - t;
+    
+    arenaFree(p_arena, p_pix);
+    
+    p_stats->peak_alloc = memStatPeak();
+    
+    if (failed) {
+        consolePrintf(failed < 0 ? "   ***ERROR: unsupported output suffix: %s\n" : "   ***ERROR: encode %s failed\n", p_suffix);
+        *pp_dst = NULL;
+        return 1;
+    }
+    
+    p_stats->dst_bytes = *p_dst_len;
+    return 0;
+}
+
+
+// a request of --serve is a line as in a job list file (see joblist.h), which can start with switches (-0 ~ -4 and -f) for this request only, for example:
+//     -2 in/1.png out/1.jls out/1.qoi
+// the input can be :N, which means N bytes of an image follow the line, then the output must be a single :SUFFIX, and the image is encoded to that format and sent back instead of written to a file
+// the response is a JSON line as the "file" line of --json, plus the console output of the conversion in "log". For an inline output, "data_bytes" bytes of the encoded image follow the line
+static int serveRequest (void *p_opt_void, ServerConn_t *p_conn, char *p_line, Arena_t *p_arena) {
+    ConvertOptions_t opt = *(const ConvertOptions_t*)p_opt_void;
+    ConsoleBuffer_t  log = {NULL, 0, 0}, json = {NULL, 0, 0};
+    ConvertStats_t   stats;
+    Job_t    job;
+    uint8_t *p_data = NULL, *p_dst = NULL;
+    size_t   dst_len = 0;
+    int      i, failed = 1, broken = 0;
+    
+    for (;;) {                        // parse the switches, a token is a switch only if it starts with one of them, so a lone "-" (the standard input) is left to be rejected below
+        while (*p_line == ' ' || *p_line == '\t')
+            p_line ++;
+        if (*p_line != '-' || !(('0' <= p_line[1] && p_line[1] <= '4') || p_line[1] == 'f' || p_line[1] == 'F'))
+            break;
+        for (p_line++; *p_line && *p_line != ' ' && *p_line != '\t'; p_line++) {
+            if ('0' <= *p_line && *p_line <= '4')
+                opt.jls_near = *p_line - '0';
+            else if (*p_line == 'f' || *p_line == 'F')
+                opt.force_write = 1;
+        }
+    }
+    
+    if (!parseJobLine(p_line, &job))  // an empty line has no response, so a client can use it to keep the connection alive
+        return 0;
+    
+    memset(&stats, 0, sizeof(stats));
+    
+    consoleCaptureBegin(&log);
+    
+    if (job.src_fname[0] == ':') {
+        char *p_end;
+        unsigned long long len = strtoull(job.src_fname+1, &p_end, 10);
+        
+        if (*p_end != '\0' || p_end == job.src_fname+1 || len > SERVE_MAX_DATA) {
+            consolePrintf("   ***ERROR: invalid data length %s\n", job.src_fname+1);
+            broken = 1;               // the data can not be skipped, so the connection is closed after the response
+        } else if ((p_data = (uint8_t*)malloc(len ? (size_t)len : 1)) == NULL) {
+            consolePrintf("   ***ERROR: out of memory\n");
+            broken = 1;
+        } else if (serverRead(p_conn, p_data, (size_t)len)) {
+            broken = 1;
+        } else if (job.n_dst != 1 || job.dst_fnames[0][0] != ':') {
+            consolePrintf("   ***ERROR: an inline input must have a single inline output :SUFFIX\n");
+        } else {
+            failed = convertData(p_data, (size_t)len, job.dst_fnames[0]+1, &opt, &stats, &p_dst, &dst_len, p_arena);
+        }
+        
+    } else {
+        addDefaultOutput(&job, NULL); // as nextJob(), a file without outputs is converted to png
+        for (i=0; i<job.n_dst && job.dst_fnames[i][0] != ':' && !isStdStreamName(job.dst_fnames[i]); i++);
+        if (isStdStreamName(job.src_fname) || (i < job.n_dst && isStdStreamName(job.dst_fnames[i])))
+            consolePrintf("   ***ERROR: the standard input and output of the server can not be used by a request, use :N and :SUFFIX instead\n");
+        else if (i < job.n_dst)
+            consolePrintf("   ***ERROR: an inline output %s must have an inline input :N\n", job.dst_fnames[i]);
+        else
+            failed = convertFile(&job, 0, 1, &opt, &stats, p_arena);
+    }
+    
+    consoleCaptureEnd();
+    
+    writeJSONFile(&json, &opt, &job, failed, &stats);
+    bufferPrintf(&json, ",\"log\":");
+    writeJSONString(&json, log.p_buf ? log.p_buf : "");
+    if (p_dst)
+        bufferPrintf(&json, ",\"data_bytes\":%llu", (unsigned long long)dst_len);
+    bufferPrintf(&json, "}\n");
+    
+    if (serverWrite(p_conn, json.p_buf, json.len) || (p_dst && serverWrite(p_conn, p_dst, dst_len)))
+        broken = 1;
+    
+    if (p_dst)
+        arenaFree(p_arena, p_dst);
+    free(p_data);
+    free(json.p_buf);
+    free(log.p_buf);
+    freeJob(&job);
+    
+    return broken;
+}
+
+
+int main (int argc, char **argv) {
+    int  i, n_fname, n_src, n_dir=0, n_file, n_thread, bench_iter, prefetch, n_success=0, n_failed, use_std_stream=0;
+    
+    int  switches[128];
+    char **fnames, **src_fnames;
+    int  *is_dst;
+    
+    char *json_fname, *list_fname, *cache_fname, *to_suffix, *serve_path, *cpu_name, *mem_limit_str;
+    uint64_t mem_limit = 0;
+    CpuLevel_t cpu_level, max_cpu_level;
+    
+    ConvertOptions_t opt;
+    ConvertStats_t   total;
+    JobList_t        jl;
+    uint64_t t_start, wall_ns;
+    
+    fnames     = (char**)malloc(sizeof(char*) * argc);
+    src_fnames = (char**)malloc(sizeof(char*) * argc);
+    is_dst     = (int*)  malloc(sizeof(int)   * argc);
+    
+    if (fnames == NULL || src_fnames == NULL || is_dst == NULL) {
+        printf("   ***ERROR: out of memory\n");
+        return -1;
+    }
+    
+    parseCommand(argc, argv, switches, &n_thread, &bench_iter, &prefetch, &json_fname, &list_fname, &cache_fname, &to_suffix, &serve_path, &mem_limit_str, &cpu_name, &n_fname, fnames, is_dst);
+    
+    for (i=n_src=0; i<n_fname; i++)
+        if (!is_dst[i])
+            src_fnames[n_src++] = fnames[i];
+    
+    if (switches['r'])
+        for (i=0; i<n_src; i++)
+            n_dir += isDir(src_fnames[i]);
+    
+    opt.force_write = switches['F'] || switches['f'];
+    opt.jls_near    = switches['4']?4: switches['3']?3: switches['2']?2: switches['1']?1: 0;
+    opt.stream      = switches['s'];
+    opt.parallel_outputs = switches['p'];
+    opt.verbose     = switches['v'];
+    opt.fp_json     = NULL;
+    opt.p_cache     = NULL;
+    opt.p_to_suffix = to_suffix;
+    
+    for (i=0; i<n_fname; i++)
+        use_std_stream |= isStdStreamName(fnames[i]);   // an input "-" without an output is also written to the standard output (see joblist.h)
+    
+    if (use_std_stream)               // the standard output carries the image, so the messages go to stderr
+        consoleSetStream(stderr);
+    
+    if (mem_limit_str && parseSize(mem_limit_str, &mem_limit)) {
+        consolePrintf("   ***ERROR: bad --mem-limit=%s, should be a number of bytes, which can end with K, M or G\n", mem_limit_str);
+        return -1;
+    }
+    
+    opt.mem_limit   = mem_limit;
+    
+    cpu_level = max_cpu_level = detectCpuLevel();
+    
+    if (cpu_name) {                   // a lower level can be forced, for example to compare the speed of the SIMD kernels with the plain C ones
+        if (parseCpuLevel(cpu_name, &cpu_level)) {
+            consolePrintf("   ***ERROR: unknown --cpu=%s, should be scalar, sse4.1 or avx2\n", cpu_name);
+            return -1;
+        }
+        if (cpu_level > max_cpu_level) {
+            consolePrintf("   ***ERROR: --cpu=%s is not supported by this CPU, which supports up to %s\n", cpu_name, getCpuLevelName(max_cpu_level));
+            return -1;
+        }
+    }
+    
+    initKernels(cpu_level);
+    
+    if (n_thread < 0)                 // a server uses all cores by default, since its requests come from many clients
+        n_thread = serve_path ? 0 : 1;
+    
+    if (n_thread <= 0)
+        n_thread = getCPUCount();
+    
+    if (bench_iter > 0) {
+        int near_mask = (switches['0']<<0) | (switches['1']<<1) | (switches['2']<<2) | (switches['3']<<3) | (switches['4']<<4);
+        return runBenchmark(bench_iter, src_fnames, n_src, near_mask);
+    }
+    
+    if (serve_path) {
+        runServer(serve_path, n_thread, serveRequest, &opt);
+        printf("   ***ERROR: serve at %s failed, the path may be a file which is not a socket, or be used by a running server\n", serve_path);
+        return -1;
+    }
+    
+    if (n_src <= 0 && list_fname == NULL) {
+        printf(USAGE);
+        return -1;
+    }
+    
+    if (openJobList(&jl, fnames, is_dst, n_fname, list_fname, switches['r'], to_suffix)) {
+        consolePrintf("   ***ERROR: open %s failed\n", list_fname);
+        return -1;
+    }
+    
+    if (json_fname) {
+        if (use_std_stream && isStdStreamName(json_fname)) {
+            consolePrintf("   ***ERROR: --json=- can not share the standard output with an image\n");
+            return -1;
+        }
+        opt.fp_json = isStdStreamName(json_fname) ? stdout : fopen(json_fname, "w");
+        if (opt.fp_json == NULL) {
+            consolePrintf("   ***ERROR: open %s failed\n", json_fname);
+            return -1;
+        }
+    }
+    
+    if (cache_fname) {
+        if ((opt.p_cache = openConvertCache(cache_fname)) == NULL) {
+            consolePrintf("   ***ERROR: open %s failed\n", cache_fname);
+            return -1;
+        }
+    }
+    
+    memset(&total, 0, sizeof(total));
+    
+    t_start = getTimeNs();
+    
+    n_file = (list_fname || n_dir) ? -1 : n_src;   // the number of jobs in the list file or in the directories is not known until it is read to the end
+    
+    if (use_std_stream)               // the images written to the standard output must be in order
+        n_thread = 1;
+    
+    if (prefetch > 0 && n_thread > 1 && n_file != 1)
+        consolePrintf("   warning: --prefetch is ignored, since the -j jobs already read the files in parallel\n");
+    else if (prefetch > 0 && opt.stream)
+        consolePrintf("   warning: --prefetch is ignored, since -s streams the images by rows\n");
+    
+    if (n_thread > 1 && n_file != 1)
+        n_success = convertFilesParallel(n_thread, &jl, n_file, &opt, &total, &n_file);
+    else if (prefetch > 0 && !opt.stream)       // streaming keeps memory low by not holding a whole image, which a pipeline must do
+        n_success = convertFilesPipelined(prefetch, &jl, n_file, &opt, &total, &n_file);
+    else
+        n_success = convertFilesSequential(&jl, n_file, &opt, &total, &n_file);
+    
+    wall_ns = getTimeNs() - t_start;
+    
+    closeJobList(&jl);
+    
+    if (opt.p_cache && closeConvertCache(opt.p_cache))
+        consolePrintf("   ***ERROR: save %s failed\n", cache_fname);
+    
+    n_failed = n_file - n_success;
+    
+    if (n_file > 1) {
+        consolePrintf("\nsummary:");
+        if (n_success > total.n_skipped) consolePrintf("  %d file converted", n_success - total.n_skipped);
+        if (total.n_skipped)             consolePrintf("  %d skipped"       , total.n_skipped);
+        if (n_failed)                    consolePrintf("  %d failed"        , n_failed);
+        consolePrintf("\n");
+    }
+    
+    if (opt.verbose)                  // the MP/s of the total is of the wall time of the whole batch, so it includes the parallel speedup
+        printStats("\nstats total:  ", &total, wall_ns);
+    
+    if (opt.fp_json) {
+        ConsoleBuffer_t json = {NULL, 0, 0};
+        bufferPrintf(&json, "{\"type\":\"total\",\"files\":%d,\"converted\":%d,\"skipped\":%d,\"failed\":%d,\"threads\":%d,\"wall_ns\":%llu,", n_file, n_success - total.n_skipped, total.n_skipped, n_failed, (n_thread<n_file ? n_thread : n_file), (unsigned long long)wall_ns);
+        writeJSONStages(&json, &total);
+        bufferPrintf(&json, "}\n");
+        fwrite(json.p_buf, sizeof(char), json.len, opt.fp_json);
+        free(json.p_buf);
+        if (opt.fp_json != stdout)
+            fclose(opt.fp_json);
     }
     
-    return n_failed;
+    return (n_failed > 0) ? 1 : 0;      // a count of failed files would wrap modulo 256 in the exit status
 }
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "platform.h"
+#include "memstat.h"
+
+
+static THREAD_LOCAL int64_t curr_bytes = 0;       // can be negative when a buffer allocated before memStatReset() is freed
+static THREAD_LOCAL int64_t peak_bytes = 0;
+
+
+static void countBytes (int64_t delta) {
+    curr_bytes += delta;
+    if (peak_bytes < curr_bytes)
+        peak_bytes = curr_bytes;
+}
+
+
+void* memMalloc (size_t size) {
+    void *p = malloc(size);
+    if (p)
+        countBytes((int64_t)getAllocSize(p));
+    return p;
+}
+
+
+void* memRealloc (void *p, size_t size) {
+    size_t old_size = p ? getAllocSize(p) : 0;
+    void  *p_new    = realloc(p, size);
+    if (p_new)
+        countBytes((int64_t)getAllocSize(p_new) - (int64_t)old_size);
+    return p_new;
+}
+
+
+void memFree (void *p) {
+    if (p)
+        countBytes(-(int64_t)getAllocSize(p));
+    free(p);
+}
+
+
+void memStatAcquire (void *p) {
+    countBytes((int64_t)getAllocSize(p));
+}
+
+
+void memStatRelease (void *p) {
+    countBytes(-(int64_t)getAllocSize(p));
+}
+
+
+void memStatReset () {
+    curr_bytes = peak_bytes = 0;
+}
+
+
+size_t memStatPeak () {
+    return (size_t)peak_bytes;
+}
@@ -0,0 +1,24 @@
+#ifndef   __MEMSTAT_H__
+#define   __MEMSTAT_H__
+
+
+// heap allocation counting per thread, so that the peak memory of converting a file can be reported even when files are converted in parallel
+// the memory is allocated by malloc() as usual, so it can be released by either memFree() or free() (but only memFree() is counted)
+
+
+void*  memMalloc    (size_t size);
+void*  memRealloc   (void *p, size_t size);
+void   memFree      (void *p);
+
+// count a block as allocated or freed without actually allocating or freeing it, for the blocks that are kept for reuse (see arena.h)
+void   memStatAcquire (void *p);
+void   memStatRelease (void *p);
+
+// start a new measurement on the calling thread
+void   memStatReset ();
+
+// return: the peak bytes allocated (and not yet freed) by the calling thread since memStatReset()
+size_t memStatPeak  ();
+
+
+#endif // __MEMSTAT_H__
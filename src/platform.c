@@ -0,0 +1,771 @@
+#define _FILE_OFFSET_BITS  64          // fseeko() and ftello() take 64-bit positions, also on 32-bit POSIX systems
+#define _GNU_SOURCE                   // fallocate() of Linux
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <afunix.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+#else
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <time.h>
+#endif
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
+
+
+// the standard input and output carry image data, which must not be translated (on Windows, they are in text mode by default)
+static FILE* setBinaryMode (FILE *fp) {
+#ifdef _WIN32
+    _setmode(_fileno(fp), _O_BINARY);
+#endif
+    return fp;
+}
+
+
+// read the rest of fp to a buffer allocated by malloc(), which starts with p_head of head_len bytes (already read from fp)
+static int readRest (FILE *fp, const uint8_t *p_head, size_t head_len, MappedFile_t *p_mf) {
+    uint8_t *p_buf = NULL;
+    size_t   len = 0, cap = 0;
+    
+    if (head_len > 0) {
+        cap = head_len + 65536;
+        if ((p_buf = (uint8_t*)malloc(cap)) == NULL)
+            return 1;
+        memcpy(p_buf, p_head, head_len);
+        len = head_len;
+    }
+    
+    for (;;) {
+        if (len + 1 >= cap) {
+            uint8_t *p;
+            cap = 2 * cap + 65536;
+            if ((p = (uint8_t*)realloc(p_buf, cap)) == NULL) {
+                free(p_buf);
+                p_buf = NULL;
+                break;
+            }
+            p_buf = p;
+        }
+        len += fread(p_buf+len, sizeof(uint8_t), cap-len-1, fp);
+        if (ferror(fp)) {
+            free(p_buf);
+            p_buf = NULL;
+            break;
+        }
+        if (feof(fp))
+            break;
+    }
+    
+    p_mf->p_data    = p_buf;
+    p_mf->len       = len;
+    p_mf->is_mapped = 0;
+    return (p_buf == NULL);
+}
+
+
+// read the whole file to a buffer allocated by malloc(), used when the file can not be mapped (for example, a pipe, or "-" for the standard input)
+static int readFile (const char *p_filename, MappedFile_t *p_mf) {
+    FILE *fp;
+    int failed;
+    
+    if ((fp = (strcmp(p_filename, "-") == 0) ? setBinaryMode(stdin) : fopen(p_filename, "rb")) == NULL)
+        return 1;
+    
+    failed = readRest(fp, NULL, 0, p_mf);
+    
+    if (fp != stdin)
+        fclose(fp);
+    
+    return failed;
+}
+
+
+size_t readStdinHead (uint8_t *p_buf, size_t len) {
+    return fread(p_buf, sizeof(uint8_t), len, setBinaryMode(stdin));
+}
+
+
+int mapStdinRest (const uint8_t *p_head, size_t head_len, MappedFile_t *p_mf) {
+    return readRest(stdin, p_head, head_len, p_mf);
+}
+
+
+FILE* openOutputStream (const char *p_filename) {
+    return (strcmp(p_filename, "-") == 0) ? setBinaryMode(stdout) : fopen(p_filename, "wb");
+}
+
+
+int closeOutputStream (FILE *fp) {
+    if (fp == stdout)
+        return (fflush(fp) != 0);
+    return (fclose(fp) != 0);
+}
+
+
+int seekOutputStream (FILE *fp, uint64_t pos) {
+#ifdef _WIN32
+    return (_fseeki64(fp, (__int64)pos, SEEK_SET) != 0);
+#else
+    return (fseeko(fp, (off_t)pos, SEEK_SET) != 0);
+#endif
+}
+
+
+int getOutputStreamLength (FILE *fp, uint64_t *p_len) {
+#ifdef _WIN32
+    __int64 len;
+    if (_fseeki64(fp, 0, SEEK_END) != 0 || (len = _ftelli64(fp)) < 0)
+        return 1;
+#else
+    off_t   len;
+    if (fseeko(fp, 0, SEEK_END) != 0 || (len = ftello(fp)) < 0)
+        return 1;
+#endif
+    *p_len = (uint64_t)len;
+    return 0;
+}
+
+
+
+typedef struct {
+    void (*p_func)(void *p_arg);
+    void  *p_arg;
+} ThreadStart_t;
+
+
+
+#ifdef _WIN32
+
+static DWORD WINAPI threadEntry (LPVOID p_start_void) {
+    ThreadStart_t start = *(ThreadStart_t*)p_start_void;
+    free(p_start_void);
+    start.p_func(start.p_arg);
+    return 0;
+}
+
+int threadCreate (Thread_t *p_thread, void (*p_func)(void *p_arg), void *p_arg) {
+    ThreadStart_t *p_start = (ThreadStart_t*)malloc(sizeof(ThreadStart_t));
+    if (p_start == NULL)
+        return 1;
+    p_start->p_func = p_func;
+    p_start->p_arg  = p_arg;
+    *p_thread = CreateThread(NULL, 0, threadEntry, p_start, 0, NULL);
+    if (*p_thread == NULL) {
+        free(p_start);
+        return 1;
+    }
+    return 0;
+}
+
+void threadJoin (Thread_t thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void mutexInit     (Mutex_t *p_mutex)                 { InitializeCriticalSection(p_mutex); }
+void mutexDestroy  (Mutex_t *p_mutex)                 { DeleteCriticalSection(p_mutex); }
+void mutexLock     (Mutex_t *p_mutex)                 { EnterCriticalSection(p_mutex); }
+void mutexUnlock   (Mutex_t *p_mutex)                 { LeaveCriticalSection(p_mutex); }
+
+void condInit      (Cond_t *p_cond)                   { InitializeConditionVariable(p_cond); }
+void condDestroy   (Cond_t *p_cond)                   { (void)p_cond; }
+void condWait      (Cond_t *p_cond, Mutex_t *p_mutex) { SleepConditionVariableCS(p_cond, p_mutex, INFINITE); }
+void condBroadcast (Cond_t *p_cond)                   { WakeAllConditionVariable(p_cond); }
+
+int getCPUCount () {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+}
+
+size_t getAllocSize (void *p) {
+    return _msize(p);
+}
+
+int openDir (const char *p_path, Dir_t *p_dir) {
+    char pattern [4096];
+    snprintf(pattern, sizeof(pattern), "%s\\*", p_path);
+    p_dir->h_find = FindFirstFileA(pattern, &p_dir->data);
+    p_dir->has_data = (p_dir->h_find != INVALID_HANDLE_VALUE);
+    return !p_dir->has_data;
+}
+
+const char* readDir (Dir_t *p_dir, int *p_is_dir) {
+    for (;;) {
+        if (!p_dir->has_data && !FindNextFileA(p_dir->h_find, &p_dir->data))
+            return NULL;
+        p_dir->has_data = 0;
+        if (strcmp(p_dir->data.cFileName, ".") == 0 || strcmp(p_dir->data.cFileName, "..") == 0)
+            continue;
+        if (p_dir->data.dwFileAttributes & FILE_ATTRIBUTE_DEVICE)
+            continue;
+        *p_is_dir = !!(p_dir->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+        if (*p_is_dir && (p_dir->data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))   // a link to a directory
+            continue;
+        return p_dir->data.cFileName;
+    }
+}
+
+void closeDir (Dir_t *p_dir) {
+    FindClose(p_dir->h_find);
+}
+
+int isDir (const char *p_path) {
+    DWORD attr = GetFileAttributesA(p_path);
+    return (attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+int makeDir (const char *p_path) {
+    return !CreateDirectoryA(p_path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS;
+}
+
+int getFileId (const char *p_path, uint64_t id[2]) {
+    BY_HANDLE_FILE_INFORMATION info;
+    HANDLE h_file = CreateFileA(p_path, 0, FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);   // FILE_FLAG_BACKUP_SEMANTICS is needed to open a directory
+    int failed;
+    if (h_file == INVALID_HANDLE_VALUE)
+        return 1;
+    failed = !GetFileInformationByHandle(h_file, &info);
+    CloseHandle(h_file);
+    id[0] = info.dwVolumeSerialNumber;
+    id[1] = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    return failed;
+}
+
+int getFileInfo (const char *p_filename, uint64_t *p_size, int64_t *p_mtime) {
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(p_filename, GetFileExInfoStandard, &info) || (info.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY|FILE_ATTRIBUTE_DEVICE)))
+        return 1;
+    *p_size  = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    *p_mtime = (int64_t)(((uint64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime) * 100;   // FILETIME is in 100 ns
+    return 0;
+}
+
+uint64_t getTimeNs () {
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER count;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ULL + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+}
+
+int mapFile (const char *p_filename, MappedFile_t *p_mf) {
+    HANDLE h_file;
+    LARGE_INTEGER size;
+    
+    p_mf->p_data    = NULL;
+    p_mf->len       = 0;
+    p_mf->is_mapped = 0;
+    p_mf->h_map     = NULL;
+    
+    if (strcmp(p_filename, "-") == 0)
+        return readFile(p_filename, p_mf);
+    
+    h_file = CreateFileA(p_filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    
+    if (h_file == INVALID_HANDLE_VALUE)
+        return 1;
+    
+    if (GetFileSizeEx(h_file, &size) && size.QuadPart > 0 && (uint64_t)size.QuadPart <= (size_t)-1) {
+        p_mf->h_map = CreateFileMappingA(h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (p_mf->h_map) {
+            p_mf->p_data = (const uint8_t*)MapViewOfFile(p_mf->h_map, FILE_MAP_READ, 0, 0, 0);
+            if (p_mf->p_data == NULL) {
+                CloseHandle(p_mf->h_map);
+                p_mf->h_map = NULL;
+            }
+        }
+    }
+    
+    CloseHandle(h_file);              // the mapping keeps a reference to the file
+    
+    if (p_mf->p_data == NULL)         // failed to map (for example, an empty file), fallback to read
+        return readFile(p_filename, p_mf);
+    
+    p_mf->len       = (size_t)size.QuadPart;
+    p_mf->is_mapped = 1;
+    return 0;
+}
+
+void unmapFile (MappedFile_t *p_mf) {
+    if (p_mf->is_mapped) {
+        UnmapViewOfFile(p_mf->p_data);
+        CloseHandle(p_mf->h_map);
+    } else {
+        free((void*)p_mf->p_data);
+    }
+    p_mf->p_data = NULL;
+    p_mf->len    = 0;
+}
+
+static int osCreateOutputFile (const char *p_filename, size_t max_len, OutputFile_t *p_of) {
+    p_of->p_data    = NULL;
+    p_of->cap       = max_len;
+    p_of->is_mapped = 0;
+    p_of->fp        = NULL;
+    p_of->h_map     = NULL;
+    
+    p_of->h_file = CreateFileA(p_filename, GENERIC_READ|GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    
+    if (p_of->h_file == INVALID_HANDLE_VALUE)
+        return 1;
+    
+    if (max_len > 0)                  // creating the mapping extends the file to max_len, and reserves its space
+        p_of->h_map = CreateFileMappingA(p_of->h_file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)max_len >> 32), (DWORD)max_len, NULL);
+    
+    if (p_of->h_map) {
+        p_of->p_data = (uint8_t*)MapViewOfFile(p_of->h_map, FILE_MAP_WRITE, 0, 0, max_len);
+        if (p_of->p_data == NULL) {
+            CloseHandle(p_of->h_map);
+            p_of->h_map = NULL;
+        }
+    }
+    
+    if (p_of->p_data == NULL) {       // failed to map (for example, a pipe), fallback to a stream, whose file descriptor owns h_file
+        LARGE_INTEGER pos;
+        int fd;
+        pos.QuadPart = 0;
+        if (SetFilePointerEx(p_of->h_file, pos, NULL, FILE_BEGIN))
+            SetEndOfFile(p_of->h_file);   // the mapping may have extended the file, but a pipe can not be truncated, so the result is ignored
+        if ((fd = _open_osfhandle((intptr_t)p_of->h_file, _O_BINARY)) < 0) {
+            CloseHandle(p_of->h_file);
+            return 1;
+        }
+        if ((p_of->fp = _fdopen(fd, "wb")) == NULL) {
+            _close(fd);
+            return 1;
+        }
+        return 0;
+    }
+    
+    p_of->is_mapped = 1;
+    return 0;
+}
+
+static int osCloseOutputFile (OutputFile_t *p_of, size_t len) {
+    LARGE_INTEGER pos;
+    int failed;
+    
+    if (p_of->is_mapped) {
+        UnmapViewOfFile(p_of->p_data);
+        CloseHandle(p_of->h_map);
+        pos.QuadPart = (LONGLONG)len;
+        failed  = !SetFilePointerEx(p_of->h_file, pos, NULL, FILE_BEGIN) || !SetEndOfFile(p_of->h_file);
+        failed |= !CloseHandle(p_of->h_file);
+    } else {
+        failed  = (ferror(p_of->fp) != 0);
+        failed |= (fclose(p_of->fp) != 0);   // also closes h_file
+    }
+    
+    p_of->p_data = NULL;
+    p_of->fp     = NULL;
+    return failed;
+}
+
+int socketListen (const char *p_path, Socket_t *p_sock) {
+    struct sockaddr_un addr;
+    WSADATA wsa;
+    DWORD   attr = GetFileAttributesA(p_path);
+    
+    if (strlen(p_path) >= sizeof(addr.sun_path) || WSAStartup(MAKEWORD(2,2), &wsa))
+        return 1;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, p_path);
+    
+    if (attr != INVALID_FILE_ATTRIBUTES) {   // a socket file is a reparse point, only a stale one is replaced, which no server accepts on
+        if (!(attr & FILE_ATTRIBUTE_REPARSE_POINT))
+            return 1;
+        if ((*p_sock = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
+            return 1;
+        if (!connect(*p_sock, (struct sockaddr*)&addr, sizeof(addr))) {
+            closesocket(*p_sock);
+            return 1;
+        }
+        closesocket(*p_sock);
+        DeleteFileA(p_path);
+    }
+    
+    if ((*p_sock = socket(AF_UNIX, SOCK_STREAM, 0)) == INVALID_SOCKET)
+        return 1;
+    
+    if (bind(*p_sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(*p_sock, SOMAXCONN)) {
+        closesocket(*p_sock);
+        return 1;
+    }
+    
+    return 0;
+}
+
+int socketAccept (Socket_t sock, Socket_t *p_conn) {
+    *p_conn = accept(sock, NULL, NULL);
+    return (*p_conn == INVALID_SOCKET);
+}
+
+long socketRecv (Socket_t sock, void *p_buf, size_t len) {
+    int n = recv(sock, (char*)p_buf, (len > 0x40000000) ? 0x40000000 : (int)len, 0);
+    return (n < 0) ? -1 : n;
+}
+
+int socketSend (Socket_t sock, const void *p_buf, size_t len) {
+    const char *p = (const char*)p_buf;
+    while (len > 0) {
+        int n = send(sock, p, (len > 0x40000000) ? 0x40000000 : (int)len, 0);
+        if (n <= 0)
+            return 1;
+        p   += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void socketClose (Socket_t sock) {
+    closesocket(sock);
+}
+
+#else
+
+static void* threadEntry (void *p_start_void) {
+    ThreadStart_t start = *(ThreadStart_t*)p_start_void;
+    free(p_start_void);
+    start.p_func(start.p_arg);
+    return NULL;
+}
+
+int threadCreate (Thread_t *p_thread, void (*p_func)(void *p_arg), void *p_arg) {
+    ThreadStart_t *p_start = (ThreadStart_t*)malloc(sizeof(ThreadStart_t));
+    if (p_start == NULL)
+        return 1;
+    p_start->p_func = p_func;
+    p_start->p_arg  = p_arg;
+    if (pthread_create(p_thread, NULL, threadEntry, p_start)) {
+        free(p_start);
+        return 1;
+    }
+    return 0;
+}
+
+void threadJoin (Thread_t thread) {
+    pthread_join(thread, NULL);
+}
+
+void mutexInit     (Mutex_t *p_mutex)                 { pthread_mutex_init(p_mutex, NULL); }
+void mutexDestroy  (Mutex_t *p_mutex)                 { pthread_mutex_destroy(p_mutex); }
+void mutexLock     (Mutex_t *p_mutex)                 { pthread_mutex_lock(p_mutex); }
+void mutexUnlock   (Mutex_t *p_mutex)                 { pthread_mutex_unlock(p_mutex); }
+
+void condInit      (Cond_t *p_cond)                   { pthread_cond_init(p_cond, NULL); }
+void condDestroy   (Cond_t *p_cond)                   { pthread_cond_destroy(p_cond); }
+void condWait      (Cond_t *p_cond, Mutex_t *p_mutex) { pthread_cond_wait(p_cond, p_mutex); }
+void condBroadcast (Cond_t *p_cond)                   { pthread_cond_broadcast(p_cond); }
+
+int getCPUCount () {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+size_t getAllocSize (void *p) {
+#ifdef __APPLE__
+    return malloc_size(p);
+#else
+    return malloc_usable_size(p);
+#endif
+}
+
+int openDir (const char *p_path, Dir_t *p_dir) {
+    p_dir->p_dir = opendir(p_path);
+    return (p_dir->p_dir == NULL);
+}
+
+const char* readDir (Dir_t *p_dir, int *p_is_dir) {
+    struct dirent *p_ent;
+    struct stat st;
+    
+    while ((p_ent = readdir((DIR*)p_dir->p_dir)) != NULL) {
+        if (strcmp(p_ent->d_name, ".") == 0 || strcmp(p_ent->d_name, "..") == 0)
+            continue;
+#ifdef DT_DIR
+        if (p_ent->d_type == DT_REG || p_ent->d_type == DT_DIR) {   // most file systems give the type, so no stat() is needed
+            *p_is_dir = (p_ent->d_type == DT_DIR);
+            return p_ent->d_name;
+        }
+#endif
+        if (fstatat(dirfd((DIR*)p_dir->p_dir), p_ent->d_name, &st, AT_SYMLINK_NOFOLLOW))
+            continue;
+        if (S_ISLNK(st.st_mode) && (fstatat(dirfd((DIR*)p_dir->p_dir), p_ent->d_name, &st, 0) || S_ISDIR(st.st_mode)))
+            continue;                 // a broken link, or a link to a directory
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+            continue;
+        *p_is_dir = S_ISDIR(st.st_mode);
+        return p_ent->d_name;
+    }
+    
+    return NULL;
+}
+
+void closeDir (Dir_t *p_dir) {
+    closedir((DIR*)p_dir->p_dir);
+}
+
+int isDir (const char *p_path) {
+    struct stat st;
+    return !stat(p_path, &st) && S_ISDIR(st.st_mode);
+}
+
+int makeDir (const char *p_path) {
+    return mkdir(p_path, 0777) && !isDir(p_path);
+}
+
+int getFileId (const char *p_path, uint64_t id[2]) {
+    struct stat st;
+    if (stat(p_path, &st))
+        return 1;
+    id[0] = (uint64_t)st.st_dev;
+    id[1] = (uint64_t)st.st_ino;
+    return 0;
+}
+
+int getFileInfo (const char *p_filename, uint64_t *p_size, int64_t *p_mtime) {
+    struct stat st;
+    if (stat(p_filename, &st) || !S_ISREG(st.st_mode))
+        return 1;
+    *p_size  = (uint64_t)st.st_size;
+#ifdef __APPLE__
+    *p_mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    *p_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return 0;
+}
+
+uint64_t getTimeNs () {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int mapFile (const char *p_filename, MappedFile_t *p_mf) {
+    struct stat st;
+    void *p;
+    int fd;
+    
+    p_mf->p_data    = NULL;
+    p_mf->len       = 0;
+    p_mf->is_mapped = 0;
+    
+    if (strcmp(p_filename, "-") == 0)
+        return readFile(p_filename, p_mf);
+    
+    if ((fd = open(p_filename, O_RDONLY)) < 0)
+        return 1;
+    
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 || (uint64_t)st.st_size > (size_t)-1) {
+        close(fd);
+        return readFile(p_filename, p_mf);     // not a regular file or empty, fallback to read
+    }
+    
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);                                 // the mapping keeps a reference to the file
+    
+    if (p == MAP_FAILED)
+        return readFile(p_filename, p_mf);
+    
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+    
+    p_mf->p_data    = (const uint8_t*)p;
+    p_mf->len       = (size_t)st.st_size;
+    p_mf->is_mapped = 1;
+    return 0;
+}
+
+void unmapFile (MappedFile_t *p_mf) {
+    if (p_mf->is_mapped)
+        munmap((void*)p_mf->p_data, p_mf->len);
+    else
+        free((void*)p_mf->p_data);
+    p_mf->p_data = NULL;
+    p_mf->len    = 0;
+}
+
+// reserve the blocks of the file, so that writing to its mapping can not fail by a full disk (which is SIGBUS instead of an error)
+// on Linux, posix_fallocate() of glibc is emulated by writing every block where the file system can not preallocate (as NFS and FUSE), which costs as much as writing the file, so fallocate() is called instead, which fails with EOPNOTSUPP there
+// return:   0 : reserved    1 : not reserved (EOPNOTSUPP, no space, or not a regular file)
+static int reserveOutputFile (int fd, size_t len) {
+    if ((off_t)len <= 0)
+        return 1;
+#ifdef __linux__
+    return (fallocate(fd, 0, 0, (off_t)len) != 0);
+#else
+    return (posix_fallocate(fd, 0, (off_t)len) != 0);
+#endif
+}
+
+static int osCreateOutputFile (const char *p_filename, size_t max_len, OutputFile_t *p_of) {
+    void *p = MAP_FAILED;
+    
+    p_of->p_data    = NULL;
+    p_of->cap       = max_len;
+    p_of->is_mapped = 0;
+    p_of->fp        = NULL;
+    
+    if ((p_of->fd = open(p_filename, O_RDWR|O_CREAT|O_TRUNC, 0666)) < 0)   // a shared writable mapping needs the file opened for read as well
+        return 1;
+    
+    if (reserveOutputFile(p_of->fd, max_len) == 0)
+        p = mmap(NULL, max_len, PROT_READ|PROT_WRITE, MAP_SHARED, p_of->fd, 0);
+    
+    if (p == MAP_FAILED) {            // not reserved or not mapped, fallback to a stream, which owns the file descriptor
+        if (ftruncate(p_of->fd, 0)) {}   // the reservation may have extended the file, but a pipe can not be truncated, so the result is ignored
+        if ((p_of->fp = fdopen(p_of->fd, "wb")) == NULL) {
+            close(p_of->fd);
+            return 1;
+        }
+        return 0;
+    }
+    
+    p_of->p_data    = (uint8_t*)p;
+    p_of->is_mapped = 1;
+    return 0;
+}
+
+static int osCloseOutputFile (OutputFile_t *p_of, size_t len) {
+    int failed;
+    
+    if (p_of->is_mapped) {
+        munmap(p_of->p_data, p_of->cap);
+        failed  = (ftruncate(p_of->fd, (off_t)len) != 0);
+        failed |= (close(p_of->fd) != 0);
+    } else {
+        failed  = (ferror(p_of->fp) != 0);
+        failed |= (fclose(p_of->fp) != 0);   // also closes fd
+    }
+    
+    p_of->p_data = NULL;
+    p_of->fp     = NULL;
+    return failed;
+}
+
+int socketListen (const char *p_path, Socket_t *p_sock) {
+    struct sockaddr_un addr;
+    struct stat st;
+    
+    if (strlen(p_path) >= sizeof(addr.sun_path))
+        return 1;
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, p_path);
+    
+    if (!lstat(p_path, &st)) {             // only a stale socket is replaced, which no server accepts on
+        if (!S_ISSOCK(st.st_mode))
+            return 1;
+        if ((*p_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+            return 1;
+        if (!connect(*p_sock, (struct sockaddr*)&addr, sizeof(addr))) {
+            close(*p_sock);
+            return 1;
+        }
+        close(*p_sock);
+        unlink(p_path);
+    }
+    
+    if ((*p_sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 1;
+    
+    if (bind(*p_sock, (struct sockaddr*)&addr, sizeof(addr)) || listen(*p_sock, SOMAXCONN)) {
+        close(*p_sock);
+        return 1;
+    }
+    
+    return 0;
+}
+
+int socketAccept (Socket_t sock, Socket_t *p_conn) {
+    do {
+        *p_conn = accept(sock, NULL, NULL);
+    } while (*p_conn < 0 && errno == EINTR);
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    if (*p_conn >= 0) {
+        int on = 1;
+        setsockopt(*p_conn, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    return (*p_conn < 0);
+}
+
+long socketRecv (Socket_t sock, void *p_buf, size_t len) {
+    ssize_t n;
+    do {
+        n = recv(sock, p_buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+    return (n < 0) ? -1 : (long)n;
+}
+
+int socketSend (Socket_t sock, const void *p_buf, size_t len) {
+    const uint8_t *p = (const uint8_t*)p_buf;
+    while (len > 0) {
+#ifdef MSG_NOSIGNAL
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);   // a client which closed the connection early must not kill the server by SIGPIPE
+#else
+        ssize_t n = send(sock, p, len, 0);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p   += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+void socketClose (Socket_t sock) {
+    close(sock);
+}
+
+#endif
+
+
+
+static THREAD_LOCAL uint64_t output_file_ns = 0;     // time spent by the calling thread in createOutputFile() and closeOutputFile()
+
+int createOutputFile (const char *p_filename, size_t max_len, OutputFile_t *p_of) {
+    uint64_t t = getTimeNs();
+    int failed = osCreateOutputFile(p_filename, max_len, p_of);
+    output_file_ns += getTimeNs() - t;
+    return failed;
+}
+
+int closeOutputFile (OutputFile_t *p_of, size_t len) {
+    uint64_t t = getTimeNs();
+    int failed = osCloseOutputFile(p_of, len);
+    output_file_ns += getTimeNs() - t;
+    return failed;
+}
+
+uint64_t getOutputFileNs () {
+    return output_file_ns;
+}
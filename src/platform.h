@@ -0,0 +1,196 @@
+#ifndef   __PLATFORM_H__
+#define   __PLATFORM_H__
+
+
+// thin wrappers of the OS facilities used by ImCvt, so that the other source files do not need to care about Windows/POSIX differences
+
+
+#ifdef _WIN32
+  #ifndef _WIN32_WINNT
+    #define _WIN32_WINNT 0x0600         // condition variables need Windows Vista or later
+  #endif
+  #include <winsock2.h>               // must be included before windows.h
+  #include <windows.h>
+  typedef HANDLE              Thread_t;
+  typedef CRITICAL_SECTION    Mutex_t;
+  typedef CONDITION_VARIABLE  Cond_t;
+#else
+  #include <pthread.h>
+  typedef pthread_t           Thread_t;
+  typedef pthread_mutex_t     Mutex_t;
+  typedef pthread_cond_t      Cond_t;
+#endif
+
+
+#ifdef _MSC_VER
+  #define  THREAD_LOCAL  __declspec(thread)
+#else
+  #define  THREAD_LOCAL  __thread
+#endif
+
+
+// functions for thread ---------------------------
+// return:   0 : success    1 : failed
+int  threadCreate  (Thread_t *p_thread, void (*p_func)(void *p_arg), void *p_arg);
+void threadJoin    (Thread_t thread);
+
+void mutexInit     (Mutex_t *p_mutex);
+void mutexDestroy  (Mutex_t *p_mutex);
+void mutexLock     (Mutex_t *p_mutex);
+void mutexUnlock   (Mutex_t *p_mutex);
+
+void condInit      (Cond_t *p_cond);
+void condDestroy   (Cond_t *p_cond);
+void condWait      (Cond_t *p_cond, Mutex_t *p_mutex);
+void condBroadcast (Cond_t *p_cond);
+
+// return: number of logical CPU cores (at least 1)
+int  getCPUCount   ();
+
+// return: monotonic time in nanoseconds, only the difference of two calls is meaningful
+uint64_t getTimeNs ();
+
+// return: usable size of a block allocated by malloc(), which may be larger than requested
+size_t getAllocSize (void *p);
+
+// get the size and the last modification time (in nanoseconds, only comparable with another call) of a regular file
+// return:   0 : success    1 : failed (not exist, or not a regular file)
+int  getFileInfo   (const char *p_filename, uint64_t *p_size, int64_t *p_mtime);
+
+
+
+// functions for read-only file mapping -----------
+typedef struct {
+    const uint8_t *p_data;            // file content
+    size_t         len;               // file length
+    int            is_mapped;         // 1: p_data is mapped from the file    0: p_data is read into a buffer allocated by malloc() (when mapping is not possible)
+#ifdef _WIN32
+    HANDLE         h_map;
+#endif
+} MappedFile_t;
+
+// p_filename="-" reads the standard input (to a buffer, since it can not be mapped)
+// return:   0 : success    1 : failed
+int  mapFile       (const char *p_filename, MappedFile_t *p_mf);
+void unmapFile     (MappedFile_t *p_mf);
+
+// read the first len bytes of the standard input (in binary mode), so that its format is known before it is read as a whole by mapStdinRest(), or by rows (see openPNMFileRowSource() in imageio.h)
+// return: the number of bytes read, less than len only at the end of the input or on an error
+size_t readStdinHead (uint8_t *p_buf, size_t len);
+
+// read the rest of the standard input, as mapFile("-"), to a buffer which starts with the p_head of head_len bytes got by readStdinHead()
+// return:   0 : success    1 : failed
+int  mapStdinRest  (const uint8_t *p_head, size_t head_len, MappedFile_t *p_mf);
+
+
+
+// functions for sequential file write ------------
+// open a file to write, "-" is the standard output (in binary mode)
+// return:  NULL : failed
+FILE* openOutputStream  (const char *p_filename);
+
+// close a file opened by openOutputStream(), the standard output is flushed but not closed
+// return:   0 : success    1 : failed (for example, the disk is full)
+int   closeOutputStream (FILE *fp);
+
+// move a file opened by openOutputStream() to the absolute position pos, which can be beyond 2GB (unlike fseek() on Windows, whose long is 32-bit)
+// return:   0 : success    1 : failed (for example, a pipe)
+int   seekOutputStream  (FILE *fp, uint64_t pos);
+
+// get the length of a file opened by openOutputStream(), which is moved to its end
+// return:   0 : success    1 : failed (for example, a pipe)
+int   getOutputStreamLength (FILE *fp, uint64_t *p_len);
+
+
+
+// functions for writable file mapping ------------
+// the file is preallocated to the max length of its content and mapped, so that an encoder can write its output stream straight into the file, then it is truncated to the final length
+// if the file can not be preallocated and mapped (for example, a pipe, or a file system without preallocation as NFS and FUSE), it is opened as a buffered stream, to which the encoder writes row by row (see streamXXXImage() in imageio.h), so that the memory does not grow with the max length
+typedef struct {
+    uint8_t       *p_data;            // buffer to write the file content to, NULL if is_mapped=0
+    size_t         cap;               // length of p_data
+    int            is_mapped;         // 1: p_data is mapped to the file    0: the file content is written to fp
+    FILE          *fp;                // the file opened as a stream (with the buffer of stdio), NULL if is_mapped=1
+#ifdef _WIN32
+    HANDLE         h_file;
+    HANDLE         h_map;
+#else
+    int            fd;
+#endif
+} OutputFile_t;
+
+// create (or truncate) the file, and map a buffer of max_len bytes for its content, or open it as a stream if it can not be mapped (is_mapped=0)
+// return:   0 : success    1 : failed
+int  createOutputFile (const char *p_filename, size_t max_len, OutputFile_t *p_of);
+
+// end the file with the first len bytes (len <= max_len) of the buffer, and close it, or flush and close the stream if is_mapped=0 (len is ignored)
+// return:   0 : success    1 : failed
+int  closeOutputFile  (OutputFile_t *p_of, size_t len);
+
+// return: the total time in nanoseconds which the calling thread spent in createOutputFile() and closeOutputFile(), only the difference of two calls is meaningful
+uint64_t getOutputFileNs ();
+
+
+
+// functions for directory ------------------------
+typedef struct {
+#ifdef _WIN32
+    HANDLE           h_find;
+    WIN32_FIND_DATAA data;
+    int              has_data;        // 1 : data is found but not yet returned
+#else
+    void            *p_dir;           // DIR*
+#endif
+} Dir_t;
+
+// return:   0 : success    1 : failed (not exist, or not a directory)
+int  openDir       (const char *p_path, Dir_t *p_dir);
+
+// get the next entry of the directory, "." and ".." are excluded, the entries which are neither regular files nor directories are skipped
+// symbolic links to directories are skipped too, so that walking a tree can not loop
+// return:  NULL     : no more entry
+//          non-NULL : name of the entry, valid until the next call. *p_is_dir=1 if it is a directory
+const char* readDir (Dir_t *p_dir, int *p_is_dir);
+
+void closeDir      (Dir_t *p_dir);
+
+// return:   1 : p_path is a directory    0 : not
+int  isDir         (const char *p_path);
+
+// get the identity of a file or directory (its device and inode number), which is the same for all the paths to it
+// return:   0 : success    1 : failed
+int  getFileId     (const char *p_path, uint64_t id[2]);
+
+// create a directory
+// return:   0 : success or already exists    1 : failed
+int  makeDir       (const char *p_path);
+
+
+
+// functions for local socket ---------------------
+// a stream socket bound to a path of the file system (Unix domain socket, which Windows also supports since Windows 10), see --serve in main.c
+#ifdef _WIN32
+typedef SOCKET Socket_t;
+#else
+typedef int    Socket_t;
+#endif
+
+// create a socket listening at p_path, a stale socket at p_path (left by a killed server) is replaced, but it fails on any other file, or a socket which a server still listens on
+// return:   0 : success    1 : failed
+int  socketListen  (const char *p_path, Socket_t *p_sock);
+
+// wait for a connection, can be called by several threads at the same time
+// return:   0 : success    1 : failed
+int  socketAccept  (Socket_t sock, Socket_t *p_conn);
+
+// return:  >0 : number of bytes received (at most len)    0 : the connection is closed by the peer    -1 : failed
+long socketRecv    (Socket_t sock, void *p_buf, size_t len);
+
+// send all the len bytes
+// return:   0 : success    1 : failed
+int  socketSend    (Socket_t sock, const void *p_buf, size_t len);
+
+void socketClose   (Socket_t sock);
+
+
+#endif // __PLATFORM_H__
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "platform.h"
+#include "server.h"
+
+
+#define  SERVER_LINE_MAX   16384      // max length of a request line, a longer line closes the connection
+#define  SERVER_MAX_THREAD 256
+
+
+struct ServerConn_s {
+    Socket_t sock;
+    uint8_t  buf [65536];             // received bytes, buf[i_buf] ~ buf[n_buf-1] are not consumed yet
+    size_t   i_buf;
+    size_t   n_buf;
+};
+
+
+typedef struct {
+    Socket_t        sock;             // the listening socket, shared by all workers
+    ServerHandler_t p_handler;
+    void           *p_ctx;
+} Server_t;
+
+
+// return:   0 : success    1 : the connection is closed
+static int fillBuffer (ServerConn_t *p_conn) {
+    long n = socketRecv(p_conn->sock, p_conn->buf, sizeof(p_conn->buf));
+    if (n <= 0)
+        return 1;
+    p_conn->i_buf = 0;
+    p_conn->n_buf = (size_t)n;
+    return 0;
+}
+
+
+// read a line, the line break (\n or \r\n) is removed
+// return:   0 : success    1 : the connection is closed, or the line is too long
+static int readLine (ServerConn_t *p_conn, char *p_line) {
+    size_t len = 0;
+    
+    for (;;) {
+        while (p_conn->i_buf < p_conn->n_buf) {
+            char ch = (char)p_conn->buf[p_conn->i_buf ++];
+            if (ch == '\n') {
+                if (len > 0 && p_line[len-1] == '\r')
+                    len --;
+                p_line[len] = '\0';
+                return 0;
+            }
+            if (len + 1 >= SERVER_LINE_MAX)
+                return 1;
+            p_line[len ++] = ch;
+        }
+        if (fillBuffer(p_conn))
+            return 1;
+    }
+}
+
+
+int serverRead (ServerConn_t *p_conn, void *p_buf, size_t len) {
+    uint8_t *p = (uint8_t*)p_buf;
+    size_t   n = p_conn->n_buf - p_conn->i_buf;
+    
+    if (n > len)
+        n = len;
+        
+    memcpy(p, p_conn->buf + p_conn->i_buf, n);   // the bytes already received with the request line
+    p_conn->i_buf += n;
+    p   += n;
+    len -= n;
+    
+    while (len > 0) {                            // the rest is received straight into p_buf
+        long r = socketRecv(p_conn->sock, p, len);
+        if (r <= 0)
+            return 1;
+        p   += r;
+        len -= (size_t)r;
+    }
+    
+    return 0;
+}
+
+
+int serverWrite (ServerConn_t *p_conn, const void *p_buf, size_t len) {
+    return socketSend(p_conn->sock, p_buf, len);
+}
+
+
+static void serverThread (void *p_srv_void) {
+    Server_t     *p_srv  = (Server_t*)p_srv_void;
+    ServerConn_t *p_conn = (ServerConn_t*)malloc(sizeof(ServerConn_t));
+    char         *p_line = (char*)malloc(SERVER_LINE_MAX);
+    Arena_t       arena;
+    
+    arenaInit(&arena);
+    
+    while (p_conn && p_line && !socketAccept(p_srv->sock, &p_conn->sock)) {
+        p_conn->i_buf = p_conn->n_buf = 0;
+        while (!readLine(p_conn, p_line) && !p_srv->p_handler(p_srv->p_ctx, p_conn, p_line, &arena));
+        socketClose(p_conn->sock);
+    }
+    
+    arenaDestroy(&arena);
+    free(p_line);
+    free(p_conn);
+}
+
+
+int runServer (const char *p_sock_path, int n_thread, ServerHandler_t p_handler, void *p_ctx) {
+    Thread_t threads [SERVER_MAX_THREAD];
+    Server_t srv;
+    int i;
+    
+    if (socketListen(p_sock_path, &srv.sock))
+        return 1;
+        
+    srv.p_handler = p_handler;
+    srv.p_ctx     = p_ctx;
+    
+    if (n_thread > SERVER_MAX_THREAD) n_thread = SERVER_MAX_THREAD;
+    
+    for (i=0; i<n_thread-1; i++)                 // the calling thread is also a worker
+        if (threadCreate(&threads[i], serverThread, &srv))
+            break;
+            
+    n_thread = i;
+    
+    printf("serving at %s by %d threads\n", p_sock_path, n_thread+1);    // only once the socket listens, so a client which waits for this line can connect
+    fflush(stdout);
+    
+    serverThread(&srv);
+    
+    for (i=0; i<n_thread; i++)
+        threadJoin(threads[i]);
+        
+    socketClose(srv.sock);
+    return 1;
+}
@@ -0,0 +1,34 @@
+#ifndef   __SERVER_H__
+#define   __SERVER_H__
+
+
+// a conversion daemon on a local socket (see --serve in main.c), so that a client pays neither the process startup nor the table initialization of the codecs for each conversion
+// each connection is served by a thread of a worker pool, and its requests are served one by one in order, so a client can run conversions in parallel by several connections
+// a request is a line of text, which can be followed by data bytes, what it means and what the response is are up to the handler
+
+
+typedef struct ServerConn_s ServerConn_t;
+
+
+// handle a request, called by the worker threads
+// p_line  : the request line without the line break, can be modified
+// p_arena : the arena of the worker thread (see arena.h), which is kept between requests
+// return:   0 : keep the connection    1 : close it (for example, the data of a malformed request can not be skipped)
+typedef int (*ServerHandler_t) (void *p_ctx, ServerConn_t *p_conn, char *p_line, Arena_t *p_arena);
+
+
+// read exactly len bytes following the request line
+// return:   0 : success    1 : failed (the connection is closed)
+int  serverRead  (ServerConn_t *p_conn, void *p_buf, size_t len);
+
+// write (a part of) the response
+// return:   0 : success    1 : failed (the connection is closed)
+int  serverWrite (ServerConn_t *p_conn, const void *p_buf, size_t len);
+
+// listen at p_sock_path, and serve the connections by n_thread worker threads until the listening socket fails
+// "serving at ..." is printed to stdout once the socket listens
+// return:   1 : failed to listen, or the listening socket failed
+int  runServer   (const char *p_sock_path, int n_thread, ServerHandler_t p_handler, void *p_ctx);
+
+
+#endif // __SERVER_H__
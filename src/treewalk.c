@@ -0,0 +1,265 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "platform.h"
+#include "console.h"
+#include "treewalk.h"
+
+
+#define  QUEUE_CAP  4096              // max number of listed files which are not yet taken, so that the walker does not run too far ahead of the conversions
+
+
+typedef struct {
+    char *p_rel_path;
+    int   is_dir;
+} TreeEntry_t;
+
+
+struct TreeWalk_s {
+    char     *p_root;
+    uint64_t (*exclude_ids)[2];       // see getFileId() in platform.h
+    int       n_exclude;
+    char     *queue [QUEUE_CAP];      // ring buffer of relative paths
+    int       i_head;
+    int       n_queue;
+    int       done;                   // 1 : the walker has finished, nothing more will be queued
+    int       stop;                   // 1 : the walker should finish as soon as possible
+    Mutex_t   mutex;
+    Cond_t    cond;
+    Thread_t  thread;
+};
+
+
+// return: p_dir/p_name (or p_name if p_dir is empty), allocated by malloc()
+static char* joinPath (const char *p_dir, const char *p_name) {
+    size_t len_dir = strlen(p_dir), len_name = strlen(p_name);
+    char  *p = (char*)malloc(len_dir + len_name + 2);
+    if (p == NULL)
+        return NULL;
+    memcpy(p, p_dir, len_dir);
+    if (len_dir > 0 && p_dir[len_dir-1] != '/' && p_dir[len_dir-1] != '\\')
+        p[len_dir++] = '/';
+    memcpy(p+len_dir, p_name, len_name+1);
+    return p;
+}
+
+
+static int compareEntries (const void *p_a, const void *p_b) {
+    return strcmp(((const TreeEntry_t*)p_a)->p_rel_path, ((const TreeEntry_t*)p_b)->p_rel_path);
+}
+
+
+// return:   1 : the directory should not be walked into
+static int isExcluded (TreeWalk_t *p_tw, const char *p_path) {
+    uint64_t id [2];
+    int i;
+    if (p_tw->n_exclude <= 0 || getFileId(p_path, id))
+        return 0;
+    for (i=0; i<p_tw->n_exclude; i++)
+        if (p_tw->exclude_ids[i][0] == id[0] && p_tw->exclude_ids[i][1] == id[1])
+            return 1;
+    return 0;
+}
+
+
+// put a file to the queue, waits if it is full
+// return:   0 : success    1 : the walker should stop (then p_rel_path is freed)
+static int queueFile (TreeWalk_t *p_tw, char *p_rel_path) {
+    int stop;
+    mutexLock(&p_tw->mutex);
+    while (p_tw->n_queue >= QUEUE_CAP && !p_tw->stop)
+        condWait(&p_tw->cond, &p_tw->mutex);
+    stop = p_tw->stop;
+    if (!stop) {
+        p_tw->queue[(p_tw->i_head + p_tw->n_queue) % QUEUE_CAP] = p_rel_path;
+        p_tw->n_queue ++;
+        condBroadcast(&p_tw->cond);
+    }
+    mutexUnlock(&p_tw->mutex);
+    if (stop)
+        free(p_rel_path);
+    return stop;
+}
+
+
+// list the entries of a directory, sorted by name
+// return: number of entries, *p_entries is allocated by malloc() (can be NULL if there is no entry)
+static int listDir (const char *p_path, const char *p_rel_dir, TreeEntry_t **p_entries) {
+    TreeEntry_t *entries = NULL, *p;
+    int   n = 0, cap = 0, is_dir;
+    const char *p_name;
+    Dir_t dir;
+    
+    *p_entries = NULL;
+    
+    if (openDir(p_path, &dir)) {
+        consolePrintf("   ***ERROR: open directory %s failed\n", p_path);
+        return 0;
+    }
+    
+    while ((p_name = readDir(&dir, &is_dir)) != NULL) {
+        if (n >= cap) {
+            cap = 2 * cap + 64;
+            if ((p = (TreeEntry_t*)realloc(entries, sizeof(TreeEntry_t) * cap)) == NULL)
+                break;
+            entries = p;
+        }
+        if ((entries[n].p_rel_path = joinPath(p_rel_dir, p_name)) == NULL)
+            break;
+        entries[n].is_dir = is_dir;
+        n ++;
+    }
+    
+    closeDir(&dir);
+    
+    if (n > 1)
+        qsort(entries, n, sizeof(TreeEntry_t), compareEntries);
+        
+    *p_entries = entries;
+    return n;
+}
+
+
+// depth-first walk, the pending directories are kept in a stack, so the depth of the tree is not limited by the call stack
+static void walkThread (void *p_arg) {
+    TreeWalk_t  *p_tw = (TreeWalk_t*)p_arg;
+    char       **stack = NULL, **p;
+    int          n_stack = 0, cap_stack = 0, stop = 0;
+    
+    if ((stack = (char**)malloc(sizeof(char*) * 64)) != NULL && (stack[0] = joinPath("", "")) != NULL) {
+        cap_stack = 64;
+        n_stack = 1;
+    }
+    
+    while (n_stack > 0) {
+        char        *p_rel_dir = stack[--n_stack];
+        char        *p_path    = joinPath(p_tw->p_root, p_rel_dir);
+        TreeEntry_t *entries   = NULL;
+        int          i, n = 0;
+        
+        if (!stop && p_path)
+            n = listDir(p_path, p_rel_dir, &entries);
+            
+        for (i=0; i<n; i++) {                     // files first, in name order
+            if (entries[i].is_dir)
+                continue;
+            if (stop)
+                free(entries[i].p_rel_path);
+            else
+                stop = queueFile(p_tw, entries[i].p_rel_path);
+            entries[i].p_rel_path = NULL;
+        }
+        
+        for (i=n-1; i>=0; i--) {                  // then push the sub-directories in reverse order, so that they are walked in name order
+            char *p_sub_path;
+            if (!entries[i].is_dir)
+                continue;
+            p_sub_path = stop ? NULL : joinPath(p_tw->p_root, entries[i].p_rel_path);
+            if (p_sub_path && !isExcluded(p_tw, p_sub_path)) {
+                if (n_stack >= cap_stack && (p = (char**)realloc(stack, sizeof(char*) * 2 * cap_stack)) != NULL) {
+                    stack = p;
+                    cap_stack *= 2;
+                }
+                if (n_stack < cap_stack) {
+                    stack[n_stack++] = entries[i].p_rel_path;
+                    entries[i].p_rel_path = NULL;
+                }
+            }
+            free(p_sub_path);
+            free(entries[i].p_rel_path);
+        }
+        
+        free(entries);
+        free(p_path);
+        free(p_rel_dir);
+    }
+    
+    free(stack);
+    
+    mutexLock(&p_tw->mutex);
+    p_tw->done = 1;
+    condBroadcast(&p_tw->cond);
+    mutexUnlock(&p_tw->mutex);
+}
+
+
+TreeWalk_t* openTreeWalk (const char *p_root, const char **exclude_dirs, int n_exclude) {
+    TreeWalk_t *p_tw;
+    int i;
+    
+    if (!isDir(p_root))
+        return NULL;
+        
+    if ((p_tw = (TreeWalk_t*)calloc(1, sizeof(TreeWalk_t))) == NULL)
+        return NULL;
+        
+    p_tw->p_root      = joinPath("", p_root);
+    p_tw->exclude_ids = (uint64_t(*)[2])malloc(sizeof(uint64_t) * 2 * (n_exclude + 1));
+    
+    if (p_tw->p_root == NULL || p_tw->exclude_ids == NULL) {
+        free(p_tw->p_root);
+        free(p_tw->exclude_ids);
+        free(p_tw);
+        return NULL;
+    }
+    
+    for (i=0; i<n_exclude; i++)
+        if (!getFileId(exclude_dirs[i], p_tw->exclude_ids[p_tw->n_exclude]))
+            p_tw->n_exclude ++;
+            
+    mutexInit(&p_tw->mutex);
+    condInit(&p_tw->cond);
+    
+    if (threadCreate(&p_tw->thread, walkThread, p_tw)) {
+        mutexDestroy(&p_tw->mutex);
+        condDestroy(&p_tw->cond);
+        free(p_tw->exclude_ids);
+        free(p_tw->p_root);
+        free(p_tw);
+        return NULL;
+    }
+    
+    return p_tw;
+}
+
+
+void closeTreeWalk (TreeWalk_t *p_tw) {
+    mutexLock(&p_tw->mutex);
+    p_tw->stop = 1;
+    condBroadcast(&p_tw->cond);
+    mutexUnlock(&p_tw->mutex);
+    
+    threadJoin(p_tw->thread);
+    
+    for (; p_tw->n_queue > 0; p_tw->n_queue--) {
+        free(p_tw->queue[p_tw->i_head]);
+        p_tw->i_head = (p_tw->i_head + 1) % QUEUE_CAP;
+    }
+    
+    mutexDestroy(&p_tw->mutex);
+    condDestroy(&p_tw->cond);
+    free(p_tw->exclude_ids);
+    free(p_tw->p_root);
+    free(p_tw);
+}
+
+
+int nextTreeFile (TreeWalk_t *p_tw, char **pp_rel_path) {
+    int got = 0;
+    
+    mutexLock(&p_tw->mutex);
+    while (p_tw->n_queue <= 0 && !p_tw->done)
+        condWait(&p_tw->cond, &p_tw->mutex);
+    if (p_tw->n_queue > 0) {
+        *pp_rel_path = p_tw->queue[p_tw->i_head];
+        p_tw->i_head = (p_tw->i_head + 1) % QUEUE_CAP;
+        p_tw->n_queue --;
+        condBroadcast(&p_tw->cond);
+        got = 1;
+    }
+    mutexUnlock(&p_tw->mutex);
+    
+    return got;
+}
@@ -0,0 +1,26 @@
+#ifndef   __TREE_WALK_H__
+#define   __TREE_WALK_H__
+
+
+// walk a directory tree in a background thread, which lists the files in a bounded queue, so that converting the first files overlaps with walking the rest (see -r in main.c)
+// the files of a directory are listed in name order before its sub-directories, and the sub-directories are walked in name order, so the order does not depend on the file system
+
+
+typedef struct TreeWalk_s TreeWalk_t;
+
+
+// start walking the tree of p_root, the directories in exclude_dirs (for example, an output directory inside the tree) are not walked into
+// return:  NULL     : failed (p_root is not a directory, or out of memory)
+//          non-NULL : success
+TreeWalk_t* openTreeWalk (const char *p_root, const char **exclude_dirs, int n_exclude);
+
+// stop walking (if not finished), and free the walker
+void closeTreeWalk       (TreeWalk_t *p_tw);
+
+// get the next file, waits if the walker has not found it yet
+// *pp_rel_path is the path relative to p_root, separated by /, allocated by malloc(), need to be free() later
+// return:   1 : got a file    0 : no more file
+int  nextTreeFile        (TreeWalk_t *p_tw, char **pp_rel_path);
+
+
+#endif // __TREE_WALK_H__
@@ -26,12 +26,19 @@ freely, subject to the following restrictions:
 		distribution.
 */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
-#include "upng.h"
+#include "uPNG.h"
+
+#include "../memstat.h"         // count the allocations of the decoder
+#include "../cpu.h"
+#include "../kernels.h"
+#define  malloc(size)  memMalloc(size)
+#define  free(p)       memFree(p)
 
 #define MAKE_BYTE(b) ((b) & 0xFF)
 #define MAKE_DWORD(a,b,c,d) ((MAKE_BYTE(a) << 24) | (MAKE_BYTE(b) << 16) | (MAKE_BYTE(c) << 8) | MAKE_BYTE(d))
@@ -80,7 +87,7 @@ typedef enum upng_color {
 
 typedef struct upng_source {
 	const unsigned char*	buffer;
-	unsigned long			size;
+	size_t			size;
 	char					owning;
 } upng_source;
 
@@ -93,7 +100,7 @@ struct upng_t {
 	upng_format		format;
 
 	unsigned char*	buffer;
-	unsigned long	size;
+	size_t	size;
 
 	upng_error		error;
 	unsigned		error_line;
@@ -178,14 +185,14 @@ static const unsigned FIXED_DISTANCE_TREE[NUM_DISTANCE_SYMBOLS * 2] = {
 	29, 30, 31, 0, 0
 };
 
-static unsigned char read_bit(unsigned long *bitpointer, const unsigned char *bitstream)
+static unsigned char read_bit(size_t *bitpointer, const unsigned char *bitstream)
 {
 	unsigned char result = (unsigned char)((bitstream[(*bitpointer) >> 3] >> ((*bitpointer) & 0x7)) & 1);
 	(*bitpointer)++;
 	return result;
 }
 
-static unsigned read_bits(unsigned long *bitpointer, const unsigned char *bitstream, unsigned long nbits)
+static unsigned read_bits(size_t *bitpointer, const unsigned char *bitstream, size_t nbits)
 {
 	unsigned result = 0, i;
 	for (i = 0; i < nbits; i++)
@@ -270,7 +277,7 @@ static void huffman_tree_create_lengths(upng_t* upng, huffman_tree* tree, const
 	}
 }
 
-static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, unsigned long *bp, const huffman_tree* codetree, unsigned long inlength)
+static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, size_t *bp, const huffman_tree* codetree, size_t inlength)
 {
 	unsigned treepos = 0, ct;
 	unsigned char bit;
@@ -297,7 +304,7 @@ static unsigned huffman_decode_symbol(upng_t *upng, const unsigned char *in, uns
 }
 
 /* get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, unsigned long *bp, unsigned long inlength)
+static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffman_tree* codetreeD, huffman_tree* codelengthcodetree, const unsigned char *in, size_t *bp, size_t inlength)
 {
 	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
 	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
@@ -452,7 +459,7 @@ static void get_tree_inflate_dynamic(upng_t* upng, huffman_tree* codetree, huffm
 }
 
 /*inflate a block with dynamic of fixed Huffman tree*/
-static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength, unsigned btype)
+static void inflate_huffman(upng_t* upng, unsigned char* out, size_t outsize, const unsigned char *in, size_t *bp, size_t *pos, size_t inlength, unsigned btype)
 {
 	unsigned codetree_buffer[DEFLATE_CODE_BUFFER_SIZE];
 	unsigned codetreeD_buffer[DISTANCE_BUFFER_SIZE];
@@ -496,9 +503,9 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 			out[(*pos)++] = (unsigned char)(code);
 		} else if (code >= FIRST_LENGTH_CODE_INDEX && code <= LAST_LENGTH_CODE_INDEX) {	/*length code */
 			/* part 1: get length base */
-			unsigned long length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
+			size_t length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX];
 			unsigned codeD, distance, numextrabitsD;
-			unsigned long start, forward, backward, numextrabits;
+			size_t start, forward, backward, numextrabits;
 
 			/* part 2: get extra bits and add the value of that to length */
 			numextrabits = LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX];
@@ -556,9 +563,9 @@ static void inflate_huffman(upng_t* upng, unsigned char* out, unsigned long outs
 	}
 }
 
-static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long *bp, unsigned long *pos, unsigned long inlength)
+static void inflate_uncompressed(upng_t* upng, unsigned char* out, size_t outsize, const unsigned char *in, size_t *bp, size_t *pos, size_t inlength)
 {
-	unsigned long p;
+	size_t p;
 	unsigned len, nlen, n;
 
 	/* go to first boundary of byte */
@@ -603,10 +610,10 @@ static void inflate_uncompressed(upng_t* upng, unsigned char* out, unsigned long
 }
 
 /*inflate the deflated data (cfr. deflate spec); return value is the error*/
-static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned long outsize, const unsigned char *in, unsigned long insize, unsigned long inpos)
+static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, size_t outsize, const unsigned char *in, size_t insize, size_t inpos)
 {
-	unsigned long bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
-	unsigned long pos = 0;	/*byte position in the out buffer */
+	size_t bp = 0;	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte) */
+	size_t pos = 0;	/*byte position in the out buffer */
 
 	unsigned done = 0;
 
@@ -642,7 +649,7 @@ static upng_error uz_inflate_data(upng_t* upng, unsigned char* out, unsigned lon
 	return upng->error;
 }
 
-static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long outsize, const unsigned char *in, unsigned long insize)
+static upng_error uz_inflate(upng_t* upng, unsigned char *out, size_t outsize, const unsigned char *in, size_t insize)
 {
 	/* we require two bytes for the zlib data header */
 	if (insize < 2) {
@@ -674,23 +681,7 @@ static upng_error uz_inflate(upng_t* upng, unsigned char *out, unsigned long out
 	return upng->error;
 }
 
-/*Paeth predicter, used by PNG filter type 4*/
-static int paeth_predictor(int a, int b, int c)
-{
-	int p = a + b - c;
-	int pa = p > a ? p - a : a - p;
-	int pb = p > b ? p - b : b - p;
-	int pc = p > c ? p - c : c - p;
-
-	if (pa <= pb && pa <= pc)
-		return a;
-	else if (pb <= pc)
-		return b;
-	else
-		return c;
-}
-
-static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, size_t bytewidth, unsigned char filterType, size_t length)
 {
 	/*
 	   For PNG filter method 0
@@ -698,58 +689,13 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	   precon is the previous unfiltered scanline, recon the result, scanline the current one
 	   the incoming scanlines do NOT include the filtertype byte, that one is given in the parameter filterType instead
 	   recon and scanline MAY be the same memory address! precon must be disjoint.
+	   the filters are undone by unfilterRow() of kernels.h, which picks the SIMD version for the CPU
 	 */
 
-	unsigned long i;
-	switch (filterType) {
-	case 0:
-		for (i = 0; i < length; i++)
-			recon[i] = scanline[i];
-		break;
-	case 1:
-		for (i = 0; i < bytewidth; i++)
-			recon[i] = scanline[i];
-		for (i = bytewidth; i < length; i++)
-			recon[i] = scanline[i] + recon[i - bytewidth];
-		break;
-	case 2:
-		if (precon)
-			for (i = 0; i < length; i++)
-				recon[i] = scanline[i] + precon[i];
-		else
-			for (i = 0; i < length; i++)
-				recon[i] = scanline[i];
-		break;
-	case 3:
-		if (precon) {
-			for (i = 0; i < bytewidth; i++)
-				recon[i] = scanline[i] + precon[i] / 2;
-			for (i = bytewidth; i < length; i++)
-				recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
-		} else {
-			for (i = 0; i < bytewidth; i++)
-				recon[i] = scanline[i];
-			for (i = bytewidth; i < length; i++)
-				recon[i] = scanline[i] + recon[i - bytewidth] / 2;
-		}
-		break;
-	case 4:
-		if (precon) {
-			for (i = 0; i < bytewidth; i++)
-				recon[i] = (unsigned char)(scanline[i] + paeth_predictor(0, precon[i], 0));
-			for (i = bytewidth; i < length; i++)
-				recon[i] = (unsigned char)(scanline[i] + paeth_predictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]));
-		} else {
-			for (i = 0; i < bytewidth; i++)
-				recon[i] = scanline[i];
-			for (i = bytewidth; i < length; i++)
-				recon[i] = (unsigned char)(scanline[i] + paeth_predictor(recon[i - bytewidth], 0, 0));
-		}
-		break;
-	default:
+	if (filterType > 4)
 		SET_ERROR(upng, UPNG_EMALFORMED);
-		break;
-	}
+	else
+		unfilterRow(recon, scanline, precon, bytewidth, filterType, length);
 }
 
 static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in, unsigned w, unsigned h, unsigned bpp)
@@ -765,12 +711,12 @@ static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in,
 	unsigned y;
 	unsigned char *prevline = 0;
 
-	unsigned long bytewidth = (bpp + 7) / 8;	/*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
-	unsigned long linebytes = (w * bpp + 7) / 8;
+	size_t bytewidth = (bpp + 7) / 8;	/*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise */
+	size_t linebytes = ((size_t)w * bpp + 7) / 8;
 
 	for (y = 0; y < h; y++) {
-		unsigned long outindex = linebytes * y;
-		unsigned long inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
+		size_t outindex = linebytes * y;
+		size_t inindex = (1 + linebytes) * y;	/*the extra filterbyte added to each row */
 		unsigned char filterType = in[inindex];
 
 		unfilter_scanline(upng, &out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes);
@@ -782,7 +728,7 @@ static void unfilter(upng_t* upng, unsigned char *out, const unsigned char *in,
 	}
 }
 
-static void remove_padding_bits(unsigned char *out, const unsigned char *in, unsigned long olinebits, unsigned long ilinebits, unsigned h)
+static void remove_padding_bits(unsigned char *out, const unsigned char *in, size_t olinebits, size_t ilinebits, unsigned h)
 {
 	/*
 	   After filtering there are still padding bpp if scanlines have non multiple of 8 bit amounts. They need to be removed (except at last scanline of (Adam7-reduced) image) before working with pure image buffers for the Adam7 code, the color convert code and the output to the user.
@@ -791,10 +737,10 @@ static void remove_padding_bits(unsigned char *out, const unsigned char *in, uns
 	   only useful if (ilinebits - olinebits) is a value in the range 1..7
 	 */
 	unsigned y;
-	unsigned long diff = ilinebits - olinebits;
-	unsigned long obp = 0, ibp = 0;	/*bit pointers */
+	size_t diff = ilinebits - olinebits;
+	size_t obp = 0, ibp = 0;	/*bit pointers */
 	for (y = 0; y < h; y++) {
-		unsigned long x;
+		size_t x;
 		for (x = 0; x < olinebits; x++) {
 			unsigned char bit = (unsigned char)((in[(ibp) >> 3] >> (7 - ((ibp) & 0x7))) & 1);
 			ibp++;
@@ -821,12 +767,12 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 		return;
 	}
 
-	if (bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8) {
+	if (bpp < 8 && (size_t)w * bpp != (((size_t)w * bpp + 7) / 8) * 8) {
 		unfilter(upng, in, in, w, h, bpp);
 		if (upng->error != UPNG_EOK) {
 			return;
 		}
-		remove_padding_bits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
+		remove_padding_bits(out, in, (size_t)w * bpp, (((size_t)w * bpp + 7) / 8) * 8, h);
 	} else {
 		unfilter(upng, out, in, w, h, bpp);	/*we can immediatly filter into the out buffer, no other steps needed */
 	}
@@ -968,8 +914,8 @@ upng_error upng_decode(upng_t* upng)
 	const unsigned char *chunk;
 	unsigned char* compressed;
 	unsigned char* inflated;
-	unsigned long compressed_size = 0, compressed_index = 0;
-	unsigned long inflated_size;
+	size_t compressed_size = 0, compressed_index = 0;
+	size_t inflated_size;
 	upng_error error;
 
 	/* if we have an error state, bail now */
@@ -1001,11 +947,11 @@ upng_error upng_decode(upng_t* upng)
 	/* scan through the chunks, finding the size of all IDAT chunks, and also
 	 * verify general well-formed-ness */
 	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
+		size_t length;
 		//const unsigned char *data;	/*the data in the chunk */
 
 		/* make sure chunk header is not larger than the total compressed */
-		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
+		if ((size_t)(chunk - upng->source.buffer + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
@@ -1018,7 +964,7 @@ upng_error upng_decode(upng_t* upng)
 		}
 
 		/* make sure chunk header+paylaod is not larger than the total compressed */
-		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
+		if ((size_t)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
 			return upng->error;
 		}
@@ -1050,7 +996,7 @@ upng_error upng_decode(upng_t* upng)
 	 * our compressed buffer.  there's no reason to validate anything a second time. */
 	chunk = upng->source.buffer + 33;
 	while (chunk < upng->source.buffer + upng->source.size) {
-		unsigned long length;
+		size_t length;
 		const unsigned char *data;	/*the data in the chunk */
 
 		length = upng_chunk_length(chunk);
@@ -1067,8 +1013,15 @@ upng_error upng_decode(upng_t* upng)
 		chunk += upng_chunk_length(chunk) + 12;
 	}
 
+	/* the image must fit in the address space, which only matters on 32-bit platforms */
+	if (upng->height > 0 && ((uint64_t)upng->width * upng_get_bpp(upng) + 7) / 8 + 1 > (SIZE_MAX - 1) / upng->height) {
+		free(compressed);
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return upng->error;
+	}
+
 	/* allocate space to store inflated (but still filtered) data */
-	inflated_size = ((upng->width * (upng->height * upng_get_bpp(upng) + 7)) / 8) + upng->height;
+	inflated_size = (size_t)upng->height * (((size_t)upng->width * upng_get_bpp(upng) + 7) / 8 + 1) + 1;	/*each scanline has a filter byte, +1 since uz_inflate() rejects an output reaching the very end */
 	inflated = (unsigned char*)malloc(inflated_size);
 	if (inflated == NULL) {
 		free(compressed);
@@ -1088,7 +1041,7 @@ upng_error upng_decode(upng_t* upng)
 	free(compressed);
 
 	/* allocate final image buffer */
-	upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+	upng->size = ((size_t)upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
 	upng->buffer = (unsigned char*)malloc(upng->size);
 	if (upng->buffer == NULL) {
 		free(inflated);
@@ -1145,7 +1098,7 @@ static upng_t* upng_new(void)
 	return upng;
 }
 
-upng_t* upng_new_from_bytes(const unsigned char* buffer, unsigned long size)
+upng_t* upng_new_from_bytes(const unsigned char* buffer, size_t size)
 {
 	upng_t* upng = upng_new();
 	if (upng == NULL) {
@@ -1183,13 +1136,13 @@ upng_t* upng_new_from_file(const char *filename)
 	rewind(file);
 
 	/* read contents of the file into the vector */
-	buffer = (unsigned char *)malloc((unsigned long)size);
+	buffer = (unsigned char *)malloc((size_t)size);
 	if (buffer == NULL) {
 		fclose(file);
 		SET_ERROR(upng, UPNG_ENOMEM);
 		return upng;
 	}
-	fread(buffer, 1, (unsigned long)size, file);
+	fread(buffer, 1, (size_t)size, file);
 	fclose(file);
 
 	/* set the read buffer as our source buffer, with owning flag set */
@@ -1277,7 +1230,7 @@ const unsigned char* upng_get_buffer(const upng_t* upng)
 	return upng->buffer;
 }
 
-unsigned upng_get_size(const upng_t* upng)
+size_t upng_get_size(const upng_t* upng)
 {
 	return upng->size;
 }
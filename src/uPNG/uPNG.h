@@ -59,7 +59,7 @@ typedef enum upng_format {
 
 typedef struct upng_t upng_t;
 
-upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
+upng_t*		upng_new_from_bytes	(const unsigned char* buffer, size_t size);
 upng_t*		upng_new_from_file	(const char* path);
 void		upng_free			(upng_t* upng);
 
@@ -78,6 +78,6 @@ unsigned	upng_get_pixelsize	(const upng_t* upng);
 upng_format	upng_get_format		(const upng_t* upng);
 
 const unsigned char*	upng_get_buffer		(const upng_t* upng);
-unsigned				upng_get_size		(const upng_t* upng);
+size_t				upng_get_size		(const upng_t* upng);
 
 #endif // __U_PNG_H__
@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+# stream a synthetic gray image of more than 4 gigapixels (2^32 pixels) through the stream*Image() sinks with -s, and check the outputs
+#   PNG : the zlib stream is split over several IDAT chunks of at most 2^31-1 bytes, the CRC of each chunk and the Adler-32 of the stream are right, and every row is the source row
+#   QOI : the header has the full size, and every row is the source row (as RGB) when the QOI is streamed back to PNM (by streamPNMImage() from openQOIRowSource())
+#   PGM : the header has the full size, and every row is the source row
+#   JLS : a size beyond 65535 is 0 in the SOF and is in the LSE oversize image dimension marker, and the scan is followed by EOI with no other marker (the rows are not decoded)
+#   BMP : a file beyond 4 GB (whose size in the header is 32-bit) is rejected with an error and no output, otherwise the header and every row are checked
+# the source PGM is written to WORK_DIR (4.3 GB by default), the PNG, PGM and JLS are checked from a pipe, the QOI and BMP are written to WORK_DIR, and the files are removed at the end
+#
+# usage:  python3 test/stream_gigapixel.py [IMCVT] [WORK_DIR] [WIDTH HEIGHT]
+#         IMCVT defaults to ./ImCvt, WORK_DIR to the system temporary directory, WIDTH x HEIGHT to 65536 x 65600 (4,299,161,600 pixels)
+# return: 0 if all checks pass
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+
+
+READ_SIZE = 1 << 20
+
+
+def make_base (width, channels):               # the 0..255 ramp repeated over more than a row, with each value repeated for the channels
+    return bytes(v for v in range(256) for c in range(channels)) * (width // 256 + 2)
+
+
+def source_row (base, y, width, channels=1):
+    s = (7 * y + (y >> 8)) & 255                 # each row is the ramp shifted by its own offset, so a missing, repeated or swapped row is detected
+    return base[s*channels:(s+width)*channels]
+
+
+def write_source (fname, width, height):
+    base = make_base(width, 1)
+    with open(fname, 'wb') as f:
+        f.write(b'P5\n%d %d\n255\n' % (width, height))
+        for y in range(height):
+            f.write(source_row(base, y, width))
+
+
+def read_exact (fp, n):
+    data = fp.read(n)
+    if len(data) != n:
+        raise AssertionError('unexpected end of stream, %d of %d bytes' % (len(data), n))
+    return data
+
+
+class RowChecker:                                # compare the bytes of a stream, which are rows with an optional prefix (the PNG filter byte), with the source rows of gray (1) or RGB (3) channels
+    def __init__ (self, width, height, channels, prefix):
+        self.base, self.width, self.height, self.channels, self.prefix = make_base(width, channels), width, height, channels, prefix
+        self.y   = 0
+        self.buf = bytearray()
+
+    def feed (self, data):
+        self.buf += data
+        row_len = len(self.prefix) + self.width * self.channels
+        i = 0
+        while len(self.buf) - i >= row_len:
+            if self.y >= self.height:
+                raise AssertionError('more rows than the height %d' % self.height)
+            if self.buf[i:i+len(self.prefix)] != self.prefix or self.buf[i+len(self.prefix):i+row_len] != source_row(self.base, self.y, self.width, self.channels):
+                raise AssertionError('row %d mismatch' % self.y)
+            self.y += 1
+            i += row_len
+        del self.buf[:i]
+
+    def finish (self):
+        if self.y != self.height or self.buf:
+            raise AssertionError('got %d rows (and %d extra bytes) of %d' % (self.y, len(self.buf), self.height))
+
+
+def check_png (fp, width, height):
+    if read_exact(fp, 8) != b'\x89PNG\r\n\x1a\n':
+        raise AssertionError('bad PNG signature')
+
+    rows   = RowChecker(width, height, 1, b'\x00')
+    inflate= zlib.decompressobj()
+    adler  = 1
+    tail   = b''                                 # the last 4 bytes of the zlib stream, which is the Adler-32
+    n_idat = 0
+
+    while True:
+        length, ctype = struct.unpack('>I4s', read_exact(fp, 8))
+        if length > 0x7FFFFFFF:
+            raise AssertionError('%s chunk of %d bytes is longer than 2^31-1' % (ctype, length))
+        crc = zlib.crc32(ctype)
+        if ctype == b'IHDR':
+            data = read_exact(fp, length)
+            crc  = zlib.crc32(data, crc)
+            w, h, depth, color = struct.unpack('>IIBB', data[:10])
+            if (w, h, depth, color) != (width, height, 8, 0):
+                raise AssertionError('bad IHDR %dx%d depth=%d color=%d' % (w, h, depth, color))
+        elif ctype == b'IDAT':
+            n_idat += 1
+            left = length
+            while left > 0:
+                data = read_exact(fp, min(left, READ_SIZE))
+                left -= len(data)
+                crc   = zlib.crc32(data, crc)
+                tail  = (tail + data)[-4:]
+                raw   = inflate.decompress(data)
+                adler = zlib.adler32(raw, adler)
+                rows.feed(raw)
+        else:
+            crc = zlib.crc32(read_exact(fp, length), crc)
+        if struct.unpack('>I', read_exact(fp, 4))[0] != crc:
+            raise AssertionError('CRC mismatch of %s chunk %d' % (ctype, n_idat))
+        if ctype == b'IEND':
+            break
+
+    if fp.read(1):
+        raise AssertionError('data after IEND')
+    if not inflate.eof or inflate.unused_data:
+        raise AssertionError('the zlib stream is truncated, or followed by extra data')
+    if struct.unpack('>I', tail)[0] != adler:
+        raise AssertionError('Adler-32 mismatch')
+    rows.finish()
+    return n_idat
+
+
+def check_pnm (fp, width, height, channels):
+    header = b'P%d\n%d %d\n255\n' % (6 if channels == 3 else 5, width, height)
+    if read_exact(fp, len(header)) != header:
+        raise AssertionError('bad PNM header')
+    rows = RowChecker(width, height, channels, b'')
+    while True:
+        data = fp.read(READ_SIZE)
+        if not data:
+            break
+        rows.feed(data)
+    rows.finish()
+
+
+def check_jls (fp, width, height):
+    if read_exact(fp, 2) != b'\xff\xd8':
+        raise AssertionError('bad JLS SOI')
+    marker, length, bpp, h, w, n_comp = struct.unpack('>HHBHHB', read_exact(fp, 10))
+    read_exact(fp, length - 8)
+    oversize = width > 65535 or height > 65535
+    if (marker, bpp, n_comp) != (0xFFF7, 8, 1) or (h, w) != ((0, 0) if oversize else (height, width)):
+        raise AssertionError('bad SOF %04X %dx%d bpp=%d components=%d' % (marker, w, h, bpp, n_comp))
+    if oversize:
+        marker, length, lse_id, wxy, h, w = struct.unpack('>HHBBII', read_exact(fp, 14))
+        if (marker, length, lse_id, wxy, w, h) != (0xFFF8, 12, 4, 4, width, height):
+            raise AssertionError('bad LSE oversize image dimension %04X id=%d wxy=%d %dx%d' % (marker, lse_id, wxy, w, h))
+    marker, length = struct.unpack('>HH', read_exact(fp, 4))
+    if marker != 0xFFDA:
+        raise AssertionError('the header is followed by %04X instead of SOS' % marker)
+    read_exact(fp, length - 2)
+
+    tail = b''                                   # the scan data has a 0 bit after each 0xFF, so a 0xFF followed by a byte of 0x80 or more is a marker, which must be the EOI at the end
+    while True:
+        data = fp.read(READ_SIZE)
+        if not data:
+            raise AssertionError('the scan is not terminated by EOI')
+        data = tail + data
+        i = data.find(b'\xff')
+        while 0 <= i < len(data) - 1:
+            if data[i+1] >= 0x80:
+                if data[i+1] != 0xD9 or i + 2 != len(data) or fp.read(1):
+                    raise AssertionError('marker FF%02X in the scan, instead of EOI at the end' % data[i+1])
+                return
+            i = data.find(b'\xff', i + 1)
+        tail = data[-1:] if data[-1] == 0xFF else b''
+
+
+def check_bmp (fname, width, height):
+    row_size = (width + 3) // 4 * 4
+    with open(fname, 'rb') as f:
+        magic, size, offset, _, w, h, _, bpp = struct.unpack('<2sI4xIIiiHH', f.read(30))
+        if (magic, size, offset, w, h, bpp) != (b'BM', 14 + 40 + 1024 + row_size * height, 14 + 40 + 1024, width, height, 8):
+            raise AssertionError('bad BMP header %dx%d size=%d offset=%d bpp=%d' % (w, h, size, offset, bpp))
+        base = make_base(width, 1)
+        for y in range(height):                  # the rows are from bottom to top
+            f.seek(offset + (height - 1 - y) * row_size)
+            if f.read(width) != source_row(base, y, width):
+                raise AssertionError('row %d mismatch' % y)
+
+
+def run_checked (cmd, check, *args):             # run cmd, and check its standard output while it is written
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE)
+    try:
+        result = check(proc.stdout, *args)
+    finally:
+        proc.stdout.close()
+        rc = proc.wait()
+    if rc != 0:
+        raise AssertionError('%s exits with %d' % (' '.join(cmd), rc))
+    return result
+
+
+def main ():
+    imcvt    = sys.argv[1] if len(sys.argv) > 1 else './ImCvt'
+    work_dir = sys.argv[2] if len(sys.argv) > 2 else tempfile.gettempdir()
+    width    = int(sys.argv[3]) if len(sys.argv) > 4 else 65536
+    height   = int(sys.argv[4]) if len(sys.argv) > 4 else 65600
+    src_fname = os.path.join(work_dir, 'gigapixel_src.pgm')
+    qoi_fname = os.path.join(work_dir, 'gigapixel_dst.qoi')
+    bmp_fname = os.path.join(work_dir, 'gigapixel_dst.bmp')
+
+    print('%dx%d = %d pixels (2^32 = %d)' % (width, height, width * height, 1 << 32))
+    try:
+        write_source(src_fname, width, height)
+
+        n_idat = run_checked([imcvt, '-f', '-s', src_fname, '-o', '-', '--to', 'png'], check_png, width, height)
+        print('PNG : %d IDAT chunks, CRC, Adler-32 and rows ok' % n_idat)
+        if (width + 1) * height > 0x7FFFFFFF and n_idat < 2:
+            raise AssertionError('the zlib stream is longer than 2^31-1 bytes, but is not split')
+
+        subprocess.check_call([imcvt, '-f', '-s', src_fname, '-o', qoi_fname], stdout=subprocess.DEVNULL)
+        with open(qoi_fname, 'rb') as f:
+            magic, w, h = struct.unpack('>4sII', f.read(12))
+        if (magic, w, h) != (b'qoif', width, height):
+            raise AssertionError('bad QOI header %s %dx%d' % (magic, w, h))
+        run_checked([imcvt, '-f', '-s', qoi_fname, '-o', '-', '--to', 'ppm'], check_pnm, width, height, 3)
+        print('QOI : header and rows ok')
+        os.remove(qoi_fname)
+
+        run_checked([imcvt, '-f', '-s', src_fname, '-o', '-', '--to', 'pgm'], check_pnm, width, height, 1)
+        print('PGM : header and rows ok')
+
+        run_checked([imcvt, '-f', '-s', src_fname, '-o', '-', '--to', 'jls'], check_jls, width, height)
+        print('JLS : %s and markers ok' % ('SOF and LSE oversize image dimension' if width > 65535 or height > 65535 else 'SOF'))
+
+        proc = subprocess.run([imcvt, '-f', '-s', src_fname, '-o', bmp_fname], stdout=subprocess.PIPE)
+        if 14 + 40 + 1024 + (width + 3) // 4 * 4 * height > 0xFFFFFFFF:
+            if proc.returncode == 0 or b'ERROR: a BMP file is at most' not in proc.stdout or os.path.exists(bmp_fname):
+                raise AssertionError('a BMP beyond 4 GB is not rejected with an error (exit %d)' % proc.returncode)
+            print('BMP : beyond 4 GB, rejected')
+        else:
+            if proc.returncode != 0:
+                raise AssertionError('BMP exits with %d' % proc.returncode)
+            check_bmp(bmp_fname, width, height)
+            print('BMP : header and rows ok')
+    finally:
+        for fname in (src_fname, qoi_fname, bmp_fname):
+            if os.path.exists(fname):
+                os.remove(fname)
+
+    print('passed')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())